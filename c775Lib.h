@@ -12,8 +12,11 @@
 #ifndef __C775LIB__
 #define __C775LIB__
 
+#define C775_MAX_MODULES    20
 #define C775_MAX_CHANNELS   32
 #define C775_MAX_WORDS_PER_EVENT  34
+#define C775_MAX_EVENTS_PER_BUFFER 32	/* Depth of the Multi Event Buffer */
+#define C775_MAX_GEO        32
 
 /* Define a Structure for access to TDC*/
 typedef struct
@@ -106,7 +109,7 @@ typedef struct
 #define C775_68K_A24D32_OFFSET   0xe0000000
 
 /* Define default interrupt vector/level */
-#define C775_INT_VEC      0xaa
+#define C775_INT_VEC      0xc0   /* after the vectors of 20 QDCs from 0xaa */
 #define C775_VME_INT_LEVEL   4
 
 #define C775_MIN_FSR       140	/* nsec (High resoulution) */
@@ -153,6 +156,51 @@ typedef struct
 #define C775_INVALID_DATA   0x06000000
 
 
+/* CBLT/MCST chain position (cbltControl) */
+#define C775_CBLT_DISABLED  0
+#define C775_CBLT_LAST      1
+#define C775_CBLT_FIRST     2
+#define C775_CBLT_MIDDLE    3
+
+/* c775ReadBlockOverlap flags */
+#define C775_BLOCK_SWAP     0x1	/* Convert data to CPU byte order */
+
+/* c775ReadBlockIndex status */
+#define C775_BLKSTAT_PARTIAL    0x1	/* Last event cut short by the transfer size */
+#define C775_BLKSTAT_CORRUPT    0x2	/* Header or trailer missing */
+#define C775_BLKSTAT_INDEX_FULL 0x4	/* More events than index entries */
+
+/* c775FlushEvents modes */
+#define C775_FLUSH_RESET    0	/* Data reset, events counted (no read) */
+#define C775_FLUSH_PIO      1	/* Read out with programmed I/O */
+#define C775_FLUSH_DMA      2	/* Read out with block reads */
+
+/* Byte order of the data buffers (c775SetByteOrder) */
+#define C775_ORDER_VME      0	/* As read from the bus (default) */
+#define C775_ORDER_CPU      1	/* Swapped to CPU byte order */
+
+/* Data ready wait (c775SetWaitMode) */
+#define C775_WAIT_SPIN      0	/* Poll until the timeout (default) */
+#define C775_WAIT_ADAPTIVE  1	/* Poll, then sleep between polls */
+#define C775_WAIT_INT       2	/* Poll, then sleep until the interrupt */
+#define C775_WAIT_SPIN_US   20	/* Default polling time before sleeping (us) */
+#define C775_WAIT_SLEEP_MIN 10	/* First sleep (us), then doubled up to */
+#define C775_WAIT_SLEEP_MAX 1000
+
+/* Interrupt handling (c775SetIntMode) */
+#define C775_INT_DIRECT     0	/* Readout in the interrupt handler (default) */
+#define C775_INT_DEFERRED   1	/* Readout in a worker thread (Linux) */
+
+/* Threshold tables (c775SetThreshAll) */
+#define C775_THRESH_KILL    0x100	/* Kill bit of a channel threshold */
+#define C775_THRESH_VERIFY  0x1	/* Read back all the thresholds */
+#define C775_THRESH_FORCE   0x2	/* Write even the channels already set */
+#define C775_THRESH_SAME    0x4	/* One table for all the TDCs */
+
+/* c775CBLTInit flags */
+#define C775_CBLT_NOT_FIRST 0x1	/* Other boards precede the TDCs on the chain */
+#define C775_CBLT_NOT_LAST  0x2	/* Other boards follow the TDCs on the chain */
+
 /* Register Masks */
 #define C775_BITSET1_MASK   0x0098
 #define C775_INTLEVEL_MASK  0x0007
@@ -163,6 +211,8 @@ typedef struct
 #define C775_BITSET2_MASK   0x7fff
 #define C775_EVTRIGGER_MASK 0x001f
 #define C775_FSR_MASK       0x00ff
+#define C775_GEO_MASK       0x001f
+#define C775_CBLTCTRL_MASK  0x0003
 
 #define C775_DATA_ID_MASK    0x07000000
 #define C775_WORDCOUNT_MASK  0x00003f00
@@ -172,24 +222,167 @@ typedef struct
 #define C775_GEO_ADDR_MASK   0xf8000000
 #define C775_TDC_DATA_MASK   0x00000fff
 
+/* Lock policy (c775SetLockPolicy, or -DC775_LOCK_POLICY=n at compile time) */
+#define C775_LOCK_NONE      0
+#define C775_LOCK_SPIN      1
+#define C775_LOCK_MUTEX     2
+
+/* Lock counters, per module.  Times are in ns, and only counted
+   while c775LockTiming is on */
+typedef struct
+{
+  unsigned long long nlock;      /* number of times the lock was taken */
+  unsigned long long ncontend;   /* ... and had to wait for another thread */
+  unsigned long long waitTime;   /* total time spent waiting */
+  unsigned long long holdTime;   /* total time held */
+  unsigned long long holdMax;    /* longest time held */
+} c775LockStats;
+
+/* Readout counters, per module (c775GetStats).  Times are in ns.  Each
+   structure has its own cache lines, so that the readout of one module
+   does not disturb the others */
+typedef struct
+{
+  unsigned long long nevents;	/* events read */
+  unsigned long long nwords;	/* words read, including headers and trailers */
+  unsigned long long ndma;	/* block transfers */
+  unsigned long long dmaBytes;	/* bytes moved by block transfers */
+  unsigned long long dmaTime;	/* time from start to end of block transfers */
+  unsigned long long pioTime;	/* time in programmed I/O event reads */
+  unsigned long long npoll;	/* data ready polls */
+  unsigned long long nempty;	/* polls and reads that found no data */
+  unsigned long long nbadHeader;	/* invalid header words */
+  unsigned long long nbadTrailer;	/* invalid trailer words */
+  unsigned long long nberr;	/* block transfers ended by a bus error */
+  unsigned long long nclear;	/* data clears and resets */
+} __attribute__((aligned(64))) c775ModStats;
+
+/* Interrupt level and rates, per TDC (c775GetIntStats, c775IntAdaptive) */
+#define C775_INT_WINDOW_US  100000	/* rate measurement window */
+
+typedef struct
+{
+  unsigned int level;		/* events per interrupt (Event Trigger register) */
+  unsigned int intRate;		/* interrupts per second, last window */
+  unsigned int trigRate;	/* events per second, last window */
+  unsigned int nretune;		/* changes of level by c775IntAdaptive */
+  unsigned long long nint;	/* interrupts */
+  unsigned long long ndefer;	/* C775_INT_DEFERRED: handed to the worker */
+  unsigned long long deferSum;	/* their wait for the worker (us) */
+  unsigned long long deferMax;
+} c775IntStats;
+
+/* Register snapshot of a TDC (c775GetSnapshot), refreshed by the sampler
+   thread (c775SamplerStart).  Registers the library programs come from its
+   host copy, the others from the module */
+typedef struct
+{
+  unsigned long long time;	/* when taken (us), 0: never */
+  UINT32 evCount;		/* event counter (24 bits) */
+  UINT16 rev;
+  UINT16 geoAddr;
+  UINT16 status1;
+  UINT16 status2;
+  UINT16 bitSet1;
+  UINT16 bitSet2;
+  UINT16 control1;
+  UINT16 evTrigger;
+  UINT16 fsr;
+  UINT16 intLevel;
+  UINT16 intVector;
+  UINT16 cbltAddr;
+  UINT16 cbltControl;
+} c775Snapshot;
+
+/* Shared memory segment with the readout counters (c775StatsShmOpen),
+   for monitoring tools.  Counters are updated in place during the run.
+   The snapshots are written under a seqlock: snapSeq[id] is odd while
+   snap[id] is written.  Read it, copy snap[id], and copy again if it was
+   odd or has changed */
+#define C775_STATS_SHM      "/c775stats"
+#define C775_STATS_MAGIC    0x53353737   /* "775S" */
+#define C775_STATS_VERSION  5
+#define C775_STATS_CBLT     C775_MAX_MODULES   /* id of the CBLT counters */
+
+typedef struct
+{
+  unsigned int magic;		/* C775_STATS_MAGIC */
+  unsigned int version;		/* C775_STATS_VERSION */
+  unsigned int size;		/* sizeof(c775StatsSeg) */
+  unsigned int nmod;		/* number of TDCs initialized */
+  c775ModStats mod[C775_MAX_MODULES];
+  c775ModStats cblt;		/* CBLT transfers (ndma, dmaBytes, dmaTime, nberr) */
+  c775IntStats intr[C775_MAX_MODULES];	/* interrupt level and rates */
+  unsigned int snapSeq[C775_MAX_MODULES];
+  c775Snapshot snap[C775_MAX_MODULES];	/* registers (c775SamplerStart) */
+} c775StatsSeg;
+
+/* Event descriptor, filled when splitting a block of events */
+typedef struct
+{
+  int geo;			/* GEO address from the header */
+  int offset;			/* word offset of the header in the buffer */
+  int nwords;			/* words in the event, including header and trailer */
+  UINT32 evID;			/* event counter from the trailer */
+} c775EvIndex;
+
 /* Function Prototypes */
 STATUS c775Init(UINT32 addr, UINT32 addr_inc, int nadc, UINT16 crateID);
 void c775Status(int id);
+STATUS c775SamplerStart(int periodMs);
+void c775SamplerStop();
+STATUS c775GetSnapshot(int id, c775Snapshot *snap);
+STATUS c775ShadowSync(int id);
+int c775ShadowVerify(int id);
+int c775Reprogram(int id, int full);
 int c775PrintEvent(int id, int pflag);
 int c775ReadEvent(int id, UINT32 * data);
+int c775ReadEvents(int id, UINT32 * data, int maxev, int *evOffset,
+		   UINT32 * evCount, int *nevents);
 int c775FlushEvent(int id, int fflag);
+int c775FlushEvents(int id, int mode, volatile UINT32 * scratch, int nwrds,
+		    UINT32 * evID, int maxev, int *nwords);
 int c775ReadBlock(int id, volatile UINT32 * data, int nwrds);
+int c775ReadBlockIndex(int id, volatile UINT32 * data, int nwrds,
+		       c775EvIndex * evidx, int maxev, int *nevents, int *bstat);
+int c775ReadBlockStart(int id, volatile UINT32 * data, int nwrds);
+int c775ReadBlockPoll(int id);
+int c775ReadBlockComplete(int id);
+int c775ReadBlockOverlap(UINT32 idmask, volatile UINT32 * data, int nwrds,
+			 int flags, int *modWords);
+STATUS c775SetCBLT(int id, UINT32 cbltAddr, int role);
+STATUS c775CBLTInit(UINT32 cbltAddr, int flags);
+int c775CBLTReadBlock(volatile UINT32 * data, int nwrds);
+int c775CBLTSplit(volatile UINT32 * data, int nwrds, c775EvIndex * evidx,
+		  int maxev);
+STATUS c775MCSTInit(UINT32 mcstAddr, int flags);
+void c775MCSTGate();
+void c775MCSTEnable();
+void c775MCSTDisable();
+void c775MCSTClear();
+void c775MCSTReset();
+void c775MCSTEventCounterReset();
 STATUS c775IntConnect(VOIDFUNCPTR routine, int arg, UINT16 level,
 		      UINT16 vector);
 STATUS c775IntEnable(int id, UINT16 evCnt);
 STATUS c775IntDisable(int iflag);
 STATUS c775IntResume(void);
+STATUS c775IntConnectModule(int id, VOIDFUNCPTR routine, int arg,
+			    UINT16 level, UINT16 vector);
+STATUS c775IntAdaptive(int id, int maxLatency, int maxRate);
+STATUS c775GetIntStats(int id, c775IntStats *stats);
+STATUS c775SetIntMode(int mode, int prio);
 UINT16 c775Sparse(int id, int over, int under);
+unsigned int c775GDReady(unsigned int idmask, int nloop);
 int c775Dready(int id);
+STATUS c775SetWaitMode(int mode, int spinUs);
+int c775WaitFd();
+int c775WaitReady(int id, int timeout);
 int c775SetFSR(int id, UINT16 fsr);
 INT16 c775BitSet2(int id, UINT16 val);
 INT16 c775BitClear2(int id, UINT16 val);
 void c775ClearThresh(int id);
+int c775SetThreshAll(UINT32 idmask, UINT16 *thresh, int flags, UINT32 *badmask);
 void c775Gate(int id);
 void c775IncrEventBlk(int id, int count);
 void c775IncrEvent(int id);
@@ -200,5 +393,19 @@ void c775CommonStop(int id);
 void c775CommonStart(int id);
 void c775Clear(int id);
 void c775Reset(int id);
+STATUS c775SetByteOrder(int order);
+int c775GetByteOrder();
+STATUS c775SetLockPolicy(int policy);
+void c775LockTiming(int enable);
+STATUS c775GetLockStats(int id, c775LockStats *stats);
+void c775ClearLockStats(int id);
+void c775PrintLockStats(int id);
+STATUS c775GetStats(int id, c775ModStats *stats);
+void c775ClearStats(int id);
+void c775PrintStats(int id);
+STATUS c775StatsShmOpen(char *name);
+void c775StatsShmClose();
+void c775LogRate(int rate);
+int c775LogFlush();
 
 #endif /* __C775LIB__ */
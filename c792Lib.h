@@ -15,6 +15,8 @@
 #define C792_MAX_MODULES    20
 #define C792_MAX_CHANNELS   32
 #define C792_MAX_WORDS_PER_EVENT  34
+#define C792_MAX_EVENTS_PER_BUFFER 32  /* Depth of the Multi Event Buffer */
+#define C792_MAX_GEO        32
 
 /* Define a Structure for access to QDC*/
 struct c792_struct {
@@ -107,6 +109,7 @@ struct c792_ROM_struct {
 
 #define C792_DATA_READY    0x1
 #define C792_BUSY          0x4
+#define C792_EVRDY         0x100
 
 #define C792_BLK_END       0x04
 #define C792_BERR_ENABLE   0x20
@@ -130,6 +133,51 @@ struct c792_ROM_struct {
 #define C792_INVALID_DATA   0x06000000
 
 
+/* CBLT/MCST chain position (cbltControl) */
+#define C792_CBLT_DISABLED  0
+#define C792_CBLT_LAST      1
+#define C792_CBLT_FIRST     2
+#define C792_CBLT_MIDDLE    3
+
+/* c792ReadBlockOverlap flags */
+#define C792_BLOCK_SWAP     0x1   /* Convert data to CPU byte order */
+
+/* c792ReadBlockIndex status */
+#define C792_BLKSTAT_PARTIAL    0x1   /* Last event cut short by the transfer size */
+#define C792_BLKSTAT_CORRUPT    0x2   /* Header or trailer missing */
+#define C792_BLKSTAT_INDEX_FULL 0x4   /* More events than index entries */
+
+/* c792FlushEvents modes */
+#define C792_FLUSH_RESET    0     /* Data reset, events counted (no read) */
+#define C792_FLUSH_PIO      1     /* Read out with programmed I/O */
+#define C792_FLUSH_DMA      2     /* Read out with block reads */
+
+/* Byte order of the data buffers (c792SetByteOrder) */
+#define C792_ORDER_VME      0     /* As read from the bus (default) */
+#define C792_ORDER_CPU      1     /* Swapped to CPU byte order */
+
+/* Data ready wait (c792SetWaitMode) */
+#define C792_WAIT_SPIN      0     /* Poll until the timeout (default) */
+#define C792_WAIT_ADAPTIVE  1     /* Poll, then sleep between polls */
+#define C792_WAIT_INT       2     /* Poll, then sleep until the interrupt */
+#define C792_WAIT_SPIN_US   20    /* Default polling time before sleeping (us) */
+#define C792_WAIT_SLEEP_MIN 10    /* First sleep (us), then doubled up to */
+#define C792_WAIT_SLEEP_MAX 1000
+
+/* Interrupt handling (c792SetIntMode) */
+#define C792_INT_DIRECT     0     /* Readout in the interrupt handler (default) */
+#define C792_INT_DEFERRED   1     /* Readout in a worker thread (Linux) */
+
+/* Threshold tables (c792SetThreshAll) */
+#define C792_THRESH_KILL    0x100 /* Kill bit of a channel threshold */
+#define C792_THRESH_VERIFY  0x1   /* Read back all the thresholds */
+#define C792_THRESH_FORCE   0x2   /* Write even the channels already set */
+#define C792_THRESH_SAME    0x4   /* One table for all the QDCs */
+
+/* c792CBLTInit flags */
+#define C792_CBLT_NOT_FIRST 0x1   /* Other boards precede the QDCs on the chain */
+#define C792_CBLT_NOT_LAST  0x2   /* Other boards follow the QDCs on the chain */
+
 /* Register Masks */
 #define C792_BITSET1_MASK   0x0098
 #define C792_INTLEVEL_MASK  0x0007
@@ -139,6 +187,8 @@ struct c792_ROM_struct {
 #define C792_STATUS2_MASK   0x00f6
 #define C792_BITSET2_MASK   0x7fff
 #define C792_EVTRIGGER_MASK 0x001f
+#define C792_GEO_MASK       0x001f
+#define C792_CBLTCTRL_MASK  0x0003
 
 #define C792_DATA_ID_MASK    0x07000000
 #define C792_WORDCOUNT_MASK  0x00003f00
@@ -148,24 +198,164 @@ struct c792_ROM_struct {
 #define C792_GEO_ADDR_MASK   0xf8000000
 #define C792_ADC_DATA_MASK   0x00000fff
 
+/* Lock policy (c792SetLockPolicy, or -DC792_LOCK_POLICY=n at compile time) */
+#define C792_LOCK_NONE      0
+#define C792_LOCK_SPIN      1
+#define C792_LOCK_MUTEX     2
+
+/* Lock counters, per module.  Times are in ns, and only counted
+   while c792LockTiming is on */
+typedef struct
+{
+  unsigned long long nlock;      /* number of times the lock was taken */
+  unsigned long long ncontend;   /* ... and had to wait for another thread */
+  unsigned long long waitTime;   /* total time spent waiting */
+  unsigned long long holdTime;   /* total time held */
+  unsigned long long holdMax;    /* longest time held */
+} c792LockStats;
+
+/* Readout counters, per module (c792GetStats).  Times are in ns.  Each
+   structure has its own cache lines, so that the readout of one module
+   does not disturb the others */
+typedef struct
+{
+  unsigned long long nevents;     /* events read */
+  unsigned long long nwords;      /* words read, including headers and trailers */
+  unsigned long long ndma;        /* block transfers */
+  unsigned long long dmaBytes;    /* bytes moved by block transfers */
+  unsigned long long dmaTime;     /* time from start to end of block transfers */
+  unsigned long long pioTime;     /* time in programmed I/O event reads */
+  unsigned long long npoll;       /* data ready polls */
+  unsigned long long nempty;      /* polls and reads that found no data */
+  unsigned long long nbadHeader;  /* invalid header words */
+  unsigned long long nbadTrailer; /* invalid trailer words */
+  unsigned long long nberr;       /* block transfers ended by a bus error */
+  unsigned long long nclear;      /* data clears and resets */
+} __attribute__((aligned(64))) c792ModStats;
+
+/* Interrupt level and rates, per QDC (c792GetIntStats, c792IntAdaptive) */
+#define C792_INT_WINDOW_US  100000   /* rate measurement window */
+
+typedef struct
+{
+  unsigned int level;        /* events per interrupt (Event Trigger register) */
+  unsigned int intRate;      /* interrupts per second, last window */
+  unsigned int trigRate;     /* events per second, last window */
+  unsigned int nretune;      /* changes of level by c792IntAdaptive */
+  unsigned long long nint;   /* interrupts */
+  unsigned long long ndefer;     /* C792_INT_DEFERRED: handed to the worker */
+  unsigned long long deferSum;   /* their wait for the worker (us) */
+  unsigned long long deferMax;
+} c792IntStats;
+
+/* Register snapshot of a QDC (c792GetSnapshot), refreshed by the sampler
+   thread (c792SamplerStart).  Registers the library programs come from its
+   host copy, the others from the module */
+typedef struct
+{
+  unsigned long long time;   /* when taken (us), 0: never */
+  UINT32 evCount;            /* event counter (24 bits) */
+  UINT16 rev;
+  UINT16 geoAddr;
+  UINT16 status1;
+  UINT16 status2;
+  UINT16 bitSet1;
+  UINT16 bitSet2;
+  UINT16 control1;
+  UINT16 evTrigger;
+  UINT16 fclrWindow;
+  UINT16 intLevel;
+  UINT16 intVector;
+  UINT16 cbltAddr;
+  UINT16 cbltControl;
+} c792Snapshot;
+
+/* Shared memory segment with the readout counters (c792StatsShmOpen),
+   for monitoring tools.  Counters are updated in place during the run.
+   The snapshots are written under a seqlock: snapSeq[id] is odd while
+   snap[id] is written.  Read it, copy snap[id], and copy again if it was
+   odd or has changed */
+#define C792_STATS_SHM      "/c792stats"
+#define C792_STATS_MAGIC    0x53323937   /* "792S" */
+#define C792_STATS_VERSION  5
+#define C792_STATS_CBLT     C792_MAX_MODULES   /* id of the CBLT counters */
+
+typedef struct
+{
+  unsigned int magic;       /* C792_STATS_MAGIC */
+  unsigned int version;     /* C792_STATS_VERSION */
+  unsigned int size;        /* sizeof(c792StatsSeg) */
+  unsigned int nmod;        /* number of QDCs initialized */
+  c792ModStats mod[C792_MAX_MODULES];
+  c792ModStats cblt;        /* CBLT transfers (ndma, dmaBytes, dmaTime, nberr) */
+  c792IntStats intr[C792_MAX_MODULES];  /* interrupt level and rates */
+  unsigned int snapSeq[C792_MAX_MODULES];
+  c792Snapshot snap[C792_MAX_MODULES];  /* registers (c792SamplerStart) */
+} c792StatsSeg;
+
+/* Event descriptor, filled when splitting a block of events */
+typedef struct
+{
+  int    geo;      /* GEO address from the header */
+  int    offset;   /* word offset of the header in the buffer */
+  int    nwords;   /* words in the event, including header and trailer */
+  UINT32 evID;     /* event counter from the trailer */
+} c792EvIndex;
+
 /* Function Prototypes */
 STATUS c792Init (UINT32 addr, UINT32 addr_inc, int nadc, UINT16 crateID);
 UINT32 c792ScanMask();
 void   c792Status( int id, int reg, int sflag);
 void   c792GStatus(int flag);
+STATUS c792SamplerStart(int periodMs);
+void   c792SamplerStop();
+STATUS c792GetSnapshot(int id, c792Snapshot *snap);
+STATUS c792ShadowSync(int id);
+int    c792ShadowVerify(int id);
+int    c792Reprogram(int id, int full);
 int    c792PrintEvent(int id, int pflag);
 int    c792ReadEvent(int id, UINT32 *data);
+int    c792ReadEvents(int id, UINT32 *data, int maxev, int *evOffset,
+		      UINT32 *evCount, int *nevents);
 int    c792FlushEvent(int id, int fflag);
+int    c792FlushEvents(int id, int mode, volatile UINT32 *scratch, int nwrds,
+		       UINT32 *evID, int maxev, int *nwords);
 int    c792ReadBlock(int id, volatile UINT32 *data, int nwrds);
+int    c792ReadBlockIndex(int id, volatile UINT32 *data, int nwrds,
+			  c792EvIndex *evidx, int maxev, int *nevents, int *bstat);
+int    c792ReadBlockStart(int id, volatile UINT32 *data, int nwrds);
+int    c792ReadBlockPoll(int id);
+int    c792ReadBlockComplete(int id);
+int    c792ReadBlockOverlap(UINT32 idmask, volatile UINT32 *data, int nwrds,
+			    int flags, int *modWords);
+STATUS c792SetCBLT(int id, UINT32 cbltAddr, int role);
+STATUS c792CBLTInit(UINT32 cbltAddr, int flags);
+int    c792CBLTReadBlock(volatile UINT32 *data, int nwrds);
+int    c792CBLTSplit(volatile UINT32 *data, int nwrds, c792EvIndex *evidx, int maxev);
+STATUS c792MCSTInit(UINT32 mcstAddr, int flags);
+void   c792MCSTGate();
+void   c792MCSTEnable();
+void   c792MCSTDisable();
+void   c792MCSTClear();
+void   c792MCSTReset();
+void   c792MCSTEventCounterReset();
 STATUS c792IntConnect (VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector);
 STATUS c792IntEnable (int id, UINT16 evCnt);
 STATUS c792IntDisable (int iflag);
 STATUS c792IntResume (void);
+STATUS c792IntConnectModule (int id, VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector);
+STATUS c792IntAdaptive (int id, int maxLatency, int maxRate);
+STATUS c792GetIntStats (int id, c792IntStats *stats);
+STATUS c792SetIntMode (int mode, int prio);
 UINT16 c792Sparse(int id, int over, int under);
 unsigned int c792GDReady(unsigned int idmask, int nloop);
 int    c792Dready(int id);
+STATUS c792SetWaitMode(int mode, int spinUs);
+int    c792WaitFd();
+int    c792WaitReady(int id, int timeout);
 void   c792ClearThresh(int id);
 short  c792SetThresh(int id, int chan, short val);
+int    c792SetThreshAll(UINT32 idmask, UINT16 *thresh, int flags, UINT32 *badmask);
 void   c792Gate(int id);
 short  c792Control(int id, short val);
 short  c792BitSet2(int id, short val);
@@ -181,5 +371,19 @@ void   c792Clear(int id);
 void   c792Reset(int id);
 void   c792EventCounterReset(int id);
 int    c792SetGeoAddress(int id, int geo);
+STATUS c792SetByteOrder(int order);
+int    c792GetByteOrder();
+STATUS c792SetLockPolicy(int policy);
+void   c792LockTiming(int enable);
+STATUS c792GetLockStats(int id, c792LockStats *stats);
+void   c792ClearLockStats(int id);
+void   c792PrintLockStats(int id);
+STATUS c792GetStats(int id, c792ModStats *stats);
+void   c792ClearStats(int id);
+void   c792PrintStats(int id);
+STATUS c792StatsShmOpen(char *name);
+void   c792StatsShmClose();
+void   c792LogRate(int rate);
+int    c792LogFlush();
 
 #endif /* __C792LIB__ */
@@ -22,14 +22,82 @@
 #define TDC_ID 0
 #define MAX_TDC_DATA 34
 
+/* Deadline for all modules to have data, in microseconds */
+#define READOUT_TIMEOUT 100
+
+/* How to wait for data, chosen per run (see v7xxSetWaitMode):
+   C792_WAIT_SPIN, C792_WAIT_ADAPTIVE (poll WAIT_SPIN_US, then sleep), or
+   C792_WAIT_INT (needs the QDC and TDC interrupts enabled) */
+#define WAIT_MODE    C792_WAIT_ADAPTIVE
+#define WAIT_SPIN_US 20
+
+/* Uncomment to read the modules from a separate thread, which passes
+   the raw data to rocTrigger through a v7xxRing */
+/* #define READOUT_RING */
+#define RING_SLOTS       64
+#define RING_WAIT_LOOPS  100000
+
+/* Uncomment to add the trigger timing words (V7XX_TIME_MARK) to each
+   bank, ahead of the EOB.  The timing histograms are kept either way */
+/* #define TIME_STAMPS */
+
+/* Event counter check of each trigger (see v7xxCheckEnable): a module
+   whose counter slips against the trigger count is cleared, and the
+   event tagged with V7XX_CHECK_MARK.  V7XX_CHECK_ON only tags it.  The
+   event counter registers are read every COUNTER_PERIOD triggers */
+#define COUNTER_CHECK  V7XX_CHECK_RESYNC
+#define COUNTER_PERIOD 100
+
+/* Watchdog (see v7xxWatchEnable): the status of the modules is checked
+   every WATCH_PERIOD triggers, and after WATCH_MAXFAIL failed reads in a
+   row (timeouts count for the ADC only: the TDC has no event without
+   hits), and by a thread when no trigger came for WATCH_STALL_MS.  A module
+   stuck full or busy, or not read out, is drained, cleared, reset and
+   reprogrammed in turn.  The sampler threads refresh the status registers
+   every SAMPLE_MS, so that the checks do not read the bus */
+#define WATCH_PERIOD   100
+#define WATCH_MAXFAIL  3
+#define WATCH_STALL_MS 500
+#define SAMPLE_MS      100
+
 #include "linuxvme_list.c"
 #include "c792Lib.h"
 #include "c775Lib.h"
+#include "v7xxLib.h"
+#include "v7xxLog.h"
+
+/* Trigger path messages: queued, rate limited, and printed by another
+   thread, so that a noisy module does not add console I/O to the dead
+   time */
+LOCAL v7xxLog rocLog = V7XX_LOG_INIT("roc");
+#define ROC_LOG(...)  V7XX_LOG(&rocLog, __VA_ARGS__)
 
 
 /* function prototype */
 void rocTrigger(int arg);
 
+#ifdef READOUT_RING
+#include <sched.h>
+LOCAL v7xxRing *ring = NULL;
+LOCAL pthread_t readerThread;
+LOCAL volatile int readerRun = 0;
+
+/* Reader thread: only VME access here.  It reads out the events as soon
+   as the modules have them, and numbers them from their event counters
+   (v7xxPipeRead) */
+LOCAL void *
+rocReader(void *arg)
+{
+  while(readerRun)
+    {
+      if((v7xxPipeRead(ring,READOUT_TIMEOUT)<=0) && (v7xxRingDepth(ring)>0))
+	sched_yield(); /* Ring full: let the formatter catch up */
+    }
+
+  return NULL;
+}
+#endif
+
 /* function prototype */
 void rocCleanup()
 {
@@ -58,6 +126,16 @@ rocDownload()
   ////c792Init(0x08A20000,0,1,0);//0x08A20000 is user address specified on jumpers
   c792Init(0x110000,0,1,0); // we think that the above address means A24?
 
+  /* Leave the data in VME byte order: the consumer swaps it once, using
+     the byte order mark that follows the event number */
+  v7xxSetByteOrder(C792_ORDER_VME);
+
+  /* Readout counters, for monitoring from outside the ROC */
+  c792StatsShmOpen(NULL);
+  c775StatsShmOpen(NULL);
+  c792SamplerStart(SAMPLE_MS);
+  c775SamplerStart(SAMPLE_MS);
+
   printf("rocDownload: User Download Executed\n");
 
 }
@@ -66,7 +144,7 @@ void
 rocPrestart()
 {
   unsigned short iflag;
-  int stat;
+  int stat, adcPos;
 
   /* Program/Init VME Modules Here */
   /* Setup ADCs (no sparsification, enable berr for block reads) */
@@ -86,6 +164,36 @@ rocPrestart()
   //c775CommonStart(TDC_ID);
 
   c775Status(TDC_ID);
+
+  /* Printing thread of the logs, stopped by rocEnd */
+  v7xxLogStart(&rocLog);
+
+  /* Start the run with zero readout counters */
+  c792ClearStats(-1);
+  c775ClearStats(-1);
+
+  /* Readout schedule: modules are read in the order their data is ready */
+  v7xxSchedInit();
+  adcPos = v7xxSchedAdd(V7XX_QDC,ADC_ID,V7XX_READ_EVENT,MAX_ADC_DATA);
+  v7xxSchedAdd(V7XX_TDC,TDC_ID,V7XX_READ_EVENT,MAX_TDC_DATA);
+  /* or use V7XX_READ_BLOCK, if BERR was enabled */
+  v7xxSetWaitMode(WAIT_MODE,WAIT_SPIN_US);
+  v7xxCheckEnable(COUNTER_CHECK,COUNTER_PERIOD);
+#ifndef READOUT_RING
+  v7xxWatchEnable(WATCH_PERIOD,WATCH_MAXFAIL,WATCH_STALL_MS);
+  v7xxWatchTimeouts(1<<adcPos);   /* not suppressed: data for every trigger */
+#endif
+
+  /* Time the phases of every trigger (not with READOUT_RING: the
+     modules are read in another thread) */
+#ifndef READOUT_RING
+#ifdef TIME_STAMPS
+  v7xxTimeEnable(V7XX_TIME_ON|V7XX_TIME_STAMP);
+#else
+  v7xxTimeEnable(V7XX_TIME_ON);
+#endif
+  v7xxTimeClear();
+#endif
   
   printf("rocPrestart: User Prestart Executed\n");
 
@@ -100,19 +208,65 @@ rocGo()
   c775Status(TDC_ID);
   c792Status(ADC_ID,0,0); //TONY ADDED THIS
   printf("rocGo: After status!!!");
+#ifdef READOUT_RING
+  ring = v7xxRingCreate(RING_SLOTS,MAX_ADC_DATA+MAX_TDC_DATA+V7XX_CHECK_NWORDS);
+  v7xxPipeReset(tirGetIntCount()+1);
+  readerRun = 1;
+  if(pthread_create(&readerThread,NULL,rocReader,NULL)!=0)
+    {
+      printf("rocGo: ERROR: Cannot start the reader thread\n");
+      readerRun = 0;
+    }
+#endif
   /* Interrupts/Polling enabled after conclusion of rocGo() */
 }
 
 void
 rocEnd()
 {
-
+  int nleft;
+  UINT32 evID[1];
 
   //  int status, count;  
   c775Status(TDC_ID);
   c792Status(ADC_ID,0,0); //TONY ADDED THIS
   // c775Disable(TDC_ID); //Commented out, Brash: June 1, 2023
 
+#ifdef READOUT_RING
+  if(readerRun)
+    {
+      readerRun = 0;
+      pthread_join(readerThread,NULL);
+    }
+  v7xxRingPrintStats(ring);
+  v7xxRingDestroy(ring);
+  ring = NULL;
+#endif
+
+  /* Events gated but not read out: discarded with a data reset, and
+     counted from the event counters */
+  nleft = c792FlushEvents(ADC_ID,C792_FLUSH_RESET,NULL,0,evID,1,NULL);
+  if(nleft>0)
+    printf("rocEnd: %d events left in ADC %d, from event %d\n",nleft,ADC_ID,evID[0]);
+  nleft = c775FlushEvents(TDC_ID,C775_FLUSH_RESET,NULL,0,evID,1,NULL);
+  if(nleft>0)
+    printf("rocEnd: %d events left in TDC %d, from event %d\n",nleft,TDC_ID,evID[0]);
+
+  v7xxLogFlush(&rocLog);
+  c792LogFlush();
+  c775LogFlush();
+  v7xxLogStop();
+
+  c792PrintStats(-1);
+  c775PrintStats(-1);
+  v7xxSchedPrint(NULL);
+  v7xxCheckPrint();
+#ifndef READOUT_RING
+  v7xxTimePrint(0);
+  v7xxWatchPrint();
+  v7xxWatchEnable(0,0,0);
+#endif
+
   printf("rocEnd: Ended after %d events\n",tirGetIntCount());
   
 }
@@ -121,91 +275,99 @@ void
 rocTrigger(int arg)
 {
 
-  int ii, status, dma, count;
-  int nwords;
-  unsigned int datascan, tirval, vme_addr;
-  unsigned long long length,size;
-  int itimeout=0;
+  int ii, nwords;
+  UINT32 tmask=0;
+#ifdef READOUT_RING
+  unsigned int trigger;
+  int stat = V7XX_PIPE_WAIT;
+#endif
+  v7xxSchedResult res[V7XX_SCHED_MAX];
+  volatile UINT32 *data;
 
 /* /\*   tirIntOutput(2); *\/ */
 
-  printf("Event Count: %d\n",tirGetIntCount());
+  v7xxTimeStart();
 
-  *dma_dabufp++ = LSWAP(tirGetIntCount()); /* Insert Event Number */
-
-  /* Check if an Event is available */
+  ROC_LOG("Event Count: %d\n",tirGetIntCount());
 
-  while(itimeout<1000)
+#ifdef READOUT_RING
+  /* The reader thread does the VME part: format the event of this
+     trigger, after those of earlier triggers that came too late for
+     them (with their own event number) */
+  trigger = tirGetIntCount();
+  data = dma_dabufp;
+  for(ii=0; (ii<RING_WAIT_LOOPS) && (stat==V7XX_PIPE_WAIT); ii++)
     {
-      itimeout++;
-      status = c792Dready(ADC_ID);
-      if(status>0) break;
-    }
-  if(status > 0)
-    {
-      if(tirGetIntCount() %100==0)
-	{
-	  printf("itimeout = %d\n",itimeout);
-	  c792PrintEvent(ADC_ID,0);
-	}
-      else
-	{
- 	  nwords = c792ReadEvent(ADC_ID,dma_dabufp);
-          /* or use c792ReadBlock, if BERR was enabled */
-/*	  nwords = c792ReadBlock(ADC_ID,dma_dabufp,MAX_ADC_DATA); */
-	  if(nwords<=0)
-	    {
-	      logMsg("ERROR: ADC Read Failed - Status 0x%x\n",nwords,0,0,0,0,0);
-	      *dma_dabufp++ = 0xda000bad;
-	      c792Clear(ADC_ID);
-	    }
-	  else
-	    {
-	      dma_dabufp += nwords;
-	    }
-	}
+      stat = v7xxPipeFormat(ring,dma_dabufp,MAX_EVENT_LENGTH/4 - (dma_dabufp - data),
+			    trigger,&nwords);
+      dma_dabufp += nwords;
+      if(stat==V7XX_PIPE_WAIT)
+	sched_yield();
     }
-  else
+  if(stat!=V7XX_PIPE_EVENT)
     {
-      logMsg("ERROR: NO data in ADC  datascan = 0x%x, itimeout=%d\n",status,itimeout,0,0,0,0);
-      c792Clear(ADC_ID);
+      ROC_LOG("ERROR: NO event from the reader thread for trigger %d (%d)\n",
+	      trigger,stat,0,0,0,0);
+      *dma_dabufp++ = LSWAP(trigger);
+      *dma_dabufp++ = v7xxOrderMark();
+      *dma_dabufp++ = 0xda000bad;
+      *dma_dabufp++ = LSWAP(0xdaebd00d);
     }
+  return;
+#endif
 
-  while(itimeout<1000)
+  *dma_dabufp++ = LSWAP(tirGetIntCount()); /* Insert Event Number */
+  *dma_dabufp++ = v7xxOrderMark();          /* Byte order of the module data */
+
+  /* Wait for all the QDCs and TDCs together, reading each one as
+     soon as it has data.  The watchdog thread stays off the modules
+     until v7xxWatchEvent */
+  v7xxWatchStart();
+  data = dma_dabufp;
+  nwords = v7xxSchedReadout(data,MAX_ADC_DATA+MAX_TDC_DATA,
+			    READOUT_TIMEOUT,&tmask,res);
+  if(nwords<0)
     {
-      itimeout++;
-      status = c775Dready(TDC_ID);
-      if(status>0) break;
+      ROC_LOG("ERROR: Readout Failed - Status 0x%x\n",nwords,0,0,0,0,0);
+      *dma_dabufp++ = 0xda000bad;
     }
-  if(status > 0)
+  else
     {
-      if(tirGetIntCount() %100==0)
-	{
-	  printf("itimeout = %d\n",itimeout);
-	  c775PrintEvent(TDC_ID,0);
-	}
-      else
+      dma_dabufp += nwords;
+
+      /* Trailer event counters against the trigger count */
+      dma_dabufp += v7xxCheckEvent(tirGetIntCount(),data,res,dma_dabufp);
+
+      for(ii=0; ii<v7xxSchedCount(); ii++)
 	{
-	  nwords = c775ReadEvent(TDC_ID,dma_dabufp);
-	  /* or use c775ReadBlock, if BERR was enabled */
-/* 	  nwords = c775ReadBlock(TDC_ID,dma_dabufp,MAX_TDC_DATA); */
-	  if(nwords<=0)
+	  if(res[ii].nwords>0) continue;
+
+	  if(res[ii].type==V7XX_QDC)
 	    {
-	      logMsg("ERROR: TDC Read Failed - Status 0x%x\n",nwords,0,0,0,0,0);
-	      *dma_dabufp++ = 0xda000bad;
-	      c775Clear(TDC_ID);
+	      if(tmask & (1<<ii))
+		ROC_LOG("ERROR: NO data in ADC %d\n",res[ii].id,0,0,0,0,0);
+	      else
+		{
+		  ROC_LOG("ERROR: ADC %d Read Failed\n",res[ii].id,0,0,0,0,0);
+		  *dma_dabufp++ = 0xda000bad;
+		}
 	    }
 	  else
 	    {
-	      dma_dabufp += nwords;
+	      if(!(tmask & (1<<ii)))
+		{
+		  ROC_LOG("ERROR: TDC %d Read Failed\n",res[ii].id,0,0,0,0,0);
+		  *dma_dabufp++ = 0xda000bad;
+		}
 	    }
 	}
     }
-  else
-    {
-      //      logMsg("ERROR: NO data in TDC  datascan = 0x%x, itimeout=%d\n",status,itimeout,0,0,0,0);
-      c775Clear(TDC_ID);
-    }
+
+  /* Modules in trouble are recovered by the watchdog */
+  v7xxWatchEvent((nwords<0) ? NULL : res);
+
+  dma_dabufp += v7xxTimeEnd(dma_dabufp);
+
   *dma_dabufp++ = LSWAP(0xdaebd00d); /* Event EOB */ //TONY - made no change
 
 /*   tirIntOutput(0); */
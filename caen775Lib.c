@@ -14,9 +14,22 @@
 *
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* SCHED_IDLE, in <sched.h> */
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+#ifndef VXWORKS
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#endif
 #ifdef VXWORKS
 #include "vxWorks.h"
 #include "logLib.h"
@@ -24,12 +37,18 @@
 #include "intLib.h"
 #include "iv.h"
 #include "semLib.h"
+#include "tickLib.h"
+#include "sysLib.h"
 #include "vxLib.h"
 #endif
 #include "jvme.h"
 
 /* Include TDC definitions */
 #include "c775Lib.h"
+#include "v7xxSwap.h"
+#include "v7xxLog.h"
+#include "v7xxInt.h"
+#include "v7xxDma.h"
 
 #ifdef VXWORKS
 /* Define external Functions */
@@ -39,20 +58,249 @@ IMPORT STATUS sysIntEnable(int);
 IMPORT STATUS sysIntDisable(int);
 #endif
 
-/* Mutex to guard c775 reads/writes */
-pthread_mutex_t c775mutex = PTHREAD_MUTEX_INITIALIZER;
-#define C775LOCK   if(pthread_mutex_lock(&c775mutex)<0) perror("pthread_mutex_lock");
-#define C775UNLOCK if(pthread_mutex_unlock(&c775mutex)<0) perror("pthread_mutex_unlock");
+/* Locks to guard c775 reads/writes - Linux only
+   One lock per TDC, so that slow control on one module does not stall
+   readout of another.  Crate-wide operations (CBLT, MCST) take all of
+   them, in id order.  The lock type is chosen at compile time with
+   C775_LOCK_POLICY, or at run time with c775SetLockPolicy. */
+#ifdef VXWORKS
+#define C775LOCK(id)
+#define C775UNLOCK(id)
+#define C775LOCK_ALL
+#define C775UNLOCK_ALL
+#else
+#ifndef C775_LOCK_POLICY
+#define C775_LOCK_POLICY C775_LOCK_MUTEX
+#endif
+
+typedef struct
+{
+  pthread_mutex_t    mutex;
+  pthread_spinlock_t spin;
+  c775LockStats      stats;
+  unsigned long long t0;       /* time the lock was taken, if timing */
+  int                policy;   /* it was taken with (c775SetLockPolicy) */
+} c775Lock_t;
+
+LOCAL c775Lock_t     c775Lock[C775_MAX_MODULES];
+LOCAL pthread_once_t c775LockOnce = PTHREAD_ONCE_INIT;
+LOCAL int            c775LockPolicy = C775_LOCK_POLICY;
+LOCAL int            c775LockTimeEnable = 0;
+
+LOCAL void
+c775LockInitAll(void)
+{
+  int ii;
+
+  for(ii=0;ii<C775_MAX_MODULES;ii++) {
+    pthread_mutex_init(&c775Lock[ii].mutex, NULL);
+    pthread_spin_init(&c775Lock[ii].spin, PTHREAD_PROCESS_PRIVATE);
+    memset(&c775Lock[ii].stats, 0, sizeof(c775LockStats));
+  }
+}
+
+LOCAL inline unsigned long long
+c775LockNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+}
+
+LOCAL inline void
+c775LockAcquire(int id)
+{
+  c775Lock_t *lk = &c775Lock[id];
+  unsigned long long tw = 0;
+  int busy = 0, policy;
+
+  pthread_once(&c775LockOnce, c775LockInitAll);
+
+  policy = c775LockPolicy;
+  switch(policy) {
+  case C775_LOCK_MUTEX:
+    if((busy = pthread_mutex_trylock(&lk->mutex)) != 0) {
+      if(c775LockTimeEnable) tw = c775LockNow();
+      if(pthread_mutex_lock(&lk->mutex) != 0) perror("pthread_mutex_lock");
+    }
+    break;
+  case C775_LOCK_SPIN:
+    if((busy = pthread_spin_trylock(&lk->spin)) != 0) {
+      if(c775LockTimeEnable) tw = c775LockNow();
+      pthread_spin_lock(&lk->spin);
+    }
+    break;
+  default:
+    break;
+  }
+
+  lk->policy = policy;
+  lk->stats.nlock++;
+  if(c775LockTimeEnable) {
+    lk->t0 = c775LockNow();
+    if(busy) lk->stats.waitTime += lk->t0 - tw;
+  }
+  if(busy) lk->stats.ncontend++;
+}
+
+LOCAL inline void
+c775LockRelease(int id)
+{
+  c775Lock_t *lk = &c775Lock[id];
+  unsigned long long held;
+
+  if(c775LockTimeEnable && lk->t0) {
+    held = c775LockNow() - lk->t0;
+    lk->stats.holdTime += held;
+    if(held > lk->stats.holdMax) lk->stats.holdMax = held;
+    lk->t0 = 0;
+  }
+
+  switch(lk->policy) {
+  case C775_LOCK_MUTEX:
+    if(pthread_mutex_unlock(&lk->mutex) != 0) perror("pthread_mutex_unlock");
+    break;
+  case C775_LOCK_SPIN:
+    pthread_spin_unlock(&lk->spin);
+    break;
+  default:
+    break;
+  }
+}
+
+#define C775LOCK(id)    c775LockAcquire(id)
+#define C775UNLOCK(id)  c775LockRelease(id)
+#define C775LOCK_ALL    {int _ilk; for(_ilk=0;_ilk<Nc775;_ilk++) c775LockAcquire(_ilk);}
+#define C775UNLOCK_ALL  {int _ilk; for(_ilk=Nc775-1;_ilk>=0;_ilk--) c775LockRelease(_ilk);}
+#endif
+
+/* Messages of the library are queued, rate limited, and printed by a
+   thread started in c775Init (see v7xxLog.h) */
+LOCAL v7xxLog c775Log = V7XX_LOG_INIT("c775Lib");
+#define C775_LOG(...)  V7XX_LOG(&c775Log, __VA_ARGS__)
+
+/* Readout counters - Linux only.  The counters of a TDC are written by
+   the thread holding its lock, and can be read at any time without it:
+   with c775GetStats, or from another process through the shared memory
+   segment of c775StatsShmOpen. */
+#ifdef VXWORKS
+#define C775_STAT_ADD(id,field,n)
+#define C775_CBLT_STAT_ADD(field,n)
+#define C775_STAT_TIME(t)           ((t) = 0)
+#define C775_STAT_SINCE(id,field,t)
+#else
+LOCAL c775StatsSeg c775StatsLocal;
+LOCAL c775StatsSeg *c775Stats = &c775StatsLocal;
+
+#define C775_STAT_INC(st,field,n)   __atomic_store_n(&(st)->field, (st)->field + (n), __ATOMIC_RELAXED)
+#define C775_STAT_ADD(id,field,n)   C775_STAT_INC(&c775Stats->mod[id],field,n)
+#define C775_CBLT_STAT_ADD(field,n) C775_STAT_INC(&c775Stats->cblt,field,n)
+#define C775_STAT_TIME(t)           ((t) = c775LockNow())
+#define C775_STAT_SINCE(id,field,t) C775_STAT_ADD(id,field,c775LockNow()-(t))
+#endif
 
 /* Define Interrupts variables */
 BOOL c775IntRunning = FALSE;	/* running flag */
-int c775IntID = -1;		/* id number of TDC generating interrupts */
+int c775IntID = -1;		/* id number of the first TDC generating interrupts */
 LOCAL VOIDFUNCPTR c775IntRoutine = NULL;	/* user interrupt service routine */
 LOCAL int c775IntArg = 0;	/* arg to user routine */
-LOCAL int c775IntEvCount = 0;	/* Number of Events to generate Interrupt */
 LOCAL UINT32 c775IntLevel = C775_VME_INT_LEVEL;	/* default VME interrupt level */
 LOCAL UINT32 c775IntVec = C775_INT_VEC;	/* default interrupt Vector */
 
+/* Data ready wait (c775WaitReady) */
+LOCAL int c775WaitMode = C775_WAIT_SPIN;	/* C775_WAIT_* */
+LOCAL int c775WaitSpinUs = C775_WAIT_SPIN_US;	/* polling before sleeping */
+#ifndef VXWORKS
+LOCAL int c775WaitEvFd = -1;	/* eventfd written by c775Int */
+#endif
+
+/* Interrupt handling (c775SetIntMode) */
+LOCAL int c775IntMode = C775_INT_DIRECT;	/* C775_INT_* */
+#ifndef VXWORKS
+LOCAL UINT32 c775IntPending = 0;	/* TDCs handed to the worker */
+LOCAL int c775IntWorkFd = -1;	/* eventfd, wakes up the worker */
+LOCAL pthread_t c775IntWorkThread;
+#endif
+
+/* Register sampler (c775SamplerStart) */
+LOCAL int c775SampleMs = 0;	/* period, 0: not running */
+#ifndef VXWORKS
+LOCAL pthread_t c775SampleThread;
+LOCAL pthread_mutex_t c775SampleMutex = PTHREAD_MUTEX_INITIALIZER;	/* held by the sampler, but while it sleeps */
+LOCAL pthread_cond_t c775SampleCond;
+#endif
+
+/* Interrupts, per TDC (c775IntEnable, c775IntConnectModule) */
+typedef struct
+{
+  VOIDFUNCPTR routine;		/* user routine, NULL for the default action */
+  int arg;			/* arg to user routine */
+  UINT32 level;			/* VME interrupt level */
+  UINT32 vec;			/* interrupt vector */
+  int connected;		/* routine, level and vector from c775IntConnectModule */
+  int enabled;
+  int paused;			/* c775IntDisable(0) */
+  int evCount;			/* Event Trigger register */
+  int evFixed;			/* evCnt of c775IntEnable */
+  int maxLatency;		/* c775IntAdaptive: us, 0: no limit */
+  int maxRate;			/* c775IntAdaptive: interrupts/s, 0: no limit */
+  int adaptOn;
+  unsigned long long winStart;	/* rate window start (us), 0: none open */
+  unsigned long long lastInt;	/* us, last interrupt (or c775IntEnable) */
+  UINT32 winEvents;		/* event counter at its start */
+  UINT32 winCount;		/* interrupts in it */
+  unsigned long long tfire;	/* C775_INT_DEFERRED: us, handed to the worker */
+  c775IntStats st;
+} c775IntMod;
+
+LOCAL c775IntMod c775IntTab[C775_MAX_MODULES];
+LOCAL int c775IntNlevel[8];	/* TDCs enabled per level */
+
+/* Host copy of the configuration registers (c775ShadowSync).  The
+   library writes them through it, so their getters and read-modify-write
+   need no bus read */
+typedef struct
+{
+  UINT16 geoAddr;
+  UINT16 cbltAddr;
+  UINT16 intLevel;
+  UINT16 intVector;
+  UINT16 control1;
+  UINT16 cbltControl;
+  UINT16 evTrigger;
+  UINT16 fclrWindow;
+  UINT16 bitSet2;
+  UINT16 crateSelect;
+  UINT16 fsr;
+  UINT16 threshold[C775_MAX_CHANNELS];
+} c775Shadow_t;
+
+LOCAL c775Shadow_t c775Shadow[C775_MAX_MODULES];
+
+/* Bits that read back, per register */
+#define C775_SHMASK_geoAddr      C775_GEO_MASK
+#define C775_SHMASK_cbltAddr     0x00ff
+#define C775_SHMASK_intLevel     C775_INTLEVEL_MASK
+#define C775_SHMASK_intVector    C775_INTVECTOR_MASK
+#define C775_SHMASK_control1     C775_CONTROL1_MASK
+#define C775_SHMASK_cbltControl  C775_CBLTCTRL_MASK
+#define C775_SHMASK_evTrigger    C775_EVTRIGGER_MASK
+#define C775_SHMASK_fclrWindow   0x03ff
+#define C775_SHMASK_bitSet2      C775_BITSET2_MASK
+#define C775_SHMASK_crateSelect  0x00ff
+#define C775_SHMASK_fsr          C775_FSR_MASK
+#define C775_SHMASK_threshold    0x01ff
+
+/* The shadowed registers, thresholds apart */
+#define C775_SHADOW_REGS						\
+  C775_SHADOW_REG(geoAddr)     C775_SHADOW_REG(cbltAddr)		\
+  C775_SHADOW_REG(intLevel)    C775_SHADOW_REG(intVector)		\
+  C775_SHADOW_REG(control1)    C775_SHADOW_REG(cbltControl)		\
+  C775_SHADOW_REG(evTrigger)   C775_SHADOW_REG(fclrWindow)		\
+  C775_SHADOW_REG(bitSet2)     C775_SHADOW_REG(crateSelect)		\
+  C775_SHADOW_REG(fsr)
+
 
 /* Define global variables */
 int Nc775 = 0;			/* Number of TDCs in Crate */
@@ -61,6 +309,39 @@ volatile c775_regs *c775pl[20];	/* Support for 68K second memory map A24/D32 */
 int c775IntCount = 0;		/* Count of interrupts from TDC */
 int c775EventCount[20];		/* Count of Events taken by TDC (Event Count Register value) */
 int c775EvtReadCnt[20];		/* Count of events read from specified TDC */
+UINT32 c775CBLTAddr = 0;	/* VME A32 address of the CBLT chain */
+int c775CBLTRole[C775_MAX_MODULES];	/* CBLT chain position of each TDC */
+int c775CBLTGeo[C775_MAX_MODULES];	/* GEO address of each TDC in the chain */
+volatile c775_regs *c775MCSTp = NULL;	/* pointer to the MCST address map */
+int c775ByteOrder = C775_ORDER_VME;	/* byte order of the data buffers */
+
+/* Data buffers are filled in VME byte order.  With C775_ORDER_CPU, each
+   block is swapped in one go once it has been checked */
+#ifdef VXWORKS
+#define C775_SWAP_BLOCK(data,nwrds)
+#define C775_BUF_WORD(w)  (w)
+#else
+#define C775_SWAP_BLOCK(data,nwrds) {if(c775ByteOrder==C775_ORDER_CPU) v7xxSwapBlock(data,nwrds);}
+#define C775_BUF_WORD(w)  ((c775ByteOrder==C775_ORDER_CPU) ? (w) : LSWAP(w))
+#endif
+
+/* Programmed I/O read of the output buffer, word ii of the window, as it
+   comes off the bus.  Each read pops a word, so a VME library that is not
+   backed by the real bus (emu/jvme.h) has to see every access */
+#ifdef VME_EMU
+#define C775_FIFO_WORD(id,ii)  vmeEmuFifoRead32(&c775pl[id]->data[ii])
+#else
+#define C775_FIFO_WORD(id,ii)  (c775pl[id]->data[ii])
+#endif
+
+/* Block read in flight (c775ReadBlockStart) */
+LOCAL int c775DmaID = -1;	/* TDC id of the transfer, or -1 */
+LOCAL volatile UINT32 *c775DmaData = NULL;	/* destination of the transfer */
+LOCAL int c775DmaNwrds = 0;	/* requested number of words */
+LOCAL unsigned long long c775DmaT0 = 0;	/* start time of the transfer (ns) */
+#ifdef VXWORKS68K51
+LOCAL int c775DmaRetVal = 0;	/* result of the (synchronous) transfer */
+#endif
 unsigned int c775MemOffset = 0;	/* CPUs A24 or A32 address space offset */
 
 #ifdef VXWORKS
@@ -70,12 +351,31 @@ SEM_ID c775Sem;			/* Semephore for Task syncronization */
 /* Macros */
 #define C775_EXEC_SOFT_RESET(id) {					\
     vmeWrite16(&c775p[id]->main.bitSet1, C775_SOFT_RESET);			\
-    vmeWrite16(&c775p[id]->main.bitClear1, C775_SOFT_RESET);}
+    vmeWrite16(&c775p[id]->main.bitClear1, C775_SOFT_RESET);		\
+    c775ShadowLoad(id);}
+
+/* Register writes, through the shadow copy */
+#define C775_SHADOW_WRITE(id,reg,val) {				\
+    c775Shadow[id].reg = (val) & C775_SHMASK_##reg;			\
+    vmeWrite16(&c775p[id]->main.reg, c775Shadow[id].reg);}
+#define C775_SHADOW_THRESH(id,chan,val) {				\
+    c775Shadow[id].threshold[chan] = (val) & C775_SHMASK_threshold;	\
+    vmeWrite16(&c775p[id]->main.threshold[chan], c775Shadow[id].threshold[chan]);}
+#define C775_SHADOW_BITSET2(id,bits) {					\
+    c775Shadow[id].bitSet2 |= (bits) & C775_SHMASK_bitSet2;		\
+    vmeWrite16(&c775p[id]->main.bitSet2, bits);}
+#define C775_SHADOW_BITCLEAR2(id,bits) {				\
+    c775Shadow[id].bitSet2 &= ~(bits);					\
+    vmeWrite16(&c775p[id]->main.bitClear2, bits);}
 
 #define C775_EXEC_DATA_RESET(id) {					\
     vmeWrite16(&c775p[id]->main.bitSet2, C775_DATA_RESET);			\
     vmeWrite16(&c775p[id]->main.bitClear2, C775_DATA_RESET);}
 
+#define C775_EXEC_MCST_DATA_RESET() {					\
+    vmeWrite16(&c775MCSTp->main.bitSet2, C775_DATA_RESET);		\
+    vmeWrite16(&c775MCSTp->main.bitClear2, C775_DATA_RESET);}
+
 #define C775_EXEC_READ_EVENT_COUNT(id) {				\
     volatile unsigned short s1, s2;					\
     s1 = vmeRead16(&c775p[id]->main.evCountL);				\
@@ -101,6 +401,23 @@ SEM_ID c775Sem;			/* Semephore for Task syncronization */
     vmeWrite16(&c775p[id]->main.swComm, 1);}
 
 
+/* Read the shadowed registers of TDC id (after a reset) */
+LOCAL void
+c775ShadowLoad(int id)
+{
+  c775Shadow_t *sh = &c775Shadow[id];
+  int ii;
+
+#define C775_SHADOW_REG(reg) \
+  sh->reg = vmeRead16(&c775p[id]->main.reg) & C775_SHMASK_##reg;
+  C775_SHADOW_REGS
+#undef C775_SHADOW_REG
+  for (ii = 0; ii < C775_MAX_CHANNELS; ii++)
+    sh->threshold[ii] =
+      vmeRead16(&c775p[id]->main.threshold[ii]) & C775_SHMASK_threshold;
+}
+
+
 /*******************************************************************************
 *
 * c775Init - Initialize c775 Library.
@@ -237,6 +554,10 @@ c775Init(UINT32 addr, UINT32 addr_inc, int ntdc, UINT16 crateID)
 	     (unsigned long) c775p[ii] - c775MemOffset, (unsigned long) c775p[ii]);
 #endif
     }
+#ifndef VXWORKS
+  c775Stats->nmod = Nc775;
+  v7xxLogStart(&c775Log);
+#endif
 
 #ifdef VXWORKS
   /* Initialize/Create Semephore */
@@ -259,23 +580,27 @@ c775Init(UINT32 addr, UINT32 addr_inc, int ntdc, UINT16 crateID)
       C775_EXEC_SOFT_RESET(ii);
       C775_EXEC_DATA_RESET(ii);
       /* Disable Interrupts */
-      vmeWrite16(&c775p[ii]->main.intLevel, 0);
+      C775_SHADOW_WRITE(ii, intLevel, 0);
       /* Zero interrupt trigger count */
-      vmeWrite16(&c775p[ii]->main.evTrigger, 0);
+      C775_SHADOW_WRITE(ii, evTrigger, 0);
       /* Set Crate ID Register */
-      vmeWrite16(&c775p[ii]->main.crateSelect, crateID);
+      C775_SHADOW_WRITE(ii, crateSelect, crateID);
       /* Increment event count only on accepted gates */
-      vmeWrite16(&c775p[ii]->main.bitClear2, C775_INCR_ALL_TRIG);
+      C775_SHADOW_BITCLEAR2(ii, C775_INCR_ALL_TRIG);
       /* Turn off suppression of header and EOB if no accepted channels */
-      vmeWrite16(&c775p[ii]->main.bitClear2, C775_INC_HEADER);
+      C775_SHADOW_BITCLEAR2(ii, C775_INC_HEADER);
 
       c775EventCount[ii] = 0;	/* Initialize the Event Count */
       c775EvtReadCnt[ii] = -1;	/* Initialize the Read Count */
+      c775CBLTRole[ii] = C775_CBLT_DISABLED;	/* Not on a chain until c775CBLTInit */
 
       c775SetFSR(ii, C775_MIN_FSR);	/* Set Full Scale Range for TDC */
 
       c775Sparse(ii, 0, 0);	/* Disable Overflow/Underflow suppression */
     }
+  c775CBLTAddr = 0;
+  c775MCSTp = NULL;
+
   /* Initialize Interrupt variables */
   c775IntID = -1;
   c775IntRunning = FALSE;
@@ -283,7 +608,8 @@ c775Init(UINT32 addr, UINT32 addr_inc, int ntdc, UINT16 crateID)
   c775IntVec = 0;
   c775IntRoutine = NULL;
   c775IntArg = 0;
-  c775IntEvCount = 0;
+  memset(c775IntTab, 0, sizeof(c775IntTab));
+  memset(c775IntNlevel, 0, sizeof(c775IntNlevel));
 
 
   if (errFlag > 0)
@@ -299,6 +625,234 @@ c775Init(UINT32 addr, UINT32 addr_inc, int ntdc, UINT16 crateID)
     }
 }
 
+LOCAL unsigned long long c775NowUs(void);
+#ifndef VXWORKS
+LOCAL void c775IntAdaptTimer(int id, c775Snapshot * snap);
+#endif
+
+/* Registers the library programs, from the host copy: always current */
+LOCAL void
+c775SnapConfig(int id, c775Snapshot * snap)
+{
+  c775Shadow_t *sh = &c775Shadow[id];
+
+  snap->geoAddr = sh->geoAddr;
+  snap->bitSet2 = sh->bitSet2;
+  snap->control1 = sh->control1;
+  snap->evTrigger = sh->evTrigger;
+  snap->fsr = sh->fsr;
+  snap->intLevel = sh->intLevel;
+  snap->intVector = sh->intVector;
+  snap->cbltAddr = sh->cbltAddr;
+  snap->cbltControl = sh->cbltControl;
+}
+
+/* Read the registers of TDC id, without its lock: the status registers
+   and the event counter have no side effect on a read, and the others
+   come from the host copy */
+LOCAL void
+c775SnapTake(int id, c775Snapshot * snap)
+{
+  UINT16 hi;
+
+  snap->rev = vmeRead16(&c775p[id]->main.rev);
+  snap->status1 = vmeRead16(&c775p[id]->main.status1);
+  snap->status2 = vmeRead16(&c775p[id]->main.status2);
+  snap->bitSet1 = vmeRead16(&c775p[id]->main.bitSet1);
+  do
+    {				/* again if the low word carried into the high one in between */
+      hi = vmeRead16(&c775p[id]->main.evCountH);
+      snap->evCount =
+	((hi & 0xff) << 16) | vmeRead16(&c775p[id]->main.evCountL);
+    }
+  while (vmeRead16(&c775p[id]->main.evCountH) != hi);
+
+  c775SnapConfig(id, snap);
+  snap->time = c775NowUs();
+}
+
+#ifndef VXWORKS
+/* Seqlock writer: the sampler thread only */
+LOCAL void
+c775SnapPublish(int id, c775Snapshot * snap)
+{
+  unsigned int seq = c775Stats->snapSeq[id];
+
+  __atomic_store_n(&c775Stats->snapSeq[id], seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  c775Stats->snap[id] = *snap;
+  __atomic_store_n(&c775Stats->snapSeq[id], seq + 2, __ATOMIC_RELEASE);
+}
+
+LOCAL void *
+c775SampleLoop(void *arg)
+{
+  c775Snapshot snap;
+  struct timespec ts;
+  int id;
+
+  pthread_mutex_lock(&c775SampleMutex);
+  while (c775SampleMs > 0)
+    {
+      for (id = 0; id < Nc775; id++)
+	{
+	  if (c775p[id] == NULL)
+	    continue;
+	  c775SnapTake(id, &snap);
+	  c775SnapPublish(id, &snap);
+	  c775IntAdaptTimer(id, &snap);
+	}
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      ts.tv_sec += c775SampleMs / 1000;
+      ts.tv_nsec += (c775SampleMs % 1000) * 1000000;
+      if (ts.tv_nsec >= 1000000000)
+	{
+	  ts.tv_sec++;
+	  ts.tv_nsec -= 1000000000;
+	}
+      pthread_cond_timedwait(&c775SampleCond, &c775SampleMutex, &ts);
+    }
+  pthread_mutex_unlock(&c775SampleMutex);
+
+  return (NULL);
+}
+#endif
+
+/*******************************************************************************
+*
+* c775SamplerStart - Start a low priority thread that reads the status
+*                    registers and event counter of all TDCs every periodMs
+*                    and publishes them, or change its period
+* c775SamplerStop  - Stop it
+* c775GetSnapshot  - Copy the last registers of TDC id published by the
+*                    sampler, or read them now if it is not running.  The
+*                    registers the library programs (control, bit set 2,
+*                    interrupt and CBLT setup) are always the current ones.
+*
+*   The sampler runs at SCHED_IDLE, takes no module lock, and is the only
+*   thread reading the bus for c775Status and the monitors mapping the
+*   stats segment (c775StatsShmOpen): they read the snapshots under a
+*   seqlock, and never wait for the readout.
+*
+*   Linux only.  On VxWorks, c775GetSnapshot always reads the module.
+*
+*
+* RETURNS: c775SamplerStart and c775GetSnapshot: OK or ERROR.
+*          c775SamplerStop: None.
+*/
+
+STATUS
+c775SamplerStart(int periodMs)
+{
+#ifdef VXWORKS
+  printf("c775SamplerStart: ERROR : Not supported on VxWorks\n");
+  return (ERROR);
+#else
+  pthread_condattr_t cattr;
+  struct sched_param param;
+  int rval;
+
+  if (periodMs <= 0)
+    {
+      printf("c775SamplerStart: ERROR : Invalid period %d ms\n", periodMs);
+      return (ERROR);
+    }
+
+  pthread_mutex_lock(&c775SampleMutex);
+  if (c775SampleMs > 0)
+    {				/* running: new period */
+      c775SampleMs = periodMs;
+      pthread_cond_signal(&c775SampleCond);
+      pthread_mutex_unlock(&c775SampleMutex);
+      return (OK);
+    }
+
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+  pthread_cond_init(&c775SampleCond, &cattr);
+  pthread_condattr_destroy(&cattr);
+
+  c775SampleMs = periodMs;
+  rval = pthread_create(&c775SampleThread, NULL, c775SampleLoop, NULL);
+  if (rval != 0)
+    {
+      printf("c775SamplerStart: ERROR : pthread_create: %s\n",
+	     strerror(rval));
+      c775SampleMs = 0;
+      pthread_cond_destroy(&c775SampleCond);
+      pthread_mutex_unlock(&c775SampleMutex);
+      return (ERROR);
+    }
+  pthread_mutex_unlock(&c775SampleMutex);
+
+  param.sched_priority = 0;
+  rval = pthread_setschedparam(c775SampleThread, SCHED_IDLE, &param);
+  if (rval != 0)
+    printf("c775SamplerStart: WARNING : No SCHED_IDLE for the sampler (%s)\n",
+	   strerror(rval));
+
+  return (OK);
+#endif
+}
+
+void
+c775SamplerStop()
+{
+#ifndef VXWORKS
+  pthread_mutex_lock(&c775SampleMutex);
+  if (c775SampleMs == 0)
+    {
+      pthread_mutex_unlock(&c775SampleMutex);
+      return;
+    }
+  c775SampleMs = 0;
+  pthread_cond_signal(&c775SampleCond);
+  pthread_mutex_unlock(&c775SampleMutex);
+
+  pthread_join(c775SampleThread, NULL);
+  pthread_cond_destroy(&c775SampleCond);
+#endif
+}
+
+STATUS
+c775GetSnapshot(int id, c775Snapshot * snap)
+{
+#ifndef VXWORKS
+  unsigned int seq;
+#endif
+
+  if ((id < 0) || (id >= Nc775) || (c775p[id] == NULL) || (snap == NULL))
+    {
+      printf("c775GetSnapshot: ERROR : TDC id %d not initialized \n", id);
+      return (ERROR);
+    }
+
+#ifndef VXWORKS
+  if (c775SampleMs > 0)
+    {
+      do
+	{
+	  seq = __atomic_load_n(&c775Stats->snapSeq[id], __ATOMIC_ACQUIRE);
+	  *snap = c775Stats->snap[id];
+	  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	}
+      while ((seq & 1) ||
+	     (seq !=
+	      __atomic_load_n(&c775Stats->snapSeq[id], __ATOMIC_RELAXED)));
+      if (snap->time != 0)
+	{
+	  c775SnapConfig(id, snap);
+	  return (OK);
+	}
+    }
+#endif
+
+  c775SnapTake(id, snap);
+
+  return (OK);
+}
+
 /*******************************************************************************
 *
 * c775Status - Gives Status info on specified TDC
@@ -315,6 +869,7 @@ c775Status(int id)
   UINT16 stat1, stat2, bit1, bit2, cntl1, rev;
   UINT16 iLvl, iVec, evTrig;
   UINT16 fsr;
+  c775Snapshot snap;
 
   if ((id < 0) || (c775p[id] == NULL))
     {
@@ -323,25 +878,24 @@ c775Status(int id)
     }
 
 
-  /* read various registers */
-  C775LOCK;
-  rev = vmeRead16(&c775p[id]->main.rev);
-  stat1 = vmeRead16(&c775p[id]->main.status1) & C775_STATUS1_MASK;
-  stat2 = vmeRead16(&c775p[id]->main.status2) & C775_STATUS2_MASK;
-  bit1 = vmeRead16(&c775p[id]->main.bitSet1) & C775_BITSET1_MASK;
-  bit2 = vmeRead16(&c775p[id]->main.bitSet2) & C775_BITSET2_MASK;
-  cntl1 = vmeRead16(&c775p[id]->main.control1) & C775_CONTROL1_MASK;
-  fsr = 4 * (290 - (vmeRead16(&c775p[id]->main.fsr) & C775_FSR_MASK));
-  C775_EXEC_READ_EVENT_COUNT(id);
+  /* status registers from the sampler if it runs, the others current */
+  if (c775GetSnapshot(id, &snap) != OK)
+    return;
+  rev = snap.rev;
+  stat1 = snap.status1 & C775_STATUS1_MASK;
+  stat2 = snap.status2 & C775_STATUS2_MASK;
+  bit1 = snap.bitSet1 & C775_BITSET1_MASK;
+  bit2 = snap.bitSet2 & C775_BITSET2_MASK;
+  cntl1 = snap.control1 & C775_CONTROL1_MASK;
+  fsr = 4 * (290 - (snap.fsr & C775_FSR_MASK));
   if (stat1 & C775_DATA_READY)
     DRdy = 1;
   if (stat2 & C775_BUFFER_FULL)
     BufFull = 1;
 
-  iLvl = vmeRead16(&c775p[id]->main.intLevel) & C775_INTLEVEL_MASK;
-  iVec = vmeRead16(&c775p[id]->main.intVector) & C775_INTVECTOR_MASK;
-  evTrig = vmeRead16(&c775p[id]->main.evTrigger) & C775_EVTRIGGER_MASK;
-  C775UNLOCK;
+  iLvl = snap.intLevel & C775_INTLEVEL_MASK;
+  iVec = snap.intVector & C775_INTVECTOR_MASK;
+  evTrig = snap.evTrigger & C775_EVTRIGGER_MASK;
 
   /* print out status info */
 
@@ -354,17 +908,20 @@ c775Status(int id)
 #endif
   printf("--------------------------------------------------------------------------------\n");
   printf(" Firmware Revision = %d.%d\n", rev >> 8, rev & 0xff);
+  if (c775SampleMs > 0)
+    printf(" Status registers sampled %llu ms ago\n",
+	   (c775NowUs() - snap.time) / 1000);
 
   if ((iLvl > 0) && (evTrig > 0))
     {
       printf(" Interrupts Enabled - Every %d events\n", evTrig);
       printf(" VME Interrupt Level: %d   Vector: 0x%x \n", iLvl, iVec);
-      printf(" Interrupt Count    : %d \n", c775IntCount);
+      printf(" Interrupt Count    : %llu \n", c775IntTab[id].st.nint);
     }
   else
     {
       printf(" Interrupts Disabled\n");
-      printf(" Last Interrupt Count    : %d \n", c775IntCount);
+      printf(" Last Interrupt Count    : %llu \n", c775IntTab[id].st.nint);
     }
   printf("\n");
 
@@ -404,14 +961,14 @@ c775Status(int id)
   printf("\n");
 
   printf("  FSR     = %d nsec\n", fsr);
-  if (c775EventCount[id] == 0xffffff)
+  if (snap.evCount == 0xffffff)
     {
       printf("  Event Count     = (No Events Taken)\n");
       printf("  Last Event Read = (No Events Read)\n");
     }
   else
     {
-      printf("  Event Count     = %d\n", c775EventCount[id]);
+      printf("  Event Count     = %d\n", snap.evCount);
       if (c775EvtReadCnt[id] == -1)
 	printf("  Last Event Read = (No Events Read)\n");
       else
@@ -423,6 +980,162 @@ c775Status(int id)
 
 }
 
+/*******************************************************************************
+*
+* c775ShadowSync   - Reload the host copy of the configuration registers
+*                    of TDC id (id<0 for all) from the module, e.g. after
+*                    it was programmed by another program
+* c775ShadowVerify - Compare the host copy with the module, and print the
+*                    registers that differ (nothing is changed)
+*
+*   The library keeps a copy of the registers it programs: GEO, CBLT
+*   address and control, interrupt level and vector, Control 1, Event
+*   Trigger, Fast Clear window, Bit Set 2, crate, full scale range and
+*   thresholds.  c775Status, the values returned by the setters and the
+*   read-modify-write of c775DisableBerr come from it, with no bus read.
+*   It is reloaded after each soft reset.
+*
+* RETURNS: c775ShadowSync: OK, or ERROR if not initialized.
+*          c775ShadowVerify: the number of registers that differ, or ERROR.
+*/
+
+STATUS
+c775ShadowSync(int id)
+{
+  int ii;
+
+  if ((id >= Nc775) || ((id >= 0) && (c775p[id] == NULL)))
+    {
+      printf("c775ShadowSync: ERROR : TDC id %d not initialized \n", id);
+      return (ERROR);
+    }
+
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if ((id >= 0) && (ii != id))
+	continue;
+      C775LOCK(ii);
+      c775ShadowLoad(ii);
+      C775UNLOCK(ii);
+    }
+
+  return (OK);
+}
+
+int
+c775ShadowVerify(int id)
+{
+  c775Shadow_t hw, *sh;
+  int ii, ich, ndiff = 0;
+
+  if ((id >= Nc775) || ((id >= 0) && (c775p[id] == NULL)))
+    {
+      printf("c775ShadowVerify: ERROR : TDC id %d not initialized \n", id);
+      return (ERROR);
+    }
+
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if ((id >= 0) && (ii != id))
+	continue;
+      sh = &c775Shadow[ii];
+
+      C775LOCK(ii);
+#define C775_SHADOW_REG(reg) \
+      hw.reg = vmeRead16(&c775p[ii]->main.reg) & C775_SHMASK_##reg;
+      C775_SHADOW_REGS
+#undef C775_SHADOW_REG
+      for (ich = 0; ich < C775_MAX_CHANNELS; ich++)
+	hw.threshold[ich] =
+	  vmeRead16(&c775p[ii]->main.threshold[ich]) & C775_SHMASK_threshold;
+      C775UNLOCK(ii);
+
+#define C775_SHADOW_REG(reg)						\
+      if (hw.reg != sh->reg)						\
+	{								\
+	  printf("c775ShadowVerify: TDC %d %-12s : module 0x%04x, shadow 0x%04x\n", \
+		 ii, #reg, hw.reg, sh->reg);				\
+	  ndiff++;							\
+	}
+      C775_SHADOW_REGS
+#undef C775_SHADOW_REG
+      for (ich = 0; ich < C775_MAX_CHANNELS; ich++)
+	{
+	  if (hw.threshold[ich] == sh->threshold[ich])
+	    continue;
+	  printf
+	    ("c775ShadowVerify: TDC %d threshold[%2d] : module 0x%04x, shadow 0x%04x\n",
+	     ii, ich, hw.threshold[ich], sh->threshold[ich]);
+	  ndiff++;
+	}
+    }
+
+  return (ndiff);
+}
+
+/*******************************************************************************
+*
+* c775Reprogram - Soft reset TDC id, and program it again from the host
+*                 copy of its configuration (see c775ShadowSync), e.g. to
+*                 recover a module that stopped answering during a run.
+*                 The data and the event counter are reset as well.
+*   full - 0 : write back the registers the soft reset changed (they are
+*              read back from the module after the reset)
+*          1 : write back every shadowed register and threshold, whatever
+*              the module reads back
+*
+*
+* RETURNS: Number of registers written, or ERROR if not initialized.
+*/
+
+int
+c775Reprogram(int id, int full)
+{
+  c775Shadow_t save, *sh;
+  int ii, nwrite = 0;
+
+  if ((id < 0) || (id >= Nc775) || (c775p[id] == NULL))
+    {
+      C775_LOG("c775Reprogram: ERROR : TDC id %d not initialized \n", id, 0,
+	       0, 0, 0, 0);
+      return (ERROR);
+    }
+  sh = &c775Shadow[id];
+
+  C775LOCK(id);
+  save = *sh;
+  C775_EXEC_DATA_RESET(id);
+  C775_EXEC_SOFT_RESET(id);
+
+#define C775_SHADOW_REG(reg)						\
+  if (full || (sh->reg != save.reg))					\
+    {									\
+      C775_SHADOW_WRITE(id, reg, save.reg);				\
+      nwrite++;								\
+    }
+  C775_SHADOW_REGS
+#undef C775_SHADOW_REG
+  /* Bit Set 2 only sets bits: clear the others */
+  if (full || (sh->bitSet2 != save.bitSet2))
+    C775_SHADOW_BITCLEAR2(id, C775_BITSET2_MASK & ~save.bitSet2);
+  for (ii = 0; ii < C775_MAX_CHANNELS; ii++)
+    {
+      if (!full && (sh->threshold[ii] == save.threshold[ii]))
+	continue;
+      C775_SHADOW_THRESH(id, ii, save.threshold[ii]);
+      nwrite++;
+    }
+
+  C775_EXEC_DATA_RESET(id);
+  C775_EXEC_CLR_EVENT_COUNT(id);
+  C775_STAT_ADD(id, nclear, 1);
+  C775UNLOCK(id);
+  c775EvtReadCnt[id] = -1;
+  c775EventCount[id] = 0;
+
+  return (nwrite);
+}
+
 /*******************************************************************************
 *
 * c775PrintEvent - Print event from TDC to standard out.
@@ -446,11 +1159,11 @@ c775PrintEvent(int id, int pflag)
 
   /* Check if there is a valid event */
 
-  C775LOCK;
+  C775LOCK(id);
   if (vmeRead16(&c775p[id]->main.status2) & C775_BUFFER_EMPTY)
     {
       printf("c775PrintEvent: Data Buffer is EMPTY!\n");
-      C775UNLOCK;
+      C775UNLOCK(id);
       return (0);
     }
   if (vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY)
@@ -462,7 +1175,7 @@ c775PrintEvent(int id, int pflag)
 	{
 	  printf("c775PrintEvent: ERROR: Invalid Header Word 0x%08x\n",
 		 header);
-	  C775UNLOCK;
+	  C775UNLOCK(id);
 	  return (-1);
 	}
       else
@@ -486,7 +1199,7 @@ c775PrintEvent(int id, int pflag)
 	{
 	  printf("c775PrintEvent: ERROR: Invalid Trailer Word 0x%08x\n",
 		 trailer);
-	  C775UNLOCK;
+	  C775UNLOCK(id);
 	  return (-1);
 	}
       else
@@ -496,14 +1209,14 @@ c775PrintEvent(int id, int pflag)
 	  printf("  Trailer: 0x%08x   Event Count = %d \n", trailer, evID);
 	}
       C775_EXEC_SET_EVTREADCNT(id, evID);
-      C775UNLOCK;
+      C775UNLOCK(id);
       return (dCnt);
 
     }
   else
     {
       printf("c775PrintEvent: Data Not ready for readout!\n");
-      C775UNLOCK;
+      C775UNLOCK(id);
       return (0);
     }
 }
@@ -524,144 +1237,289 @@ c775ReadEvent(int id, UINT32 * data)
 
   int ii, nWords, evID;
   UINT32 header, trailer, dCnt;
+  unsigned long long t0;
 
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775ReadEvent: ERROR : TDC id %d not initialized \n", id, 0, 0,
+      C775_LOG("c775ReadEvent: ERROR : TDC id %d not initialized \n", id, 0, 0,
 	     0, 0, 0);
       return (-1);
     }
 
   /* Check if there is a valid event */
 
-  C775LOCK;
+  C775LOCK(id);
+  C775_STAT_TIME(t0);
   if (vmeRead16(&c775p[id]->main.status2) & C775_BUFFER_EMPTY)
     {
-      logMsg("c775ReadEvent: Data Buffer is EMPTY!\n", 0, 0, 0, 0, 0, 0);
-      C775UNLOCK;
+      C775_LOG("c775ReadEvent: Data Buffer is EMPTY!\n", 0, 0, 0, 0, 0, 0);
+      C775_STAT_ADD(id, nempty, 1);
+      C775UNLOCK(id);
       return (0);
     }
   if (vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY)
     {
       dCnt = 0;
-      /* Read Header - Get Word count */
-      header = c775pl[id]->data[dCnt];
+      /* Read Header - Get Word count.  Words are stored as they come off
+         the bus, and only the local copy is swapped for the checks. */
+      data[dCnt] = C775_FIFO_WORD(id, dCnt);
+      header = data[dCnt];
 #ifndef VXWORKS
       header = LSWAP(header);
 #endif
       if ((header & C775_DATA_ID_MASK) != C775_HEADER_DATA)
 	{
-	  logMsg("c775ReadEvent: ERROR: Invalid Header Word 0x%08x\n", header,
+	  C775_LOG("c775ReadEvent: ERROR: Invalid Header Word 0x%08x\n", header,
 		 0, 0, 0, 0, 0);
-	  C775UNLOCK;
+	  C775_STAT_ADD(id, nbadHeader, 1);
+	  C775UNLOCK(id);
 	  return (-1);
 	}
       else
 	{
 	  nWords = (header & C775_WORDCOUNT_MASK) >> 8;
-#ifndef VXWORKS
-	  header = LSWAP(header);
-#endif
-	  data[dCnt] = header;
 	  dCnt++;
 	}
       for (ii = 0; ii < nWords; ii++)
 	{
-	  data[ii + 1] = c775pl[id]->data[ii + 1];
+	  data[ii + 1] = C775_FIFO_WORD(id, ii + 1);
 	}
       dCnt += ii;
 
-      trailer = c775pl[id]->data[dCnt];
+      data[dCnt] = C775_FIFO_WORD(id, dCnt);
+      trailer = data[dCnt];
 #ifndef VXWORKS
       trailer = LSWAP(trailer);
 #endif
       if ((trailer & C775_DATA_ID_MASK) != C775_TRAILER_DATA)
 	{
-	  logMsg("c775ReadEvent: ERROR: Invalid Trailer Word 0x%08x\n",
+	  C775_LOG("c775ReadEvent: ERROR: Invalid Trailer Word 0x%08x\n",
 		 trailer, 0, 0, 0, 0, 0);
-	  C775UNLOCK;
+	  C775_STAT_ADD(id, nbadTrailer, 1);
+	  C775UNLOCK(id);
 	  return (-1);
 	}
       else
 	{
 	  evID = trailer & C775_EVENTCOUNT_MASK;
-#ifndef VXWORKS
-	  trailer = LSWAP(trailer);
-#endif
-	  data[dCnt] = trailer;
 	  dCnt++;
 	}
       C775_EXEC_SET_EVTREADCNT(id, evID);
-      C775UNLOCK;
+      C775_STAT_ADD(id, nevents, 1);
+      C775_STAT_ADD(id, nwords, dCnt);
+      C775_STAT_SINCE(id, pioTime, t0);
+      C775UNLOCK(id);
+
+      C775_SWAP_BLOCK(data, dCnt);
       return (dCnt);
 
     }
   else
     {
-      logMsg("c775ReadEvent: Data Not ready for readout!\n", 0, 0, 0, 0, 0,
+      C775_LOG("c775ReadEvent: Data Not ready for readout!\n", 0, 0, 0, 0, 0,
 	     0);
-      C775UNLOCK;
+      C775_STAT_ADD(id, nempty, 1);
+      C775UNLOCK(id);
       return (0);
     }
 }
 
 /*******************************************************************************
 *
-* c775FlushEvent - Flush event/data from TDC.
+* c775ReadEvents - Drain up to maxev buffered events from TDC to specified
+*                  address.
 *
+*   The status registers and event counter are checked once for the whole
+*   batch, and the read counter is updated once, after the last trailer.
+*   Events are stored back to back in the same format as c775ReadEvent.
 *
-* RETURNS: Number of Data words read from the TDC.
+* INPUTS:    id       - module id of TDC to access
+*            data     - address of data destination.  Must hold at least
+*                       maxev*C775_MAX_WORDS_PER_EVENT words.
+*            maxev    - maximum number of events to read (1-32)
+*            evOffset - (optional) filled with the word offset of each
+*                       event header in data
+*            evCount  - (optional) filled with the event counter of each
+*                       event, taken from its trailer
+*            nevents  - (optional) returns the number of events read
+*
+* RETURNS: Number of Data words read from the TDC (including Headers/Trailers),
+*          0 if no data, or -1 on error.
+*          If a corrupt event is found after good ones, the good events are
+*          kept and their word count is returned.
 */
 
 int
-c775FlushEvent(int id, int fflag)
+c775ReadEvents(int id, UINT32 * data, int maxev, int *evOffset,
+	       UINT32 * evCount, int *nevents)
 {
 
-  int evID;
-  int done = 0;
-  UINT32 tmpData, dCnt;
+  int ii, iev, nevts, nWords, evID = -1, err = 0;
+  UINT32 header, trailer, dCnt;
+  unsigned long long t0;
+
+  if (nevents)
+    *nevents = 0;
 
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775FlushEvent: ERROR : TDC id %d not initialized \n", id, 0, 0,
+      C775_LOG("c775ReadEvents: ERROR : TDC id %d not initialized \n", id, 0, 0,
 	     0, 0, 0);
       return (-1);
     }
 
-  /* Check if there is a valid event */
+  if ((maxev <= 0) || (maxev > C775_MAX_EVENTS_PER_BUFFER))
+    maxev = C775_MAX_EVENTS_PER_BUFFER;
 
-  C775LOCK;
+  /* Check once if there are valid events */
+
+  C775LOCK(id);
+  C775_STAT_TIME(t0);
   if (vmeRead16(&c775p[id]->main.status2) & C775_BUFFER_EMPTY)
     {
-      if (fflag > 0)
-	logMsg("c775FlushEvent: Data Buffer is EMPTY!\n", 0, 0, 0, 0, 0, 0);
-      C775UNLOCK;
+      C775_STAT_ADD(id, nempty, 1);
+      C775UNLOCK(id);
       return (0);
     }
-
-  /* Check if Data Ready Flag is on */
-  if (vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY)
+  if ((vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY) == 0)
     {
-      dCnt = 0;
+      C775_LOG("c775ReadEvents: Data Not ready for readout!\n", 0, 0, 0, 0, 0,
+	     0);
+      C775_STAT_ADD(id, nempty, 1);
+      C775UNLOCK(id);
+      return (0);
+    }
 
-      while (!done)
-	{
-	  tmpData = c775pl[id]->data[dCnt];
-#ifndef VXWORKS
-	  tmpData = LSWAP(tmpData);
-#endif
+  /* Number of events waiting.  If the software read count is out of step,
+     read until the buffer reports no more valid data */
+  C775_EXEC_READ_EVENT_COUNT(id);
+  nevts = c775EventCount[id] - c775EvtReadCnt[id];
+  if ((nevts <= 0) || (nevts > maxev))
+    nevts = maxev;
+
+  dCnt = 0;
+  for (iev = 0; iev < nevts; iev++)
+    {
+      /* Read Header - Get Word count */
+      data[dCnt] = C775_FIFO_WORD(id, 0);
+      header = data[dCnt];
+#ifndef VXWORKS
+      header = LSWAP(header);
+#endif
+      if ((header & C775_DATA_ID_MASK) == C775_INVALID_DATA)
+	break;			/* Buffer drained */
+
+      if ((header & C775_DATA_ID_MASK) != C775_HEADER_DATA)
+	{
+	  C775_LOG("c775ReadEvents: ERROR: Invalid Header Word 0x%08x (event %d)\n",
+		 header, iev, 0, 0, 0, 0);
+	  C775_STAT_ADD(id, nbadHeader, 1);
+	  err = 1;
+	  break;
+	}
+      nWords = (header & C775_WORDCOUNT_MASK) >> 8;
+      if (evOffset)
+	evOffset[iev] = dCnt;
+
+      for (ii = 0; ii < nWords; ii++)
+	{
+	  data[dCnt + ii + 1] = C775_FIFO_WORD(id, ii + 1);
+	}
+
+      data[dCnt + nWords + 1] = C775_FIFO_WORD(id, nWords + 1);
+      trailer = data[dCnt + nWords + 1];
+#ifndef VXWORKS
+      trailer = LSWAP(trailer);
+#endif
+      if ((trailer & C775_DATA_ID_MASK) != C775_TRAILER_DATA)
+	{
+	  C775_LOG("c775ReadEvents: ERROR: Invalid Trailer Word 0x%08x (event %d)\n",
+		 trailer, iev, 0, 0, 0, 0);
+	  C775_STAT_ADD(id, nbadTrailer, 1);
+	  err = 1;
+	  break;
+	}
+      evID = trailer & C775_EVENTCOUNT_MASK;
+      if (evCount)
+	evCount[iev] = evID;
+      dCnt += nWords + 2;
+    }
+
+  if (iev > 0)
+    C775_EXEC_SET_EVTREADCNT(id, evID);
+  C775_STAT_ADD(id, nevents, iev);
+  C775_STAT_ADD(id, nwords, dCnt);
+  C775_STAT_SINCE(id, pioTime, t0);
+  C775UNLOCK(id);
+
+  C775_SWAP_BLOCK(data, dCnt);
+
+  if (nevents)
+    *nevents = iev;
+
+  if (err && (iev == 0))
+    return (-1);
+
+  return (dCnt);
+}
+
+/*******************************************************************************
+*
+* c775FlushEvent - Flush event/data from TDC.
+*
+*
+* RETURNS: Number of Data words read from the TDC.
+*/
+
+int
+c775FlushEvent(int id, int fflag)
+{
+
+  int evID;
+  int done = 0;
+  UINT32 tmpData, dCnt;
+
+  if ((id < 0) || (c775p[id] == NULL))
+    {
+      C775_LOG("c775FlushEvent: ERROR : TDC id %d not initialized \n", id, 0, 0,
+	     0, 0, 0);
+      return (-1);
+    }
+
+  /* Check if there is a valid event */
+
+  C775LOCK(id);
+  if (vmeRead16(&c775p[id]->main.status2) & C775_BUFFER_EMPTY)
+    {
+      if (fflag > 0)
+	C775_LOG("c775FlushEvent: Data Buffer is EMPTY!\n", 0, 0, 0, 0, 0, 0);
+      C775UNLOCK(id);
+      return (0);
+    }
+
+  /* Check if Data Ready Flag is on */
+  if (vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY)
+    {
+      dCnt = 0;
+
+      while (!done)
+	{
+	  tmpData = C775_FIFO_WORD(id, dCnt);
+#ifndef VXWORKS
+	  tmpData = LSWAP(tmpData);
+#endif
 	  switch (tmpData & C775_DATA_ID_MASK)
 	    {
 	    case C775_HEADER_DATA:
 	      if (fflag > 0)
-		logMsg("c775FlushEvent: Found Header 0x%08x\n", tmpData, 0, 0,
+		C775_LOG("c775FlushEvent: Found Header 0x%08x\n", tmpData, 0, 0,
 		       0, 0, 0);
 	      break;
 	    case C775_DATA:
 	      break;
 	    case C775_TRAILER_DATA:
 	      if (fflag > 0)
-		logMsg(" c775FlushEvent: Found Trailer 0x%08x\n", tmpData, 0,
+		C775_LOG(" c775FlushEvent: Found Trailer 0x%08x\n", tmpData, 0,
 		       0, 0, 0, 0);
 	      evID = tmpData & C775_EVENTCOUNT_MASK;
 	      C775_EXEC_SET_EVTREADCNT(id, evID);
@@ -669,13 +1527,13 @@ c775FlushEvent(int id, int fflag)
 	      break;
 	    case C775_INVALID_DATA:
 	      if (fflag > 0)
-		logMsg(" c775FlushEvent: Buffer Empty 0x%08x\n", tmpData, 0,
+		C775_LOG(" c775FlushEvent: Buffer Empty 0x%08x\n", tmpData, 0,
 		       0, 0, 0, 0);
 	      done = 1;
 	      break;
 	    default:
 	      if (fflag > 0)
-		logMsg(" c775FlushEvent: Invalid Data 0x%08x\n", tmpData, 0,
+		C775_LOG(" c775FlushEvent: Invalid Data 0x%08x\n", tmpData, 0,
 		       0, 0, 0, 0);
 	    }
 
@@ -690,21 +1548,161 @@ c775FlushEvent(int id, int fflag)
 	}
       if (fflag > 1)
 	printf("\n");
-      C775UNLOCK;
+      C775UNLOCK(id);
       return (dCnt);
 
     }
   else
     {
       if (fflag > 0)
-	logMsg("c775FlushEvent: Data Not ready for readout!\n", 0, 0, 0, 0, 0,
+	C775_LOG("c775FlushEvent: Data Not ready for readout!\n", 0, 0, 0, 0, 0,
 	       0);
-      C775UNLOCK;
+      C775UNLOCK(id);
       return (0);
     }
 }
 
 
+/*******************************************************************************
+*
+* c775FlushEvents - Discard all the events buffered in TDC id, and tell
+*                   which ones they were.
+*
+* INPUTS:    id      - module id of TDC to access
+*            mode    - C775_FLUSH_RESET : data reset.  Nothing is read:
+*                                         the events are counted with the
+*                                         event counter, and their ids
+*                                         follow the last one read.  If no
+*                                         event was read since c775Clear,
+*                                         they are read as with
+*                                         C775_FLUSH_PIO.
+*                      C775_FLUSH_PIO   : read into scratch, with
+*                                         c775ReadEvents
+*                      C775_FLUSH_DMA   : read into scratch with block reads
+*                                         (BERR enabled, scratch in DMA
+*                                         memory)
+*            scratch - (optional for RESET and PIO) buffer of nwrds words
+*                      for the data read, overwritten.  Without it, PIO
+*                      reads one event at a time.
+*            nwrds   - size of scratch.  C775_MAX_EVENTS_PER_BUFFER *
+*                      C775_MAX_WORDS_PER_EVENT words hold a full buffer.
+*            evID    - (optional) filled with the event counter of the
+*                      first maxev events discarded
+*            maxev   - size of evID
+*            nwords  - (optional) returns the number of words read (0 with
+*                      the data reset)
+*
+*   Unlike c775Clear, the read count stays in step with the event counter,
+*   so checks of the trailer counter go on working.
+*
+* RETURNS: Number of events discarded, or ERROR.
+*/
+
+int
+c775FlushEvents(int id, int mode, volatile UINT32 * scratch, int nwrds,
+		UINT32 * evID, int maxev, int *nwords)
+{
+  UINT32 evbuf[C775_MAX_WORDS_PER_EVENT], cnt[C775_MAX_EVENTS_PER_BUFFER];
+  c775EvIndex evidx[C775_MAX_EVENTS_PER_BUFFER];
+  int ii, nev, nw, total = 0, nwrd = 0, pass, batch, last;
+
+  if (nwords)
+    *nwords = 0;
+
+  if ((id < 0) || (id >= Nc775) || (c775p[id] == NULL))
+    {
+      C775_LOG("c775FlushEvents: ERROR : TDC id %d not initialized \n", id, 0,
+	       0, 0, 0, 0);
+      return (ERROR);
+    }
+  if ((scratch == NULL) || (nwrds <= 0))
+    {
+      scratch = NULL;
+      nwrds = 0;
+    }
+
+  switch (mode)
+    {
+    case C775_FLUSH_RESET:
+      C775LOCK(id);
+      if (vmeRead16(&c775p[id]->main.status2) & C775_BUFFER_EMPTY)
+	{
+	  C775UNLOCK(id);
+	  return (0);
+	}
+      if (c775EvtReadCnt[id] >= 0)
+	{
+	  C775_EXEC_READ_EVENT_COUNT(id);
+	  last = c775EvtReadCnt[id];
+	  nev = c775EventCount[id] - last;
+	  if ((nev > 0) && (nev <= C775_MAX_EVENTS_PER_BUFFER))
+	    {
+	      C775_EXEC_DATA_RESET(id);
+	      C775_STAT_ADD(id, nclear, 1);
+	      c775EvtReadCnt[id] = c775EventCount[id];
+	      C775UNLOCK(id);
+	      for (ii = 0; (ii < nev) && (ii < maxev) && evID; ii++)
+		evID[ii] = (last + 1 + ii) & C775_EVENTCOUNT_MASK;
+	      return (nev);
+	    }
+	}
+      C775UNLOCK(id);
+      /* Read count not known, or out of step: read them out */
+      /* fall through */
+
+    case C775_FLUSH_PIO:
+      batch = nwrds / C775_MAX_WORDS_PER_EVENT;
+      for (pass = 0; pass <= C775_MAX_EVENTS_PER_BUFFER; pass++)
+	{
+	  if (batch > 0)
+	    nw = c775ReadEvents(id, (UINT32 *) scratch, batch, NULL, cnt, &nev);
+	  else
+	    nw = c775ReadEvents(id, evbuf, 1, NULL, cnt, &nev);
+	  if (nw <= 0)
+	    break;
+	  for (ii = 0; ii < nev; ii++, total++)
+	    if (evID && (total < maxev))
+	      evID[total] = cnt[ii];
+	  nwrd += nw;
+	}
+      break;
+
+    case C775_FLUSH_DMA:
+      if ((scratch == NULL)
+	  || !(c775Shadow[id].control1 & C775_BERR_ENABLE))
+	{
+	  C775_LOG
+	    ("c775FlushEvents: ERROR : TDC id %d: DMA needs a scratch buffer and BERR enabled\n",
+	     id, 0, 0, 0, 0, 0);
+	  return (ERROR);
+	}
+      for (pass = 0; pass <= C775_MAX_EVENTS_PER_BUFFER; pass++)
+	{
+	  if (vmeRead16(&c775p[id]->main.status2) & C775_BUFFER_EMPTY)
+	    break;
+	  nw = c775ReadBlockIndex(id, scratch, nwrds, evidx,
+				  C775_MAX_EVENTS_PER_BUFFER, &nev, NULL);
+	  if ((nw <= 0) || (nev == 0))
+	    break;
+	  for (ii = 0; ii < nev; ii++, total++)
+	    if (evID && (total < maxev))
+	      evID[total] = evidx[ii].evID;
+	  nwrd += nw;
+	}
+      break;
+
+    default:
+      C775_LOG("c775FlushEvents: ERROR : Invalid mode %d \n", mode, 0, 0, 0,
+	       0, 0);
+      return (ERROR);
+    }
+
+  if (nwords)
+    *nwords = nwrd;
+
+  return (total);
+}
+
 /*******************************************************************************
 *
 * c775ReadBlock - Read Block of events from TDC to specified address.
@@ -713,29 +1711,71 @@ c775FlushEvent(int id, int fflag)
 *            data   - address of data destination
 *            nwrds  - number of data words to transfer
 *
-* RETURNS: OK or ERROR on success of transfer.
+* RETURNS: Number of data words up to and including the last complete
+*          event, or ERROR.
 *
-* Note: User must call c775IncrEventBlk after a successful
-*       call to c775ReadBlock to increment the number of events Read.
-*         (e.g.   c775IncrEventBlk(0,15);
+* Note: The read counter is updated from the trailer of the last complete
+*       event, so c775IncrEventBlk is not needed.  Use c775ReadBlockIndex
+*       to also get the position of each event.
 */
 
 int
 c775ReadBlock(int id, volatile UINT32 * data, int nwrds)
 {
+  if (c775ReadBlockStart(id, data, nwrds) != OK)
+    return (ERROR);
 
-  int retVal, xferCount;
-  UINT32 vmeAdr, trailer, evID;
-  UINT16 stat = 0;
+  return (c775ReadBlockComplete(id));
+}
+
+/*******************************************************************************
+*
+* c775ReadBlockStart    - Start a block read from TDC to specified address.
+* c775ReadBlockPoll     - Check for a block read in flight.
+* c775ReadBlockComplete - Wait for a block read and check its data.
+*
+*   Split form of c775ReadBlock, so the CPU can do other work while the
+*   DMA engine is busy.  Only one transfer may be in flight at a time,
+*   and this includes transfers started from the c792 library: a start
+*   while the engine is taken fails (see v7xxDma.h).
+*
+*   The jvme library does not provide a non-blocking DMA status, so
+*   c775ReadBlockPoll only reports whether a transfer was started and not
+*   yet completed.  The wait is done in c775ReadBlockComplete.
+*
+* INPUTS:    id     - module id of TDC to access
+*            data   - address of data destination
+*            nwrds  - number of data words to transfer
+*
+* RETURNS: c775ReadBlockStart    - OK or ERROR.
+*          c775ReadBlockPoll     - 1 if a transfer for this TDC is in flight,
+*                                  otherwise 0.
+*          c775ReadBlockComplete - as c775ReadBlock.
+*/
+
+int
+c775ReadBlockStart(int id, volatile UINT32 * data, int nwrds)
+{
+
+  int retVal, owner;
+  UINT32 vmeAdr;
 
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775ReadBlock: ERROR : TDC id %d not initialized \n", id, 0, 0,
-	     0, 0, 0);
-      return (-1);
+      C775_LOG("c775ReadBlockStart: ERROR : TDC id %d not initialized \n", id,
+	     0, 0, 0, 0, 0);
+      return (ERROR);
+    }
+
+  /* The engine is shared with the c792 library (see v7xxDma.h) */
+  if (v7xxDmaTake(V7XX_DMA_TDC, id, &owner) != OK)
+    {
+      C775_LOG("c775ReadBlockStart: ERROR : DMA engine busy with %s id %d \n",
+	       V7XX_DMA_LIB(owner), V7XX_DMA_ID(owner), 0, 0, 0, 0);
+      return (ERROR);
     }
 
-  C775LOCK;
+  C775LOCK(id);
 #ifdef VXWORKSPPC
   /* Don't bother checking if there is a valid event. Just blast data out of the
      FIFO Valid or Invalid
@@ -744,165 +1784,1254 @@ c775ReadBlock(int id, volatile UINT32 * data, int nwrds)
   retVal =
     sysVmeDmaSend((UINT32) data, (UINT32) (c775pl[id]->data), (nwrds << 2),
 		  0);
-  if (retVal < 0)
-    {
-      logMsg("c775ReadBlock: ERROR in DMA transfer Initialization 0x%x\n",
-	     retVal, 0, 0, 0, 0, 0);
-      return (retVal);
-    }
-  /* Wait until Done or Error */
-  retVal = sysVmeDmaDone(1000, 1);
 
 #elif defined(VXWORKS68K51)
 
-  /* 68K Block 32 transfer from FIFO using VME2Chip */
-  retVal = mvme_dma((long) data, 1, (long) (c775pl[id]->data), 0, nwrds, 1);
+  /* 68K Block 32 transfer from FIFO using VME2Chip.  This one is not
+     asynchronous, keep the result for c775ReadBlockComplete */
+  c775DmaRetVal =
+    mvme_dma((long) data, 1, (long) (c775pl[id]->data), 0, nwrds, 1);
+  retVal = 0;
 
 #else
   /* Linux readout with jvme library */
   vmeAdr = (unsigned long) c775p[id]->data - c775MemOffset;
-  retVal = vmeDmaSend((unsigned long)data, vmeAdr, (nwrds << 2));
+  C775_STAT_TIME(c775DmaT0);
+  retVal = vmeDmaSend((unsigned long) data, vmeAdr, (nwrds << 2));
+#endif
+  C775UNLOCK(id);
+
   if (retVal < 0)
     {
-      logMsg("c775ReadBlock: ERROR in DMA transfer Initialization 0x%x\n",
+      C775_LOG("c775ReadBlockStart: ERROR in DMA transfer Initialization 0x%x\n",
 	     retVal, 0, 0, 0, 0, 0);
-      C775UNLOCK;
+      v7xxDmaGive();
       return (ERROR);
     }
+
+  c775DmaData = data;
+  c775DmaNwrds = nwrds;
+  c775DmaID = id;
+
+  return (OK);
+}
+
+int
+c775ReadBlockPoll(int id)
+{
+  return ((id >= 0) && (c775DmaID == id));
+}
+
+/* Wait for the transfer in flight, and check if the TDC ended it.
+   Returns number of longwords transfered, 0 if the transfer ended
+   without a bus error, or ERROR */
+LOCAL int
+c775ReadBlockWait(int id)
+{
+  int retVal, xferCount;
+  UINT16 stat = 0;
+
+#ifdef VXWORKSPPC
+  /* Wait until Done or Error */
+  retVal = sysVmeDmaDone(1000, 1);
+#elif defined(VXWORKS68K51)
+  retVal = c775DmaRetVal;
+#else
   /* Wait until Done or Error */
   retVal = vmeDmaDone();
-
 #endif
+  c775DmaID = -1;
+  v7xxDmaGive();
 
-  if (retVal != 0)
+  C775LOCK(id);
+  C775_STAT_ADD(id, ndma, 1);
+  C775_STAT_SINCE(id, dmaTime, c775DmaT0);
+  if (retVal == 0)
     {
-      /* Check to see if error was generated by TDC */
-      stat = vmeRead16(&c775p[id]->main.bitSet1) & C775_VME_BUS_ERROR;
-      if ((retVal > 0) && (stat))
-	{
-	  vmeWrite16(&c775p[id]->main.bitClear1, C775_VME_BUS_ERROR);
-/*       logMsg("c775ReadBlock: INFO: DMA terminated by TDC(BUS Error) - Transfer OK\n",0,0,0,0,0,0); */
+      C775_STAT_ADD(id, dmaBytes, c775DmaNwrds << 2);
+      C775UNLOCK(id);
+      return (OK);
+    }
+
+  /* Check to see if error was generated by TDC */
+  stat = vmeRead16(&c775p[id]->main.bitSet1) & C775_VME_BUS_ERROR;
+  if ((retVal > 0) && (stat))
+    {
+      vmeWrite16(&c775p[id]->main.bitClear1, C775_VME_BUS_ERROR);
+/*       C775_LOG("c775ReadBlock: INFO: DMA terminated by TDC(BUS Error) - Transfer OK\n",0,0,0,0,0,0); */
 #ifdef VXWORKS
-	  xferCount = (nwrds - (retVal >> 2));	/* Number of Longwords transfered */
+      xferCount = (c775DmaNwrds - (retVal >> 2));	/* Number of Longwords transfered */
 #else
-	  xferCount = (retVal >> 2);	/* Number of Longwords transfered */
+      xferCount = (retVal >> 2);	/* Number of Longwords transfered */
 #endif
-	  trailer = data[xferCount - 1];
+      C775_STAT_ADD(id, dmaBytes, xferCount << 2);
+      C775_STAT_ADD(id, nberr, 1);
+      C775UNLOCK(id);
+      return (xferCount);
+    }
+  C775UNLOCK(id);
+
+  C775_LOG("c775ReadBlock: ERROR in DMA transfer 0x%x\n", retVal, 0, 0,
+	 0, 0, 0);
+  return (ERROR);
+}
+
+/* Walk forward through the transfer, from header to header using the
+   word counts, and check that each event ends with a trailer.  Events are
+   added to evidx (if not NULL), and the read counter is updated from the
+   last complete event.  *bstat gets C775_BLKSTAT_* flags.
+   Returns the number of longwords up to and including the last EOB, 0 if
+   the transfer holds only filler words, or ERROR if it holds no complete
+   event */
+LOCAL int
+c775ReadBlockCheck(int id, volatile UINT32 * data, int xferCount,
+		   c775EvIndex * evidx, int maxev, int *nevents, int *bstat)
+{
+  UINT32 header, trailer, evID = 0;
+  int iword = 0, good = 0, nev = 0, nidx = 0, stat = 0, nWords;
+  int badHeader = 0, badTrailer = 0;
+
+  while (iword < xferCount)
+    {
+      header = data[iword];
 #ifndef VXWORKS
-	  trailer = LSWAP(trailer);
+      header = LSWAP(header);
 #endif
-	  if ((trailer & C775_DATA_ID_MASK) == C775_TRAILER_DATA)
-	    {
-	      evID = trailer & C775_EVENTCOUNT_MASK;
-	      C775_EXEC_SET_EVTREADCNT(id, evID);
-	      C775UNLOCK;
-	      return (xferCount);	/* Return number of data words transfered */
-	    }
-	  else
-	    {
-	      trailer = data[xferCount - 2];
+      if ((header & C775_DATA_ID_MASK) == C775_INVALID_DATA)
+	{
+	  iword++;		/* Alignment word, or filler after the last event */
+	  continue;
+	}
+      if ((header & C775_DATA_ID_MASK) != C775_HEADER_DATA)
+	{
+	  stat |= C775_BLKSTAT_CORRUPT;
+	  badHeader = 1;
+	  break;
+	}
+
+      nWords = (header & C775_WORDCOUNT_MASK) >> 8;
+      if (iword + nWords + 1 >= xferCount)
+	{
+	  stat |= C775_BLKSTAT_PARTIAL;
+	  break;
+	}
+
+      trailer = data[iword + nWords + 1];
 #ifndef VXWORKS
-	      trailer = LSWAP(trailer);
-#endif
-	      if ((trailer & C775_DATA_ID_MASK) == C775_TRAILER_DATA)
-		{
-		  evID = trailer & C775_EVENTCOUNT_MASK;
-		  C775_EXEC_SET_EVTREADCNT(id, evID);
-		  C775UNLOCK;
-		  return (xferCount - 1);	/* Return number of data words transfered */
-		}
-	      else
-		{
-		  logMsg("c775ReadBlock: ERROR: Invalid Trailer data 0x%x\n",
-			 trailer, 0, 0, 0, 0, 0);
-		  C775UNLOCK;
-		  return (xferCount);
-		}
-	    }
+      trailer = LSWAP(trailer);
+#endif
+      if ((trailer & C775_DATA_ID_MASK) != C775_TRAILER_DATA)
+	{
+	  stat |= C775_BLKSTAT_CORRUPT;
+	  badTrailer = 1;
+	  break;
 	}
-      else
+      evID = trailer & C775_EVENTCOUNT_MASK;
+
+      if (evidx)
 	{
-	  logMsg("c775ReadBlock: ERROR in DMA transfer 0x%x\n", retVal, 0, 0,
-		 0, 0, 0);
-	  C775UNLOCK;
-	  return (retVal);
+	  if (nidx < maxev)
+	    {
+	      evidx[nidx].geo = (header & C775_GEO_ADDR_MASK) >> 27;
+	      evidx[nidx].offset = iword;
+	      evidx[nidx].nwords = nWords + 2;
+	      evidx[nidx].evID = evID;
+	      nidx++;
+	    }
+	  else
+	    stat |= C775_BLKSTAT_INDEX_FULL;
 	}
+
+      nev++;
+      iword += nWords + 2;
+      good = iword;
     }
 
-  C775UNLOCK;
-  return (OK);
+  if (nevents)
+    *nevents = nidx;
+  if (bstat)
+    *bstat = stat;
+
+  C775LOCK(id);
+  if (nev > 0)
+    C775_EXEC_SET_EVTREADCNT(id, evID);
+  C775_STAT_ADD(id, nevents, nev);
+  C775_STAT_ADD(id, nwords, good);
+  C775_STAT_ADD(id, nbadHeader, badHeader);
+  C775_STAT_ADD(id, nbadTrailer, badTrailer);
+  C775UNLOCK(id);
+
+  if ((nev == 0) && (stat == 0))
+    return (0);
+
+  if (nev == 0)
+    {
+      C775_LOG("c775ReadBlock: ERROR: Failed to find EOB (xferCount = %d)\n",
+	     xferCount, 0, 0, 0, 0, 0);
+      return (ERROR);
+    }
+
+  if (stat & C775_BLKSTAT_CORRUPT)
+    C775_LOG("c775ReadBlock: ERROR: Corrupt data at word %d (xferCount = %d)\n",
+	   iword, xferCount, 0, 0, 0, 0);
 
+  return (good);		/* Return number of data words transfered */
 }
 
+int
+c775ReadBlockComplete(int id)
+{
+  int xferCount;
+  volatile UINT32 *data = c775DmaData;
+
+  if ((id < 0) || (c775DmaID != id))
+    {
+      C775_LOG
+	("c775ReadBlockComplete: ERROR : No transfer in flight for TDC id %d \n",
+	 id, 0, 0, 0, 0, 0);
+      return (ERROR);
+    }
+
+  xferCount = c775ReadBlockWait(id);
+  if (xferCount <= 0)
+    return (xferCount);
+
+  xferCount = c775ReadBlockCheck(id, data, xferCount, NULL, 0, NULL, NULL);
+  if (xferCount > 0)
+    C775_SWAP_BLOCK(data, xferCount);
+
+  return (xferCount);
+}
 
 /*******************************************************************************
 *
-* c775Int - default interrupt handler
+* c775ReadBlockIndex - Block read of events from TDC, with an index of the
+*                      events read
 *
-* This rountine handles the c775 TDC interrupt.  A user routine is
-* called, if one was connected by c775IntConnect().
+*   Same as c775ReadBlock, but the check of the transfer also fills evidx
+*   with the offset, length, GEO and event counter of each complete event,
+*   so that the caller does not have to scan the data again.
 *
-* RETURNS: N/A
+* INPUTS:    id      - module id of TDC to access
+*            data    - address of data destination
+*            nwrds   - maximum number of data words to transfer
+*            evidx   - filled with one descriptor per event
+*            maxev   - size of evidx
+*            nevents - returns the number of descriptors filled
+*            bstat   - (optional) returns C775_BLKSTAT_* flags:
+*                      PARTIAL    : the last event was cut by nwrds
+*                      CORRUPT    : a header or trailer was not found
+*                                   where expected
+*                      INDEX_FULL : more than maxev events were read
 *
+* RETURNS: Number of data words up to and including the last complete
+*          event, or ERROR.  The read counter is updated from that event.
 */
-//FIXME SKIPPED
-LOCAL void
-c775Int(void)
+
+int
+c775ReadBlockIndex(int id, volatile UINT32 * data, int nwrds,
+		   c775EvIndex * evidx, int maxev, int *nevents, int *bstat)
 {
-  int ii = 0;
-  UINT32 nevt = 0;
+  int xferCount;
 
-  /* Disable interrupts */
-#ifdef VXWORKS
-  sysIntDisable(c775IntLevel);
-#endif
+  if ((evidx == NULL) || (maxev <= 0) || (nevents == NULL))
+    {
+      C775_LOG("c775ReadBlockIndex: ERROR : Invalid event index \n", 0, 0, 0,
+	     0, 0, 0);
+      return (ERROR);
+    }
 
-  c775IntCount++;
+  *nevents = 0;
+  if (bstat)
+    *bstat = 0;
 
-#ifndef VXWORKS
-  vmeBusLock();
-#endif
+  if (c775ReadBlockStart(id, data, nwrds) != OK)
+    return (ERROR);
+
+  xferCount = c775ReadBlockWait(id);
+  if (xferCount <= 0)
+    return (xferCount);
+
+  xferCount = c775ReadBlockCheck(id, data, xferCount, evidx, maxev,
+				 nevents, bstat);
+  if (xferCount > 0)
+    C775_SWAP_BLOCK(data, xferCount);
+
+  return (xferCount);
+}
+
+/*******************************************************************************
+*
+* c775ReadBlockOverlap - Block read of several TDCs, keeping one DMA in flight
+*
+*   The TDCs in idmask are read in id order into consecutive regions of
+*   data.  As soon as the transfer from one TDC is done, the transfer from
+*   the next one is started behind it, and the finished region is checked
+*   (and optionally byte swapped) while the DMA engine fills the next one.
+*
+*   A filler (not valid datum) word is inserted in front of a region that
+*   would not start on an 8 byte boundary, and words after the last trailer
+*   of a region are overwritten with filler words.
+*   data may be dma_dabufp in a readout list; advance it by the return value.
+*
+* INPUTS:    idmask   - mask of TDC ids to read
+*            data     - address of data destination.  Must hold
+*                       nwrds + 1 words for each TDC in idmask.
+*            nwrds    - maximum number of data words to transfer per TDC
+*            flags    - C775_BLOCK_SWAP: convert the data to CPU byte order
+*            modWords - (optional) filled with the number of words in the
+*                       region of each TDC id, or ERROR if its read failed
+*
+* RETURNS: Total number of words written to data, or ERROR.
+*/
+
+LOCAL int
+c775ReadBlockOverlapStart(int id, volatile UINT32 * pos, int nwrds)
+{
+  /* Keep the destination of the DMA on an 8 byte boundary */
+  if ((unsigned long) (pos) & 0x7)
+    {
+#ifdef VXWORKS
+      *pos++ = C775_INVALID_DATA;
+#else
+      *pos++ = LSWAP(C775_INVALID_DATA);
+#endif
+    }
+
+  return (c775ReadBlockStart(id, pos, nwrds));
+}
+
+int
+c775ReadBlockOverlap(UINT32 idmask, volatile UINT32 * data, int nwrds,
+		     int flags, int *modWords)
+{
+  int ii, jj, nmod = 0, nw, good, dummy, total = 0;
+  int ids[C775_MAX_MODULES];
+  volatile UINT32 *dst, *pos = data;
+
+  for (ii = 0; ii < Nc775; ii++)
+    if ((idmask & (1 << ii)) && (c775p[ii] != NULL))
+      ids[nmod++] = ii;
+
+  if (nmod == 0)
+    return (0);
+
+  if (c775ReadBlockOverlapStart(ids[0], pos, nwrds) != OK)
+    return (ERROR);
+
+  for (ii = 0; ii < nmod; ii++)
+    {
+      if (c775DmaID != ids[ii])
+	{			/* Could not be started */
+	  if (modWords)
+	    modWords[ids[ii]] = ERROR;
+	  if (ii + 1 < nmod)
+	    c775ReadBlockOverlapStart(ids[ii + 1], pos, nwrds);
+	  continue;
+	}
+
+      /* Region includes the alignment word, if one was inserted */
+      dst = pos;
+      dummy = c775DmaData - dst;
+      nw = c775ReadBlockWait(ids[ii]);
+      if (nw < 0)
+	nw = 0;
+      nw += dummy;
+      pos = dst + nw;
+
+      /* Keep the bus busy with the next TDC */
+      if (ii + 1 < nmod)
+	c775ReadBlockOverlapStart(ids[ii + 1], pos, nwrds);
+
+      if (nw > dummy)
+	{
+	  /* No complete event: the region is all filler */
+	  good = c775ReadBlockCheck(ids[ii], dst, nw, NULL, 0, NULL, NULL);
+	  if (good < 0)
+	    good = 0;
+	  for (jj = good; jj < nw; jj++)
+#ifdef VXWORKS
+	    dst[jj] = C775_INVALID_DATA;
+#else
+	    dst[jj] = LSWAP(C775_INVALID_DATA);
+#endif
+
+#ifndef VXWORKS
+	  if ((flags & C775_BLOCK_SWAP) || (c775ByteOrder == C775_ORDER_CPU))
+	    v7xxSwapBlock(dst, nw);
+#endif
+	}
+
+      if (modWords)
+	modWords[ids[ii]] = nw;
+      total += nw;
+    }
+
+  return (total);
+}
+
+
+/*******************************************************************************
+*
+* c775SetCBLT   - Program the CBLT/MCST address and chain position of a TDC
+* c775CBLTInit  - Build a CBLT chain from all initialized TDCs
+*
+*   The chain order follows the GEO address (slot), lowest slot FIRST and
+*   highest slot LAST.  In a crate that also holds V792 QDCs on the same
+*   chain, use C775_CBLT_NOT_FIRST / C775_CBLT_NOT_LAST when the TDCs are
+*   not at the ends of the chain, or program interleaved boards one by one
+*   with c775SetCBLT.
+*
+*   Bus errors are enabled on all chain members, since the chain is
+*   terminated by a BERR from the LAST board.
+*
+* INPUTS:    cbltAddr - VME A32 address of the chain (bits 31-24 only)
+*            role     - C775_CBLT_DISABLED, _LAST, _FIRST or _MIDDLE
+*            flags    - C775_CBLT_NOT_FIRST, C775_CBLT_NOT_LAST
+*
+* RETURNS: OK, or ERROR if the address is invalid or no TDC is initialized.
+*/
+
+STATUS
+c775SetCBLT(int id, UINT32 cbltAddr, int role)
+{
+  if ((id < 0) || (c775p[id] == NULL))
+    {
+      printf("c775SetCBLT: ERROR : TDC id %d not initialized \n", id);
+      return (ERROR);
+    }
+
+  if (cbltAddr & 0x00ffffff)
+    {
+      printf
+	("c775SetCBLT: ERROR: Invalid CBLT address 0x%08x (only bits 31-24 allowed)\n",
+	 cbltAddr);
+      return (ERROR);
+    }
+
+  if ((role < C775_CBLT_DISABLED) || (role > C775_CBLT_MIDDLE))
+    {
+      printf("c775SetCBLT: ERROR: Invalid chain position (%d)\n", role);
+      return (ERROR);
+    }
+
+  C775LOCK(id);
+  C775_SHADOW_WRITE(id, cbltAddr, (cbltAddr >> 24) & 0xff);
+  C775_SHADOW_WRITE(id, cbltControl, role);
+  if (role != C775_CBLT_DISABLED)
+    C775_SHADOW_WRITE(id, control1,
+		      c775Shadow[id].control1
+		      | C775_BERR_ENABLE | C775_BLK_END);
+  c775CBLTGeo[id] = c775Shadow[id].geoAddr & C775_GEO_MASK;
+  C775UNLOCK(id);
+
+  c775CBLTRole[id] = role;
+  c775CBLTAddr = cbltAddr;
+
+  return (OK);
+}
+
+STATUS
+c775CBLTInit(UINT32 cbltAddr, int flags)
+{
+  int ii, jj, tmp, role;
+  int order[C775_MAX_MODULES];
+
+  if (Nc775 <= 0)
+    {
+      printf("c775CBLTInit: ERROR: No TDCs initialized\n");
+      return (ERROR);
+    }
+
+  /* A lone TDC cannot be both ends of the chain */
+  if ((Nc775 == 1) && !(flags & (C775_CBLT_NOT_FIRST | C775_CBLT_NOT_LAST)))
+    {
+      printf("c775CBLTInit: ERROR: A chain needs at least two boards\n");
+      return (ERROR);
+    }
+
+  /* Sort the TDCs by GEO address */
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      order[ii] = ii;
+      c775CBLTGeo[ii] = c775Shadow[ii].geoAddr & C775_GEO_MASK;
+    }
+
+  for (ii = 1; ii < Nc775; ii++)
+    {
+      for (jj = ii;
+	   (jj > 0) && (c775CBLTGeo[order[jj - 1]] > c775CBLTGeo[order[jj]]);
+	   jj--)
+	{
+	  tmp = order[jj];
+	  order[jj] = order[jj - 1];
+	  order[jj - 1] = tmp;
+	}
+    }
+
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if ((ii > 0) && (c775CBLTGeo[order[ii]] == c775CBLTGeo[order[ii - 1]]))
+	printf
+	  ("c775CBLTInit: WARN: TDC %d and %d have the same GEO address (%d)\n",
+	   order[ii - 1], order[ii], c775CBLTGeo[order[ii]]);
+
+      if ((ii == 0) && !(flags & C775_CBLT_NOT_FIRST))
+	role = C775_CBLT_FIRST;
+      else if ((ii == Nc775 - 1) && !(flags & C775_CBLT_NOT_LAST))
+	role = C775_CBLT_LAST;
+      else
+	role = C775_CBLT_MIDDLE;
+
+      if (c775SetCBLT(order[ii], cbltAddr, role) != OK)
+	return (ERROR);
+    }
+
+  return (OK);
+}
+
+/*******************************************************************************
+*
+* c775CBLTReadBlock - Read the whole CBLT chain with a single DMA transfer
+*
+*   The DMA engine must be configured for A32 block transfers,
+*   e.g. vmeDmaConfig(2,3,0) for MBLT.
+*
+* INPUTS:    data   - address of data destination
+*            nwrds  - maximum number of data words to transfer
+*
+* RETURNS: Number of data words transfered (including an alignment word
+*          at the start, if one was needed), or ERROR.
+*          Use c775CBLTSplit to find the events of each module.
+*/
+
+int
+c775CBLTReadBlock(volatile UINT32 * data, int nwrds)
+{
+  int ii, retVal, xferCount, dummy = 0, owner;
+  volatile unsigned int *laddr;
+  unsigned long long t0;
+
+  if (c775CBLTAddr == 0)
+    {
+      C775_LOG("c775CBLTReadBlock: ERROR : CBLT chain not initialized \n", 0, 0,
+	     0, 0, 0, 0);
+      return (ERROR);
+    }
+
+  /* Check for 8 byte boundary for address - insert dummy word */
+  if ((unsigned long) (data) & 0x7)
+    {
+#ifdef VXWORKS
+      *data = C775_INVALID_DATA;
+#else
+      *data = LSWAP(C775_INVALID_DATA);
+#endif
+      dummy = 1;
+      laddr = (data + 1);
+    }
+  else
+    {
+      dummy = 0;
+      laddr = data;
+    }
+
+  if (v7xxDmaTake(V7XX_DMA_TDC, C775_STATS_CBLT, &owner) != OK)
+    {
+      C775_LOG("c775CBLTReadBlock: ERROR : DMA engine busy with %s id %d \n",
+	       V7XX_DMA_LIB(owner), V7XX_DMA_ID(owner), 0, 0, 0, 0);
+      return (ERROR);
+    }
+
+  C775LOCK_ALL;
+#ifdef VXWORKSPPC
+  retVal = sysVmeDmaSend((UINT32) laddr, c775CBLTAddr, (nwrds << 2), 0);
+  if (retVal < 0)
+    {
+      C775_LOG("c775CBLTReadBlock: ERROR in DMA transfer Initialization 0x%x\n",
+	     retVal, 0, 0, 0, 0, 0);
+      C775UNLOCK_ALL;
+      v7xxDmaGive();
+      return (ERROR);
+    }
+  retVal = sysVmeDmaDone(1000, 1);
+#elif defined(VXWORKS68K51)
+  C775_LOG("c775CBLTReadBlock: ERROR: CBLT requires A32 addressing\n", 0, 0, 0,
+	 0, 0, 0);
+  C775UNLOCK_ALL;
+  v7xxDmaGive();
+  return (ERROR);
+#else
+  C775_STAT_TIME(t0);
+  retVal = vmeDmaSend((unsigned long) laddr, c775CBLTAddr, (nwrds << 2));
+  if (retVal < 0)
+    {
+      C775_LOG("c775CBLTReadBlock: ERROR in DMA transfer Initialization 0x%x\n",
+	     retVal, 0, 0, 0, 0, 0);
+      C775UNLOCK_ALL;
+      v7xxDmaGive();
+      return (ERROR);
+    }
+  retVal = vmeDmaDone();
+  C775_CBLT_STAT_ADD(ndma, 1);
+  C775_CBLT_STAT_ADD(dmaTime, c775LockNow() - t0);
+#endif
+  v7xxDmaGive();
+
+  if (retVal < 0)
+    {
+      C775_LOG("c775CBLTReadBlock: ERROR in DMA transfer retVal = 0x%x\n",
+	     retVal, 0, 0, 0, 0, 0);
+      C775UNLOCK_ALL;
+      return (ERROR);
+    }
+
+#ifdef VXWORKS
+  xferCount = (nwrds - (retVal >> 2) + dummy);
+#else
+  xferCount = (retVal >> 2) + dummy;
+#endif
+  C775_CBLT_STAT_ADD(dmaBytes, (xferCount - dummy) << 2);
+
+  /* Clear the bus error flag on the TDC that terminated the chain */
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if (c775CBLTRole[ii] == C775_CBLT_LAST)
+	{
+	  if (vmeRead16(&c775p[ii]->main.bitSet1) & C775_VME_BUS_ERROR)
+	    {
+	      vmeWrite16(&c775p[ii]->main.bitClear1, C775_VME_BUS_ERROR);
+	      C775_CBLT_STAT_ADD(nberr, 1);
+	    }
+	  break;
+	}
+    }
+  C775UNLOCK_ALL;
+
+  C775_SWAP_BLOCK(data, xferCount);
+
+  return (xferCount);
+}
+
+/*******************************************************************************
+*
+* c775CBLTSplit - Split a CBLT data stream into per-module events
+*
+*   Each event is located with the word count of its header and checked for
+*   a trailer.  Filler words (not valid datum) between events are skipped.
+*   The read counter of every TDC found in the stream is updated.  Events
+*   from other boards on the chain (e.g. V792 QDCs) are indexed, but must be
+*   accounted with c792CBLTSplit.
+*
+* INPUTS:    data   - CBLT data, as returned by c775CBLTReadBlock
+*            nwrds  - number of words in data
+*            evidx  - filled with one descriptor per event
+*            maxev  - size of evidx
+*
+* RETURNS: Number of events found, or ERROR if the stream is corrupt.
+*/
+
+int
+c775CBLTSplit(volatile UINT32 * data, int nwrds, c775EvIndex * evidx,
+	      int maxev)
+{
+  int ii, id, iword = 0, nev = 0, nWords;
+  UINT32 word, trailer;
+  int geoID[C775_MAX_GEO];
+
+  for (ii = 0; ii < C775_MAX_GEO; ii++)
+    geoID[ii] = -1;
+  for (ii = 0; ii < Nc775; ii++)
+    if (c775CBLTRole[ii] != C775_CBLT_DISABLED)
+      geoID[c775CBLTGeo[ii]] = ii;
+
+  while (iword < nwrds)
+    {
+      word = C775_BUF_WORD(data[iword]);
+      if ((word & C775_DATA_ID_MASK) != C775_HEADER_DATA)
+	{
+	  if ((word & C775_DATA_ID_MASK) != C775_INVALID_DATA)
+	    {
+	      C775_LOG("c775CBLTSplit: ERROR: Unexpected word 0x%08x at %d\n",
+		     word, iword, 0, 0, 0, 0);
+	      C775_CBLT_STAT_ADD(nbadHeader, 1);
+	      return (ERROR);
+	    }
+	  iword++;
+	  continue;
+	}
+
+      nWords = (word & C775_WORDCOUNT_MASK) >> 8;
+      if (iword + nWords + 1 >= nwrds)
+	{
+	  C775_LOG("c775CBLTSplit: ERROR: Truncated event at %d\n", iword, 0, 0,
+		 0, 0, 0);
+	  return (ERROR);
+	}
+      trailer = C775_BUF_WORD(data[iword + nWords + 1]);
+      if ((trailer & C775_DATA_ID_MASK) != C775_TRAILER_DATA)
+	{
+	  C775_LOG("c775CBLTSplit: ERROR: Invalid Trailer Word 0x%08x at %d\n",
+		 trailer, iword + nWords + 1, 0, 0, 0, 0);
+	  id = geoID[(word & C775_GEO_ADDR_MASK) >> 27];
+	  if (id >= 0)
+	    C775_STAT_ADD(id, nbadTrailer, 1);
+	  else
+	    C775_CBLT_STAT_ADD(nbadTrailer, 1);
+	  return (ERROR);
+	}
+
+      if (nev >= maxev)
+	{
+	  C775_LOG("c775CBLTSplit: ERROR: More than %d events in stream\n",
+		 maxev, 0, 0, 0, 0, 0);
+	  return (ERROR);
+	}
+      evidx[nev].geo = (word & C775_GEO_ADDR_MASK) >> 27;
+      evidx[nev].offset = iword;
+      evidx[nev].nwords = nWords + 2;
+      evidx[nev].evID = trailer & C775_EVENTCOUNT_MASK;
+
+      id = geoID[evidx[nev].geo];
+      if (id >= 0)
+	{
+	  C775_EXEC_SET_EVTREADCNT(id, evidx[nev].evID);
+	  C775_STAT_ADD(id, nevents, 1);
+	  C775_STAT_ADD(id, nwords, nWords + 2);
+	}
+
+      nev++;
+      iword += nWords + 2;
+    }
+
+  return (nev);
+}
+
+
+/*******************************************************************************
+*
+* c775MCSTInit - Program the multicast (MCST) address of all initialized TDCs
+*
+*   MCST shares the address and chain position registers with CBLT, so this
+*   sets up the same chain as c775CBLTInit, then maps the A32 multicast
+*   address for the c775MCST* commands below.  Each of them is a single
+*   VME write to all TDCs on the chain, instead of one write per module.
+*
+*   If V792 QDCs are on the same chain they receive the commands too, but
+*   only the TDC software counters are updated here.
+*
+* INPUTS:    mcstAddr - VME A32 address (bits 31-24 only)
+*            flags    - C775_CBLT_NOT_FIRST, C775_CBLT_NOT_LAST
+*
+* RETURNS: OK, or ERROR if the chain could not be programmed or mapped.
+*/
+
+STATUS
+c775MCSTInit(UINT32 mcstAddr, int flags)
+{
+  int res;
+  unsigned long laddr;
+
+  c775MCSTp = NULL;
+
+  if (c775CBLTInit(mcstAddr, flags) != OK)
+    return (ERROR);
+
+#ifdef VXWORKS
+  res = sysBusToLocalAdrs(0x09, (char *) mcstAddr, (char **) &laddr);
+  if (res != 0)
+    {
+      printf("c775MCSTInit: ERROR in sysBusToLocalAdrs(0x09,0x%x,&laddr) \n",
+	     mcstAddr);
+      return (ERROR);
+    }
+#else
+  res = vmeBusToLocalAdrs(0x09, (char *) (unsigned long) mcstAddr,
+			  (char **) (unsigned long) &laddr);
+  if (res != 0)
+    {
+      printf("c775MCSTInit: ERROR in vmeBusToLocalAdrs(0x09,0x%x,&laddr) \n",
+	     mcstAddr);
+      return (ERROR);
+    }
+#endif
+  c775MCSTp = (c775_regs *) laddr;
+
+  return (OK);
+}
+
+/*******************************************************************************
+*
+* c775MCSTGate              - Issue Software Gate to all TDCs
+* c775MCSTEnable            - Bring all TDCs Online (Enable Gates)
+* c775MCSTDisable           - Bring all TDCs Offline (Disable Gates)
+* c775MCSTClear             - Clear (data reset) all TDCs
+* c775MCSTReset             - Clear/Reset all TDCs
+* c775MCSTEventCounterReset - Reset the event counter of all TDCs
+*
+*
+* RETURNS: None.
+*/
+
+void
+c775MCSTGate()
+{
+  if (c775MCSTp == NULL)
+    {
+      C775_LOG("c775MCSTGate: ERROR : MCST not initialized \n", 0, 0, 0, 0, 0,
+	     0);
+      return;
+    }
+  C775LOCK_ALL;
+  vmeWrite16(&c775MCSTp->main.swComm, 1);
+  C775UNLOCK_ALL;
+}
+
+void
+c775MCSTEnable()
+{
+  int ii;
+
+  if (c775MCSTp == NULL)
+    {
+      C775_LOG("c775MCSTEnable: ERROR : MCST not initialized \n", 0, 0, 0, 0, 0,
+	     0);
+      return;
+    }
+  C775LOCK_ALL;
+  vmeWrite16(&c775MCSTp->main.bitClear2, C775_OFFLINE);
+  for (ii = 0; ii < Nc775; ii++)
+    if (c775CBLTRole[ii] != C775_CBLT_DISABLED)
+      c775Shadow[ii].bitSet2 &= ~C775_OFFLINE;
+  C775UNLOCK_ALL;
+}
+
+void
+c775MCSTDisable()
+{
+  int ii;
+
+  if (c775MCSTp == NULL)
+    {
+      C775_LOG("c775MCSTDisable: ERROR : MCST not initialized \n", 0, 0, 0, 0,
+	     0, 0);
+      return;
+    }
+  C775LOCK_ALL;
+  vmeWrite16(&c775MCSTp->main.bitSet2, C775_OFFLINE);
+  for (ii = 0; ii < Nc775; ii++)
+    if (c775CBLTRole[ii] != C775_CBLT_DISABLED)
+      c775Shadow[ii].bitSet2 |= C775_OFFLINE;
+  C775UNLOCK_ALL;
+}
+
+void
+c775MCSTClear()
+{
+  int ii;
+
+  if (c775MCSTp == NULL)
+    {
+      C775_LOG("c775MCSTClear: ERROR : MCST not initialized \n", 0, 0, 0, 0, 0,
+	     0);
+      return;
+    }
+  C775LOCK_ALL;
+  C775_EXEC_MCST_DATA_RESET();
+  C775UNLOCK_ALL;
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if (c775CBLTRole[ii] == C775_CBLT_DISABLED)
+	continue;
+      c775EvtReadCnt[ii] = -1;
+      c775EventCount[ii] = 0;
+      C775_STAT_ADD(ii, nclear, 1);
+    }
+}
+
+void
+c775MCSTReset()
+{
+  int ii;
+
+  if (c775MCSTp == NULL)
+    {
+      C775_LOG("c775MCSTReset: ERROR : MCST not initialized \n", 0, 0, 0, 0, 0,
+	     0);
+      return;
+    }
+  C775LOCK_ALL;
+  C775_EXEC_MCST_DATA_RESET();
+  vmeWrite16(&c775MCSTp->main.bitSet1, C775_SOFT_RESET);
+  vmeWrite16(&c775MCSTp->main.bitClear1, C775_SOFT_RESET);
+  for (ii = 0; ii < Nc775; ii++)
+    if (c775CBLTRole[ii] != C775_CBLT_DISABLED)
+      c775ShadowLoad(ii);
+  C775UNLOCK_ALL;
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if (c775CBLTRole[ii] == C775_CBLT_DISABLED)
+	continue;
+      c775EvtReadCnt[ii] = -1;
+      c775EventCount[ii] = 0;
+      C775_STAT_ADD(ii, nclear, 1);
+    }
+}
+
+void
+c775MCSTEventCounterReset()
+{
+  int ii;
+
+  if (c775MCSTp == NULL)
+    {
+      C775_LOG("c775MCSTEventCounterReset: ERROR : MCST not initialized \n", 0,
+	     0, 0, 0, 0, 0);
+      return;
+    }
+  C775LOCK_ALL;
+  vmeWrite16(&c775MCSTp->main.evCountReset, 1);
+  C775UNLOCK_ALL;
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if (c775CBLTRole[ii] == C775_CBLT_DISABLED)
+	continue;
+      c775EvtReadCnt[ii] = -1;
+      c775EventCount[ii] = 0;
+    }
+}
+
+
+LOCAL unsigned long long
+c775NowUs(void)
+{
+#ifdef VXWORKS
+  return ((unsigned long long) tickGet() * 1000000ULL / sysClkRateGet());
+#else
+  return (c775LockNow() / 1000);
+#endif
+}
+
+/* Called for each interrupt of TDC id: at the end of each
+   C775_INT_WINDOW_US, measure its trigger and interrupt rates and, with
+   c775IntAdaptive, retune its Event Trigger register to the lowest level
+   that keeps the interrupt rate under maxRate, but no higher than what
+   the trigger rate fills in maxLatency.  The window and the level are
+   kept under the lock of the TDC, as c775IntAdaptTimer changes them
+   from the sampler thread */
+LOCAL void
+c775IntAdapt(int id)
+{
+  c775IntMod *im = &c775IntTab[id];
+  unsigned long long now, dt;
+  UINT32 evnow, nev, lo, hi, level;
+
+  C775LOCK(id);
+  im->st.nint++;
+  im->winCount++;
+
+  now = c775NowUs();
+  im->lastInt = now;
+  if ((im->winStart != 0) && (now - im->winStart < C775_INT_WINDOW_US))
+    {
+      C775UNLOCK(id);
+      return;
+    }
+
+  C775_EXEC_READ_EVENT_COUNT(id);
+  evnow = c775EventCount[id] & C775_EVENTCOUNT_MASK;
+
+  if (im->winStart != 0)
+    {
+      dt = now - im->winStart;
+      nev = (evnow - im->winEvents) & C775_EVENTCOUNT_MASK;
+      im->st.trigRate = (UINT32) (nev * 1000000ULL / dt);
+      im->st.intRate = (UINT32) (im->winCount * 1000000ULL / dt);
+    }
+
+  if (im->adaptOn && (im->winStart != 0))
+    {
+      lo = (im->maxRate > 0) ?
+	(im->st.trigRate + im->maxRate - 1) / im->maxRate : 1;
+      hi = (im->maxLatency > 0) ?
+	1 + (UINT32) ((unsigned long long) im->st.trigRate *
+		      im->maxLatency / 1000000) : C775_EVTRIGGER_MASK;
+      level = (lo < hi) ? lo : hi;
+      if (level < 1)
+	level = 1;
+      if (level > C775_EVTRIGGER_MASK)
+	level = C775_EVTRIGGER_MASK;
+
+      if (level != im->evCount)
+	{
+	  /* Deferred, the worker re-arms the TDC with the new level */
+	  if (!im->paused && (c775IntMode != C775_INT_DEFERRED))
+	    C775_SHADOW_WRITE(id, evTrigger, level);
+	  im->evCount = level;
+	  im->st.nretune++;
+	}
+    }
+  im->st.level = im->evCount;
+#ifndef VXWORKS
+  c775Stats->intr[id] = im->st;
+#endif
+
+  im->winStart = now;
+  im->winEvents = evnow;
+  im->winCount = 0;
+  C775UNLOCK(id);
+}
+
+#ifndef VXWORKS
+/* From the sampler thread: an adaptive TDC with events waiting and no
+   interrupt for maxLatency has a level the trigger rate no longer fills.
+   Lower it to 1, so that the waiting events interrupt now, and measure
+   the rate again from the next interrupt: the window of c775IntAdapt
+   retunes it */
+LOCAL void
+c775IntAdaptTimer(int id, c775Snapshot * snap)
+{
+  c775IntMod *im = &c775IntTab[id];
+
+  if (!(snap->status1 & C775_DATA_READY))
+    return;
+
+  C775LOCK(id);
+  if (!im->enabled || im->paused || !im->adaptOn || (im->maxLatency <= 0)
+      || (im->evCount <= 1) || (c775NowUs() < im->lastInt + im->maxLatency))
+    {
+      C775UNLOCK(id);
+      return;
+    }
+
+  /* Deferred, with the worker: it re-arms the TDC with the new level */
+  if (c775Shadow[id].evTrigger)
+    C775_SHADOW_WRITE(id, evTrigger, 1);
+  im->evCount = 1;
+  im->winStart = 0;
+  im->st.level = 1;
+  im->st.nretune++;
+  c775Stats->intr[id] = im->st;
+  C775UNLOCK(id);
+}
+#endif
+
+/* Wake up c775WaitReady (C775_WAIT_INT) */
+LOCAL void
+c775IntWake(void)
+{
+  if (c775WaitMode != C775_WAIT_INT)
+    return;
+#ifdef VXWORKS
+  semGive(c775Sem);
+#else
+  unsigned long long one = 1;
+  if ((c775WaitEvFd >= 0) && (write(c775WaitEvFd, &one, sizeof(one)) < 0))
+    C775_LOG("c775Int: ERROR : Wakeup of c775WaitReady failed\n", 0, 0,
+	     0, 0, 0, 0);
+#endif
+}
+
+/* Serve an interrupt of TDC id: user routine or default action */
+LOCAL void
+c775IntModule(int id)
+{
+  c775IntMod *im = &c775IntTab[id];
+  int ii = 0;
+  UINT32 nevt = 0;
+
+  if (im->routine != NULL)
+    {				/* call user routine */
+      (*im->routine) (im->arg);
+    }
+  else if (c775WaitMode != C775_WAIT_INT)
+    {				/* data is read by the waiter */
+      /* Default action is to increment the Read pointer by
+         the number of events in the Event Trigger register
+         or until the Data buffer is empty. The later case would
+         indicate a possible error. In either case the data is
+         effectively thrown away */
+      nevt = im->evCount;	/* the register is 0 while deferred */
+      while ((ii < nevt) && (c775Dready(id) > 0))
+	{
+	  C775LOCK(id);
+	  C775_EXEC_INCR_EVENT(id);
+	  C775UNLOCK(id);
+	  ii++;
+	}
+      if (ii < nevt)
+	C775_LOG
+	  ("c775Int: WARN : TDC %d - Events dumped (%d) != Events Triggered (%d)\n",
+	   id, ii, nevt, 0, 0, 0);
+      C775_LOG("c775Int: Processed %d events\n", nevt, 0, 0, 0, 0, 0);
+
+    }
+
+  c775IntAdapt(id);
+}
+
+#ifndef VXWORKS
+/* C775_INT_DEFERRED, interrupt side: release the interrupt of each TDC of
+   the level with Event Ready (Event Trigger register to 0), and hand
+   them to c775IntWorker.  No vmeBusLock, and at most two register
+   accesses per TDC.  As each TDC stays released until the worker has
+   served it, a bit per TDC is enough to queue it */
+LOCAL void
+c775IntDefer(int level)
+{
+  unsigned long long one = 1, now = c775NowUs();
+  UINT32 mask = 0;
+  UINT16 stat;
+  int id;
+
+  for (id = 0; id < Nc775; id++)
+    {
+      if (!c775IntTab[id].enabled || (c775IntTab[id].level != (UINT32) level))
+	continue;
+      C775LOCK(id);
+      stat = ((c775IntNlevel[level] > 1)
+	      || v7xxIntShared(V7XX_INT_TDC, level)) ?
+	vmeRead16(&c775p[id]->main.status1) & C775_EVRDY : C775_EVRDY;
+      if (stat)
+	C775_SHADOW_WRITE(id, evTrigger, 0);
+      C775UNLOCK(id);
+      if (!stat)
+	continue;
+      c775IntTab[id].tfire = now;
+      mask |= (1 << id);
+    }
+  if (mask == 0)
+    return;
+
+  __atomic_fetch_or(&c775IntPending, mask, __ATOMIC_RELEASE);
+  if (write(c775IntWorkFd, &one, sizeof(one)) < 0)
+    C775_LOG("c775Int: ERROR : Wakeup of the interrupt worker failed\n", 0,
+	     0, 0, 0, 0, 0);
+}
+
+/* C775_INT_DEFERRED, worker thread: serve the TDCs handed over by
+   c775IntDefer, then re-arm their interrupt.  The user routine runs
+   without vmeBusLock, like the readout of a polling trigger routine;
+   the library locks protect each TDC */
+LOCAL void *
+c775IntWorker(void *arg)
+{
+  c775IntMod *im;
+  unsigned long long cnt, now, wait;
+  UINT32 mask;
+  int id;
+
+  while (1)
+    {
+      if (read(c775IntWorkFd, &cnt, sizeof(cnt)) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror("c775IntWorker: read");
+	  break;
+	}
+      if (c775IntMode != C775_INT_DEFERRED)
+	break;
+
+      mask = __atomic_exchange_n(&c775IntPending, 0, __ATOMIC_ACQUIRE);
+      now = c775NowUs();
+      for (; mask; mask &= mask - 1)
+	{
+	  id = __builtin_ctz(mask);
+	  im = &c775IntTab[id];
+
+	  wait = (now > im->tfire) ? now - im->tfire : 0;
+	  im->st.ndefer++;
+	  im->st.deferSum += wait;
+	  if (wait > im->st.deferMax)
+	    im->st.deferMax = wait;
+
+	  c775IntModule(id);
+
+	  C775LOCK(id);
+	  if (im->enabled && !im->paused)
+	    C775_SHADOW_WRITE(id, evTrigger, im->evCount);
+	  C775UNLOCK(id);
+	}
+    }
+
+  return (NULL);
+}
+#endif
+
+/*******************************************************************************
+*
+* c775Int - default interrupt handler
+*
+* This rountine handles the c775 TDC interrupts.  On VxWorks, each TDC
+* has its own vector, and arg is its id.  On Linux, the handler is
+* connected to a VME level, arg is the level, and it handles each TDC
+* enabled on that level with Event Ready set (without reading the status
+* when there is only one).  A TDC served with the interrupt of another
+* may still raise its own, which then finds nothing to do.
+*
+* For each TDC, the user routine connected by c775IntConnect() or
+* c775IntConnectModule() is called.  In the C775_WAIT_INT wait mode, it
+* also wakes up c775WaitReady, and leaves the data in the module for it.
+*
+* In the C775_INT_DEFERRED mode (c775SetIntMode), the handler only
+* releases the interrupt of the TDCs that fired and queues them, and the
+* routine is called from the worker thread.
+*
+* RETURNS: N/A
+*
+*/
+//FIXME SKIPPED
+LOCAL void
+c775Int(int arg)
+{
+#ifndef VXWORKS
+  int id;
+  UINT16 stat;
+#endif
+
+  /* Disable interrupts */
+#ifdef VXWORKS
+  sysIntDisable(c775IntTab[arg].level);
+#endif
+
+  c775IntCount++;
+  c775IntWake();
 
-  if (c775IntRoutine != NULL)
-    {				/* call user routine */
-      (*c775IntRoutine) (c775IntArg);
+#ifdef VXWORKS
+  c775IntModule(arg);
+#else
+  if (c775IntMode == C775_INT_DEFERRED)
+    {
+      c775IntDefer(arg);
     }
   else
     {
-      if ((c775IntID < 0) || (c775p[c775IntID] == NULL))
-	{
-	  logMsg("c775Int: ERROR : TDC id %d not initialized \n", c775IntID,
-		 0, 0, 0, 0, 0);
-	  return;
-	}
-      /* Default action is to increment the Read pointer by
-         the number of events in the Event Trigger register
-         or until the Data buffer is empty. The later case would
-         indicate a possible error. In either case the data is
-         effectively thrown away */
-      C775LOCK;
-      nevt = vmeRead16(&c775p[c775IntID]->main.evTrigger) & C775_EVTRIGGER_MASK;
-      C775UNLOCK;
-      while ((ii < nevt) && (c775Dready(c775IntID) > 0))
+      vmeBusLock();
+
+      for (id = 0; id < Nc775; id++)
 	{
-	  C775LOCK;
-	  C775_EXEC_INCR_EVENT(c775IntID);
-	  C775UNLOCK;
-	  ii++;
+	  if (!c775IntTab[id].enabled
+	      || (c775IntTab[id].level != (UINT32) arg))
+	    continue;
+	  if ((c775IntNlevel[arg] > 1) || v7xxIntShared(V7XX_INT_TDC, arg))
+	    {
+	      C775LOCK(id);
+	      stat = vmeRead16(&c775p[id]->main.status1) & C775_EVRDY;
+	      C775UNLOCK(id);
+	      if (!stat)
+		continue;
+	    }
+	  c775IntModule(id);
 	}
-      if (ii < nevt)
-	logMsg
-	  ("c775Int: WARN : TDC %d - Events dumped (%d) != Events Triggered (%d)\n",
-	   c775IntID, ii, nevt, 0, 0, 0);
-      logMsg("c775Int: Processed %d events\n", nevt, 0, 0, 0, 0, 0);
 
+      vmeBusUnlock();
     }
+#endif
 
   /* Enable interrupts */
 #ifdef VXWORKS
-  sysIntEnable(c775IntLevel);
-#else
-  vmeBusUnlock();
+  sysIntEnable(c775IntTab[arg].level);
 #endif
 
 
@@ -911,14 +3040,19 @@ c775Int(void)
 
 /*******************************************************************************
 *
-* c775IntConnect - connect a user routine to the c775 TDC interrupt
+* c775IntConnect       - connect a user routine to the c775 TDC interrupts
+* c775IntConnectModule - connect a user routine to the interrupt of one TDC
 *
-* This routine specifies the user interrupt routine to be called at each
-* interrupt.
+* c775IntConnect sets the routine, VME level and base vector of all the
+* TDCs.  Each TDC interrupts with its own vector, vector + id.
+* c775IntConnectModule gives TDC id its own routine, level and vector (0:
+* those of c775IntConnect).  The routine is called with arg at each
+* interrupt of the TDC; with NULL, the data is thrown away.
+*
+* The interrupt service routine is connected by c775IntEnable.
 *
 * RETURNS: OK, or ERROR if Interrupts are enabled
 */
-//FIXME SKIPPED
 
 STATUS
 c775IntConnect(VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector)
@@ -968,31 +3102,78 @@ c775IntConnect(VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector)
       c775IntVec = vector;
     }
 
-  /* Connect the ISR */
-#ifdef VXWORKSPPC
-  if ((intDisconnect((int) INUM_TO_IVEC(c775IntVec)) != 0))
+  return (OK);
+}
+
+STATUS
+c775IntConnectModule(int id, VOIDFUNCPTR routine, int arg, UINT16 level,
+		     UINT16 vector)
+{
+  c775IntMod *im;
+
+  if ((id < 0) || (c775p[id] == NULL))
     {
-      printf("c775IntConnect: ERROR disconnecting Interrupt\n");
+      printf("c775IntConnectModule: ERROR : TDC id %d not initialized \n", id);
       return (ERROR);
     }
-#endif
-#ifdef VXWORKS
-  if ((intConnect(INUM_TO_IVEC(c775IntVec), c775Int, 0)) != 0)
+  im = &c775IntTab[id];
+
+  if (im->enabled)
     {
-      printf("c775IntConnect: ERROR in intConnect()\n");
+      printf
+	("c775IntConnectModule: ERROR : Interrupts already enabled for TDC id %d\n",
+	 id);
       return (ERROR);
     }
-#else
-  if (vmeIntDisconnect(c775IntLevel) != 0)
+  if (level > 7)
+    {
+      printf
+	("c775IntConnectModule: ERROR: Invalid VME interrupt level (%d). Must be (1-7)\n",
+	 level);
+      return (ERROR);
+    }
+  if ((vector != 0) && ((vector < 32) || (vector > 255)))
+    {
+      printf
+	("c775IntConnectModule: ERROR: Invalid interrupt vector (%d). Must be (32<vector<255)\n",
+	 vector);
+      return (ERROR);
+    }
+
+  im->routine = routine;
+  im->arg = arg;
+  im->level = level;
+  im->vec = vector;
+  im->connected = 1;
+
+  return (OK);
+}
+
+/* Connect c775Int to the vector (VxWorks) or register it on the level
+   (Linux) of TDC id */
+LOCAL STATUS
+c775IntAttach(int id)
+{
+  c775IntMod *im = &c775IntTab[id];
+
+#ifdef VXWORKSPPC
+  if ((intDisconnect((int) INUM_TO_IVEC(im->vec)) != 0))
     {
       printf("c775IntConnect: ERROR disconnecting Interrupt\n");
       return (ERROR);
     }
-  if (vmeIntConnect(c775IntVec, c775IntLevel, c775Int, 0) != 0)
+#endif
+#ifdef VXWORKS
+  if ((intConnect(INUM_TO_IVEC(im->vec), c775Int, id)) != 0)
     {
       printf("c775IntConnect: ERROR in intConnect()\n");
       return (ERROR);
     }
+#else
+  /* The level may also serve the QDCs: see v7xxInt.h */
+  if (v7xxIntAttachLevel(V7XX_INT_TDC, im->level, im->vec,
+			 (VOIDFUNCPTR) c775Int) != OK)
+    return (ERROR);
 #endif
 
   return (OK);
@@ -1003,7 +3184,8 @@ c775IntConnect(VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector)
 *
 * c775IntEnable - Enable interrupts from specified TDC
 *
-* Enables interrupts for a specified TDC.
+* Enables interrupts for a specified TDC, every evCnt events.  May be
+* called for several TDCs.
 *
 * RETURNS OK or ERROR if TDC is not available or parameter is out of range
 */
@@ -1011,23 +3193,21 @@ c775IntConnect(VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector)
 STATUS
 c775IntEnable(int id, UINT16 evCnt)
 {
-
-  if (c775IntRunning)
-    {
-      printf
-	("c775IntEnable: ERROR : Interrupts already initialized for TDC id %d\n",
-	 c775IntID);
-      return (ERROR);
-    }
+  c775IntMod *im;
 
   if ((id < 0) || (c775p[id] == NULL))
     {
       printf("c775IntEnable: ERROR : TDC id %d not initialized \n", id);
       return (ERROR);
     }
-  else
+  im = &c775IntTab[id];
+
+  if (im->enabled)
     {
-      c775IntID = id;
+      printf
+	("c775IntEnable: ERROR : Interrupts already initialized for TDC id %d\n",
+	 id);
+      return (ERROR);
     }
 
   /* check for event count out of range */
@@ -1039,20 +3219,60 @@ c775IntEnable(int id, UINT16 evCnt)
       return (ERROR);
     }
 
+  /* Routine, level and vector of c775IntConnect, unless the TDC has its own */
+  if (!im->connected)
+    {
+      im->routine = c775IntRoutine;
+      im->arg = c775IntArg;
+      im->level = 0;
+      im->vec = 0;
+    }
+  if (im->level == 0)
+    im->level = c775IntLevel ? c775IntLevel : C775_VME_INT_LEVEL;
+  if (im->vec == 0)
+    im->vec = (c775IntVec ? c775IntVec : C775_INT_VEC) + id;
+  if (im->vec > 255)
+    {
+      printf
+	("c775IntEnable: ERROR: Interrupt vector of TDC id %d (%d) is out of range\n",
+	 id, im->vec);
+      return (ERROR);
+    }
+
+  if (v7xxIntClaimVec(V7XX_INT_TDC, im->vec) != OK)
+    return (ERROR);
+  if (c775IntAttach(id) != OK)
+    {
+      v7xxIntReleaseVec(V7XX_INT_TDC, im->vec);
+      return (ERROR);
+    }
+
 #ifdef VXWORKS
-  sysIntEnable(c775IntLevel);	/* Enable VME interrupts */
+  sysIntEnable(im->level);	/* Enable VME interrupts */
 #endif
 
   /* Zero Counter and set Running Flag */
-  c775IntEvCount = evCnt;
-  c775IntCount = 0;
+  im->evCount = evCnt;
+  im->evFixed = evCnt;
+  im->winStart = 0;
+  im->lastInt = c775NowUs();
+  memset(&im->st, 0, sizeof(im->st));
+  im->st.level = evCnt;
+  im->paused = 0;
+  im->enabled = 1;
+  c775IntNlevel[im->level]++;
+  if (!c775IntRunning)
+    {
+      c775IntID = id;
+      c775IntCount = 0;
+    }
   c775IntRunning = TRUE;
   /* Enable interrupts on TDC */
-  C775LOCK;
-  vmeWrite16(&c775p[c775IntID]->main.intVector, c775IntVec);
-  vmeWrite16(&c775p[c775IntID]->main.intLevel, c775IntLevel);
-  vmeWrite16(&c775p[c775IntID]->main.evTrigger, c775IntEvCount);
-  C775UNLOCK;
+  C775LOCK(id);
+  C775_SHADOW_WRITE(id, intVector, im->vec);
+  C775_SHADOW_WRITE(id, intLevel, im->level);
+  C775_SHADOW_WRITE(id, evTrigger, im->evCount);
+  C775UNLOCK(id);
 
   return (OK);
 }
@@ -1060,7 +3280,10 @@ c775IntEnable(int id, UINT16 evCnt)
 
 /*******************************************************************************
 *
-* c775IntDisable - disable the TDC interrupts
+* c775IntDisable - disable the interrupts of all the TDCs
+*
+*   iflag > 0: for good (c775IntEnable again to restart)
+*   otherwise: pause them until c775IntResume
 *
 * RETURNS: OK, or ERROR if not initialized
 */
@@ -1068,26 +3291,41 @@ c775IntEnable(int id, UINT16 evCnt)
 STATUS
 c775IntDisable(int iflag)
 {
+  int id;
 
-  if ((c775IntID < 0) || (c775p[c775IntID] == NULL))
+  if (!c775IntRunning)
     {
-      logMsg("c775IntDisable: ERROR : TDC id %d not initialized \n",
-	     c775IntID, 0, 0, 0, 0, 0);
+      C775_LOG("c775IntDisable: ERROR : Interrupts are not Enabled \n", 0, 0,
+	       0, 0, 0, 0);
       return (ERROR);
     }
 
+  for (id = 0; id < Nc775; id++)
+    {
+      if (!c775IntTab[id].enabled)
+	continue;
 #ifdef VXWORKS
-  sysIntDisable(c775IntLevel);	/* Disable VME interrupts */
+      sysIntDisable(c775IntTab[id].level);	/* Disable VME interrupts */
 #endif
-  C775LOCK;
-  vmeWrite16(&c775p[c775IntID]->main.evTrigger, 0);
+      C775LOCK(id);
+      C775_SHADOW_WRITE(id, evTrigger, 0);
+      c775IntTab[id].paused = 1;
+      if (iflag > 0)
+	{
+	  C775_SHADOW_WRITE(id, intLevel, 0);
+	  C775_SHADOW_WRITE(id, intVector, 0);
+	  c775IntTab[id].enabled = 0;
+	  v7xxIntReleaseVec(V7XX_INT_TDC, c775IntTab[id].vec);
+	  if (--c775IntNlevel[c775IntTab[id].level] == 0)
+	    v7xxIntDetachLevel(V7XX_INT_TDC, c775IntTab[id].level);
+	}
+      C775UNLOCK(id);
+    }
 
   /* Tell tasks that Interrupts have been disabled */
   if (iflag > 0)
     {
       c775IntRunning = FALSE;
-      vmeWrite16(&c775p[c775IntID]->main.intLevel, 0);
-      vmeWrite16(&c775p[c775IntID]->main.intVector, 0);
     }
 #ifdef VXWORKS
   else
@@ -1096,14 +3334,13 @@ c775IntDisable(int iflag)
     }
 #endif
 
-  C775UNLOCK;
   return (OK);
 }
 
 /*******************************************************************************
 *
 * c775IntResume - Re-enable interrupts from previously
-*                 intitialized TDC
+*                 intitialized TDCs
 *
 * RETURNS: OK, or ERROR if not initialized
 */
@@ -1112,43 +3349,212 @@ STATUS
 c775IntResume(void)
 {
   UINT16 evTrig = 0;
+  int id, nres = 0;
 
-  if ((c775IntID < 0) || (c775p[c775IntID] == NULL))
+  if (!c775IntRunning)
     {
-      logMsg("c775IntResume: ERROR : TDC id %d not initialized \n", c775IntID,
-	     0, 0, 0, 0, 0);
+      C775_LOG("c775IntResume: ERROR : Interrupts are not Enabled \n", 0, 0, 0,
+	     0, 0, 0);
       return (ERROR);
     }
 
-  C775LOCK;
-  if ((c775IntRunning))
+  for (id = 0; id < Nc775; id++)
     {
-      evTrig = vmeRead16(&c775p[c775IntID]->main.evTrigger) & C775_EVTRIGGER_MASK;
+      if (!c775IntTab[id].enabled)
+	continue;
+      C775LOCK(id);
+      c775IntTab[id].paused = 0;
+      evTrig = c775Shadow[id].evTrigger;
       if (evTrig == 0)
 	{
 #ifdef VXWORKS
-	  sysIntEnable(c775IntLevel);
+	  sysIntEnable(c775IntTab[id].level);
 #endif
-	  vmeWrite16(&c775p[c775IntID]->main.evTrigger, c775IntEvCount);
+	  C775_SHADOW_WRITE(id, evTrigger, c775IntTab[id].evCount);
+	  nres++;
 	}
-      else
+      C775UNLOCK(id);
+    }
+
+  if (nres == 0)
+    {
+      C775_LOG("c775IntResume: WARNING : Interrupts already enabled \n", 0,
+	       0, 0, 0, 0, 0);
+      return (ERROR);
+    }
+
+  return (OK);
+}
+
+/*******************************************************************************
+*
+* c775IntAdaptive - Retune the number of events per interrupt (Event
+*                   Trigger register) of TDC id (id<0 for all) to its
+*                   trigger rate, measured over each C775_INT_WINDOW_US by
+*                   the interrupt handler.  The level is the lowest that
+*                   keeps the interrupt rate under maxRate, capped so that
+*                   at the measured rate the first event of an interrupt
+*                   waits no more than maxLatency.  Both 0: back to the
+*                   fixed level of c775IntEnable.
+*
+*   maxLatency - us, 0 for no limit
+*   maxRate    - interrupts per second, 0 for no limit
+*
+*   The level is measured at the interrupts only: when the trigger rate
+*   drops, the events of a high level would stay in the module until the
+*   level is filled.  The sampler thread (c775SamplerStart) lowers the
+*   level to 1 when events wait and no interrupt came for maxLatency, so
+*   they wait at most maxLatency plus the sampler period.
+*
+* c775GetIntStats - Copy the interrupt level, and the interrupt and trigger
+*                   rates of the last window of TDC id (also in the shared
+*                   memory segment of c775StatsShmOpen)
+*
+* RETURNS: OK, or ERROR if not initialized or out of range
+*/
+
+STATUS
+c775IntAdaptive(int id, int maxLatency, int maxRate)
+{
+  c775IntMod *im;
+  int ii;
+
+  if ((id >= Nc775) || (maxLatency < 0) || (maxRate < 0))
+    {
+      C775_LOG
+	("c775IntAdaptive: ERROR : Invalid TDC id %d or limits (%d us, %d/s)\n",
+	 id, maxLatency, maxRate, 0, 0, 0);
+      return (ERROR);
+    }
+
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if ((id >= 0) && (ii != id))
+	continue;
+      im = &c775IntTab[ii];
+
+      im->maxLatency = maxLatency;
+      im->maxRate = maxRate;
+      im->winStart = 0;
+      im->adaptOn = (maxLatency > 0) || (maxRate > 0);
+
+      if (!im->adaptOn && im->enabled && (im->evCount != im->evFixed))
 	{
-	  logMsg("c775IntResume: WARNING : Interrupts already enabled \n", 0,
-		 0, 0, 0, 0, 0);
-	  C775UNLOCK;
-	  return (ERROR);
+	  im->evCount = im->evFixed;
+	  im->st.level = im->evCount;
+	  C775LOCK(ii);
+	  if (c775Shadow[ii].evTrigger)
+	    C775_SHADOW_WRITE(ii, evTrigger, im->evCount);
+	  C775UNLOCK(ii);
 	}
     }
-  else
+
+  return (OK);
+}
+
+STATUS
+c775GetIntStats(int id, c775IntStats * stats)
+{
+  if ((id < 0) || (id >= C775_MAX_MODULES) || (stats == NULL))
+    return (ERROR);
+
+  *stats = c775IntTab[id].st;
+
+  return (OK);
+}
+
+/*******************************************************************************
+*
+* c775SetIntMode - Select where the TDC interrupts are served (Linux)
+*
+*   mode - C775_INT_DIRECT   : in the interrupt handler, which holds
+*                              vmeBusLock while the routines run (default)
+*          C775_INT_DEFERRED : the handler only releases the interrupt of
+*                              the TDCs that fired (Event Trigger register
+*                              to 0) and queues them.  A worker thread
+*                              calls their routine, or the default action,
+*                              without vmeBusLock, then re-arms them.
+*   prio - SCHED_FIFO priority of the worker, 0 for the default scheduling
+*          (also used, with a warning, if SCHED_FIFO is not permitted)
+*
+*   Set before c775IntEnable, or once the interrupts are disabled for good.
+*   The time each TDC waited for the worker is in c775GetIntStats.
+*
+* RETURNS: OK, or ERROR if the interrupts are enabled, or on VxWorks
+*/
+
+STATUS
+c775SetIntMode(int mode, int prio)
+{
+#ifdef VXWORKS
+  printf("c775SetIntMode: ERROR : Not supported on VxWorks\n");
+  return (ERROR);
+#else
+  pthread_attr_t attr;
+  struct sched_param param;
+  unsigned long long one = 1;
+  int rval = -1;
+
+  if ((mode != C775_INT_DIRECT) && (mode != C775_INT_DEFERRED))
     {
-      logMsg("c775IntResume: ERROR : Interrupts are not Enabled \n", 0, 0, 0,
-	     0, 0, 0);
-      C775UNLOCK;
+      printf("c775SetIntMode: ERROR : Invalid mode %d\n", mode);
+      return (ERROR);
+    }
+  if (c775IntRunning)
+    {
+      printf("c775SetIntMode: ERROR : Interrupts are enabled\n");
+      return (ERROR);
+    }
+  if (mode == c775IntMode)
+    return (OK);
+
+  if (mode == C775_INT_DIRECT)
+    {				/* stop the worker */
+      c775IntMode = mode;
+      if (write(c775IntWorkFd, &one, sizeof(one)) < 0)
+	perror("c775SetIntMode: write");
+      pthread_join(c775IntWorkThread, NULL);
+      close(c775IntWorkFd);
+      c775IntWorkFd = -1;
+      return (OK);
+    }
+
+  c775IntWorkFd = eventfd(0, EFD_CLOEXEC);
+  if (c775IntWorkFd < 0)
+    {
+      perror("c775SetIntMode: eventfd");
+      return (ERROR);
+    }
+  c775IntPending = 0;
+  c775IntMode = mode;
+
+  if (prio > 0)
+    {
+      pthread_attr_init(&attr);
+      pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+      param.sched_priority = prio;
+      pthread_attr_setschedparam(&attr, &param);
+      rval = pthread_create(&c775IntWorkThread, &attr, c775IntWorker, NULL);
+      pthread_attr_destroy(&attr);
+      if (rval != 0)
+	printf
+	  ("c775SetIntMode: WARNING : No SCHED_FIFO priority %d for the worker (%s)\n",
+	   prio, strerror(rval));
+    }
+  if (rval != 0)
+    rval = pthread_create(&c775IntWorkThread, NULL, c775IntWorker, NULL);
+  if (rval != 0)
+    {
+      printf("c775SetIntMode: ERROR : pthread_create: %s\n", strerror(rval));
+      c775IntMode = C775_INT_DIRECT;
+      close(c775IntWorkFd);
+      c775IntWorkFd = -1;
       return (ERROR);
     }
 
-  C775UNLOCK;
   return (OK);
+#endif
 }
 
 
@@ -1172,27 +3578,27 @@ c775Sparse(int id, int over, int under)
       return (0xffff);
     }
 
-  C775LOCK;
+  C775LOCK(id);
   if (!over)
     {				/* Set Overflow suppression */
-      vmeWrite16(&c775p[id]->main.bitSet2, C775_OVER_RANGE);
+      C775_SHADOW_BITSET2(id, C775_OVER_RANGE);
     }
   else
     {
-      vmeWrite16(&c775p[id]->main.bitClear2, C775_OVER_RANGE);
+      C775_SHADOW_BITCLEAR2(id, C775_OVER_RANGE);
     }
 
   if (!under)
     {				/* Set Underflow suppression */
-      vmeWrite16(&c775p[id]->main.bitSet2, C775_LOW_THRESHOLD);
+      C775_SHADOW_BITSET2(id, C775_LOW_THRESHOLD);
     }
   else
     {
-      vmeWrite16(&c775p[id]->main.bitClear2, C775_LOW_THRESHOLD);
+      C775_SHADOW_BITCLEAR2(id, C775_LOW_THRESHOLD);
     }
-  rval = vmeRead16(&c775p[id]->main.bitSet2) & C775_BITSET2_MASK;
+  rval = c775Shadow[id].bitSet2 & C775_BITSET2_MASK;
 
-  C775UNLOCK;
+  C775UNLOCK(id);
   return (rval);
 }
 
@@ -1215,28 +3621,234 @@ c775Dready(int id)
 
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775Dready: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
-	     0, 0);
+      C775_LOG("c775Dready: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
+	     0, 0);
+      return (ERROR);
+    }
+
+  C775LOCK(id);
+  stat = vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY;
+  if (stat)
+    {
+      C775_EXEC_READ_EVENT_COUNT(id);
+      nevts = c775EventCount[id] - c775EvtReadCnt[id];
+      if (nevts <= 0)
+	{
+	  C775_LOG("c775Dready: ERROR : Bad Event Ready Count (nevts = %d)\n",
+		 nevts, 0, 0, 0, 0, 0);
+	  C775UNLOCK(id);
+	  return (ERROR);
+	}
+    }
+  else
+    C775_STAT_ADD(id, nempty, 1);
+  C775_STAT_ADD(id, npoll, 1);
+
+  C775UNLOCK(id);
+  return (nevts);
+}
+
+unsigned int
+c775GDReady (unsigned int idmask, int nloop)
+{
+  int iloop, id, stat = 0;
+  unsigned int dmask = 0;
+
+  for (iloop = 0; iloop < nloop; iloop++)
+    {
+      for (id = 0; id < Nc775; id++)
+	{
+	  if (idmask & (1 << id))
+	    {			/* id used */
+
+	      if (!(dmask & (1 << id)))
+		{		/* No data ready yet. Check it now. */
+		  C775LOCK(id);
+		  stat =
+		    vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY;
+		  C775_STAT_ADD(id, npoll, 1);
+		  if (!stat)
+		    C775_STAT_ADD(id, nempty, 1);
+		  C775UNLOCK(id);
+
+		  if (stat)
+		    dmask |= (1 << id);
+
+		  if (dmask == idmask)
+		    {		/* Data ready mask matches user idmask */
+		      return (dmask);
+		    }
+		}
+	    }
+	}
+    }
+
+  return (dmask);
+}
+
+
+/*******************************************************************************
+*
+* c775SetWaitMode - Select how c775WaitReady waits for data (per run)
+*
+*   mode   - C775_WAIT_SPIN     : poll the Data Ready bit until the timeout
+*                                 (lowest latency, keeps the bus and a CPU
+*                                 busy when the trigger rate is low)
+*            C775_WAIT_ADAPTIVE : poll for spinUs, then sleep between polls,
+*                                 from C775_WAIT_SLEEP_MIN doubling up to
+*                                 C775_WAIT_SLEEP_MAX us
+*            C775_WAIT_INT      : poll for spinUs, then sleep until the TDC
+*                                 interrupt.  Interrupts must be set up with
+*                                 c775IntConnect and c775IntEnable.  The
+*                                 default handler then leaves the data in
+*                                 the module.
+*   spinUs - polling time before sleeping (us), <0 for C775_WAIT_SPIN_US
+*
+* c775WaitFd      - Return a file descriptor that becomes readable on the
+*                   TDC interrupt (Linux, C775_WAIT_INT), for a readout
+*                   loop that waits in poll/select itself.  Read the 8 byte
+*                   interrupt count from it to clear it.
+*
+* RETURNS: OK or ERROR.  c775WaitFd: the fd or ERROR.
+*/
+
+STATUS
+c775SetWaitMode(int mode, int spinUs)
+{
+  if ((mode < C775_WAIT_SPIN) || (mode > C775_WAIT_INT))
+    {
+      C775_LOG("c775SetWaitMode: ERROR : Invalid mode %d\n", mode, 0, 0, 0,
+	       0, 0);
+      return (ERROR);
+    }
+
+#ifndef VXWORKS
+  if ((mode == C775_WAIT_INT) && (c775WaitFd() < 0))
+    return (ERROR);
+#endif
+
+  c775WaitSpinUs = (spinUs < 0) ? C775_WAIT_SPIN_US : spinUs;
+  c775WaitMode = mode;
+
+  return (OK);
+}
+
+int
+c775WaitFd()
+{
+#ifdef VXWORKS
+  C775_LOG("c775WaitFd: ERROR : Not supported on VxWorks\n", 0, 0, 0, 0, 0,
+	   0);
+  return (ERROR);
+#else
+  if (c775WaitEvFd < 0)
+    {
+      c775WaitEvFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (c775WaitEvFd < 0)
+	{
+	  perror("c775WaitFd: eventfd");
+	  return (ERROR);
+	}
+    }
+
+  return (c775WaitEvFd);
+#endif
+}
+
+/* Sleep up to us, or (C775_WAIT_INT) until the interrupt */
+LOCAL void
+c775WaitSleep(int mode, unsigned long long us)
+{
+#ifdef VXWORKS
+  if (mode == C775_WAIT_INT)
+    {
+      int ticks = (int) ((us * sysClkRateGet() + 999999) / 1000000);
+      semTake(c775Sem, ticks);
+    }
+  else
+    taskDelay(0);		/* a tick is too long, just yield */
+#else
+  struct timeval tv;
+  fd_set fds;
+  unsigned long long cnt;
+
+  tv.tv_sec = us / 1000000;
+  tv.tv_usec = us % 1000000;
+  if (mode == C775_WAIT_INT)
+    {
+      FD_ZERO(&fds);
+      FD_SET(c775WaitEvFd, &fds);
+      if (select(c775WaitEvFd + 1, &fds, NULL, NULL, &tv) > 0)
+	if (read(c775WaitEvFd, &cnt, sizeof(cnt)) < 0)
+	  cnt = 0;		/* already cleared by another waiter */
+    }
+  else
+    select(0, NULL, NULL, NULL, &tv);
+#endif
+}
+
+/*******************************************************************************
+*
+* c775WaitReady - Wait for data in the TDC, with the strategy selected by
+*                 c775SetWaitMode.  Each poll is a single read of Status
+*                 Register 1; the event counter is read once data is ready.
+*
+*   timeout - longest wait in us (0: check once)
+*
+* RETURNS: # of events in FIFO (1-32), 0 on timeout, or ERROR.
+*/
+
+int
+c775WaitReady(int id, int timeout)
+{
+  unsigned long long t0, now, left;
+  unsigned long long sleepUs = C775_WAIT_SLEEP_MIN;
+  int mode = c775WaitMode;
+  UINT16 stat;
+
+  if ((id < 0) || (c775p[id] == NULL))
+    {
+      C775_LOG("c775WaitReady: ERROR : TDC id %d not initialized \n", id, 0,
+	       0, 0, 0, 0);
       return (ERROR);
     }
 
-  C775LOCK;
-  stat = vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY;
-  if (stat)
+  /* Only a TDC with interrupts wakes us up */
+  if ((mode == C775_WAIT_INT) && !c775IntTab[id].enabled)
+    mode = C775_WAIT_ADAPTIVE;
+
+  t0 = c775NowUs();
+  while (1)
     {
-      C775_EXEC_READ_EVENT_COUNT(id);
-      nevts = c775EventCount[id] - c775EvtReadCnt[id];
-      if (nevts <= 0)
+      C775LOCK(id);
+      stat = vmeRead16(&c775p[id]->main.status1) & C775_DATA_READY;
+      if (!stat)
 	{
-	  logMsg("c775Dready: ERROR : Bad Event Ready Count (nevts = %d)\n",
-		 nevts, 0, 0, 0, 0, 0);
-	  C775UNLOCK;
-	  return (ERROR);
+	  C775_STAT_ADD(id, npoll, 1);
+	  C775_STAT_ADD(id, nempty, 1);
 	}
-    }
+      C775UNLOCK(id);
 
-  C775UNLOCK;
-  return (nevts);
+      if (stat)
+	return (c775Dready(id));
+
+      now = c775NowUs();
+      if (now - t0 >= (unsigned long long) timeout)
+	return (0);
+      if ((mode == C775_WAIT_SPIN)
+	  || (now - t0 < (unsigned long long) c775WaitSpinUs))
+	continue;
+
+      left = t0 + timeout - now;
+      if (mode == C775_WAIT_INT)
+	c775WaitSleep(mode, left);
+      else
+	{
+	  c775WaitSleep(mode, (sleepUs < left) ? sleepUs : left);
+	  if (sleepUs < C775_WAIT_SLEEP_MAX)
+	    sleepUs *= 2;
+	}
+    }
 }
 
 
@@ -1266,33 +3878,33 @@ c775SetFSR(int id, UINT16 fsr)
 
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775SetFSR: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
+      C775_LOG("c775SetFSR: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
 	     0, 0);
       return (ERROR);
     }
 
-  C775LOCK;
+  C775LOCK(id);
   if (fsr == 0)
     {
-      reg = vmeRead16(&c775p[id]->main.fsr) & C775_FSR_MASK;
+      reg = c775Shadow[id].fsr;
       rfsr = (int) (290 - reg) * 4;
     }
   else if ((fsr < C775_MIN_FSR) || (fsr > C775_MAX_FSR))
     {
-      logMsg("c775SetFSR: ERROR: FSR (%d ns) out of range (140<=FSR<=1200)\n",
+      C775_LOG("c775SetFSR: ERROR: FSR (%d ns) out of range (140<=FSR<=1200)\n",
 	     fsr, 0, 0, 0, 0, 0);
-      C775UNLOCK;
+      C775UNLOCK(id);
       return (ERROR);
     }
   else
     {
       reg = (UINT16) (290 - (fsr >> 2));
-      vmeWrite16(&c775p[id]->main.fsr, reg);
-      reg = vmeRead16(&c775p[id]->main.fsr) & C775_FSR_MASK;
+      C775_SHADOW_WRITE(id, fsr, reg);
+      reg = c775Shadow[id].fsr;
       rfsr = (int) (290 - reg) * 4;
     }
 
-  C775UNLOCK;
+  C775UNLOCK(id);
   return (rfsr);
 
 }
@@ -1312,17 +3924,17 @@ c775BitSet2(int id, UINT16 val)
 
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775BitSet2: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
+      C775_LOG("c775BitSet2: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
 	     0, 0);
       return (ERROR);
     }
 
-  C775LOCK;
+  C775LOCK(id);
   if (val)
-    vmeWrite16(&c775p[id]->main.bitSet2, val);
-  rval = vmeRead16(&c775p[id]->main.bitSet2) & C775_BITSET2_MASK;
+    C775_SHADOW_BITSET2(id, val);
+  rval = c775Shadow[id].bitSet2 & C775_BITSET2_MASK;
 
-  C775UNLOCK;
+  C775UNLOCK(id);
   return (rval);
 }
 
@@ -1333,17 +3945,17 @@ c775BitClear2(int id, UINT16 val)
 
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775BitClear2: ERROR : TDC id %d not initialized \n", id, 0, 0,
+      C775_LOG("c775BitClear2: ERROR : TDC id %d not initialized \n", id, 0, 0,
 	     0, 0, 0);
       return (ERROR);
     }
 
-  C775LOCK;
+  C775LOCK(id);
   if (val)
-    vmeWrite16(&c775p[id]->main.bitClear2, val);
-  rval = vmeRead16(&c775p[id]->main.bitSet2) & C775_BITSET2_MASK;
+    C775_SHADOW_BITCLEAR2(id, val);
+  rval = c775Shadow[id].bitSet2 & C775_BITSET2_MASK;
 
-  C775UNLOCK;
+  C775UNLOCK(id);
   return (rval);
 }
 
@@ -1371,21 +3983,140 @@ c775BitClear2(int id, UINT16 val)
 void
 c775ClearThresh(int id)
 {
-  int ii;
+  UINT16 zero[C775_MAX_CHANNELS];
 
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775ClearThresh: ERROR : TDC id %d not initialized \n", id, 0,
+      C775_LOG("c775ClearThresh: ERROR : TDC id %d not initialized \n", id, 0,
 	     0, 0, 0, 0);
       return;
     }
 
-  C775LOCK;
-  for (ii = 0; ii < C775_MAX_CHANNELS; ii++)
+  memset(zero, 0, sizeof(zero));
+  c775SetThreshAll(1 << id, zero, 0, NULL);
+}
+
+/*******************************************************************************
+*
+* c775SetThreshAll - Load the thresholds of all the channels of the TDCs in
+*                    idmask (bit n for TDC id n)
+*
+*   thresh  - C775_MAX_CHANNELS values per TDC, the tables one after the
+*             other in id order.  Bits 0-7 are the threshold, and
+*             C775_THRESH_KILL kills the channel.
+*   flags   - C775_THRESH_VERIFY : read back all the thresholds once loaded
+*             C775_THRESH_FORCE  : also write the channels the host copy
+*                                  says already hold the value
+*             C775_THRESH_SAME   : thresh is a single table, for all TDCs.
+*                                  If idmask is the whole MCST chain, it is
+*                                  written once to the MCST address.
+*   badmask - with C775_THRESH_VERIFY, one word per TDC in id order, with
+*             bit n set if channel n read back wrong (may be NULL)
+*
+*   Each TDC is locked once for its whole table.  Channels already holding
+*   the value (see c775ShadowSync) are not written, so reloading the same
+*   tables costs no write, only the readback.  A channel that reads back
+*   wrong is written again on the next call.
+*
+*
+* RETURNS: The number of channels that read back wrong (0 without
+*          C775_THRESH_VERIFY), or ERROR.
+*/
+
+int
+c775SetThreshAll(UINT32 idmask, UINT16 * thresh, int flags, UINT32 * badmask)
+{
+  UINT16 *tab, val;
+  UINT32 chainmask = 0, bad;
+  int ii, ich, imod = 0, nbad = 0, mcst = 0;
+
+  if ((thresh == NULL) || (idmask == 0) ||
+      (flags & ~(C775_THRESH_VERIFY | C775_THRESH_FORCE | C775_THRESH_SAME)))
+    {
+      C775_LOG
+	("c775SetThreshAll: ERROR : Invalid arguments (idmask 0x%x, flags 0x%x)\n",
+	 idmask, flags, 0, 0, 0, 0);
+      return (ERROR);
+    }
+  for (ii = 0; ii < 32; ii++)
+    {
+      if (!(idmask & (1U << ii)))
+	continue;
+      if ((ii >= Nc775) || (c775p[ii] == NULL))
+	{
+	  C775_LOG("c775SetThreshAll: ERROR : TDC id %d not initialized \n",
+		   ii, 0, 0, 0, 0, 0);
+	  return (ERROR);
+	}
+    }
+
+  /* One table for the whole chain: a single MCST write per channel */
+  if ((flags & C775_THRESH_SAME) && (c775MCSTp != NULL))
+    {
+      for (ii = 0; ii < Nc775; ii++)
+	if (c775CBLTRole[ii] != C775_CBLT_DISABLED)
+	  chainmask |= (1 << ii);
+      mcst = (chainmask == idmask);
+    }
+
+  if (mcst)
+    {
+      C775LOCK_ALL;
+      for (ich = 0; ich < C775_MAX_CHANNELS; ich++)
+	{
+	  val = thresh[ich] & C775_SHMASK_threshold;
+	  for (ii = 0; ii < Nc775; ii++)
+	    if ((idmask & (1 << ii))
+		&& (c775Shadow[ii].threshold[ich] != val))
+	      break;
+	  if ((ii == Nc775) && !(flags & C775_THRESH_FORCE))
+	    continue;
+	  vmeWrite16(&c775MCSTp->main.threshold[ich], val);
+	  for (ii = 0; ii < Nc775; ii++)
+	    if (idmask & (1 << ii))
+	      c775Shadow[ii].threshold[ich] = val;
+	}
+      C775UNLOCK_ALL;
+    }
+
+  for (ii = 0; ii < Nc775; ii++)
     {
-      vmeWrite16(&c775p[id]->main.threshold[ii], 0);
+      if (!(idmask & (1 << ii)))
+	continue;
+      tab =
+	(flags & C775_THRESH_SAME) ? thresh : &thresh[imod * C775_MAX_CHANNELS];
+      bad = 0;
+
+      C775LOCK(ii);
+      for (ich = 0; (ich < C775_MAX_CHANNELS) && !mcst; ich++)
+	{
+	  val = tab[ich] & C775_SHMASK_threshold;
+	  if ((flags & C775_THRESH_FORCE)
+	      || (c775Shadow[ii].threshold[ich] != val))
+	    C775_SHADOW_THRESH(ii, ich, val);
+	}
+      if (flags & C775_THRESH_VERIFY)
+	{
+	  for (ich = 0; ich < C775_MAX_CHANNELS; ich++)
+	    {
+	      val =
+		vmeRead16(&c775p[ii]->main.threshold[ich]) &
+		C775_SHMASK_threshold;
+	      if (val == (tab[ich] & C775_SHMASK_threshold))
+		continue;
+	      c775Shadow[ii].threshold[ich] = val;
+	      bad |= (1 << ich);
+	      nbad++;
+	    }
+	}
+      C775UNLOCK(ii);
+
+      if (badmask)
+	badmask[imod] = bad;
+      imod++;
     }
-  C775UNLOCK;
+
+  return (nbad);
 }
 
 void
@@ -1393,13 +4124,13 @@ c775Gate(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775Gate: ERROR : TDC id %d not initialized \n", id, 0, 0, 0, 0,
+      C775_LOG("c775Gate: ERROR : TDC id %d not initialized \n", id, 0, 0, 0, 0,
 	     0);
       return;
     }
-  C775LOCK;
+  C775LOCK(id);
   C775_EXEC_GATE(id);
-  C775UNLOCK;
+  C775UNLOCK(id);
 }
 
 void
@@ -1407,14 +4138,14 @@ c775EnableBerr(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775EnableBerr: ERROR : QDC id %d not initialized \n", id, 0, 0,
+      C775_LOG("c775EnableBerr: ERROR : QDC id %d not initialized \n", id, 0, 0,
 	     0, 0, 0);
       return;
     }
 
-  C775LOCK;
-  vmeWrite16(&c775p[id]->main.control1, C775_BERR_ENABLE);	/*  | C775_BLK_END); */
-  C775UNLOCK;
+  C775LOCK(id);
+  C775_SHADOW_WRITE(id, control1, C775_BERR_ENABLE);	/*  | C775_BLK_END); */
+  C775UNLOCK(id);
 }
 
 void
@@ -1422,16 +4153,15 @@ c775DisableBerr(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775DisableBerr: ERROR : QDC id %d not initialized \n", id, 0, 0,
+      C775_LOG("c775DisableBerr: ERROR : QDC id %d not initialized \n", id, 0, 0,
 	     0, 0, 0);
       return;
     }
 
-  C775LOCK;
-  vmeWrite16(&c775p[id]->main.control1,
-	    vmeRead16(&c775p[id]->main.control1)
-	     & ~(C775_BERR_ENABLE | C775_BLK_END));
-  C775UNLOCK;
+  C775LOCK(id);
+  C775_SHADOW_WRITE(id, control1,
+		    c775Shadow[id].control1 & ~(C775_BERR_ENABLE | C775_BLK_END));
+  C775UNLOCK(id);
 }
 
 void
@@ -1439,7 +4169,7 @@ c775IncrEventBlk(int id, int count)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775IncrEventBlk: ERROR : TDC id %d not initialized \n", id, 0,
+      C775_LOG("c775IncrEventBlk: ERROR : TDC id %d not initialized \n", id, 0,
 	     0, 0, 0, 0);
       return;
     }
@@ -1453,13 +4183,13 @@ c775IncrEvent(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775IncrEvent: ERROR : TDC id %d not initialized \n", id, 0, 0,
+      C775_LOG("c775IncrEvent: ERROR : TDC id %d not initialized \n", id, 0, 0,
 	     0, 0, 0);
       return;
     }
-  C775LOCK;
+  C775LOCK(id);
   C775_EXEC_INCR_EVENT(id);
-  C775UNLOCK;
+  C775UNLOCK(id);
 }
 
 void
@@ -1467,13 +4197,13 @@ c775IncrWord(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775IncrWord: ERROR : TDC id %d not initialized \n", id, 0, 0,
+      C775_LOG("c775IncrWord: ERROR : TDC id %d not initialized \n", id, 0, 0,
 	     0, 0, 0);
       return;
     }
-  C775LOCK;
+  C775LOCK(id);
   C775_EXEC_INCR_WORD(id);
-  C775UNLOCK;
+  C775UNLOCK(id);
 }
 
 void
@@ -1481,13 +4211,13 @@ c775Enable(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775Enable: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
+      C775_LOG("c775Enable: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
 	     0, 0);
       return;
     }
-  C775LOCK;
-  vmeWrite16(&c775p[id]->main.bitClear2, C775_OFFLINE);
-  C775UNLOCK;
+  C775LOCK(id);
+  C775_SHADOW_BITCLEAR2(id, C775_OFFLINE);
+  C775UNLOCK(id);
 }
 
 void
@@ -1495,13 +4225,13 @@ c775Disable(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775Disable: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
+      C775_LOG("c775Disable: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
 	     0, 0);
       return;
     }
-  C775LOCK;
-  vmeWrite16(&c775p[id]->main.bitSet2, C775_OFFLINE);
-  C775UNLOCK;
+  C775LOCK(id);
+  C775_SHADOW_BITSET2(id, C775_OFFLINE);
+  C775UNLOCK(id);
 }
 
 void
@@ -1509,13 +4239,13 @@ c775CommonStop(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775CommonStop: ERROR : TDC id %d not initialized \n", id, 0, 0,
+      C775_LOG("c775CommonStop: ERROR : TDC id %d not initialized \n", id, 0, 0,
 	     0, 0, 0);
       return;
     }
-  C775LOCK;
-  vmeWrite16(&c775p[id]->main.bitSet2, C775_COMMON_STOP);
-  C775UNLOCK;
+  C775LOCK(id);
+  C775_SHADOW_BITSET2(id, C775_COMMON_STOP);
+  C775UNLOCK(id);
 }
 
 void
@@ -1523,13 +4253,13 @@ c775CommonStart(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775CommonStart: ERROR : TDC id %d not initialized \n", id, 0,
+      C775_LOG("c775CommonStart: ERROR : TDC id %d not initialized \n", id, 0,
 	     0, 0, 0, 0);
       return;
     }
-  C775LOCK;
-  vmeWrite16(&c775p[id]->main.bitClear2, C775_COMMON_STOP);
-  C775UNLOCK;
+  C775LOCK(id);
+  C775_SHADOW_BITCLEAR2(id, C775_COMMON_STOP);
+  C775UNLOCK(id);
 }
 
 
@@ -1538,13 +4268,14 @@ c775Clear(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775Clear: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
+      C775_LOG("c775Clear: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
 	     0, 0);
       return;
     }
-  C775LOCK;
+  C775LOCK(id);
   C775_EXEC_DATA_RESET(id);
-  C775UNLOCK;
+  C775_STAT_ADD(id, nclear, 1);
+  C775UNLOCK(id);
   c775EvtReadCnt[id] = -1;
   c775EventCount[id] = 0;
 
@@ -1555,14 +4286,439 @@ c775Reset(int id)
 {
   if ((id < 0) || (c775p[id] == NULL))
     {
-      logMsg("c775Reset: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
+      C775_LOG("c775Reset: ERROR : TDC id %d not initialized \n", id, 0, 0, 0,
 	     0, 0);
       return;
     }
-  C775LOCK;
+  C775LOCK(id);
   C775_EXEC_DATA_RESET(id);
   C775_EXEC_SOFT_RESET(id);
-  C775UNLOCK;
+  C775_STAT_ADD(id, nclear, 1);
+  C775UNLOCK(id);
   c775EvtReadCnt[id] = -1;
   c775EventCount[id] = 0;
 }
+
+/*******************************************************************************
+*
+* c775SetByteOrder - Select the byte order of the data buffers filled by
+*                    c775ReadEvent, c775ReadEvents, c775ReadBlock,
+*                    c775ReadBlockOverlap and c775CBLTReadBlock
+*                    C775_ORDER_VME : as it comes off the bus (default).
+*                                     Nothing is swapped in the trigger
+*                                     path: the consumer swaps, if needed.
+*                    C775_ORDER_CPU : CPU byte order.  Each block is
+*                                     swapped in one go after the read.
+*                    On VxWorks both are the same.
+* c775GetByteOrder - Return the current setting
+*
+*
+* RETURNS: c775SetByteOrder: OK or ERROR.  c775GetByteOrder: the setting.
+*/
+
+STATUS
+c775SetByteOrder (int order)
+{
+  if ((order != C775_ORDER_VME) && (order != C775_ORDER_CPU))
+    {
+      printf ("c775SetByteOrder: ERROR: Invalid byte order (%d)\n", order);
+      return (ERROR);
+    }
+
+  c775ByteOrder = order;
+
+  return (OK);
+}
+
+int
+c775GetByteOrder ()
+{
+  return (c775ByteOrder);
+}
+
+/*******************************************************************************
+*
+* c775SetLockPolicy  - Select the type of the per-module locks
+*                      C775_LOCK_NONE  : no locking (single threaded readout)
+*                      C775_LOCK_SPIN  : spinlocks
+*                      C775_LOCK_MUTEX : pthread mutexes (default)
+*                      Refused while the interrupts, the interrupt worker or
+*                      the sampler run, or while a lock is held.
+* c775LockTiming     - Enable/Disable measurement of lock wait and hold times
+* c775GetLockStats   - Copy the lock counters of a TDC
+* c775ClearLockStats - Zero the lock counters of a TDC (id<0 for all)
+* c775PrintLockStats - Print the lock counters of a TDC (id<0 for all)
+*
+*
+* RETURNS: c775SetLockPolicy and c775GetLockStats: OK or ERROR.
+*          Others: None.
+*/
+
+STATUS
+c775SetLockPolicy (int policy)
+{
+#ifdef VXWORKS
+  printf ("c775SetLockPolicy: ERROR: Not supported on VxWorks\n");
+  return (ERROR);
+#else
+  c775Lock_t *lk;
+  int ii, old, busy = 0;
+
+  if ((policy < C775_LOCK_NONE) || (policy > C775_LOCK_MUTEX))
+    {
+      printf ("c775SetLockPolicy: ERROR: Invalid lock policy (%d)\n", policy);
+      return (ERROR);
+    }
+  if (c775IntRunning || (c775IntMode != C775_INT_DIRECT) || (c775SampleMs > 0))
+    {
+      printf
+	("c775SetLockPolicy: ERROR: Interrupts, interrupt worker or sampler running\n");
+      return (ERROR);
+    }
+
+  pthread_once (&c775LockOnce, c775LockInitAll);
+
+  /* Take every lock, so that none is held across the change.  A thread
+     that waits for one releases it as it was taken (c775LockRelease) */
+  old = c775LockPolicy;
+  for (ii = 0; ii < C775_MAX_MODULES; ii++)
+    {
+      lk = &c775Lock[ii];
+      if (old == C775_LOCK_MUTEX)
+	busy = pthread_mutex_trylock (&lk->mutex);
+      else if (old == C775_LOCK_SPIN)
+	busy = pthread_spin_trylock (&lk->spin);
+      if (busy)
+	break;
+    }
+
+  if (busy)
+    printf ("c775SetLockPolicy: ERROR: Lock of TDC id %d is held\n", ii);
+  else
+    c775LockPolicy = policy;
+
+  while (--ii >= 0)
+    {
+      lk = &c775Lock[ii];
+      if (old == C775_LOCK_MUTEX)
+	pthread_mutex_unlock (&lk->mutex);
+      else if (old == C775_LOCK_SPIN)
+	pthread_spin_unlock (&lk->spin);
+    }
+
+  return (busy ? ERROR : OK);
+#endif
+}
+
+void
+c775LockTiming (int enable)
+{
+#ifndef VXWORKS
+  c775LockTimeEnable = enable ? 1 : 0;
+#endif
+}
+
+STATUS
+c775GetLockStats (int id, c775LockStats * stats)
+{
+  if ((id < 0) || (id >= C775_MAX_MODULES) || (stats == NULL))
+    {
+      printf ("c775GetLockStats: ERROR : Invalid TDC id %d \n", id);
+      return (ERROR);
+    }
+
+#ifdef VXWORKS
+  memset (stats, 0, sizeof (c775LockStats));
+#else
+  C775LOCK (id);
+  *stats = c775Lock[id].stats;
+  C775UNLOCK (id);
+  /* Do not count the copy itself */
+  stats->nlock--;
+#endif
+
+  return (OK);
+}
+
+void
+c775ClearLockStats (int id)
+{
+#ifndef VXWORKS
+  int ii;
+
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if ((id >= 0) && (ii != id))
+	continue;
+      C775LOCK (ii);
+      memset (&c775Lock[ii].stats, 0, sizeof (c775LockStats));
+      C775UNLOCK (ii);
+    }
+#endif
+}
+
+void
+c775PrintLockStats (int id)
+{
+  int ii;
+  c775LockStats st;
+
+  printf ("\n");
+  printf ("                    CAEN775 Lock Statistics (%s%s)\n\n",
+#ifdef VXWORKS
+	  "none", ""
+#else
+	  (c775LockPolicy == C775_LOCK_MUTEX) ? "mutex" :
+	  (c775LockPolicy == C775_LOCK_SPIN) ? "spinlock" : "none",
+	  c775LockTimeEnable ? ", timed" : ""
+#endif
+    );
+  printf
+    ("  #     Locks        Contended    Wait [us]     Held [us]     Max held [us]\n");
+  printf
+    ("--------------------------------------------------------------------------------\n");
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if ((id >= 0) && (ii != id))
+	continue;
+      c775GetLockStats (ii, &st);
+      printf (" %2d  %12llu %12llu %13.1f %13.1f %13.1f\n", ii,
+	      st.nlock, st.ncontend, st.waitTime / 1000., st.holdTime / 1000.,
+	      st.holdMax / 1000.);
+    }
+  printf
+    ("--------------------------------------------------------------------------------\n");
+  printf ("\n");
+}
+
+/*******************************************************************************
+*
+* c775GetStats       - Copy the readout counters of a TDC
+*                      (id = C775_STATS_CBLT for the CBLT transfers)
+* c775ClearStats     - Zero the readout counters of a TDC (id<0 for all,
+*                      including CBLT)
+* c775PrintStats     - Print the readout counters of a TDC (id<0 for all)
+* c775StatsShmOpen   - Move the readout counters to the POSIX shared memory
+*                      segment name (NULL for C775_STATS_SHM), so that they
+*                      can be followed from another process.  The counters
+*                      kept so far are carried over.
+* c775StatsShmClose  - Move the readout counters back to local memory.  The
+*                      segment is left in place, for tools reading it after
+*                      the run.  Must not be called during the readout.
+*
+*   The counters are not locked against the readout, so a copy taken during
+*   the run may mix values from before and after an event.
+*
+*
+* RETURNS: c775GetStats and c775StatsShmOpen: OK or ERROR.
+*          Others: None.
+*/
+
+STATUS
+c775GetStats (int id, c775ModStats * stats)
+{
+  if ((id < 0) || (id > C775_STATS_CBLT) || (stats == NULL))
+    {
+      printf ("c775GetStats: ERROR : Invalid TDC id %d \n", id);
+      return (ERROR);
+    }
+
+#ifdef VXWORKS
+  memset (stats, 0, sizeof (c775ModStats));
+#else
+  if (id == C775_STATS_CBLT)
+    *stats = c775Stats->cblt;
+  else
+    *stats = c775Stats->mod[id];
+#endif
+
+  return (OK);
+}
+
+void
+c775ClearStats (int id)
+{
+#ifndef VXWORKS
+  int ii;
+
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if ((id >= 0) && (ii != id))
+	continue;
+      C775LOCK (ii);
+      memset (&c775Stats->mod[ii], 0, sizeof (c775ModStats));
+      C775UNLOCK (ii);
+    }
+  if ((id < 0) || (id == C775_STATS_CBLT))
+    {
+      C775LOCK_ALL;
+      memset (&c775Stats->cblt, 0, sizeof (c775ModStats));
+      C775UNLOCK_ALL;
+    }
+#endif
+}
+
+void
+c775PrintStats (int id)
+{
+  int ii;
+  c775ModStats st;
+
+  printf ("\n");
+  printf ("                    CAEN775 Readout Statistics\n\n");
+  printf
+    ("  #     Events       Words     DMA  DMA [MB]  DMA [us]  PIO [us]     Polls     Empty  BadH  BadT  BERR  Clr\n");
+  printf
+    ("----------------------------------------------------------------------------------------------------------------\n");
+  for (ii = 0; ii <= C775_STATS_CBLT; ii++)
+    {
+      if ((id >= 0) && (ii != id))
+	continue;
+      if ((ii >= Nc775) && (ii != C775_STATS_CBLT))
+	continue;
+      c775GetStats (ii, &st);
+      if (ii == C775_STATS_CBLT)
+	{
+	  if (st.ndma == 0)
+	    continue;
+	  printf ("CBLT");
+	}
+      else
+	printf (" %2d ", ii);
+      printf
+	(" %10llu %11llu %7llu %9.2f %9.0f %9.0f %9llu %9llu %5llu %5llu %5llu %4llu\n",
+	 st.nevents, st.nwords, st.ndma, st.dmaBytes / 1e6,
+	 st.dmaTime / 1000., st.pioTime / 1000., st.npoll, st.nempty,
+	 st.nbadHeader, st.nbadTrailer, st.nberr, st.nclear);
+    }
+  printf
+    ("----------------------------------------------------------------------------------------------------------------\n");
+  for (ii = 0; ii < Nc775; ii++)
+    {
+      if (((id >= 0) && (ii != id)) || !c775IntTab[ii].enabled)
+	continue;
+      printf
+	("  Interrupts %2d: %llu, %u events per interrupt%s, %u interrupts/s, %u events/s, %u retunes\n",
+	 ii, c775IntTab[ii].st.nint, c775IntTab[ii].st.level,
+	 c775IntTab[ii].adaptOn ? " (adaptive)" : "",
+	 c775IntTab[ii].st.intRate, c775IntTab[ii].st.trigRate,
+	 c775IntTab[ii].st.nretune);
+      if (c775IntTab[ii].st.ndefer)
+	printf
+	  ("                 deferred to the worker, waited %.1f us mean, %llu us max\n",
+	   (double) c775IntTab[ii].st.deferSum / c775IntTab[ii].st.ndefer,
+	   c775IntTab[ii].st.deferMax);
+    }
+#ifndef VXWORKS
+  printf
+    ("  Messages: %llu queued, %llu over the rate limit, %llu lost (ring full)\n",
+     c775Log.nput, c775Log.nsupp, c775Log.nlost);
+#endif
+  printf ("\n");
+}
+
+STATUS
+c775StatsShmOpen (char *name)
+{
+#ifdef VXWORKS
+  printf ("c775StatsShmOpen: ERROR: Not supported on VxWorks\n");
+  return (ERROR);
+#else
+  int fd;
+  c775StatsSeg *seg;
+
+  if (c775Stats != &c775StatsLocal)
+    {
+      printf ("c775StatsShmOpen: ERROR: Shared memory segment already open\n");
+      return (ERROR);
+    }
+  if (name == NULL)
+    name = C775_STATS_SHM;
+
+  fd = shm_open (name, O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+    {
+      perror ("c775StatsShmOpen: shm_open");
+      return (ERROR);
+    }
+  if (ftruncate (fd, sizeof (c775StatsSeg)) < 0)
+    {
+      perror ("c775StatsShmOpen: ftruncate");
+      close (fd);
+      return (ERROR);
+    }
+  seg = (c775StatsSeg *) mmap (NULL, sizeof (c775StatsSeg),
+			       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (seg == MAP_FAILED)
+    {
+      perror ("c775StatsShmOpen: mmap");
+      return (ERROR);
+    }
+
+  pthread_mutex_lock (&c775SampleMutex);
+  C775LOCK_ALL;
+  memcpy (seg, &c775StatsLocal, sizeof (c775StatsSeg));
+  seg->magic = C775_STATS_MAGIC;
+  seg->version = C775_STATS_VERSION;
+  seg->size = sizeof (c775StatsSeg);
+  seg->nmod = Nc775;
+  c775Stats = seg;
+  C775UNLOCK_ALL;
+  pthread_mutex_unlock (&c775SampleMutex);
+
+  printf ("c775StatsShmOpen: Readout counters in shared memory %s\n", name);
+
+  return (OK);
+#endif
+}
+
+void
+c775StatsShmClose ()
+{
+#ifndef VXWORKS
+  c775StatsSeg *seg = c775Stats;
+
+  if (seg == &c775StatsLocal)
+    return;
+
+  pthread_mutex_lock (&c775SampleMutex);
+  C775LOCK_ALL;
+  memcpy (&c775StatsLocal, seg, sizeof (c775StatsSeg));
+  c775Stats = &c775StatsLocal;
+  C775UNLOCK_ALL;
+  pthread_mutex_unlock (&c775SampleMutex);
+
+  munmap (seg, sizeof (c775StatsSeg));
+#endif
+}
+
+/*******************************************************************************
+*
+* c775LogRate   - Set the number of messages per second let through from
+*                 each place in the library (0: V7XX_LOG_RATE).  The others
+*                 are counted, and the count printed with the next one.
+* c775LogFlush  - Print the queued messages now, in the calling thread
+*
+*   Linux only.  On VxWorks, messages go straight to logMsg.
+*
+*
+* RETURNS: c775LogFlush: Number of messages printed.
+*          c775LogRate: None.
+*/
+
+void
+c775LogRate (int rate)
+{
+  c775Log.rate = (rate > 0) ? rate : 0;
+}
+
+int
+c775LogFlush ()
+{
+#ifdef VXWORKS
+  return (0);
+#else
+  return (v7xxLogFlush (&c775Log));
+#endif
+}
@@ -16,6 +16,9 @@
 *
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   /* SCHED_IDLE, in <sched.h> */
+#endif
 #ifdef VXWORKS
 #include "vxWorks.h"
 #include "logLib.h"
@@ -23,10 +26,20 @@
 #include "intLib.h"
 #include "iv.h"
 #include "semLib.h"
+#include "tickLib.h"
+#include "sysLib.h"
 #include "vxLib.h"
 #include "fppLib.h"
 #else
 #include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <sched.h>
 #endif
 #include <stdlib.h>
 #include <stdio.h>
@@ -35,6 +48,10 @@
 
 /* Include QDC definitions */
 #include "c792Lib.h"
+#include "v7xxSwap.h"
+#include "v7xxLog.h"
+#include "v7xxInt.h"
+#include "v7xxDma.h"
 
 
 /* Include DMA Library definintions */
@@ -53,25 +70,249 @@ IMPORT  STATUS sysIntEnable(int);
 IMPORT  STATUS sysIntDisable(int);
 #endif
 
-/* Mutex to guard c792 reads/writes - Linux only */
+/* Locks to guard c792 reads/writes - Linux only
+   One lock per QDC, so that slow control on one module does not stall
+   readout of another.  Crate-wide operations (CBLT, MCST) take all of
+   them, in id order.  The lock type is chosen at compile time with
+   C792_LOCK_POLICY, or at run time with c792SetLockPolicy. */
+#ifdef VXWORKS
+#define C792LOCK(id)
+#define C792UNLOCK(id)
+#define C792LOCK_ALL
+#define C792UNLOCK_ALL
+#else
+#ifndef C792_LOCK_POLICY
+#define C792_LOCK_POLICY C792_LOCK_MUTEX
+#endif
+
+typedef struct
+{
+  pthread_mutex_t    mutex;
+  pthread_spinlock_t spin;
+  c792LockStats      stats;
+  unsigned long long t0;       /* time the lock was taken, if timing */
+  int                policy;   /* it was taken with (c792SetLockPolicy) */
+} c792Lock_t;
+
+LOCAL c792Lock_t     c792Lock[C792_MAX_MODULES];
+LOCAL pthread_once_t c792LockOnce = PTHREAD_ONCE_INIT;
+LOCAL int            c792LockPolicy = C792_LOCK_POLICY;
+LOCAL int            c792LockTimeEnable = 0;
+
+LOCAL void
+c792LockInitAll(void)
+{
+  int ii;
+
+  for(ii=0;ii<C792_MAX_MODULES;ii++) {
+    pthread_mutex_init(&c792Lock[ii].mutex, NULL);
+    pthread_spin_init(&c792Lock[ii].spin, PTHREAD_PROCESS_PRIVATE);
+    memset(&c792Lock[ii].stats, 0, sizeof(c792LockStats));
+  }
+}
+
+LOCAL inline unsigned long long
+c792LockNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+}
+
+LOCAL inline void
+c792LockAcquire(int id)
+{
+  c792Lock_t *lk = &c792Lock[id];
+  unsigned long long tw = 0;
+  int busy = 0, policy;
+
+  pthread_once(&c792LockOnce, c792LockInitAll);
+
+  policy = c792LockPolicy;
+  switch(policy) {
+  case C792_LOCK_MUTEX:
+    if((busy = pthread_mutex_trylock(&lk->mutex)) != 0) {
+      if(c792LockTimeEnable) tw = c792LockNow();
+      if(pthread_mutex_lock(&lk->mutex) != 0) perror("pthread_mutex_lock");
+    }
+    break;
+  case C792_LOCK_SPIN:
+    if((busy = pthread_spin_trylock(&lk->spin)) != 0) {
+      if(c792LockTimeEnable) tw = c792LockNow();
+      pthread_spin_lock(&lk->spin);
+    }
+    break;
+  default:
+    break;
+  }
+
+  lk->policy = policy;
+  lk->stats.nlock++;
+  if(c792LockTimeEnable) {
+    lk->t0 = c792LockNow();
+    if(busy) lk->stats.waitTime += lk->t0 - tw;
+  }
+  if(busy) lk->stats.ncontend++;
+}
+
+LOCAL inline void
+c792LockRelease(int id)
+{
+  c792Lock_t *lk = &c792Lock[id];
+  unsigned long long held;
+
+  if(c792LockTimeEnable && lk->t0) {
+    held = c792LockNow() - lk->t0;
+    lk->stats.holdTime += held;
+    if(held > lk->stats.holdMax) lk->stats.holdMax = held;
+    lk->t0 = 0;
+  }
+
+  switch(lk->policy) {
+  case C792_LOCK_MUTEX:
+    if(pthread_mutex_unlock(&lk->mutex) != 0) perror("pthread_mutex_unlock");
+    break;
+  case C792_LOCK_SPIN:
+    pthread_spin_unlock(&lk->spin);
+    break;
+  default:
+    break;
+  }
+}
+
+#define C792LOCK(id)    c792LockAcquire(id)
+#define C792UNLOCK(id)  c792LockRelease(id)
+#define C792LOCK_ALL    {int _ilk; for(_ilk=0;_ilk<Nc792;_ilk++) c792LockAcquire(_ilk);}
+#define C792UNLOCK_ALL  {int _ilk; for(_ilk=Nc792-1;_ilk>=0;_ilk--) c792LockRelease(_ilk);}
+#endif
+
+/* Messages of the library are queued, rate limited, and printed by a
+   thread started in c792Init (see v7xxLog.h) */
+LOCAL v7xxLog c792Log = V7XX_LOG_INIT("c792Lib");
+#define C792_LOG(...)  V7XX_LOG(&c792Log, __VA_ARGS__)
+
+/* Readout counters - Linux only.  The counters of a QDC are written by
+   the thread holding its lock, and can be read at any time without it:
+   with c792GetStats, or from another process through the shared memory
+   segment of c792StatsShmOpen. */
 #ifdef VXWORKS
-#define C792LOCK
-#define C792UNLOCK
+#define C792_STAT_ADD(id,field,n)
+#define C792_CBLT_STAT_ADD(field,n)
+#define C792_STAT_TIME(t)           ((t) = 0)
+#define C792_STAT_SINCE(id,field,t)
 #else
-pthread_mutex_t c792mutex = PTHREAD_MUTEX_INITIALIZER;
-#define C792LOCK   if(pthread_mutex_lock(&c792mutex)<0) perror("pthread_mutex_lock");
-#define C792UNLOCK if(pthread_mutex_unlock(&c792mutex)<0) perror("pthread_mutex_unlock");
+LOCAL c792StatsSeg  c792StatsLocal;
+LOCAL c792StatsSeg *c792Stats = &c792StatsLocal;
+
+#define C792_STAT_INC(st,field,n)   __atomic_store_n(&(st)->field, (st)->field + (n), __ATOMIC_RELAXED)
+#define C792_STAT_ADD(id,field,n)   C792_STAT_INC(&c792Stats->mod[id],field,n)
+#define C792_CBLT_STAT_ADD(field,n) C792_STAT_INC(&c792Stats->cblt,field,n)
+#define C792_STAT_TIME(t)           ((t) = c792LockNow())
+#define C792_STAT_SINCE(id,field,t) C792_STAT_ADD(id,field,c792LockNow()-(t))
 #endif
 
-/* Define Interrupts variables */
+/* Define Interrupts variables (defaults of c792IntConnect) */
 BOOL              c792IntRunning  = FALSE;                    /* running flag */
-int               c792IntID       = -1;                       /* id number of QDC generating interrupts */
+int               c792IntID       = -1;                       /* id number of the first QDC generating interrupts */
 LOCAL VOIDFUNCPTR c792IntRoutine  = NULL;                     /* user interrupt service routine */
 LOCAL int         c792IntArg      = 0;                        /* arg to user routine */
-LOCAL int         c792IntEvCount  = 0;                        /* Number of Events to generate Interrupt */
 LOCAL UINT32      c792IntLevel    = C792_VME_INT_LEVEL;       /* default VME interrupt level */
 LOCAL UINT32      c792IntVec      = C792_INT_VEC;             /* default interrupt Vector */
 
+/* Data ready wait (c792WaitReady) */
+LOCAL int         c792WaitMode    = C792_WAIT_SPIN;           /* C792_WAIT_* */
+LOCAL int         c792WaitSpinUs  = C792_WAIT_SPIN_US;        /* polling before sleeping */
+#ifndef VXWORKS
+LOCAL int         c792WaitEvFd    = -1;                       /* eventfd written by c792Int */
+#endif
+
+/* Interrupt handling (c792SetIntMode) */
+LOCAL int         c792IntMode     = C792_INT_DIRECT;          /* C792_INT_* */
+#ifndef VXWORKS
+LOCAL UINT32      c792IntPending  = 0;                        /* QDCs handed to the worker */
+LOCAL int         c792IntWorkFd   = -1;                       /* eventfd, wakes up the worker */
+LOCAL pthread_t   c792IntWorkThread;
+#endif
+
+/* Register sampler (c792SamplerStart) */
+LOCAL int         c792SampleMs    = 0;                        /* period, 0: not running */
+#ifndef VXWORKS
+LOCAL pthread_t   c792SampleThread;
+LOCAL pthread_mutex_t c792SampleMutex = PTHREAD_MUTEX_INITIALIZER; /* held by the sampler, but while it sleeps */
+LOCAL pthread_cond_t  c792SampleCond;
+#endif
+
+/* Interrupts, per QDC (c792IntEnable, c792IntConnectModule) */
+typedef struct
+{
+  VOIDFUNCPTR routine;          /* user routine, NULL for the default action */
+  int         arg;              /* arg to user routine */
+  UINT32      level;            /* VME interrupt level */
+  UINT32      vec;              /* interrupt vector */
+  int         connected;        /* routine, level and vector from c792IntConnectModule */
+  int         enabled;
+  int         paused;           /* c792IntDisable(0) */
+  int         evCount;          /* Event Trigger register */
+  int         evFixed;          /* evCnt of c792IntEnable */
+  int         maxLatency;       /* c792IntAdaptive: us, 0: no limit */
+  int         maxRate;          /* c792IntAdaptive: interrupts/s, 0: no limit */
+  int         adaptOn;
+  unsigned long long winStart;  /* rate window start (us), 0: none open */
+  unsigned long long lastInt;   /* us, last interrupt (or c792IntEnable) */
+  UINT32      winEvents;        /* event counter at its start */
+  UINT32      winCount;         /* interrupts in it */
+  unsigned long long tfire;     /* C792_INT_DEFERRED: us, handed to the worker */
+  c792IntStats st;
+} c792IntMod;
+
+LOCAL c792IntMod  c792IntTab[C792_MAX_MODULES];
+LOCAL int         c792IntNlevel[8];                           /* QDCs enabled per level */
+
+/* Host copy of the configuration registers (c792ShadowSync).  The
+   library writes them through it, so their getters and read-modify-write
+   need no bus read */
+typedef struct
+{
+  UINT16 geoAddr;
+  UINT16 cbltAddr;
+  UINT16 intLevel;
+  UINT16 intVector;
+  UINT16 control1;
+  UINT16 cbltControl;
+  UINT16 evTrigger;
+  UINT16 fclrWindow;
+  UINT16 bitSet2;
+  UINT16 crateSelect;
+  UINT16 iped;
+  UINT16 threshold[C792_MAX_CHANNELS];
+} c792Shadow_t;
+
+LOCAL c792Shadow_t c792Shadow[C792_MAX_MODULES];
+
+/* Bits that read back, per register */
+#define C792_SHMASK_geoAddr      C792_GEO_MASK
+#define C792_SHMASK_cbltAddr     0x00ff
+#define C792_SHMASK_intLevel     C792_INTLEVEL_MASK
+#define C792_SHMASK_intVector    C792_INTVECTOR_MASK
+#define C792_SHMASK_control1     (C792_CONTROL1_MASK | C792_ALIGN64)
+#define C792_SHMASK_cbltControl  C792_CBLTCTRL_MASK
+#define C792_SHMASK_evTrigger    C792_EVTRIGGER_MASK
+#define C792_SHMASK_fclrWindow   0x03ff
+#define C792_SHMASK_bitSet2      C792_BITSET2_MASK
+#define C792_SHMASK_crateSelect  0x00ff
+#define C792_SHMASK_iped         0x00ff
+#define C792_SHMASK_threshold    0x01ff
+
+/* The shadowed registers, thresholds apart */
+#define C792_SHADOW_REGS						\
+  C792_SHADOW_REG(geoAddr)     C792_SHADOW_REG(cbltAddr)		\
+  C792_SHADOW_REG(intLevel)    C792_SHADOW_REG(intVector)		\
+  C792_SHADOW_REG(control1)    C792_SHADOW_REG(cbltControl)		\
+  C792_SHADOW_REG(evTrigger)   C792_SHADOW_REG(fclrWindow)		\
+  C792_SHADOW_REG(bitSet2)     C792_SHADOW_REG(crateSelect)		\
+  C792_SHADOW_REG(iped)
+
 
 /* Define global variables */
 int Nc792 = 0;                                /* Number of QDCs in Crate */
@@ -80,6 +321,40 @@ volatile struct c792_struct *c792pl[C792_MAX_MODULES];      /* Support for 68K s
 int c792IntCount = 0;                         /* Count of interrupts from QDC */
 int c792EventCount[C792_MAX_MODULES];                       /* Count of Events taken by QDC (Event Count Register value) */
 int c792EvtReadCnt[C792_MAX_MODULES];                       /* Count of events read from specified QDC */
+UINT32 c792CBLTAddr = 0;                                    /* VME A32 address of the CBLT chain */
+int c792CBLTRole[C792_MAX_MODULES];                         /* CBLT chain position of each QDC */
+int c792CBLTGeo[C792_MAX_MODULES];                          /* GEO address of each QDC in the chain */
+volatile struct c792_struct *c792MCSTp = NULL;              /* pointer to the MCST address map */
+int c792ByteOrder = C792_ORDER_VME;                         /* byte order of the data buffers */
+
+/* Data buffers are filled in VME byte order.  With C792_ORDER_CPU, each
+   block is swapped in one go once it has been checked */
+#ifdef VXWORKS
+#define C792_SWAP_BLOCK(data,nwrds)
+#define C792_BUF_WORD(w)  (w)
+#else
+#define C792_SWAP_BLOCK(data,nwrds) {if(c792ByteOrder==C792_ORDER_CPU) v7xxSwapBlock(data,nwrds);}
+#define C792_BUF_WORD(w)  ((c792ByteOrder==C792_ORDER_CPU) ? (w) : LSWAP(w))
+#endif
+
+/* Programmed I/O read of the output buffer, word ii of the window, as it
+   comes off the bus.  Each read pops a word, so a VME library that is not
+   backed by the real bus (emu/jvme.h) has to see every access */
+#ifdef VME_EMU
+#define C792_FIFO_WORD(id,ii)  vmeEmuFifoRead32(&c792pl[id]->data[ii])
+#else
+#define C792_FIFO_WORD(id,ii)  (c792pl[id]->data[ii])
+#endif
+
+/* Block read in flight (c792ReadBlockStart) */
+LOCAL int               c792DmaID     = -1;                 /* QDC id of the transfer, or -1 */
+LOCAL volatile UINT32  *c792DmaData   = NULL;               /* destination of the transfer */
+LOCAL int               c792DmaNwrds  = 0;                  /* requested number of words */
+LOCAL int               c792DmaDummy  = 0;                  /* alignment word inserted */
+LOCAL unsigned long long c792DmaT0    = 0;                  /* start time of the transfer */
+#ifdef VXWORKS68K51
+LOCAL int               c792DmaRetVal = 0;                  /* result of the (synchronous) transfer */
+#endif
 
 unsigned long c792MemOffset = 0;               /* CPUs A24 or A32 address space offset */
 
@@ -92,12 +367,31 @@ SEM_ID c792Sem;                               /* Semephore for Task syncronizati
 /* Macros */
 #define C792_EXEC_SOFT_RESET(id) {					\
     vmeWrite16(&c792p[id]->bitSet1, C792_SOFT_RESET);			\
-    vmeWrite16(&c792p[id]->bitClear1, C792_SOFT_RESET);}
+    vmeWrite16(&c792p[id]->bitClear1, C792_SOFT_RESET);		\
+    c792ShadowLoad(id);}
+
+/* Register writes, through the shadow copy */
+#define C792_SHADOW_WRITE(id,reg,val) {				\
+    c792Shadow[id].reg = (val) & C792_SHMASK_##reg;			\
+    vmeWrite16(&c792p[id]->reg, c792Shadow[id].reg);}
+#define C792_SHADOW_THRESH(id,chan,val) {				\
+    c792Shadow[id].threshold[chan] = (val) & C792_SHMASK_threshold;	\
+    vmeWrite16(&c792p[id]->threshold[chan], c792Shadow[id].threshold[chan]);}
+#define C792_SHADOW_BITSET2(id,bits) {					\
+    c792Shadow[id].bitSet2 |= (bits) & C792_SHMASK_bitSet2;		\
+    vmeWrite16(&c792p[id]->bitSet2, bits);}
+#define C792_SHADOW_BITCLEAR2(id,bits) {				\
+    c792Shadow[id].bitSet2 &= ~(bits);					\
+    vmeWrite16(&c792p[id]->bitClear2, bits);}
 
 #define C792_EXEC_DATA_RESET(id) {					\
     vmeWrite16(&c792p[id]->bitSet2, C792_DATA_RESET);			\
     vmeWrite16(&c792p[id]->bitClear2, C792_DATA_RESET);}
 
+#define C792_EXEC_MCST_DATA_RESET() {					\
+    vmeWrite16(&c792MCSTp->bitSet2, C792_DATA_RESET);			\
+    vmeWrite16(&c792MCSTp->bitClear2, C792_DATA_RESET);}
+
 #define C792_EXEC_READ_EVENT_COUNT(id) {				\
     volatile unsigned short s1, s2;					\
     s1 = vmeRead16(&c792p[id]->evCountL);				\
@@ -123,6 +417,21 @@ SEM_ID c792Sem;                               /* Semephore for Task syncronizati
     vmeWrite16(&c792p[id]->swComm, 1);}
 
 
+/* Read the shadowed registers of QDC id (after a reset) */
+LOCAL void
+c792ShadowLoad(int id)
+{
+  c792Shadow_t *sh = &c792Shadow[id];
+  int ii;
+
+#define C792_SHADOW_REG(reg) sh->reg = vmeRead16(&c792p[id]->reg) & C792_SHMASK_##reg;
+  C792_SHADOW_REGS
+#undef C792_SHADOW_REG
+  for(ii=0;ii<C792_MAX_CHANNELS;ii++)
+    sh->threshold[ii] = vmeRead16(&c792p[id]->threshold[ii]) & C792_SHMASK_threshold;
+}
+
+
 /*******************************************************************************
 *
 * c792Init - Initialize c792 Library.
@@ -233,6 +542,10 @@ c792Init (UINT32 addr, UINT32 addr_inc, int nadc, UINT16 crateID)
 	   (unsigned long)(c792p[ii]) - c792MemOffset, (unsigned long) c792p[ii]);
 #endif
   }
+#ifndef VXWORKS
+  c792Stats->nmod = Nc792;
+  v7xxLogStart(&c792Log);
+#endif
 
 #ifdef VXWORKS
   /* Initialize/Create Semephore */
@@ -251,15 +564,18 @@ c792Init (UINT32 addr, UINT32 addr_inc, int nadc, UINT16 crateID)
   for(ii=0;ii<Nc792;ii++) {
     C792_EXEC_SOFT_RESET(ii);
     C792_EXEC_DATA_RESET(ii);
-    vmeWrite16(&c792p[ii]->intLevel,0);        /* Disable Interrupts */
-    vmeWrite16(&c792p[ii]->evTrigger,0);       /* Zero interrupt trigger count */
-    vmeWrite16(&c792p[ii]->crateSelect,crateID);  /* Set Crate ID Register */
-    vmeWrite16(&c792p[ii]->bitClear2,C792_INCR_ALL_TRIG); /* Increment event count only on
-							    accepted gates */
+    C792_SHADOW_WRITE(ii,intLevel,0);          /* Disable Interrupts */
+    C792_SHADOW_WRITE(ii,evTrigger,0);         /* Zero interrupt trigger count */
+    C792_SHADOW_WRITE(ii,crateSelect,crateID); /* Set Crate ID Register */
+    C792_SHADOW_BITCLEAR2(ii,C792_INCR_ALL_TRIG); /* Increment event count only on
+						    accepted gates */
 
     c792EventCount[ii] =  0;          /* Initialize the Event Count */
     c792EvtReadCnt[ii] = -1;          /* Initialize the Read Count */
+    c792CBLTRole[ii] = C792_CBLT_DISABLED; /* Not on a chain until c792CBLTInit */
   }
+  c792CBLTAddr = 0;
+  c792MCSTp = NULL;
   /* Initialize Interrupt variables */
   c792IntID = -1;
   c792IntRunning = FALSE;
@@ -267,7 +583,8 @@ c792Init (UINT32 addr, UINT32 addr_inc, int nadc, UINT16 crateID)
   c792IntVec = 0;
   c792IntRoutine = NULL;
   c792IntArg = 0;
-  c792IntEvCount = 0;
+  memset(c792IntTab, 0, sizeof(c792IntTab));
+  memset(c792IntNlevel, 0, sizeof(c792IntNlevel));
 
 #ifdef VXWORKSPPC
   bzero((char *)&c792Fpr,sizeof(c792Fpr));
@@ -295,6 +612,216 @@ c792ScanMask()
   return rval;
 }
 
+LOCAL unsigned long long c792NowUs(void);
+#ifndef VXWORKS
+LOCAL void c792IntAdaptTimer(int id, c792Snapshot *snap);
+#endif
+
+/* Registers the library programs, from the host copy: always current */
+LOCAL void
+c792SnapConfig(int id, c792Snapshot *snap)
+{
+  c792Shadow_t *sh = &c792Shadow[id];
+
+  snap->geoAddr     = sh->geoAddr;
+  snap->bitSet2     = sh->bitSet2;
+  snap->control1    = sh->control1;
+  snap->evTrigger   = sh->evTrigger;
+  snap->fclrWindow  = sh->fclrWindow;
+  snap->intLevel    = sh->intLevel;
+  snap->intVector   = sh->intVector;
+  snap->cbltAddr    = sh->cbltAddr;
+  snap->cbltControl = sh->cbltControl;
+}
+
+/* Read the registers of QDC id, without its lock: the status registers
+   and the event counter have no side effect on a read, and the others
+   come from the host copy */
+LOCAL void
+c792SnapTake(int id, c792Snapshot *snap)
+{
+  UINT16 hi;
+
+  snap->rev     = vmeRead16(&c792p[id]->rev);
+  snap->status1 = vmeRead16(&c792p[id]->status1);
+  snap->status2 = vmeRead16(&c792p[id]->status2);
+  snap->bitSet1 = vmeRead16(&c792p[id]->bitSet1);
+  do {   /* again if the low word carried into the high one in between */
+    hi = vmeRead16(&c792p[id]->evCountH);
+    snap->evCount = ((hi & 0xff)<<16) | vmeRead16(&c792p[id]->evCountL);
+  } while(vmeRead16(&c792p[id]->evCountH) != hi);
+
+  c792SnapConfig(id, snap);
+  snap->time = c792NowUs();
+}
+
+#ifndef VXWORKS
+/* Seqlock writer: the sampler thread only */
+LOCAL void
+c792SnapPublish(int id, c792Snapshot *snap)
+{
+  unsigned int seq = c792Stats->snapSeq[id];
+
+  __atomic_store_n(&c792Stats->snapSeq[id], seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  c792Stats->snap[id] = *snap;
+  __atomic_store_n(&c792Stats->snapSeq[id], seq + 2, __ATOMIC_RELEASE);
+}
+
+LOCAL void *
+c792SampleLoop(void *arg)
+{
+  c792Snapshot snap;
+  struct timespec ts;
+  int id;
+
+  pthread_mutex_lock(&c792SampleMutex);
+  while(c792SampleMs > 0) {
+    for(id=0;id<Nc792;id++) {
+      if(c792p[id] == NULL) continue;
+      c792SnapTake(id, &snap);
+      c792SnapPublish(id, &snap);
+      c792IntAdaptTimer(id, &snap);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec  += c792SampleMs/1000;
+    ts.tv_nsec += (c792SampleMs%1000)*1000000;
+    if(ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&c792SampleCond, &c792SampleMutex, &ts);
+  }
+  pthread_mutex_unlock(&c792SampleMutex);
+
+  return(NULL);
+}
+#endif
+
+/*******************************************************************************
+*
+* c792SamplerStart - Start a low priority thread that reads the status
+*                    registers and event counter of all QDCs every periodMs
+*                    and publishes them, or change its period
+* c792SamplerStop  - Stop it
+* c792GetSnapshot  - Copy the last registers of QDC id published by the
+*                    sampler, or read them now if it is not running.  The
+*                    registers the library programs (control, bit set 2,
+*                    interrupt and CBLT setup) are always the current ones.
+*
+*   The sampler runs at SCHED_IDLE, takes no module lock, and is the only
+*   thread reading the bus for c792Status, c792GStatus and the monitors
+*   mapping the stats segment (c792StatsShmOpen): they read the snapshots
+*   under a seqlock, and never wait for the readout.
+*
+*   Linux only.  On VxWorks, c792GetSnapshot always reads the module.
+*
+*
+* RETURNS: c792SamplerStart and c792GetSnapshot: OK or ERROR.
+*          c792SamplerStop: None.
+*/
+
+STATUS
+c792SamplerStart(int periodMs)
+{
+#ifdef VXWORKS
+  printf("c792SamplerStart: ERROR : Not supported on VxWorks\n");
+  return(ERROR);
+#else
+  pthread_condattr_t cattr;
+  struct sched_param param;
+  int rval;
+
+  if(periodMs <= 0) {
+    printf("c792SamplerStart: ERROR : Invalid period %d ms\n",periodMs);
+    return(ERROR);
+  }
+
+  pthread_mutex_lock(&c792SampleMutex);
+  if(c792SampleMs > 0) {   /* running: new period */
+    c792SampleMs = periodMs;
+    pthread_cond_signal(&c792SampleCond);
+    pthread_mutex_unlock(&c792SampleMutex);
+    return(OK);
+  }
+
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+  pthread_cond_init(&c792SampleCond, &cattr);
+  pthread_condattr_destroy(&cattr);
+
+  c792SampleMs = periodMs;
+  rval = pthread_create(&c792SampleThread, NULL, c792SampleLoop, NULL);
+  if(rval != 0) {
+    printf("c792SamplerStart: ERROR : pthread_create: %s\n",strerror(rval));
+    c792SampleMs = 0;
+    pthread_cond_destroy(&c792SampleCond);
+    pthread_mutex_unlock(&c792SampleMutex);
+    return(ERROR);
+  }
+  pthread_mutex_unlock(&c792SampleMutex);
+
+  param.sched_priority = 0;
+  rval = pthread_setschedparam(c792SampleThread, SCHED_IDLE, &param);
+  if(rval != 0)
+    printf("c792SamplerStart: WARNING : No SCHED_IDLE for the sampler (%s)\n",
+	   strerror(rval));
+
+  return(OK);
+#endif
+}
+
+void
+c792SamplerStop()
+{
+#ifndef VXWORKS
+  pthread_mutex_lock(&c792SampleMutex);
+  if(c792SampleMs == 0) {
+    pthread_mutex_unlock(&c792SampleMutex);
+    return;
+  }
+  c792SampleMs = 0;
+  pthread_cond_signal(&c792SampleCond);
+  pthread_mutex_unlock(&c792SampleMutex);
+
+  pthread_join(c792SampleThread, NULL);
+  pthread_cond_destroy(&c792SampleCond);
+#endif
+}
+
+STATUS
+c792GetSnapshot(int id, c792Snapshot *snap)
+{
+#ifndef VXWORKS
+  unsigned int seq;
+#endif
+
+  if((id<0) || (id>=Nc792) || (c792p[id] == NULL) || (snap == NULL)) {
+    printf("c792GetSnapshot: ERROR : QDC id %d not initialized \n",id);
+    return(ERROR);
+  }
+
+#ifndef VXWORKS
+  if(c792SampleMs > 0) {
+    do {
+      seq = __atomic_load_n(&c792Stats->snapSeq[id], __ATOMIC_ACQUIRE);
+      *snap = c792Stats->snap[id];
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while((seq & 1) ||
+	    (seq != __atomic_load_n(&c792Stats->snapSeq[id], __ATOMIC_RELAXED)));
+    if(snap->time != 0) {
+      c792SnapConfig(id, snap);
+      return(OK);
+    }
+  }
+#endif
+
+  c792SnapTake(id, snap);
+
+  return(OK);
+}
+
 /*******************************************************************************
 *
 * c792Status - Gives Status info on specified QDC
@@ -311,6 +838,7 @@ c792Status( int id, int reg, int sflag)
   int BlkEnd=0, Berr=0;
   UINT16 stat1, stat2, bit1, bit2, cntl1;
   UINT16 iLvl, iVec, evTrig;
+  c792Snapshot snap;
 
 
 
@@ -320,18 +848,17 @@ c792Status( int id, int reg, int sflag)
   }
 
 
-  /* read various registers */
-  C792LOCK;
-  stat1 = vmeRead16(&c792p[id]->status1)&C792_STATUS1_MASK;
-  stat2 = vmeRead16(&c792p[id]->status2)&C792_STATUS2_MASK;
-  bit1 =  vmeRead16(&c792p[id]->bitSet1)&C792_BITSET1_MASK;
-  bit2 =  vmeRead16(&c792p[id]->bitSet2)&C792_BITSET2_MASK;
-  cntl1 = vmeRead16(&c792p[id]->control1)&C792_CONTROL1_MASK;
-  C792_EXEC_READ_EVENT_COUNT(id);
-  iLvl = vmeRead16(&c792p[id]->intLevel)&C792_INTLEVEL_MASK;
-  iVec = vmeRead16(&c792p[id]->intVector)&C792_INTVECTOR_MASK;
-  evTrig = vmeRead16(&c792p[id]->evTrigger)&C792_EVTRIGGER_MASK;
-  C792UNLOCK;
+  /* status registers from the sampler if it runs, the others current */
+  if(c792GetSnapshot(id, &snap) != OK)
+    return;
+  stat1 = snap.status1&C792_STATUS1_MASK;
+  stat2 = snap.status2&C792_STATUS2_MASK;
+  bit1 =  snap.bitSet1&C792_BITSET1_MASK;
+  bit2 =  snap.bitSet2&C792_BITSET2_MASK;
+  cntl1 = snap.control1&C792_CONTROL1_MASK;
+  iLvl = snap.intLevel&C792_INTLEVEL_MASK;
+  iVec = snap.intVector&C792_INTVECTOR_MASK;
+  evTrig = snap.evTrigger&C792_EVTRIGGER_MASK;
 
   /* Get info from registers */
   if(stat1&C792_DATA_READY) DRdy = 1;
@@ -349,14 +876,16 @@ c792Status( int id, int reg, int sflag)
 	 (unsigned long) c792p[id]);
 #endif
   printf("---------------------------------------------- \n");
+  if(c792SampleMs > 0)
+    printf(" Status registers sampled %llu ms ago\n",(c792NowUs() - snap.time)/1000);
 
   if( (iLvl>0) && (evTrig>0)) {
     printf(" Interrupts Enabled - Every %d events\n",evTrig);
     printf(" VME Interrupt Level: %d   Vector: 0x%x \n",iLvl,iVec);
-    printf(" Interrupt Count    : %d \n",c792IntCount);
+    printf(" Interrupt Count    : %llu \n",c792IntTab[id].st.nint);
   } else {
     printf(" Interrupts Disabled\n");
-    printf(" Last Interrupt Count    : %d \n",c792IntCount);
+    printf(" Last Interrupt Count    : %llu \n",c792IntTab[id].st.nint);
   }
   printf("\n");
 
@@ -380,11 +909,11 @@ c792Status( int id, int reg, int sflag)
     printf("  Control = 0x%04x\n",cntl1);
   }
 
-  if(c792EventCount[id] == 0xffffff) {
+  if(snap.evCount == 0xffffff) {
     printf("  Event Count     = (No Events Taken)\n");
     printf("  Last Event Read = (No Events Read)\n");
   }else{
-    printf("  Event Count     = %d\n",c792EventCount[id]);
+    printf("  Event Count     = %d\n",snap.evCount);
     if(c792EvtReadCnt[id] == -1)
       printf("  Last Event Read = (No Events Read)\n");
     else
@@ -404,45 +933,12 @@ c792Status( int id, int reg, int sflag)
 void
 c792GStatus(int flag)
 {
-  struct c792_struct *r792;
-  unsigned long *addr;
+  c792Snapshot r792[C792_MAX_MODULES];
   int iadc;
 
-  r792 = (struct c792_struct *)malloc(C792_MAX_MODULES*sizeof(struct c792_struct));
-  if(r792 == NULL)
-    {
-      printf("%s: ERROR: Out of Memory\n", __func__);
-      return;
-    }
-
-  addr = (unsigned long *)malloc(C792_MAX_MODULES*sizeof(unsigned long));
-  if(addr == NULL)
-    {
-      printf("%s: ERROR: Out of Memory\n", __func__);
-      return;
-    }
-
-  C792LOCK;
+  /* status registers from the sampler if it runs, the others current */
   for(iadc = 0; iadc < Nc792; iadc++)
-    {
-      addr[iadc] = (unsigned long)c792p[iadc] - c792MemOffset;
-
-      r792[iadc].rev = vmeRead16(&c792p[iadc]->rev);
-      r792[iadc].geoAddr = vmeRead16(&c792p[iadc]->geoAddr);
-      r792[iadc].cbltAddr = vmeRead16(&c792p[iadc]->cbltAddr);
-      r792[iadc].bitSet1 = vmeRead16(&c792p[iadc]->bitSet1);
-      r792[iadc].status1 = vmeRead16(&c792p[iadc]->status1);
-      r792[iadc].control1 = vmeRead16(&c792p[iadc]->control1);
-      r792[iadc].cbltControl = vmeRead16(&c792p[iadc]->cbltControl);
-      r792[iadc].evTrigger = vmeRead16(&c792p[iadc]->evTrigger);
-      r792[iadc].status2 = vmeRead16(&c792p[iadc]->status2);
-      r792[iadc].evCountL = vmeRead16(&c792p[iadc]->evCountL);
-      r792[iadc].evCountH = vmeRead16(&c792p[iadc]->evCountH);
-      r792[iadc].fclrWindow = vmeRead16(&c792p[iadc]->fclrWindow);
-      r792[iadc].bitSet2 = vmeRead16(&c792p[iadc]->bitSet2);
-
-    }
-  C792UNLOCK;
+    c792GetSnapshot(iadc, &r792[iadc]);
 
   printf("\n");
   /* Parameters from Registers */
@@ -459,7 +955,7 @@ c792GStatus(int flag)
 
       printf("0x%04x       ",r792[iadc].rev);
 
-      printf("0x%08lx   ",addr[iadc]);
+      printf("0x%08lx   ",(unsigned long)c792p[iadc] - c792MemOffset);
 
       printf("0x%08x - ", (r792[iadc].cbltAddr)<<24);
 
@@ -550,9 +1046,7 @@ c792GStatus(int flag)
       printf("%s      ",
 	     (r792[iadc].status2 & 0x4)?"BUSY":"----");
 
-      unsigned int evCount = ((unsigned int)(r792[iadc].evCountH & 0xFF) << 16) |
-	(unsigned int)r792[iadc].evCountL;
-      printf("%-8d   ", evCount);
+      printf("%-8d   ", r792[iadc].evCount);
 
       printf("\n");
     }
@@ -560,9 +1054,145 @@ c792GStatus(int flag)
 
   printf("\n");
   printf("\n");
+}
+
+/*******************************************************************************
+*
+* c792ShadowSync   - Reload the host copy of the configuration registers
+*                    of QDC id (id<0 for all) from the module, e.g. after
+*                    it was programmed by another program
+* c792ShadowVerify - Compare the host copy with the module, and print the
+*                    registers that differ (nothing is changed)
+*
+*   The library keeps a copy of the registers it programs: GEO, CBLT
+*   address and control, interrupt level and vector, Control 1, Event
+*   Trigger, Fast Clear window, Bit Set 2, crate, Iped and thresholds.
+*   c792Status, c792GStatus, the values returned by the setters and the
+*   read-modify-write of c792EnableBerr/c792DisableBerr come from it, with
+*   no bus read.  It is reloaded after each soft reset.
+*
+* RETURNS: c792ShadowSync: OK, or ERROR if not initialized.
+*          c792ShadowVerify: the number of registers that differ, or ERROR.
+*/
+
+STATUS
+c792ShadowSync(int id)
+{
+  int ii;
+
+  if((id>=Nc792) || ((id>=0) && (c792p[id] == NULL))) {
+    printf("c792ShadowSync: ERROR : QDC id %d not initialized \n",id);
+    return(ERROR);
+  }
+
+  for(ii=0;ii<Nc792;ii++) {
+    if((id>=0) && (ii!=id)) continue;
+    C792LOCK(ii);
+    c792ShadowLoad(ii);
+    C792UNLOCK(ii);
+  }
+
+  return(OK);
+}
+
+int
+c792ShadowVerify(int id)
+{
+  c792Shadow_t hw, *sh;
+  int ii, ich, ndiff = 0;
+
+  if((id>=Nc792) || ((id>=0) && (c792p[id] == NULL))) {
+    printf("c792ShadowVerify: ERROR : QDC id %d not initialized \n",id);
+    return(ERROR);
+  }
+
+  for(ii=0;ii<Nc792;ii++) {
+    if((id>=0) && (ii!=id)) continue;
+    sh = &c792Shadow[ii];
+
+    C792LOCK(ii);
+#define C792_SHADOW_REG(reg) hw.reg = vmeRead16(&c792p[ii]->reg) & C792_SHMASK_##reg;
+    C792_SHADOW_REGS
+#undef C792_SHADOW_REG
+    for(ich=0;ich<C792_MAX_CHANNELS;ich++)
+      hw.threshold[ich] = vmeRead16(&c792p[ii]->threshold[ich]) & C792_SHMASK_threshold;
+    C792UNLOCK(ii);
+
+#define C792_SHADOW_REG(reg)						\
+    if(hw.reg != sh->reg) {						\
+      printf("c792ShadowVerify: QDC %d %-12s : module 0x%04x, shadow 0x%04x\n", \
+	     ii, #reg, hw.reg, sh->reg);					\
+      ndiff++;								\
+    }
+    C792_SHADOW_REGS
+#undef C792_SHADOW_REG
+    for(ich=0;ich<C792_MAX_CHANNELS;ich++) {
+      if(hw.threshold[ich] == sh->threshold[ich]) continue;
+      printf("c792ShadowVerify: QDC %d threshold[%2d] : module 0x%04x, shadow 0x%04x\n",
+	     ii, ich, hw.threshold[ich], sh->threshold[ich]);
+      ndiff++;
+    }
+  }
+
+  return(ndiff);
+}
+
+/*******************************************************************************
+*
+* c792Reprogram - Soft reset QDC id, and program it again from the host
+*                 copy of its configuration (see c792ShadowSync), e.g. to
+*                 recover a module that stopped answering during a run.
+*                 The data and the event counter are reset as well.
+*   full - 0 : write back the registers the soft reset changed (they are
+*              read back from the module after the reset)
+*          1 : write back every shadowed register and threshold, whatever
+*              the module reads back
+*
+*
+* RETURNS: Number of registers written, or ERROR if not initialized.
+*/
+
+int
+c792Reprogram(int id, int full)
+{
+  c792Shadow_t save, *sh;
+  int ii, nwrite = 0;
+
+  if((id<0) || (id>=Nc792) || (c792p[id] == NULL)) {
+    C792_LOG("c792Reprogram: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    return(ERROR);
+  }
+  sh = &c792Shadow[id];
+
+  C792LOCK(id);
+  save = *sh;
+  C792_EXEC_DATA_RESET(id);
+  C792_EXEC_SOFT_RESET(id);
+
+#define C792_SHADOW_REG(reg)						\
+  if(full || (sh->reg != save.reg)) {					\
+    C792_SHADOW_WRITE(id,reg,save.reg);					\
+    nwrite++;								\
+  }
+  C792_SHADOW_REGS
+#undef C792_SHADOW_REG
+  /* Bit Set 2 only sets bits: clear the others */
+  if(full || (sh->bitSet2 != save.bitSet2))
+    C792_SHADOW_BITCLEAR2(id,C792_BITSET2_MASK & ~save.bitSet2);
+  for(ii=0;ii<C792_MAX_CHANNELS;ii++) {
+    if(!full && (sh->threshold[ii] == save.threshold[ii])) continue;
+    C792_SHADOW_THRESH(id,ii,save.threshold[ii]);
+    nwrite++;
+  }
+
+  C792_EXEC_DATA_RESET(id);
+  C792_EXEC_CLR_EVENT_COUNT(id);
+  C792_STAT_ADD(id,nclear,1);
+  C792UNLOCK(id);
+  c792EvtReadCnt[id] = -1;
+  c792EventCount[id] =  0;
 
-  if(r792)
-    free(r792);
+  return(nwrite);
 }
 
 /*******************************************************************************
@@ -587,10 +1217,10 @@ c792PrintEvent(int id, int pflag)
 
   /* Check if there is a valid event */
 
-  C792LOCK;
+  C792LOCK(id);
   if(vmeRead16(&c792p[id]->status2)&C792_BUFFER_EMPTY) {
     printf("c792PrintEvent: Data Buffer is EMPTY!\n");
-    C792UNLOCK;
+    C792UNLOCK(id);
     return(0);
   }
   if(vmeRead16(&c792p[id]->status1)&C792_DATA_READY) {
@@ -599,7 +1229,7 @@ c792PrintEvent(int id, int pflag)
     header = vmeRead32(&c792pl[id]->data[0]);
     if((header&C792_DATA_ID_MASK) != C792_HEADER_DATA) {
       printf("c792PrintEvent: ERROR: Invalid Header Word 0x%08x\n",header);
-      C792UNLOCK;
+      C792UNLOCK(id);
       return(-1);
     }else{
       printf("  ADC DATA for Module %d\n",id);
@@ -617,7 +1247,7 @@ c792PrintEvent(int id, int pflag)
     trailer = vmeRead32(&c792pl[id]->data[dCnt]);
     if((trailer&C792_DATA_ID_MASK) != C792_TRAILER_DATA) {
       printf("c792PrintEvent: ERROR: Invalid Trailer Word 0x%08x\n",trailer);
-      C792UNLOCK;
+      C792UNLOCK(id);
       return(-1);
     }else{
       evID = trailer&C792_EVENTCOUNT_MASK;
@@ -625,16 +1255,16 @@ c792PrintEvent(int id, int pflag)
       printf("  Trailer: 0x%08x   Event Count = %d \n",trailer,evID);
     }
     C792_EXEC_SET_EVTREADCNT(id,evID);
-    C792UNLOCK;
+    C792UNLOCK(id);
     return (dCnt);
 
   }else{
     printf("c792PrintEvent: Data Not ready for readout!\n");
-    C792UNLOCK;
+    C792UNLOCK(id);
     return(0);
   }
 
-  C792UNLOCK;
+  C792UNLOCK(id);
 
 }
 
@@ -654,124 +1284,260 @@ c792ReadEvent(int id, UINT32 *data)
 
   int ii, nWords, evID;
   UINT32 header, trailer, dCnt;
+  unsigned long long t0;
 
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792ReadEvent: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792ReadEvent: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return(-1);
   }
 
   /* Check if there is a valid event */
 
-  C792LOCK;
+  C792LOCK(id);
+  C792_STAT_TIME(t0);
   if(vmeRead16(&c792p[id]->status2)&C792_BUFFER_EMPTY) {
-    logMsg("c792ReadEvent: Data Buffer is EMPTY!\n",0,0,0,0,0,0);
-    C792UNLOCK;
+    C792_LOG("c792ReadEvent: Data Buffer is EMPTY!\n",0,0,0,0,0,0);
+    C792_STAT_ADD(id,nempty,1);
+    C792UNLOCK(id);
     return(0);
   }
   if(vmeRead16(&c792p[id]->status1)&C792_DATA_READY) {
     dCnt = 0;
-    /* Read Header - Get Word count */
-    header = vmeRead32(&c792pl[id]->data[dCnt]);
+    /* Read Header - Get Word count.  Words are stored as they come off
+       the bus, and only the local copy is swapped for the checks. */
+    data[dCnt] = C792_FIFO_WORD(id,dCnt);
+    header = data[dCnt];
+#ifndef VXWORKS
+    header = LSWAP(header);
+#endif
     if((header&C792_DATA_ID_MASK) != C792_HEADER_DATA) {
-      logMsg("c792ReadEvent: ERROR: Invalid Header Word 0x%08x (0x%08x)\n",header,c792pl[id]->data[dCnt],0,0,0,0);
-      C792UNLOCK;
+      C792_LOG("c792ReadEvent: ERROR: Invalid Header Word 0x%08x\n",header,0,0,0,0,0);
+      C792_STAT_ADD(id,nbadHeader,1);
+      C792UNLOCK(id);
       return(-1);
     }else{
       nWords = (header&C792_WORDCOUNT_MASK)>>8;
-#ifndef VXWORKS
-      // Swap endian-ness to be consistent with the data.
-      header = LSWAP(header);
-#endif
-      data[dCnt] = header;
       dCnt++;
     }
     for(ii=0;ii<nWords;ii++) {
-      data[ii+1] = c792pl[id]->data[ii+1];
+      data[ii+1] = C792_FIFO_WORD(id,ii+1);
     }
     dCnt += ii;
 
-    trailer = vmeRead32(&c792pl[id]->data[dCnt]);
+    data[dCnt] = C792_FIFO_WORD(id,dCnt);
+    trailer = data[dCnt];
+#ifndef VXWORKS
+    trailer = LSWAP(trailer);
+#endif
     if((trailer&C792_DATA_ID_MASK) != C792_TRAILER_DATA) {
-      logMsg("c792ReadEvent: ERROR: Invalid Trailer Word 0x%08x\n",trailer,0,0,0,0,0);
-      C792UNLOCK;
+      C792_LOG("c792ReadEvent: ERROR: Invalid Trailer Word 0x%08x\n",trailer,0,0,0,0,0);
+      C792_STAT_ADD(id,nbadTrailer,1);
+      C792UNLOCK(id);
       return(-1);
     }else{
       evID = trailer&C792_EVENTCOUNT_MASK;
-#ifndef VXWORKS
-      // Swap endian-ness to be consistent with the data.
-      trailer = LSWAP(trailer);
-#endif
-      data[dCnt] = trailer;
       dCnt++;
     }
     C792_EXEC_SET_EVTREADCNT(id,evID);
-    C792UNLOCK;
+    C792_STAT_ADD(id,nevents,1);
+    C792_STAT_ADD(id,nwords,dCnt);
+    C792_STAT_SINCE(id,pioTime,t0);
+    C792UNLOCK(id);
+
+    C792_SWAP_BLOCK(data,dCnt);
     return (dCnt);
 
   }else{
-    logMsg("c792ReadEvent: Data Not ready for readout!\n",0,0,0,0,0,0);
-    C792UNLOCK;
+    C792_LOG("c792ReadEvent: Data Not ready for readout!\n",0,0,0,0,0,0);
+    C792_STAT_ADD(id,nempty,1);
+    C792UNLOCK(id);
     return(0);
   }
 
-  C792UNLOCK;
+  C792UNLOCK(id);
 
 }
 
 /*******************************************************************************
 *
-* c792FlushEvent - Flush event/data from QDC.
+* c792ReadEvents - Drain up to maxev buffered events from QDC to specified
+*                  address.
 *
+*   The status registers and event counter are checked once for the whole
+*   batch, and the read counter is updated once, after the last trailer.
+*   Events are stored back to back in the same format as c792ReadEvent.
 *
-* RETURNS: Number of Data words read from the QDC.
+* INPUTS:    id       - module id of QDC to access
+*            data     - address of data destination.  Must hold at least
+*                       maxev*C792_MAX_WORDS_PER_EVENT words.
+*            maxev    - maximum number of events to read (1-32)
+*            evOffset - (optional) filled with the word offset of each
+*                       event header in data
+*            evCount  - (optional) filled with the event counter of each
+*                       event, taken from its trailer
+*            nevents  - (optional) returns the number of events read
+*
+* RETURNS: Number of Data words read from the QDC (including Headers/Trailers),
+*          0 if no data, or -1 on error.
+*          If a corrupt event is found after good ones, the good events are
+*          kept and their word count is returned.
 */
 
 int
-c792FlushEvent(int id, int fflag)
+c792ReadEvents(int id, UINT32 *data, int maxev, int *evOffset,
+	       UINT32 *evCount, int *nevents)
 {
 
-  int evID;
-  int done = 0;
-  UINT32 tmpData, dCnt;
+  int ii, iev, nevts, nWords, evID = -1, err = 0;
+  UINT32 header, trailer, dCnt;
+  unsigned long long t0;
+
+  if(nevents) *nevents = 0;
 
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792FlushEvent: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792ReadEvents: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return(-1);
   }
 
-  /* Check if there is a valid event */
+  if((maxev<=0) || (maxev>C792_MAX_EVENTS_PER_BUFFER))
+    maxev = C792_MAX_EVENTS_PER_BUFFER;
+
+  /* Check once if there are valid events */
 
-  C792LOCK;
-  if((c792p[id]->status2)&C792_BUFFER_EMPTY) {
-    if(fflag > 0) logMsg("c792FlushEvent: Data Buffer is EMPTY!\n",0,0,0,0,0,0);
-    C792UNLOCK;
+  C792LOCK(id);
+  C792_STAT_TIME(t0);
+  if(vmeRead16(&c792p[id]->status2)&C792_BUFFER_EMPTY) {
+    C792_STAT_ADD(id,nempty,1);
+    C792UNLOCK(id);
+    return(0);
+  }
+  if((vmeRead16(&c792p[id]->status1)&C792_DATA_READY)==0) {
+    C792_LOG("c792ReadEvents: Data Not ready for readout!\n",0,0,0,0,0,0);
+    C792_STAT_ADD(id,nempty,1);
+    C792UNLOCK(id);
     return(0);
   }
 
-  /* Check if Data Ready Flag is on */
-  if(vmeRead16(&c792p[id]->status1)&C792_DATA_READY) {
-    dCnt = 0;
+  /* Number of events waiting.  If the software read count is out of step,
+     read until the buffer reports no more valid data */
+  C792_EXEC_READ_EVENT_COUNT(id);
+  nevts = c792EventCount[id] - c792EvtReadCnt[id];
+  if((nevts<=0) || (nevts>maxev))
+    nevts = maxev;
 
-    while (!done) {
-      tmpData = vmeRead32(&c792pl[id]->data[dCnt]);
-      switch (tmpData&C792_DATA_ID_MASK) {
-      case C792_HEADER_DATA:
-	if(fflag > 0) logMsg("c792FlushEvent: Found Header 0x%08x\n",tmpData,0,0,0,0,0);
-	break;
-      case C792_DATA:
-	break;
-      case C792_TRAILER_DATA:
-	if(fflag > 0) logMsg(" c792FlushEvent: Found Trailer 0x%08x\n",tmpData,0,0,0,0,0);
-	evID = tmpData&C792_EVENTCOUNT_MASK;
-	C792_EXEC_SET_EVTREADCNT(id,evID);
-	done = 1;
-	break;
-      case C792_INVALID_DATA:
-	if(fflag > 0) logMsg(" c792FlushEvent: Buffer Empty 0x%08x\n",tmpData,0,0,0,0,0);
+  dCnt = 0;
+  for(iev=0;iev<nevts;iev++) {
+    /* Read Header - Get Word count */
+    data[dCnt] = C792_FIFO_WORD(id,0);
+    header = data[dCnt];
+#ifndef VXWORKS
+    header = LSWAP(header);
+#endif
+    if((header&C792_DATA_ID_MASK) == C792_INVALID_DATA)
+      break; /* Buffer drained */
+
+    if((header&C792_DATA_ID_MASK) != C792_HEADER_DATA) {
+      C792_LOG("c792ReadEvents: ERROR: Invalid Header Word 0x%08x (event %d)\n",
+	     header,iev,0,0,0,0);
+      C792_STAT_ADD(id,nbadHeader,1);
+      err = 1;
+      break;
+    }
+    nWords = (header&C792_WORDCOUNT_MASK)>>8;
+    if(evOffset) evOffset[iev] = dCnt;
+
+    for(ii=0;ii<nWords;ii++) {
+      data[dCnt+ii+1] = C792_FIFO_WORD(id,ii+1);
+    }
+
+    data[dCnt+nWords+1] = C792_FIFO_WORD(id,nWords+1);
+    trailer = data[dCnt+nWords+1];
+#ifndef VXWORKS
+    trailer = LSWAP(trailer);
+#endif
+    if((trailer&C792_DATA_ID_MASK) != C792_TRAILER_DATA) {
+      C792_LOG("c792ReadEvents: ERROR: Invalid Trailer Word 0x%08x (event %d)\n",
+	     trailer,iev,0,0,0,0);
+      C792_STAT_ADD(id,nbadTrailer,1);
+      err = 1;
+      break;
+    }
+    evID = trailer&C792_EVENTCOUNT_MASK;
+    if(evCount) evCount[iev] = evID;
+    dCnt += nWords + 2;
+  }
+
+  if(iev > 0)
+    C792_EXEC_SET_EVTREADCNT(id,evID);
+  C792_STAT_ADD(id,nevents,iev);
+  C792_STAT_ADD(id,nwords,dCnt);
+  C792_STAT_SINCE(id,pioTime,t0);
+  C792UNLOCK(id);
+
+  C792_SWAP_BLOCK(data,dCnt);
+
+  if(nevents) *nevents = iev;
+
+  if(err && (iev == 0))
+    return(-1);
+
+  return(dCnt);
+}
+
+/*******************************************************************************
+*
+* c792FlushEvent - Flush event/data from QDC.
+*
+*
+* RETURNS: Number of Data words read from the QDC.
+*/
+
+int
+c792FlushEvent(int id, int fflag)
+{
+
+  int evID;
+  int done = 0;
+  UINT32 tmpData, dCnt;
+
+  if((id<0) || (c792p[id] == NULL)) {
+    C792_LOG("c792FlushEvent: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    return(-1);
+  }
+
+  /* Check if there is a valid event */
+
+  C792LOCK(id);
+  if(vmeRead16(&c792p[id]->status2)&C792_BUFFER_EMPTY) {
+    if(fflag > 0) C792_LOG("c792FlushEvent: Data Buffer is EMPTY!\n",0,0,0,0,0,0);
+    C792UNLOCK(id);
+    return(0);
+  }
+
+  /* Check if Data Ready Flag is on */
+  if(vmeRead16(&c792p[id]->status1)&C792_DATA_READY) {
+    dCnt = 0;
+
+    while (!done) {
+      tmpData = vmeRead32(&c792pl[id]->data[dCnt]);
+      switch (tmpData&C792_DATA_ID_MASK) {
+      case C792_HEADER_DATA:
+	if(fflag > 0) C792_LOG("c792FlushEvent: Found Header 0x%08x\n",tmpData,0,0,0,0,0);
+	break;
+      case C792_DATA:
+	break;
+      case C792_TRAILER_DATA:
+	if(fflag > 0) C792_LOG(" c792FlushEvent: Found Trailer 0x%08x\n",tmpData,0,0,0,0,0);
+	evID = tmpData&C792_EVENTCOUNT_MASK;
+	C792_EXEC_SET_EVTREADCNT(id,evID);
+	done = 1;
+	break;
+      case C792_INVALID_DATA:
+	if(fflag > 0) C792_LOG(" c792FlushEvent: Buffer Empty 0x%08x\n",tmpData,0,0,0,0,0);
 	done = 1;
 	break;
       default:
-	if(fflag > 0) logMsg(" c792FlushEvent: Invalid Data 0x%08x\n",tmpData,0,0,0,0,0);
+	if(fflag > 0) C792_LOG(" c792FlushEvent: Invalid Data 0x%08x\n",tmpData,0,0,0,0,0);
       }
 
       /* Print out Data */
@@ -783,20 +1549,140 @@ c792FlushEvent(int id, int fflag)
     }
     if(fflag > 1) printf("\n");
 
-    C792UNLOCK;
+    C792UNLOCK(id);
     return (dCnt);
 
   }else{
-    if(fflag > 0) logMsg("c792FlushEvent: Data Not ready for readout!\n",0,0,0,0,0,0);
-    C792UNLOCK;
+    if(fflag > 0) C792_LOG("c792FlushEvent: Data Not ready for readout!\n",0,0,0,0,0,0);
+    C792UNLOCK(id);
     return(0);
   }
 
-  C792UNLOCK;
+  C792UNLOCK(id);
 
 }
 
 
+/*******************************************************************************
+*
+* c792FlushEvents - Discard all the events buffered in QDC id, and tell
+*                   which ones they were.
+*
+* INPUTS:    id      - module id of QDC to access
+*            mode    - C792_FLUSH_RESET : data reset.  Nothing is read:
+*                                         the events are counted with the
+*                                         event counter, and their ids
+*                                         follow the last one read.  If no
+*                                         event was read since c792Clear,
+*                                         they are read as with
+*                                         C792_FLUSH_PIO.
+*                      C792_FLUSH_PIO   : read into scratch, with
+*                                         c792ReadEvents
+*                      C792_FLUSH_DMA   : read into scratch with block reads
+*                                         (BERR enabled, scratch in DMA
+*                                         memory)
+*            scratch - (optional for RESET and PIO) buffer of nwrds words
+*                      for the data read, overwritten.  Without it, PIO
+*                      reads one event at a time.
+*            nwrds   - size of scratch.  C792_MAX_EVENTS_PER_BUFFER *
+*                      C792_MAX_WORDS_PER_EVENT words hold a full buffer.
+*            evID    - (optional) filled with the event counter of the
+*                      first maxev events discarded
+*            maxev   - size of evID
+*            nwords  - (optional) returns the number of words read (0 with
+*                      the data reset)
+*
+*   Unlike c792Clear, the read count stays in step with the event counter,
+*   so checks of the trailer counter go on working.
+*
+* RETURNS: Number of events discarded, or ERROR.
+*/
+
+int
+c792FlushEvents(int id, int mode, volatile UINT32 *scratch, int nwrds,
+		UINT32 *evID, int maxev, int *nwords)
+{
+  UINT32 evbuf[C792_MAX_WORDS_PER_EVENT], cnt[C792_MAX_EVENTS_PER_BUFFER];
+  c792EvIndex evidx[C792_MAX_EVENTS_PER_BUFFER];
+  int ii, nev, nw, total = 0, nwrd = 0, pass, batch, last;
+
+  if(nwords) *nwords = 0;
+
+  if((id<0) || (id>=Nc792) || (c792p[id] == NULL)) {
+    C792_LOG("c792FlushEvents: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    return(ERROR);
+  }
+  if((scratch == NULL) || (nwrds <= 0)) {
+    scratch = NULL;
+    nwrds = 0;
+  }
+
+  switch(mode) {
+  case C792_FLUSH_RESET:
+    C792LOCK(id);
+    if(vmeRead16(&c792p[id]->status2)&C792_BUFFER_EMPTY) {
+      C792UNLOCK(id);
+      return(0);
+    }
+    if(c792EvtReadCnt[id] >= 0) {
+      C792_EXEC_READ_EVENT_COUNT(id);
+      last = c792EvtReadCnt[id];
+      nev = c792EventCount[id] - last;
+      if((nev > 0) && (nev <= C792_MAX_EVENTS_PER_BUFFER)) {
+	C792_EXEC_DATA_RESET(id);
+	C792_STAT_ADD(id,nclear,1);
+	c792EvtReadCnt[id] = c792EventCount[id];
+	C792UNLOCK(id);
+	for(ii=0;(ii<nev) && (ii<maxev) && evID;ii++)
+	  evID[ii] = (last + 1 + ii) & C792_EVENTCOUNT_MASK;
+	return(nev);
+      }
+    }
+    C792UNLOCK(id);
+    /* Read count not known, or out of step: read them out */
+    /* fall through */
+
+  case C792_FLUSH_PIO:
+    batch = nwrds/C792_MAX_WORDS_PER_EVENT;
+    for(pass=0;pass<=C792_MAX_EVENTS_PER_BUFFER;pass++) {
+      if(batch > 0)
+	nw = c792ReadEvents(id,(UINT32 *)scratch,batch,NULL,cnt,&nev);
+      else
+	nw = c792ReadEvents(id,evbuf,1,NULL,cnt,&nev);
+      if(nw <= 0) break;
+      for(ii=0;ii<nev;ii++,total++)
+	if(evID && (total < maxev)) evID[total] = cnt[ii];
+      nwrd += nw;
+    }
+    break;
+
+  case C792_FLUSH_DMA:
+    if((scratch == NULL) || !(c792Shadow[id].control1 & C792_BERR_ENABLE)) {
+      C792_LOG("c792FlushEvents: ERROR : QDC id %d: DMA needs a scratch buffer and BERR enabled\n",
+	       id,0,0,0,0,0);
+      return(ERROR);
+    }
+    for(pass=0;pass<=C792_MAX_EVENTS_PER_BUFFER;pass++) {
+      if(vmeRead16(&c792p[id]->status2)&C792_BUFFER_EMPTY) break;
+      nw = c792ReadBlockIndex(id,scratch,nwrds,evidx,C792_MAX_EVENTS_PER_BUFFER,
+			      &nev,NULL);
+      if((nw <= 0) || (nev == 0)) break;
+      for(ii=0;ii<nev;ii++,total++)
+	if(evID && (total < maxev)) evID[total] = evidx[ii].evID;
+      nwrd += nw;
+    }
+    break;
+
+  default:
+    C792_LOG("c792FlushEvents: ERROR : Invalid mode %d \n",mode,0,0,0,0,0);
+    return(ERROR);
+  }
+
+  if(nwords) *nwords = nwrd;
+
+  return(total);
+}
+
 /*******************************************************************************
 *
 * c792ReadBlock - Read Block of events from QDC to specified address.
@@ -805,26 +1691,66 @@ c792FlushEvent(int id, int fflag)
 *            data   - address of data destination
 *            nwrds  - number of data words to transfer
 *
-* RETURNS: OK or ERROR on success of transfer.
+* RETURNS: Number of data words up to and including the last complete
+*          event, or ERROR.
 *
-* Note: User must call c792IncrEventBlk after a successful
-*       call to c792ReadBlock to increment the number of events Read.
-*         (e.g.   c792IncrEventBlk(0,15);
+* Note: The read counter is updated from the trailer of the last complete
+*       event, so c792IncrEventBlk is not needed.  Use c792ReadBlockIndex
+*       to also get the position of each event.
 */
 
 int
 c792ReadBlock(int id, volatile UINT32 *data, int nwrds)
+{
+  if(c792ReadBlockStart(id, data, nwrds) != OK)
+    return(ERROR);
+
+  return(c792ReadBlockComplete(id));
+}
+
+/*******************************************************************************
+*
+* c792ReadBlockStart    - Start a block read from QDC to specified address.
+* c792ReadBlockPoll     - Check for a block read in flight.
+* c792ReadBlockComplete - Wait for a block read and check its data.
+*
+*   Split form of c792ReadBlock, so the CPU can do other work while the
+*   DMA engine is busy.  Only one transfer may be in flight at a time,
+*   and this includes transfers started from the c775 library: a start
+*   while the engine is taken fails (see v7xxDma.h).
+*
+*   The jvme library does not provide a non-blocking DMA status, so
+*   c792ReadBlockPoll only reports whether a transfer was started and not
+*   yet completed.  The wait is done in c792ReadBlockComplete.
+*
+* INPUTS:    id     - module id of QDC to access
+*            data   - address of data destination
+*            nwrds  - number of data words to transfer
+*
+* RETURNS: c792ReadBlockStart    - OK or ERROR.
+*          c792ReadBlockPoll     - 1 if a transfer for this QDC is in flight,
+*                                  otherwise 0.
+*          c792ReadBlockComplete - as c792ReadBlock.
+*/
+
+int
+c792ReadBlockStart(int id, volatile UINT32 *data, int nwrds)
 {
 
-  int retVal, xferCount=0;
+  int retVal, owner;
   int dummy=0;
   volatile unsigned int *laddr;
-  UINT32 evID, vmeAdr;
-  UINT16 reg = 0, stat = 0;
-  UINT32 trailer;
+  UINT32 vmeAdr;
 
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792ReadBlock: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792ReadBlockStart: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    return(ERROR);
+  }
+
+  /* The engine is shared with the c775 library (see v7xxDma.h) */
+  if(v7xxDmaTake(V7XX_DMA_QDC,id,&owner) != OK) {
+    C792_LOG("c792ReadBlockStart: ERROR : DMA engine busy with %s id %d \n",
+	   V7XX_DMA_LIB(owner),V7XX_DMA_ID(owner),0,0,0,0);
     return(ERROR);
   }
 
@@ -838,17 +1764,15 @@ c792ReadBlock(int id, volatile UINT32 *data, int nwrds)
 #endif
       dummy = 1;
       laddr = (data + 1);
-      xferCount = 1;
     }
   else
     {
       dummy = 0;
       laddr = data;
-      xferCount = 0;
     }
 
 
-  C792LOCK;
+  C792LOCK(id);
 #ifdef VXWORKSPPC
   /* Don't bother checking if there is a valid event. Just blast data out of the
      FIFO Valid or Invalid
@@ -856,117 +1780,1100 @@ c792ReadBlock(int id, volatile UINT32 *data, int nwrds)
 
   vmeAdr = (UINT32)(c792p[id]->data) - c792MemOffset;
   retVal = sysVmeDmaSend((UINT32)laddr, vmeAdr, (nwrds<<2), 0);
-  if(retVal < 0) {
-    logMsg("c792ReadBlock: ERROR in DMA transfer Initialization 0x%x\n",retVal,0,0,0,0,0);
-    C792UNLOCK;
-    return(ERROR);
-  }
-  /* Wait until Done or Error */
-  retVal = sysVmeDmaDone(1000,1);
 
 #elif defined(VXWORKS68K51)
 
-  /* 68K Block 32 transfer from FIFO using VME2Chip */
-  retVal = mvme_dma((long)laddr, 1, (long)(c792pl[id]->data), 0, nwrds, 1);
+  /* 68K Block 32 transfer from FIFO using VME2Chip.  This one is not
+     asynchronous, keep the result for c792ReadBlockComplete */
+  c792DmaRetVal = mvme_dma((long)laddr, 1, (long)(c792pl[id]->data), 0, nwrds, 1);
+  retVal = 0;
 
 #else
   /* Linux readout with jvme library */
   vmeAdr = (unsigned long)(c792p[id]->data) - c792MemOffset;
+  C792_STAT_TIME(c792DmaT0);
   retVal = vmeDmaSend((unsigned long)laddr, vmeAdr, (nwrds<<2));
+#endif
+  C792UNLOCK(id);
+
   if(retVal < 0) {
-    logMsg("c792ReadBlock: ERROR in DMA transfer Initialization 0x%x\n",retVal,0,0,0,0,0);
-    C792UNLOCK;
+    C792_LOG("c792ReadBlockStart: ERROR in DMA transfer Initialization 0x%x\n",retVal,0,0,0,0,0);
+    v7xxDmaGive();
     return(ERROR);
   }
+
+  c792DmaData  = data;
+  c792DmaNwrds = nwrds;
+  c792DmaDummy = dummy;
+  c792DmaID    = id;
+
+  return(OK);
+}
+
+int
+c792ReadBlockPoll(int id)
+{
+  return((id >= 0) && (c792DmaID == id));
+}
+
+/* Wait for the transfer in flight, and check if the QDC ended it.
+   Returns number of longwords in the destination (including the dummy word),
+   0 if the transfer ended without a bus error, or ERROR */
+LOCAL int
+c792ReadBlockWait(int id)
+{
+  int retVal, xferCount = 0;
+  int dummy = c792DmaDummy;
+  UINT16 reg = 0, stat = 0;
+
+#ifdef VXWORKSPPC
+  /* Wait until Done or Error */
+  retVal = sysVmeDmaDone(1000,1);
+#elif defined(VXWORKS68K51)
+  retVal = c792DmaRetVal;
+#else
   /* Wait until Done or Error */
   retVal = vmeDmaDone();
-
 #endif
+  c792DmaID = -1;
+  v7xxDmaGive();
+
+  C792LOCK(id);
+  C792_STAT_ADD(id,ndma,1);
+  C792_STAT_SINCE(id,dmaTime,c792DmaT0);
+  if(retVal == 0) {
+    C792_STAT_ADD(id,dmaBytes,c792DmaNwrds<<2);
+    C792UNLOCK(id);
+    return(OK);
+  }
 
-  if(retVal != 0) {
-    /* Check to see if error was generated by QDC */
-    reg = vmeRead16(&c792p[id]->bitSet1);
-    stat = reg & C792_VME_BUS_ERROR;
-    if((retVal>0) && (stat)) {
-      vmeWrite16(&c792p[id]->bitClear1, C792_VME_BUS_ERROR);
-      /*logMsg("c792ReadBlock: INFO: DMA terminated by QDC - Transfer OK\n",0,0,0,0,0,0); */
+  /* Check to see if error was generated by QDC */
+  reg = vmeRead16(&c792p[id]->bitSet1);
+  stat = reg & C792_VME_BUS_ERROR;
+  if((retVal>0) && (stat)) {
+    vmeWrite16(&c792p[id]->bitClear1, C792_VME_BUS_ERROR);
+    /*C792_LOG("c792ReadBlock: INFO: DMA terminated by QDC - Transfer OK\n",0,0,0,0,0,0); */
 #ifdef VXWORKS
-      xferCount = (nwrds - (retVal>>2) + dummy);  /* Number of Longwords transfered */
+    xferCount = (c792DmaNwrds - (retVal>>2) + dummy);  /* Number of Longwords transfered */
 #else
-      xferCount = (retVal>>2) + dummy;  /* Number of Longwords transfered */
+    xferCount = (retVal>>2) + dummy;  /* Number of Longwords transfered */
 #endif
+    C792_STAT_ADD(id,dmaBytes,(xferCount - dummy)<<2);
+    C792_STAT_ADD(id,nberr,1);
+    C792UNLOCK(id);
+    return(xferCount);
+  }
+  C792UNLOCK(id);
 
-      /* Work backwards until the EOB is found */
-      int iword = xferCount -1, ieob = -1;
-      while(iword >= 0)
-	{
-	  trailer = data[iword];
+  C792_LOG("%s(%d): ERROR in DMA transfer retVal = 0x%x stat = %d reg = 0x%x\n",
+	 __func__,id,retVal,stat, reg);
+  return(ERROR);
+}
+
+/* Walk forward through the transfer, from header to header using the
+   word counts, and check that each event ends with a trailer.  Events are
+   added to evidx (if not NULL), and the read counter is updated from the
+   last complete event.  *bstat gets C792_BLKSTAT_* flags.
+   Returns the number of longwords up to and including the last EOB, 0 if
+   the transfer holds only filler words, or ERROR if it holds no complete
+   event */
+LOCAL int
+c792ReadBlockCheck(int id, volatile UINT32 *data, int xferCount,
+		   c792EvIndex *evidx, int maxev, int *nevents, int *bstat)
+{
+  UINT32 header, trailer, evID = 0;
+  int iword = 0, good = 0, nev = 0, nidx = 0, stat = 0, nWords;
+  int badHeader = 0, badTrailer = 0;
+
+  while(iword < xferCount)
+    {
+      header = data[iword];
 #ifndef VXWORKS
-	  trailer = LSWAP(trailer);
+      header = LSWAP(header);
 #endif
-	  if ((trailer&C792_DATA_ID_MASK) == C792_TRAILER_DATA) {
-	    ieob = iword;
-	    break;
-	  }
-	  iword--;
-	}
+      if((header&C792_DATA_ID_MASK) == C792_INVALID_DATA) {
+	iword++;   /* Alignment word, or filler after the last event */
+	continue;
+      }
+      if((header&C792_DATA_ID_MASK) != C792_HEADER_DATA) {
+	stat |= C792_BLKSTAT_CORRUPT;
+	badHeader = 1;
+	break;
+      }
 
-      if(ieob == -1)
-	{
-	  logMsg("%s(%d): ERROR: Failed to find EOB (xferCount = %d)\n",
-		 __func__, id, xferCount);
-	  C792UNLOCK;
-	  return(xferCount); // FIXME: return ERROR;
-	}
+      nWords = (header&C792_WORDCOUNT_MASK)>>8;
+      if(iword + nWords + 1 >= xferCount) {
+	stat |= C792_BLKSTAT_PARTIAL;
+	break;
+      }
 
-      xferCount = iword + 1;
-      if ((trailer&C792_DATA_ID_MASK) == C792_TRAILER_DATA) {
-	evID = trailer&C792_EVENTCOUNT_MASK;
-	C792_EXEC_SET_EVTREADCNT(id,evID);
-	C792UNLOCK;
-	return(xferCount); /* Return number of data words transfered */
-      } else {
-	logMsg("%s(%d): ERROR: Invalid Trailer data 0x%x\n",
-	       __func__, id,trailer);
-	C792UNLOCK;
-	/* return(ERROR); */
-	return(xferCount);
+      trailer = data[iword + nWords + 1];
+#ifndef VXWORKS
+      trailer = LSWAP(trailer);
+#endif
+      if((trailer&C792_DATA_ID_MASK) != C792_TRAILER_DATA) {
+	stat |= C792_BLKSTAT_CORRUPT;
+	badTrailer = 1;
+	break;
       }
-    } else {
-      logMsg("%s(%d): ERROR in DMA transfer retVal = 0x%x stat = %d reg = 0x%x\n",
-	     __func__,id,retVal,stat, reg);
-      C792UNLOCK;
+      evID = trailer&C792_EVENTCOUNT_MASK;
+
+      if(evidx) {
+	if(nidx < maxev) {
+	  evidx[nidx].geo    = (header&C792_GEO_ADDR_MASK)>>27;
+	  evidx[nidx].offset = iword;
+	  evidx[nidx].nwords = nWords + 2;
+	  evidx[nidx].evID   = evID;
+	  nidx++;
+	} else {
+	  stat |= C792_BLKSTAT_INDEX_FULL;
+	}
+      }
+
+      nev++;
+      iword += nWords + 2;
+      good = iword;
+    }
+
+  if(nevents) *nevents = nidx;
+  if(bstat) *bstat = stat;
+
+  C792LOCK(id);
+  if(nev > 0)
+    C792_EXEC_SET_EVTREADCNT(id,evID);
+  C792_STAT_ADD(id,nevents,nev);
+  C792_STAT_ADD(id,nwords,good);
+  C792_STAT_ADD(id,nbadHeader,badHeader);
+  C792_STAT_ADD(id,nbadTrailer,badTrailer);
+  C792UNLOCK(id);
+
+  if((nev == 0) && (stat == 0))
+    return(0);
+
+  if(nev == 0)
+    {
+      C792_LOG("%s(%d): ERROR: Failed to find EOB (xferCount = %d)\n",
+	     __func__, id, xferCount);
       return(ERROR);
     }
+
+  if(stat & C792_BLKSTAT_CORRUPT)
+    C792_LOG("%s(%d): ERROR: Corrupt data at word %d (xferCount = %d)\n",
+	   __func__, id, iword, xferCount);
+
+  return(good); /* Return number of data words transfered */
+}
+
+int
+c792ReadBlockComplete(int id)
+{
+  int xferCount;
+  volatile UINT32 *data = c792DmaData;
+
+  if((id<0) || (c792DmaID != id)) {
+    C792_LOG("c792ReadBlockComplete: ERROR : No transfer in flight for QDC id %d \n",
+	   id,0,0,0,0,0);
+    return(ERROR);
   }
 
-  C792UNLOCK;
-  return(OK);
+  xferCount = c792ReadBlockWait(id);
+  if(xferCount <= 0)
+    return(xferCount);
+
+  xferCount = c792ReadBlockCheck(id, data, xferCount, NULL, 0, NULL, NULL);
+  if(xferCount > 0)
+    C792_SWAP_BLOCK(data,xferCount);
+
+  return(xferCount);
+}
+
+/*******************************************************************************
+*
+* c792ReadBlockIndex - Block read of events from QDC, with an index of the
+*                      events read
+*
+*   Same as c792ReadBlock, but the check of the transfer also fills evidx
+*   with the offset, length, GEO and event counter of each complete event,
+*   so that the caller does not have to scan the data again.
+*
+* INPUTS:    id      - module id of QDC to access
+*            data    - address of data destination
+*            nwrds   - maximum number of data words to transfer
+*            evidx   - filled with one descriptor per event
+*            maxev   - size of evidx
+*            nevents - returns the number of descriptors filled
+*            bstat   - (optional) returns C792_BLKSTAT_* flags:
+*                      PARTIAL    : the last event was cut by nwrds
+*                      CORRUPT    : a header or trailer was not found
+*                                   where expected
+*                      INDEX_FULL : more than maxev events were read
+*
+* RETURNS: Number of data words up to and including the last complete
+*          event (and an alignment word at the start, if one was needed),
+*          or ERROR.  The read counter is updated from that event.
+*/
+
+int
+c792ReadBlockIndex(int id, volatile UINT32 *data, int nwrds,
+		   c792EvIndex *evidx, int maxev, int *nevents, int *bstat)
+{
+  int xferCount;
+
+  if((evidx == NULL) || (maxev <= 0) || (nevents == NULL)) {
+    C792_LOG("c792ReadBlockIndex: ERROR : Invalid event index \n",0,0,0,0,0,0);
+    return(ERROR);
+  }
+
+  *nevents = 0;
+  if(bstat) *bstat = 0;
+
+  if(c792ReadBlockStart(id, data, nwrds) != OK)
+    return(ERROR);
+
+  xferCount = c792ReadBlockWait(id);
+  if(xferCount <= 0)
+    return(xferCount);
+
+  xferCount = c792ReadBlockCheck(id, data, xferCount, evidx, maxev,
+				 nevents, bstat);
+  if(xferCount > 0)
+    C792_SWAP_BLOCK(data,xferCount);
+
+  return(xferCount);
+}
+
+/*******************************************************************************
+*
+* c792ReadBlockOverlap - Block read of several QDCs, keeping one DMA in flight
+*
+*   The QDCs in idmask are read in id order into consecutive regions of
+*   data.  As soon as the transfer from one QDC is done, the transfer from
+*   the next one is started behind it, and the finished region is checked
+*   (and optionally byte swapped) while the DMA engine fills the next one.
+*
+*   Each region may start with an alignment word, and words after the last
+*   trailer of a region are overwritten with filler (not valid datum) words.
+*   data may be dma_dabufp in a readout list; advance it by the return value.
+*
+* INPUTS:    idmask   - mask of QDC ids to read (see c792ScanMask)
+*            data     - address of data destination.  Must hold
+*                       nwrds + 1 words for each QDC in idmask.
+*            nwrds    - maximum number of data words to transfer per QDC
+*            flags    - C792_BLOCK_SWAP: convert the data to CPU byte order
+*            modWords - (optional) filled with the number of words in the
+*                       region of each QDC id, or ERROR if its read failed
+*
+* RETURNS: Total number of words written to data, or ERROR.
+*/
+
+int
+c792ReadBlockOverlap(UINT32 idmask, volatile UINT32 *data, int nwrds,
+		     int flags, int *modWords)
+{
+  int ii, jj, nmod = 0, nw, good, total = 0;
+  int ids[C792_MAX_MODULES];
+  volatile UINT32 *dst, *pos = data;
+
+  for(ii=0;ii<Nc792;ii++)
+    if((idmask & (1<<ii)) && (c792p[ii] != NULL))
+      ids[nmod++] = ii;
+
+  if(nmod == 0)
+    return(0);
+
+  if(c792ReadBlockStart(ids[0], pos, nwrds) != OK)
+    return(ERROR);
+
+  for(ii=0;ii<nmod;ii++)
+    {
+      if(c792DmaID != ids[ii])
+	{ /* Could not be started */
+	  if(modWords) modWords[ids[ii]] = ERROR;
+	  if(ii+1 < nmod)
+	    c792ReadBlockStart(ids[ii+1], pos, nwrds);
+	  continue;
+	}
+
+      dst = c792DmaData;
+      nw = c792ReadBlockWait(ids[ii]);
+      if(nw < 0)
+	nw = 0;
+      pos = dst + nw;
+
+      /* Keep the bus busy with the next QDC */
+      if(ii+1 < nmod)
+	c792ReadBlockStart(ids[ii+1], pos, nwrds);
+
+      if(nw > 0)
+	{
+	  /* No complete event: the region is all filler */
+	  good = c792ReadBlockCheck(ids[ii], dst, nw, NULL, 0, NULL, NULL);
+	  if(good < 0)
+	    good = 0;
+	  for(jj=good;jj<nw;jj++)
+#ifdef VXWORKS
+	    dst[jj] = C792_INVALID_DATA;
+#else
+	    dst[jj] = LSWAP(C792_INVALID_DATA);
+#endif
+
+#ifndef VXWORKS
+	  if((flags & C792_BLOCK_SWAP) || (c792ByteOrder==C792_ORDER_CPU))
+	    v7xxSwapBlock(dst,nw);
+#endif
+	}
+
+      if(modWords) modWords[ids[ii]] = nw;
+      total += nw;
+    }
+
+  return(total);
+}
+
+
+/*******************************************************************************
+*
+* c792SetCBLT   - Program the CBLT/MCST address and chain position of a QDC
+* c792CBLTInit  - Build a CBLT chain from all initialized QDCs
+*
+*   The chain order follows the GEO address (slot), lowest slot FIRST and
+*   highest slot LAST.  In a crate that also holds V775 TDCs on the same
+*   chain, use C792_CBLT_NOT_FIRST / C792_CBLT_NOT_LAST when the QDCs are
+*   not at the ends of the chain, or program interleaved boards one by one
+*   with c792SetCBLT.
+*
+*   Bus errors are enabled on all chain members, since the chain is
+*   terminated by a BERR from the LAST board.
+*
+* INPUTS:    cbltAddr - VME A32 address of the chain (bits 31-24 only)
+*            role     - C792_CBLT_DISABLED, _LAST, _FIRST or _MIDDLE
+*            flags    - C792_CBLT_NOT_FIRST, C792_CBLT_NOT_LAST
+*
+* RETURNS: OK, or ERROR if the address is invalid or no QDC is initialized.
+*/
+
+STATUS
+c792SetCBLT(int id, UINT32 cbltAddr, int role)
+{
+  if((id<0) || (c792p[id] == NULL)) {
+    printf("c792SetCBLT: ERROR : QDC id %d not initialized \n",id);
+    return(ERROR);
+  }
+
+  if(cbltAddr & 0x00ffffff) {
+    printf("c792SetCBLT: ERROR: Invalid CBLT address 0x%08x (only bits 31-24 allowed)\n",
+	   cbltAddr);
+    return(ERROR);
+  }
+
+  if((role<C792_CBLT_DISABLED) || (role>C792_CBLT_MIDDLE)) {
+    printf("c792SetCBLT: ERROR: Invalid chain position (%d)\n",role);
+    return(ERROR);
+  }
+
+  C792LOCK(id);
+  C792_SHADOW_WRITE(id,cbltAddr,(cbltAddr>>24)&0xff);
+  C792_SHADOW_WRITE(id,cbltControl,role);
+  if(role != C792_CBLT_DISABLED)
+    C792_SHADOW_WRITE(id,control1,
+		      c792Shadow[id].control1 | C792_BERR_ENABLE | C792_BLK_END);
+  c792CBLTGeo[id] = c792Shadow[id].geoAddr&C792_GEO_MASK;
+  C792UNLOCK(id);
+
+  c792CBLTRole[id] = role;
+  c792CBLTAddr = cbltAddr;
+
+  return(OK);
+}
+
+STATUS
+c792CBLTInit(UINT32 cbltAddr, int flags)
+{
+  int ii, jj, tmp, role;
+  int order[C792_MAX_MODULES];
+
+  if(Nc792 <= 0) {
+    printf("c792CBLTInit: ERROR: No QDCs initialized\n");
+    return(ERROR);
+  }
+
+  /* A lone QDC cannot be both ends of the chain */
+  if((Nc792==1) && !(flags&(C792_CBLT_NOT_FIRST|C792_CBLT_NOT_LAST))) {
+    printf("c792CBLTInit: ERROR: A chain needs at least two boards\n");
+    return(ERROR);
+  }
+
+  /* Sort the QDCs by GEO address */
+  for(ii=0;ii<Nc792;ii++) {
+    order[ii] = ii;
+    c792CBLTGeo[ii] = c792Shadow[ii].geoAddr&C792_GEO_MASK;
+  }
+
+  for(ii=1;ii<Nc792;ii++) {
+    for(jj=ii;(jj>0) && (c792CBLTGeo[order[jj-1]] > c792CBLTGeo[order[jj]]);jj--) {
+      tmp = order[jj]; order[jj] = order[jj-1]; order[jj-1] = tmp;
+    }
+  }
+
+  for(ii=0;ii<Nc792;ii++) {
+    if((ii>0) && (c792CBLTGeo[order[ii]] == c792CBLTGeo[order[ii-1]]))
+      printf("c792CBLTInit: WARN: QDC %d and %d have the same GEO address (%d)\n",
+	     order[ii-1],order[ii],c792CBLTGeo[order[ii]]);
+
+    if((ii==0) && !(flags&C792_CBLT_NOT_FIRST))
+      role = C792_CBLT_FIRST;
+    else if((ii==Nc792-1) && !(flags&C792_CBLT_NOT_LAST))
+      role = C792_CBLT_LAST;
+    else
+      role = C792_CBLT_MIDDLE;
+
+    if(c792SetCBLT(order[ii], cbltAddr, role) != OK)
+      return(ERROR);
+  }
+
+  return(OK);
+}
+
+/*******************************************************************************
+*
+* c792CBLTReadBlock - Read the whole CBLT chain with a single DMA transfer
+*
+*   The DMA engine must be configured for A32 block transfers,
+*   e.g. vmeDmaConfig(2,3,0) for MBLT.
+*
+* INPUTS:    data   - address of data destination
+*            nwrds  - maximum number of data words to transfer
+*
+* RETURNS: Number of data words transfered (including an alignment word
+*          at the start, if one was needed), or ERROR.
+*          Use c792CBLTSplit to find the events of each module.
+*/
+
+int
+c792CBLTReadBlock(volatile UINT32 *data, int nwrds)
+{
+  int ii, retVal, xferCount, dummy=0, owner;
+  volatile unsigned int *laddr;
+  unsigned long long t0;
+
+  if(c792CBLTAddr == 0) {
+    C792_LOG("c792CBLTReadBlock: ERROR : CBLT chain not initialized \n",0,0,0,0,0,0);
+    return(ERROR);
+  }
+
+  /* Check for 8 byte boundary for address - insert dummy word */
+  if((unsigned long) (data)&0x7)
+    {
+#ifdef VXWORKS
+      *data = C792_INVALID_DATA;
+#else
+      *data = LSWAP(C792_INVALID_DATA);
+#endif
+      dummy = 1;
+      laddr = (data + 1);
+    }
+  else
+    {
+      dummy = 0;
+      laddr = data;
+    }
+
+  if(v7xxDmaTake(V7XX_DMA_QDC,C792_STATS_CBLT,&owner) != OK) {
+    C792_LOG("c792CBLTReadBlock: ERROR : DMA engine busy with %s id %d \n",
+	   V7XX_DMA_LIB(owner),V7XX_DMA_ID(owner),0,0,0,0);
+    return(ERROR);
+  }
+
+  C792LOCK_ALL;
+#ifdef VXWORKSPPC
+  retVal = sysVmeDmaSend((UINT32)laddr, c792CBLTAddr, (nwrds<<2), 0);
+  if(retVal < 0) {
+    C792_LOG("c792CBLTReadBlock: ERROR in DMA transfer Initialization 0x%x\n",retVal,0,0,0,0,0);
+    C792UNLOCK_ALL;
+    v7xxDmaGive();
+    return(ERROR);
+  }
+  retVal = sysVmeDmaDone(1000,1);
+#elif defined(VXWORKS68K51)
+  C792_LOG("c792CBLTReadBlock: ERROR: CBLT requires A32 addressing\n",0,0,0,0,0,0);
+  C792UNLOCK_ALL;
+  v7xxDmaGive();
+  return(ERROR);
+#else
+  C792_STAT_TIME(t0);
+  retVal = vmeDmaSend((unsigned long)laddr, c792CBLTAddr, (nwrds<<2));
+  if(retVal < 0) {
+    C792_LOG("c792CBLTReadBlock: ERROR in DMA transfer Initialization 0x%x\n",retVal,0,0,0,0,0);
+    C792UNLOCK_ALL;
+    v7xxDmaGive();
+    return(ERROR);
+  }
+  retVal = vmeDmaDone();
+  C792_CBLT_STAT_ADD(ndma,1);
+  C792_CBLT_STAT_ADD(dmaTime,c792LockNow() - t0);
+#endif
+  v7xxDmaGive();
+
+  if(retVal < 0) {
+    C792_LOG("c792CBLTReadBlock: ERROR in DMA transfer retVal = 0x%x\n",retVal,0,0,0,0,0);
+    C792UNLOCK_ALL;
+    return(ERROR);
+  }
+
+#ifdef VXWORKS
+  xferCount = (nwrds - (retVal>>2) + dummy);
+#else
+  xferCount = (retVal>>2) + dummy;
+#endif
+  C792_CBLT_STAT_ADD(dmaBytes,(xferCount - dummy)<<2);
+
+  /* Clear the bus error flag on the QDC that terminated the chain */
+  for(ii=0;ii<Nc792;ii++) {
+    if(c792CBLTRole[ii] == C792_CBLT_LAST) {
+      if(vmeRead16(&c792p[ii]->bitSet1)&C792_VME_BUS_ERROR) {
+	vmeWrite16(&c792p[ii]->bitClear1, C792_VME_BUS_ERROR);
+	C792_CBLT_STAT_ADD(nberr,1);
+      }
+      break;
+    }
+  }
+  C792UNLOCK_ALL;
+
+  C792_SWAP_BLOCK(data,xferCount);
+
+  return(xferCount);
+}
+
+/*******************************************************************************
+*
+* c792CBLTSplit - Split a CBLT data stream into per-module events
+*
+*   Each event is located with the word count of its header and checked for
+*   a trailer.  Filler words (not valid datum) between events are skipped.
+*   The read counter of every QDC found in the stream is updated.  Events
+*   from other boards on the chain (e.g. V775 TDCs) are indexed, but must be
+*   accounted with c775CBLTSplit.
+*
+* INPUTS:    data   - CBLT data, as returned by c792CBLTReadBlock
+*            nwrds  - number of words in data
+*            evidx  - filled with one descriptor per event
+*            maxev  - size of evidx
+*
+* RETURNS: Number of events found, or ERROR if the stream is corrupt.
+*/
+
+int
+c792CBLTSplit(volatile UINT32 *data, int nwrds, c792EvIndex *evidx, int maxev)
+{
+  int ii, id, iword = 0, nev = 0, nWords;
+  UINT32 word, trailer;
+  int geoID[C792_MAX_GEO];
+
+  for(ii=0;ii<C792_MAX_GEO;ii++)
+    geoID[ii] = -1;
+  for(ii=0;ii<Nc792;ii++)
+    if(c792CBLTRole[ii] != C792_CBLT_DISABLED)
+      geoID[c792CBLTGeo[ii]] = ii;
+
+  while(iword < nwrds) {
+    word = C792_BUF_WORD(data[iword]);
+    if((word&C792_DATA_ID_MASK) != C792_HEADER_DATA) {
+      if((word&C792_DATA_ID_MASK) != C792_INVALID_DATA) {
+	C792_LOG("c792CBLTSplit: ERROR: Unexpected word 0x%08x at %d\n",
+	       word,iword,0,0,0,0);
+	C792_CBLT_STAT_ADD(nbadHeader,1);
+	return(ERROR);
+      }
+      iword++;
+      continue;
+    }
+
+    nWords = (word&C792_WORDCOUNT_MASK)>>8;
+    if(iword + nWords + 1 >= nwrds) {
+      C792_LOG("c792CBLTSplit: ERROR: Truncated event at %d\n",iword,0,0,0,0,0);
+      return(ERROR);
+    }
+    trailer = C792_BUF_WORD(data[iword + nWords + 1]);
+    if((trailer&C792_DATA_ID_MASK) != C792_TRAILER_DATA) {
+      C792_LOG("c792CBLTSplit: ERROR: Invalid Trailer Word 0x%08x at %d\n",
+	     trailer,iword + nWords + 1,0,0,0,0);
+      id = geoID[(word&C792_GEO_ADDR_MASK)>>27];
+      if(id >= 0)
+	C792_STAT_ADD(id,nbadTrailer,1);
+      else
+	C792_CBLT_STAT_ADD(nbadTrailer,1);
+      return(ERROR);
+    }
+
+    if(nev >= maxev) {
+      C792_LOG("c792CBLTSplit: ERROR: More than %d events in stream\n",maxev,0,0,0,0,0);
+      return(ERROR);
+    }
+    evidx[nev].geo    = (word&C792_GEO_ADDR_MASK)>>27;
+    evidx[nev].offset = iword;
+    evidx[nev].nwords = nWords + 2;
+    evidx[nev].evID   = trailer&C792_EVENTCOUNT_MASK;
+
+    id = geoID[evidx[nev].geo];
+    if(id >= 0) {
+      C792_EXEC_SET_EVTREADCNT(id,evidx[nev].evID);
+      C792_STAT_ADD(id,nevents,1);
+      C792_STAT_ADD(id,nwords,nWords + 2);
+    }
+
+    nev++;
+    iword += nWords + 2;
+  }
+
+  return(nev);
+}
+
+
+/*******************************************************************************
+*
+* c792MCSTInit - Program the multicast (MCST) address of all initialized QDCs
+*
+*   MCST shares the address and chain position registers with CBLT, so this
+*   sets up the same chain as c792CBLTInit, then maps the A32 multicast
+*   address for the c792MCST* commands below.  Each of them is a single
+*   VME write to all QDCs on the chain, instead of one write per module.
+*
+*   If V775 TDCs are on the same chain they receive the commands too, but
+*   only the QDC software counters are updated here.
+*
+* INPUTS:    mcstAddr - VME A32 address (bits 31-24 only)
+*            flags    - C792_CBLT_NOT_FIRST, C792_CBLT_NOT_LAST
+*
+* RETURNS: OK, or ERROR if the chain could not be programmed or mapped.
+*/
+
+STATUS
+c792MCSTInit(UINT32 mcstAddr, int flags)
+{
+  int res;
+  unsigned long laddr;
+
+  c792MCSTp = NULL;
+
+  if(c792CBLTInit(mcstAddr, flags) != OK)
+    return(ERROR);
+
+#ifdef VXWORKS
+  res = sysBusToLocalAdrs(0x09,(char *)mcstAddr,(char **)&laddr);
+  if (res != 0) {
+    printf("c792MCSTInit: ERROR in sysBusToLocalAdrs(0x09,0x%x,&laddr) \n",mcstAddr);
+    return(ERROR);
+  }
+#else
+  res = vmeBusToLocalAdrs(0x09,(char *)(unsigned long)mcstAddr,(char **)&laddr);
+  if (res != 0) {
+    printf("c792MCSTInit: ERROR in vmeBusToLocalAdrs(0x09,0x%x,&laddr) \n",mcstAddr);
+    return(ERROR);
+  }
+#endif
+  c792MCSTp = (struct c792_struct *)laddr;
+
+  return(OK);
+}
+
+/*******************************************************************************
+*
+* c792MCSTGate                - Issue Software Gate to all QDCs
+* c792MCSTEnable              - Bring all QDCs Online (Enable Gates)
+* c792MCSTDisable             - Bring all QDCs Offline (Disable Gates)
+* c792MCSTClear               - Clear (data reset) all QDCs
+* c792MCSTReset               - Clear/Reset all QDCs
+* c792MCSTEventCounterReset   - Reset the event counter of all QDCs
+*
+*
+* RETURNS: None.
+*/
+
+void
+c792MCSTGate()
+{
+  if(c792MCSTp == NULL) {
+    C792_LOG("c792MCSTGate: ERROR : MCST not initialized \n",0,0,0,0,0,0);
+    return;
+  }
+  C792LOCK_ALL;
+  vmeWrite16(&c792MCSTp->swComm, 1);
+  C792UNLOCK_ALL;
+}
+
+void
+c792MCSTEnable()
+{
+  int ii;
+
+  if(c792MCSTp == NULL) {
+    C792_LOG("c792MCSTEnable: ERROR : MCST not initialized \n",0,0,0,0,0,0);
+    return;
+  }
+  C792LOCK_ALL;
+  vmeWrite16(&c792MCSTp->bitClear2, C792_OFFLINE);
+  for(ii=0;ii<Nc792;ii++)
+    if(c792CBLTRole[ii] != C792_CBLT_DISABLED)
+      c792Shadow[ii].bitSet2 &= ~C792_OFFLINE;
+  C792UNLOCK_ALL;
+}
+
+void
+c792MCSTDisable()
+{
+  int ii;
+
+  if(c792MCSTp == NULL) {
+    C792_LOG("c792MCSTDisable: ERROR : MCST not initialized \n",0,0,0,0,0,0);
+    return;
+  }
+  C792LOCK_ALL;
+  vmeWrite16(&c792MCSTp->bitSet2, C792_OFFLINE);
+  for(ii=0;ii<Nc792;ii++)
+    if(c792CBLTRole[ii] != C792_CBLT_DISABLED)
+      c792Shadow[ii].bitSet2 |= C792_OFFLINE;
+  C792UNLOCK_ALL;
+}
+
+void
+c792MCSTClear()
+{
+  int ii;
+
+  if(c792MCSTp == NULL) {
+    C792_LOG("c792MCSTClear: ERROR : MCST not initialized \n",0,0,0,0,0,0);
+    return;
+  }
+  C792LOCK_ALL;
+  C792_EXEC_MCST_DATA_RESET();
+  C792UNLOCK_ALL;
+  for(ii=0;ii<Nc792;ii++) {
+    if(c792CBLTRole[ii] == C792_CBLT_DISABLED) continue;
+    c792EvtReadCnt[ii] = -1;
+    c792EventCount[ii] =  0;
+    C792_STAT_ADD(ii,nclear,1);
+  }
+}
+
+void
+c792MCSTReset()
+{
+  int ii;
+
+  if(c792MCSTp == NULL) {
+    C792_LOG("c792MCSTReset: ERROR : MCST not initialized \n",0,0,0,0,0,0);
+    return;
+  }
+  C792LOCK_ALL;
+  C792_EXEC_MCST_DATA_RESET();
+  vmeWrite16(&c792MCSTp->bitSet1, C792_SOFT_RESET);
+  vmeWrite16(&c792MCSTp->bitClear1, C792_SOFT_RESET);
+  vmeWrite16(&c792MCSTp->evCountReset, 1);
+  for(ii=0;ii<Nc792;ii++)
+    if(c792CBLTRole[ii] != C792_CBLT_DISABLED)
+      c792ShadowLoad(ii);
+  C792UNLOCK_ALL;
+  for(ii=0;ii<Nc792;ii++) {
+    if(c792CBLTRole[ii] == C792_CBLT_DISABLED) continue;
+    c792EvtReadCnt[ii] = -1;
+    c792EventCount[ii] =  0;
+    C792_STAT_ADD(ii,nclear,1);
+  }
+}
+
+void
+c792MCSTEventCounterReset()
+{
+  int ii;
+
+  if(c792MCSTp == NULL) {
+    C792_LOG("c792MCSTEventCounterReset: ERROR : MCST not initialized \n",0,0,0,0,0,0);
+    return;
+  }
+  C792LOCK_ALL;
+  vmeWrite16(&c792MCSTp->evCountReset, 1);
+  C792UNLOCK_ALL;
+  for(ii=0;ii<Nc792;ii++) {
+    if(c792CBLTRole[ii] == C792_CBLT_DISABLED) continue;
+    c792EvtReadCnt[ii] = -1;
+    c792EventCount[ii] =  0;
+  }
+}
+
+
+LOCAL unsigned long long
+c792NowUs(void)
+{
+#ifdef VXWORKS
+  return((unsigned long long)tickGet()*1000000ULL/sysClkRateGet());
+#else
+  return(c792LockNow()/1000);
+#endif
+}
+
+/* Called for each interrupt of QDC id: at the end of each
+   C792_INT_WINDOW_US, measure its trigger and interrupt rates and, with
+   c792IntAdaptive, retune its Event Trigger register to the lowest level
+   that keeps the interrupt rate under maxRate, but no higher than what
+   the trigger rate fills in maxLatency.  The window and the level are
+   kept under the lock of the QDC, as c792IntAdaptTimer changes them
+   from the sampler thread */
+LOCAL void
+c792IntAdapt(int id)
+{
+  c792IntMod *im = &c792IntTab[id];
+  unsigned long long now, dt;
+  UINT32 evnow, nev, lo, hi, level;
+
+  C792LOCK(id);
+  im->st.nint++;
+  im->winCount++;
+
+  now = c792NowUs();
+  im->lastInt = now;
+  if((im->winStart != 0) && (now - im->winStart < C792_INT_WINDOW_US)) {
+    C792UNLOCK(id);
+    return;
+  }
+
+  C792_EXEC_READ_EVENT_COUNT(id);
+  evnow = c792EventCount[id]&C792_EVENTCOUNT_MASK;
+
+  if(im->winStart != 0) {
+    dt  = now - im->winStart;
+    nev = (evnow - im->winEvents)&C792_EVENTCOUNT_MASK;
+    im->st.trigRate = (UINT32)(nev*1000000ULL/dt);
+    im->st.intRate  = (UINT32)(im->winCount*1000000ULL/dt);
+  }
+
+  if(im->adaptOn && (im->winStart != 0)) {
+    lo = (im->maxRate > 0) ?
+      (im->st.trigRate + im->maxRate - 1)/im->maxRate : 1;
+    hi = (im->maxLatency > 0) ?
+      1 + (UINT32)((unsigned long long)im->st.trigRate*im->maxLatency/1000000) :
+      C792_EVTRIGGER_MASK;
+    level = (lo < hi) ? lo : hi;
+    if(level < 1) level = 1;
+    if(level > C792_EVTRIGGER_MASK) level = C792_EVTRIGGER_MASK;
+
+    if(level != im->evCount) {
+      /* Deferred, the worker re-arms the QDC with the new level */
+      if(!im->paused && (c792IntMode != C792_INT_DEFERRED))
+	C792_SHADOW_WRITE(id,evTrigger,level);
+      im->evCount = level;
+      im->st.nretune++;
+    }
+  }
+  im->st.level = im->evCount;
+#ifndef VXWORKS
+  c792Stats->intr[id] = im->st;
+#endif
+
+  im->winStart  = now;
+  im->winEvents = evnow;
+  im->winCount  = 0;
+  C792UNLOCK(id);
+}
+
+#ifndef VXWORKS
+/* From the sampler thread: an adaptive QDC with events waiting and no
+   interrupt for maxLatency has a level the trigger rate no longer fills.
+   Lower it to 1, so that the waiting events interrupt now, and measure
+   the rate again from the next interrupt: the window of c792IntAdapt
+   retunes it */
+LOCAL void
+c792IntAdaptTimer(int id, c792Snapshot *snap)
+{
+  c792IntMod *im = &c792IntTab[id];
+
+  if(!(snap->status1 & C792_DATA_READY))
+    return;
+
+  C792LOCK(id);
+  if(!im->enabled || im->paused || !im->adaptOn || (im->maxLatency <= 0) ||
+     (im->evCount <= 1) || (c792NowUs() < im->lastInt + im->maxLatency)) {
+    C792UNLOCK(id);
+    return;
+  }
+
+  /* Deferred, with the worker: it re-arms the QDC with the new level */
+  if(c792Shadow[id].evTrigger)
+    C792_SHADOW_WRITE(id,evTrigger,1);
+  im->evCount  = 1;
+  im->winStart = 0;
+  im->st.level = 1;
+  im->st.nretune++;
+  c792Stats->intr[id] = im->st;
+  C792UNLOCK(id);
+}
+#endif
+
+/* Wake up c792WaitReady (C792_WAIT_INT) */
+LOCAL void
+c792IntWake(void)
+{
+  if (c792WaitMode != C792_WAIT_INT)
+    return;
+#ifdef VXWORKS
+  semGive(c792Sem);
+#else
+  unsigned long long one = 1;
+  if((c792WaitEvFd >= 0) && (write(c792WaitEvFd, &one, sizeof(one)) < 0))
+    C792_LOG("c792Int: ERROR : Wakeup of c792WaitReady failed\n",0,0,0,0,0,0);
+#endif
+}
+
+/* Serve an interrupt of QDC id: user routine or default action */
+LOCAL void
+c792IntModule(int id)
+{
+  c792IntMod *im = &c792IntTab[id];
+  int ii=0;
+  UINT32 nevt1=0;
+  UINT32 nevt2=0;
+
+  if (im->routine != NULL)  {     /* call user routine */
+    (*im->routine) (im->arg);
+  }else if (c792WaitMode != C792_WAIT_INT) {  /* data is read by the waiter */
+    /* Default action is to increment the Read pointer by
+       the number of events in the Event Trigger register
+       or until the Data buffer is empty. The later case would
+       indicate a possible error. In either case the data is
+       effectively thrown away */
+    nevt1 = im->evCount;   /* the register is 0 while deferred */
+    nevt2 = c792Dready(id);
+    if(nevt2<nevt1) {
+      C792_LOG("c792Int: ERROR: Event Trig Register(%d) < # Events Ready (%d)\n",
+             nevt1,nevt2,0,0,0,0);
+      c792Clear(id);
+    } else {
+      C792LOCK(id);
+      for(ii=0;ii<nevt1;ii++) {
+	C792_EXEC_INCR_EVENT(id);
+      }
+      C792UNLOCK(id);
+    }
+
+    /* C792_LOG("c792Int: Processed %d events\n",nevt,0,0,0,0,0); */
+  }
+
+  c792IntAdapt(id);
+}
+
+#ifndef VXWORKS
+/* C792_INT_DEFERRED, interrupt side: release the interrupt of each QDC of
+   the level with Event Ready (Event Trigger register to 0), and hand
+   them to c792IntWorker.  No vmeBusLock, and at most two register
+   accesses per QDC.  As each QDC stays released until the worker has
+   served it, a bit per QDC is enough to queue it */
+LOCAL void
+c792IntDefer(int level)
+{
+  unsigned long long one = 1, now = c792NowUs();
+  UINT32 mask = 0;
+  UINT16 stat;
+  int id;
+
+  for(id=0;id<Nc792;id++) {
+    if(!c792IntTab[id].enabled || (c792IntTab[id].level != (UINT32)level))
+      continue;
+    C792LOCK(id);
+    stat = ((c792IntNlevel[level] > 1) || v7xxIntShared(V7XX_INT_QDC,level)) ?
+      vmeRead16(&c792p[id]->status1)&C792_EVRDY : C792_EVRDY;
+    if(stat)
+      C792_SHADOW_WRITE(id,evTrigger,0);
+    C792UNLOCK(id);
+    if(!stat) continue;
+    c792IntTab[id].tfire = now;
+    mask |= (1<<id);
+  }
+  if(mask == 0)
+    return;
+
+  __atomic_fetch_or(&c792IntPending, mask, __ATOMIC_RELEASE);
+  if(write(c792IntWorkFd, &one, sizeof(one)) < 0)
+    C792_LOG("c792Int: ERROR : Wakeup of the interrupt worker failed\n",0,0,0,0,0,0);
+}
+
+/* C792_INT_DEFERRED, worker thread: serve the QDCs handed over by
+   c792IntDefer, then re-arm their interrupt.  The user routine runs
+   without vmeBusLock, like the readout of a polling trigger routine;
+   the library locks protect each QDC */
+LOCAL void *
+c792IntWorker(void *arg)
+{
+  c792IntMod *im;
+  unsigned long long cnt, now, wait;
+  UINT32 mask;
+  int id;
+
+  while(1) {
+    if(read(c792IntWorkFd, &cnt, sizeof(cnt)) < 0) {
+      if(errno == EINTR) continue;
+      perror("c792IntWorker: read");
+      break;
+    }
+    if(c792IntMode != C792_INT_DEFERRED)
+      break;
+
+    mask = __atomic_exchange_n(&c792IntPending, 0, __ATOMIC_ACQUIRE);
+    now = c792NowUs();
+    for(; mask; mask &= mask - 1) {
+      id = __builtin_ctz(mask);
+      im = &c792IntTab[id];
+
+      wait = (now > im->tfire) ? now - im->tfire : 0;
+      im->st.ndefer++;
+      im->st.deferSum += wait;
+      if(wait > im->st.deferMax) im->st.deferMax = wait;
+
+      c792IntModule(id);
+
+      C792LOCK(id);
+      if(im->enabled && !im->paused)
+	C792_SHADOW_WRITE(id,evTrigger,im->evCount);
+      C792UNLOCK(id);
+    }
+  }
 
+  return(NULL);
 }
-
+#endif
 
 /*******************************************************************************
 *
 * c792Int - default interrupt handler
 *
-* This rountine handles the c792 QDC interrupt.  A user routine is
-* called, if one was connected by c792IntConnect().
+* This rountine handles the c792 QDC interrupts.  On VxWorks, each QDC
+* has its own vector, and arg is its id.  On Linux, the handler is
+* connected to a VME level, arg is the level, and it handles each QDC
+* enabled on that level with Event Ready set (without reading the status
+* when there is only one).  A QDC served with the interrupt of another
+* may still raise its own, which then finds nothing to do.
+*
+* For each QDC, the user routine connected by c792IntConnect() or
+* c792IntConnectModule() is called.  In the C792_WAIT_INT wait mode, it
+* also wakes up c792WaitReady, and leaves the data in the module for it.
+*
+* In the C792_INT_DEFERRED mode (c792SetIntMode), the handler only
+* releases the interrupt of the QDCs that fired and queues them, and the
+* routine is called from the worker thread.
 *
 * RETURNS: N/A
 *
 */
 
 LOCAL void
-c792Int (void)
+c792Int (int arg)
 {
-  int ii=0;
-  UINT32 nevt1=0;
-  UINT32 nevt2=0;
+#ifndef VXWORKS
+  int id;
+  UINT16 stat;
+#endif
 
   /* Disable interrupts */
 #ifdef VXWORKS
-  sysIntDisable(c792IntLevel);
+  sysIntDisable(c792IntTab[arg].level);
 #endif
 
 
@@ -975,44 +2882,30 @@ c792Int (void)
 #endif
 
   c792IntCount++;
+  c792IntWake();
 
-#ifndef VXWORKS
-  vmeBusLock();
-#endif
-
-  if (c792IntRoutine != NULL)  {     /* call user routine */
-    (*c792IntRoutine) (c792IntArg);
-  }else{
-    if((c792IntID<0) || (c792p[c792IntID] == NULL)) {
-      logMsg("c792Int: ERROR : QDC id %d not initialized \n",c792IntID,0,0,0,0,0);
-      return;
-    }
-    /* Default action is to increment the Read pointer by
-       the number of events in the Event Trigger register
-       or until the Data buffer is empty. The later case would
-       indicate a possible error. In either case the data is
-       effectively thrown away */
-    C792LOCK;
-    nevt1 = vmeRead16(&c792p[c792IntID]->evTrigger)&C792_EVTRIGGER_MASK;
-    C792UNLOCK;
-    nevt2 = c792Dready(c792IntID);
-    if(nevt2<nevt1) {
-      logMsg("c792Int: ERROR: Event Trig Register(%d) < # Events Ready (%d)\n",
-             nevt1,nevt2,0,0,0,0);
-      c792Clear(c792IntID);
-    } else {
-      C792LOCK;
-      for(ii=0;ii<nevt1;ii++) {
-	C792_EXEC_INCR_EVENT(c792IntID);
+#ifdef VXWORKS
+  c792IntModule(arg);
+#else
+  if(c792IntMode == C792_INT_DEFERRED) {
+    c792IntDefer(arg);
+  } else {
+    vmeBusLock();
+
+    for(id=0;id<Nc792;id++) {
+      if(!c792IntTab[id].enabled || (c792IntTab[id].level != (UINT32)arg))
+	continue;
+      if((c792IntNlevel[arg] > 1) || v7xxIntShared(V7XX_INT_QDC,arg)) {
+	C792LOCK(id);
+	stat = vmeRead16(&c792p[id]->status1)&C792_EVRDY;
+	C792UNLOCK(id);
+	if(!stat) continue;
       }
-      C792UNLOCK;
+      c792IntModule(id);
     }
 
-    /* logMsg("c792Int: Processed %d events\n",nevt,0,0,0,0,0); */
+    vmeBusUnlock();
   }
-
-#ifndef VXWORKS
-  vmeBusUnlock();
 #endif
 
 #ifdef VXWORKSPPC
@@ -1021,7 +2914,7 @@ c792Int (void)
 
   /* Enable interrupts */
 #ifdef VXWORKS
-  sysIntEnable(c792IntLevel);
+  sysIntEnable(c792IntTab[arg].level);
 #endif
 
 }
@@ -1029,10 +2922,16 @@ c792Int (void)
 
 /*******************************************************************************
 *
-* c792IntConnect - connect a user routine to the c792 QDC interrupt
+* c792IntConnect       - connect a user routine to the c792 QDC interrupts
+* c792IntConnectModule - connect a user routine to the interrupt of one QDC
+*
+* c792IntConnect sets the routine, VME level and base vector of all the
+* QDCs.  Each QDC interrupts with its own vector, vector + id.
+* c792IntConnectModule gives QDC id its own routine, level and vector (0:
+* those of c792IntConnect).  The routine is called with arg at each
+* interrupt of the QDC; with NULL, the data is thrown away.
 *
-* This routine specifies the user interrupt routine to be called at each
-* interrupt.
+* The interrupt service routine is connected by c792IntEnable.
 *
 * RETURNS: OK, or ERROR if Interrupts are enabled
 */
@@ -1069,29 +2968,64 @@ c792IntConnect (VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector)
     c792IntVec = vector;
   }
 
-  /* Connect the ISR */
+  return (OK);
+}
+
+STATUS
+c792IntConnectModule (int id, VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector)
+{
+  c792IntMod *im;
+
+  if((id<0) || (c792p[id] == NULL)) {
+    printf("c792IntConnectModule: ERROR : QDC id %d not initialized \n",id);
+    return(ERROR);
+  }
+  im = &c792IntTab[id];
+
+  if(im->enabled) {
+    printf("c792IntConnectModule: ERROR : Interrupts already enabled for QDC id %d\n",id);
+    return(ERROR);
+  }
+  if(level > 7) {
+    printf("c792IntConnectModule: ERROR: Invalid VME interrupt level (%d). Must be (1-7)\n",level);
+    return(ERROR);
+  }
+  if((vector != 0) && ((vector < 32)||(vector>255))) {
+    printf("c792IntConnectModule: ERROR: Invalid interrupt vector (%d). Must be (32<vector<255)\n",vector);
+    return(ERROR);
+  }
+
+  im->routine   = routine;
+  im->arg       = arg;
+  im->level     = level;
+  im->vec       = vector;
+  im->connected = 1;
+
+  return (OK);
+}
+
+/* Connect c792Int to the vector (VxWorks) or register it on the level
+   (Linux) of QDC id */
+LOCAL STATUS
+c792IntAttach (int id)
+{
+  c792IntMod *im = &c792IntTab[id];
+
 #ifdef VXWORKSPPC
-  if((intDisconnect((int)INUM_TO_IVEC(c792IntVec)) != 0)) {
+  if((intDisconnect((int)INUM_TO_IVEC(im->vec)) != 0)) {
     printf("c792IntConnect: ERROR disconnecting Interrupt\n");
     return(ERROR);
   }
 #endif
 #ifdef VXWORKS
-  if((intConnect(INUM_TO_IVEC(c792IntVec),c792Int,0)) != 0) {
+  if((intConnect(INUM_TO_IVEC(im->vec),c792Int,id)) != 0) {
     printf("c792IntConnect: ERROR in intConnect()\n");
     return(ERROR);
   }
 #else
-  if(vmeIntDisconnect(c792IntLevel) != 0)
-    {
-      printf("c792IntConnect: ERROR disconnecting Interrupt\n");
-      return(ERROR);
-    }
-  if(vmeIntConnect(c792IntVec,c792IntLevel,c792Int,0) != 0)
-    {
-      printf("c792IntConnect: ERROR in intConnect()\n");
-      return(ERROR);
-    }
+  /* The level may also serve the TDCs: see v7xxInt.h */
+  if(v7xxIntAttachLevel(V7XX_INT_QDC,im->level,im->vec,(VOIDFUNCPTR)c792Int) != OK)
+    return(ERROR);
 #endif
 
   return (OK);
@@ -1102,7 +3036,8 @@ c792IntConnect (VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector)
 *
 * c792IntEnable - Enable interrupts from specified QDC
 *
-* Enables interrupts for a specified QDC.
+* Enables interrupts for a specified QDC, every evCnt events.  May be
+* called for several QDCs.
 *
 * RETURNS OK or ERROR if QDC is not available or parameter is out of range
 */
@@ -1110,18 +3045,18 @@ c792IntConnect (VOIDFUNCPTR routine, int arg, UINT16 level, UINT16 vector)
 STATUS
 c792IntEnable (int id, UINT16 evCnt)
 {
+  c792IntMod *im;
 
-  if(c792IntRunning) {
-    printf("c792IntEnable: ERROR : Interrupts already initialized for QDC id %d\n",
-	   c792IntID);
+  if((id<0) || (c792p[id] == NULL)) {
+    printf("c792IntEnable: ERROR : QDC id %d not initialized \n",id);
     return(ERROR);
   }
+  im = &c792IntTab[id];
 
-  if((id<0) || (c792p[id] == NULL)) {
-    printf("c792IntEnable: ERROR : QDC id %d not initialized \n",id);
+  if(im->enabled) {
+    printf("c792IntEnable: ERROR : Interrupts already initialized for QDC id %d\n",
+	   id);
     return(ERROR);
-  }else{
-    c792IntID = id;
   }
 
   /* check for event count out of range */
@@ -1131,20 +3066,55 @@ c792IntEnable (int id, UINT16 evCnt)
     return(ERROR);
   }
 
+  /* Routine, level and vector of c792IntConnect, unless the QDC has its own */
+  if(!im->connected) {
+    im->routine = c792IntRoutine;
+    im->arg     = c792IntArg;
+    im->level   = 0;
+    im->vec     = 0;
+  }
+  if(im->level == 0)
+    im->level = c792IntLevel ? c792IntLevel : C792_VME_INT_LEVEL;
+  if(im->vec == 0)
+    im->vec = (c792IntVec ? c792IntVec : C792_INT_VEC) + id;
+  if(im->vec > 255) {
+    printf("c792IntEnable: ERROR: Interrupt vector of QDC id %d (%d) is out of range\n",
+	   id,im->vec);
+    return(ERROR);
+  }
+
+  if(v7xxIntClaimVec(V7XX_INT_QDC,im->vec) != OK)
+    return(ERROR);
+  if(c792IntAttach(id) != OK) {
+    v7xxIntReleaseVec(V7XX_INT_QDC,im->vec);
+    return(ERROR);
+  }
+
 #ifdef VXWORKS
-  sysIntEnable(c792IntLevel);   /* Enable VME interrupts */
+  sysIntEnable(im->level);   /* Enable VME interrupts */
 #endif
 
   /* Zero Counter and set Running Flag */
-  c792IntEvCount = evCnt;
-  c792IntCount = 0;
+  im->evCount  = evCnt;
+  im->evFixed  = evCnt;
+  im->winStart = 0;
+  im->lastInt  = c792NowUs();
+  memset(&im->st, 0, sizeof(im->st));
+  im->st.level = evCnt;
+  im->paused   = 0;
+  im->enabled  = 1;
+  c792IntNlevel[im->level]++;
+  if(!c792IntRunning) {
+    c792IntID = id;
+    c792IntCount = 0;
+  }
   c792IntRunning = TRUE;
   /* Enable interrupts on QDC */
-  C792LOCK;
-  vmeWrite16(&c792p[c792IntID]->intVector, c792IntVec);
-  vmeWrite16(&c792p[c792IntID]->intLevel, c792IntLevel);
-  vmeWrite16(&c792p[c792IntID]->evTrigger, c792IntEvCount);
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_WRITE(id,intVector,im->vec);
+  C792_SHADOW_WRITE(id,intLevel,im->level);
+  C792_SHADOW_WRITE(id,evTrigger,im->evCount);
+  C792UNLOCK(id);
 
   return(OK);
 }
@@ -1152,7 +3122,10 @@ c792IntEnable (int id, UINT16 evCnt)
 
 /*******************************************************************************
 *
-* c792IntDisable - disable the QDC interrupts
+* c792IntDisable - disable the interrupts of all the QDCs
+*
+*   iflag > 0: for good (c792IntEnable again to restart)
+*   otherwise: pause them until c792IntResume
 *
 * RETURNS: OK, or ERROR if not initialized
 */
@@ -1160,24 +3133,37 @@ c792IntEnable (int id, UINT16 evCnt)
 STATUS
 c792IntDisable (int iflag)
 {
+  int id;
 
-  if((c792IntID<0) || (c792p[c792IntID] == NULL)) {
-    logMsg("c792IntDisable: ERROR : QDC id %d not initialized \n",c792IntID,0,0,0,0,0);
+  if(!c792IntRunning) {
+    C792_LOG("c792IntDisable: ERROR : Interrupts are not Enabled \n",0,0,0,0,0,0);
     return(ERROR);
   }
 
+  for(id=0;id<Nc792;id++) {
+    if(!c792IntTab[id].enabled) continue;
 #ifdef VXWORKS
-  sysIntDisable(c792IntLevel);   /* Disable VME interrupts */
+    sysIntDisable(c792IntTab[id].level);   /* Disable VME interrupts */
 #endif
-  C792LOCK;
-  vmeWrite16(&c792p[c792IntID]->evTrigger, 0);
+    C792LOCK(id);
+    C792_SHADOW_WRITE(id,evTrigger,0);
+    c792IntTab[id].paused = 1;
+    if(iflag > 0)
+      {
+	C792_SHADOW_WRITE(id,intLevel,0);
+	C792_SHADOW_WRITE(id,intVector,0);
+	c792IntTab[id].enabled = 0;
+	v7xxIntReleaseVec(V7XX_INT_QDC,c792IntTab[id].vec);
+	if(--c792IntNlevel[c792IntTab[id].level] == 0)
+	  v7xxIntDetachLevel(V7XX_INT_QDC,c792IntTab[id].level);
+      }
+    C792UNLOCK(id);
+  }
 
   /* Tell tasks that Interrupts have been disabled */
   if(iflag > 0)
     {
       c792IntRunning = FALSE;
-      vmeWrite16(&c792p[c792IntID]->intLevel, 0);
-      vmeWrite16(&c792p[c792IntID]->intVector, 0);
     }
 #ifdef VXWORKS
   else
@@ -1185,7 +3171,6 @@ c792IntDisable (int iflag)
       semGive(c792Sem);
     }
 #endif
-  C792UNLOCK;
 
   return (OK);
 }
@@ -1193,7 +3178,7 @@ c792IntDisable (int iflag)
 /*******************************************************************************
 *
 * c792IntResume - Re-enable interrupts from previously
-*                 intitialized QDC
+*                 intitialized QDCs
 *
 * RETURNS: OK, or ERROR if not initialized
 */
@@ -1202,34 +3187,195 @@ STATUS
 c792IntResume (void)
 {
   UINT16 evTrig = 0;
+  int id, nres = 0;
 
-  if((c792IntID<0) || (c792p[c792IntID] == NULL)) {
-    logMsg("c792IntResume: ERROR : QDC id %d not initialized \n",c792IntID,0,0,0,0,0);
-    return(ERROR);
+  if (!c792IntRunning) {
+      C792_LOG("c792IntResume: ERROR : Interrupts are not Enabled \n",0,0,0,0,0,0);
+      return(ERROR);
   }
 
-  if ((c792IntRunning)) {
-    C792LOCK;
-    evTrig = vmeRead16(&c792p[c792IntID]->evTrigger)&C792_EVTRIGGER_MASK;
+  for(id=0;id<Nc792;id++) {
+    if(!c792IntTab[id].enabled) continue;
+    C792LOCK(id);
+    c792IntTab[id].paused = 0;
+    evTrig = c792Shadow[id].evTrigger;
     if (evTrig == 0) {
 #ifdef VXWORKS
-      sysIntEnable(c792IntLevel);
+      sysIntEnable(c792IntTab[id].level);
 #endif
-      vmeWrite16(&c792p[c792IntID]->evTrigger, c792IntEvCount);
-    } else {
-      logMsg("c792IntResume: WARNING : Interrupts already enabled \n",0,0,0,0,0,0);
-      C792UNLOCK;
-      return(ERROR);
+      C792_SHADOW_WRITE(id,evTrigger,c792IntTab[id].evCount);
+      nres++;
     }
-    C792UNLOCK;
-  } else {
-      logMsg("c792IntResume: ERROR : Interrupts are not Enabled \n",0,0,0,0,0,0);
-      return(ERROR);
+    C792UNLOCK(id);
+  }
+
+  if(nres == 0) {
+    C792_LOG("c792IntResume: WARNING : Interrupts already enabled \n",0,0,0,0,0,0);
+    return(ERROR);
   }
 
   return (OK);
 }
 
+/*******************************************************************************
+*
+* c792IntAdaptive - Retune the number of events per interrupt (Event
+*                   Trigger register) of QDC id (id<0 for all) to its
+*                   trigger rate, measured over each C792_INT_WINDOW_US by
+*                   the interrupt handler.  The level is the lowest that
+*                   keeps the interrupt rate under maxRate, capped so that
+*                   at the measured rate the first event of an interrupt
+*                   waits no more than maxLatency.  Both 0: back to the
+*                   fixed level of c792IntEnable.
+*
+*   maxLatency - us, 0 for no limit
+*   maxRate    - interrupts per second, 0 for no limit
+*
+*   The level is measured at the interrupts only: when the trigger rate
+*   drops, the events of a high level would stay in the module until the
+*   level is filled.  The sampler thread (c792SamplerStart) lowers the
+*   level to 1 when events wait and no interrupt came for maxLatency, so
+*   they wait at most maxLatency plus the sampler period.
+*
+* c792GetIntStats - Copy the interrupt level, and the interrupt and trigger
+*                   rates of the last window of QDC id (also in the shared
+*                   memory segment of c792StatsShmOpen)
+*
+* RETURNS: OK, or ERROR if not initialized or out of range
+*/
+
+STATUS
+c792IntAdaptive (int id, int maxLatency, int maxRate)
+{
+  c792IntMod *im;
+  int ii;
+
+  if((id>=Nc792) || (maxLatency < 0) || (maxRate < 0)) {
+    C792_LOG("c792IntAdaptive: ERROR : Invalid QDC id %d or limits (%d us, %d/s)\n",
+	   id,maxLatency,maxRate,0,0,0);
+    return(ERROR);
+  }
+
+  for(ii=0;ii<Nc792;ii++) {
+    if((id>=0) && (ii!=id)) continue;
+    im = &c792IntTab[ii];
+
+    im->maxLatency = maxLatency;
+    im->maxRate    = maxRate;
+    im->winStart   = 0;
+    im->adaptOn    = (maxLatency > 0) || (maxRate > 0);
+
+    if(!im->adaptOn && im->enabled && (im->evCount != im->evFixed)) {
+      im->evCount  = im->evFixed;
+      im->st.level = im->evCount;
+      C792LOCK(ii);
+      if(c792Shadow[ii].evTrigger)
+	C792_SHADOW_WRITE(ii,evTrigger,im->evCount);
+      C792UNLOCK(ii);
+    }
+  }
+
+  return(OK);
+}
+
+STATUS
+c792GetIntStats (int id, c792IntStats *stats)
+{
+  if((id<0) || (id>=C792_MAX_MODULES) || (stats == NULL))
+    return(ERROR);
+
+  *stats = c792IntTab[id].st;
+
+  return(OK);
+}
+
+/*******************************************************************************
+*
+* c792SetIntMode - Select where the QDC interrupts are served (Linux)
+*
+*   mode - C792_INT_DIRECT   : in the interrupt handler, which holds
+*                              vmeBusLock while the routines run (default)
+*          C792_INT_DEFERRED : the handler only releases the interrupt of
+*                              the QDCs that fired (Event Trigger register
+*                              to 0) and queues them.  A worker thread
+*                              calls their routine, or the default action,
+*                              without vmeBusLock, then re-arms them.
+*   prio - SCHED_FIFO priority of the worker, 0 for the default scheduling
+*          (also used, with a warning, if SCHED_FIFO is not permitted)
+*
+*   Set before c792IntEnable, or once the interrupts are disabled for good.
+*   The time each QDC waited for the worker is in c792GetIntStats.
+*
+* RETURNS: OK, or ERROR if the interrupts are enabled, or on VxWorks
+*/
+
+STATUS
+c792SetIntMode (int mode, int prio)
+{
+#ifdef VXWORKS
+  printf("c792SetIntMode: ERROR : Not supported on VxWorks\n");
+  return(ERROR);
+#else
+  pthread_attr_t attr;
+  struct sched_param param;
+  unsigned long long one = 1;
+  int rval = -1;
+
+  if((mode != C792_INT_DIRECT) && (mode != C792_INT_DEFERRED)) {
+    printf("c792SetIntMode: ERROR : Invalid mode %d\n",mode);
+    return(ERROR);
+  }
+  if(c792IntRunning) {
+    printf("c792SetIntMode: ERROR : Interrupts are enabled\n");
+    return(ERROR);
+  }
+  if(mode == c792IntMode)
+    return(OK);
+
+  if(mode == C792_INT_DIRECT) {   /* stop the worker */
+    c792IntMode = mode;
+    if(write(c792IntWorkFd, &one, sizeof(one)) < 0)
+      perror("c792SetIntMode: write");
+    pthread_join(c792IntWorkThread, NULL);
+    close(c792IntWorkFd);
+    c792IntWorkFd = -1;
+    return(OK);
+  }
+
+  c792IntWorkFd = eventfd(0, EFD_CLOEXEC);
+  if(c792IntWorkFd < 0) {
+    perror("c792SetIntMode: eventfd");
+    return(ERROR);
+  }
+  c792IntPending = 0;
+  c792IntMode    = mode;
+
+  if(prio > 0) {
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = prio;
+    pthread_attr_setschedparam(&attr, &param);
+    rval = pthread_create(&c792IntWorkThread, &attr, c792IntWorker, NULL);
+    pthread_attr_destroy(&attr);
+    if(rval != 0)
+      printf("c792SetIntMode: WARNING : No SCHED_FIFO priority %d for the worker (%s)\n",
+	     prio,strerror(rval));
+  }
+  if(rval != 0)
+    rval = pthread_create(&c792IntWorkThread, NULL, c792IntWorker, NULL);
+  if(rval != 0) {
+    printf("c792SetIntMode: ERROR : pthread_create: %s\n",strerror(rval));
+    c792IntMode = C792_INT_DIRECT;
+    close(c792IntWorkFd);
+    c792IntWorkFd = -1;
+    return(ERROR);
+  }
+
+  return(OK);
+#endif
+}
+
 
 
 /*******************************************************************************
@@ -1250,22 +3396,22 @@ c792Sparse(int id, int over, int under)
     return(0xffff);
   }
 
-  C792LOCK;
+  C792LOCK(id);
   if(!over) {  /* Set Overflow suppression */
-    vmeWrite16(&c792p[id]->bitSet2, C792_OVERFLOW_SUP);
+    C792_SHADOW_BITSET2(id,C792_OVERFLOW_SUP);
   }else{
-    vmeWrite16(&c792p[id]->bitClear2, C792_OVERFLOW_SUP);
+    C792_SHADOW_BITCLEAR2(id,C792_OVERFLOW_SUP);
   }
 
   if(!under) {  /* Set Underflow suppression */
-    vmeWrite16(&c792p[id]->bitSet2, C792_UNDERFLOW_SUP);
+    C792_SHADOW_BITSET2(id,C792_UNDERFLOW_SUP);
   }else{
-    vmeWrite16(&c792p[id]->bitClear2, C792_UNDERFLOW_SUP);
+    C792_SHADOW_BITCLEAR2(id,C792_UNDERFLOW_SUP);
   }
 
 
-  rval = vmeRead16(&c792p[id]->bitSet2)&C792_BITSET2_MASK;
-  C792UNLOCK;
+  rval = c792Shadow[id].bitSet2&C792_BITSET2_MASK;
+  C792UNLOCK(id);
 
   return(rval);
 }
@@ -1276,72 +3422,228 @@ c792Sparse(int id, int over, int under)
 * c792Dready - Return status of Data Ready bit in QDC
 *
 *
-* RETURNS: 0(No Data) or  # of events in FIFO (1-32) or ERROR.
+* RETURNS: 0(No Data) or  # of events in FIFO (1-32) or ERROR.
+*/
+
+int
+c792Dready(int id)
+{
+
+  int nevts = 0;
+  UINT16 stat=0;
+
+
+  if((id<0) || (c792p[id] == NULL)) {
+    C792_LOG("c792Dready: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    return (ERROR);
+  }
+
+  C792LOCK(id);
+  stat = vmeRead16(&c792p[id]->status1)&C792_DATA_READY;
+  if(stat) {
+    C792_EXEC_READ_EVENT_COUNT(id);
+    nevts = c792EventCount[id] - c792EvtReadCnt[id];
+  } else {
+    C792_STAT_ADD(id,nempty,1);
+  }
+  C792_STAT_ADD(id,npoll,1);
+  C792UNLOCK(id);
+
+  if(stat && (nevts <= 0)) {
+    C792_LOG("c792Dready: ERROR : Bad Event Ready Count (nevts = %d)\n",
+	   nevts,0,0,0,0,0);
+    return(ERROR);
+  }
+
+  return(nevts);
+}
+
+unsigned int
+c792GDReady(unsigned int idmask, int nloop)
+{
+  int iloop, id, stat=0;
+  unsigned int dmask=0;
+
+  for(iloop = 0; iloop < nloop; iloop++)
+    {
+      for(id=0; id<Nc792; id++)
+	{
+	  if(idmask & (1<<id))
+	    { /* id used */
+
+	      if(!(dmask & (1<<id)))
+		{ /* No data ready yet. Check it now. */
+		  C792LOCK(id);
+		  stat = vmeRead16(&c792p[id]->status1)&C792_DATA_READY;
+		  C792_STAT_ADD(id,npoll,1);
+		  if(!stat)
+		    C792_STAT_ADD(id,nempty,1);
+		  C792UNLOCK(id);
+
+		  if(stat)
+		    dmask |= (1<<id);
+
+		  if(dmask == idmask)
+		    { /* Blockready mask matches user idmask */
+		      return(dmask);
+		    }
+		}
+	    }
+	}
+    }
+
+  return(dmask);
+}
+
+/*******************************************************************************
+*
+* c792SetWaitMode - Select how c792WaitReady waits for data (per run)
+*
+*   mode   - C792_WAIT_SPIN     : poll the Data Ready bit until the timeout
+*                                 (lowest latency, keeps the bus and a CPU
+*                                 busy when the trigger rate is low)
+*            C792_WAIT_ADAPTIVE : poll for spinUs, then sleep between polls,
+*                                 from C792_WAIT_SLEEP_MIN doubling up to
+*                                 C792_WAIT_SLEEP_MAX us
+*            C792_WAIT_INT      : poll for spinUs, then sleep until the QDC
+*                                 interrupt.  Interrupts must be set up with
+*                                 c792IntConnect and c792IntEnable.  The
+*                                 default handler then leaves the data in
+*                                 the module.
+*   spinUs - polling time before sleeping (us), <0 for C792_WAIT_SPIN_US
+*
+* c792WaitFd      - Return a file descriptor that becomes readable on the
+*                   QDC interrupt (Linux, C792_WAIT_INT), for a readout
+*                   loop that waits in poll/select itself.  Read the 8 byte
+*                   interrupt count from it to clear it.
+*
+* RETURNS: OK or ERROR.  c792WaitFd: the fd or ERROR.
+*/
+
+STATUS
+c792SetWaitMode(int mode, int spinUs)
+{
+  if((mode < C792_WAIT_SPIN) || (mode > C792_WAIT_INT)) {
+    C792_LOG("c792SetWaitMode: ERROR : Invalid mode %d\n",mode,0,0,0,0,0);
+    return(ERROR);
+  }
+
+#ifndef VXWORKS
+  if((mode == C792_WAIT_INT) && (c792WaitFd() < 0))
+    return(ERROR);
+#endif
+
+  c792WaitSpinUs = (spinUs < 0) ? C792_WAIT_SPIN_US : spinUs;
+  c792WaitMode   = mode;
+
+  return(OK);
+}
+
+int
+c792WaitFd()
+{
+#ifdef VXWORKS
+  C792_LOG("c792WaitFd: ERROR : Not supported on VxWorks\n",0,0,0,0,0,0);
+  return(ERROR);
+#else
+  if(c792WaitEvFd < 0) {
+    c792WaitEvFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(c792WaitEvFd < 0) {
+      perror("c792WaitFd: eventfd");
+      return(ERROR);
+    }
+  }
+
+  return(c792WaitEvFd);
+#endif
+}
+
+/* Sleep up to us, or (C792_WAIT_INT) until the interrupt */
+LOCAL void
+c792WaitSleep(int mode, unsigned long long us)
+{
+#ifdef VXWORKS
+  if(mode == C792_WAIT_INT) {
+    int ticks = (int)((us*sysClkRateGet() + 999999)/1000000);
+    semTake(c792Sem, ticks);
+  } else
+    taskDelay(0);   /* a tick is too long, just yield */
+#else
+  struct timeval tv;
+  fd_set fds;
+  unsigned long long cnt;
+
+  tv.tv_sec  = us/1000000;
+  tv.tv_usec = us%1000000;
+  if(mode == C792_WAIT_INT) {
+    FD_ZERO(&fds);
+    FD_SET(c792WaitEvFd, &fds);
+    if(select(c792WaitEvFd + 1, &fds, NULL, NULL, &tv) > 0)
+      if(read(c792WaitEvFd, &cnt, sizeof(cnt)) < 0)
+	cnt = 0;   /* already cleared by another waiter */
+  } else
+    select(0, NULL, NULL, NULL, &tv);
+#endif
+}
+
+/*******************************************************************************
+*
+* c792WaitReady - Wait for data in the QDC, with the strategy selected by
+*                 c792SetWaitMode.  Each poll is a single read of Status
+*                 Register 1; the event counter is read once data is ready.
+*
+*   timeout - longest wait in us (0: check once)
+*
+* RETURNS: # of events in FIFO (1-32), 0 on timeout, or ERROR.
 */
 
 int
-c792Dready(int id)
+c792WaitReady(int id, int timeout)
 {
-
-  int nevts = 0;
-  UINT16 stat=0;
-
+  unsigned long long t0, now, left;
+  unsigned long long sleepUs = C792_WAIT_SLEEP_MIN;
+  int mode = c792WaitMode;
+  UINT16 stat;
 
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792Dready: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
-    return (ERROR);
-  }
-
-  C792LOCK;
-  stat = vmeRead16(&c792p[id]->status1)&C792_DATA_READY;
-  if(stat) {
-    C792_EXEC_READ_EVENT_COUNT(id);
-    C792UNLOCK;
-    nevts = c792EventCount[id] - c792EvtReadCnt[id];
-    if(nevts <= 0) {
-      logMsg("c792Dready: ERROR : Bad Event Ready Count (nevts = %d)\n",
-	     nevts,0,0,0,0,0);
-      return(ERROR);
-    }
+    C792_LOG("c792WaitReady: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    return(ERROR);
   }
-  C792UNLOCK;
 
-  return(nevts);
-}
-
-unsigned int
-c792GDReady(unsigned int idmask, int nloop)
-{
-  int iloop, id, stat=0;
-  unsigned int dmask=0;
+  /* Only a QDC with interrupts wakes us up */
+  if((mode == C792_WAIT_INT) && !c792IntTab[id].enabled)
+    mode = C792_WAIT_ADAPTIVE;
 
-  C792LOCK;
-  for(iloop = 0; iloop < nloop; iloop++)
+  t0 = c792NowUs();
+  while(1)
     {
-      for(id=0; id<Nc792; id++)
-	{
-	  if(idmask & (1<<id))
-	    { /* id used */
+      C792LOCK(id);
+      stat = vmeRead16(&c792p[id]->status1)&C792_DATA_READY;
+      if(!stat) {
+	C792_STAT_ADD(id,npoll,1);
+	C792_STAT_ADD(id,nempty,1);
+      }
+      C792UNLOCK(id);
 
-	      if(!(dmask & (1<<id)))
-		{ /* No data ready yet. Check it now. */
-		  stat = vmeRead16(&c792p[id]->status1)&C792_DATA_READY;
+      if(stat)
+	return(c792Dready(id));
 
-		  if(stat)
-		    dmask |= (1<<id);
+      now = c792NowUs();
+      if(now - t0 >= (unsigned long long)timeout)
+	return(0);
+      if((mode == C792_WAIT_SPIN) || (now - t0 < (unsigned long long)c792WaitSpinUs))
+	continue;
 
-		  if(dmask == idmask)
-		    { /* Blockready mask matches user idmask */
-		      C792UNLOCK;
-		      return(dmask);
-		    }
-		}
-	    }
+      left = t0 + timeout - now;
+      if(mode == C792_WAIT_INT)
+	c792WaitSleep(mode, left);
+      else
+	{
+	  c792WaitSleep(mode, (sleepUs < left) ? sleepUs : left);
+	  if(sleepUs < C792_WAIT_SLEEP_MAX)
+	    sleepUs *= 2;
 	}
     }
-  C792UNLOCK;
-
-  return(dmask);
 }
 
 /*******************************************************************************
@@ -1366,18 +3668,15 @@ c792GDReady(unsigned int idmask, int nloop)
 void
 c792ClearThresh(int id)
 {
-  int ii;
+  UINT16 zero[C792_MAX_CHANNELS];
 
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792ClearThresh: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792ClearThresh: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
 
-  C792LOCK;
-  for (ii=0;ii< C792_MAX_CHANNELS; ii++) {
-    vmeWrite16(&c792p[id]->threshold[ii], 0);
-  }
-  C792UNLOCK;
+  memset(zero, 0, sizeof(zero));
+  c792SetThreshAll(1<<id, zero, 0, NULL);
 }
 
 short
@@ -1386,34 +3685,137 @@ c792SetThresh(int id, int chan, short val)
   short rval;
 
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792SetThresh: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792SetThresh: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return(-1);
   }
 
   if((chan<0) || (chan>(C792_MAX_CHANNELS-1))) {
-    logMsg("c792SetThresh: channel id %d - out of range (0-31) \n",chan,0,0,0,0,0);
+    C792_LOG("c792SetThresh: channel id %d - out of range (0-31) \n",chan,0,0,0,0,0);
     return (-1);
   }
 
-  C792LOCK;
-  vmeWrite16(&c792p[id]->threshold[chan], val);
-  rval = vmeRead16(&c792p[id]->threshold[chan]);
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_THRESH(id,chan,val);
+  rval = c792Shadow[id].threshold[chan];
+  C792UNLOCK(id);
 
   return (rval);
 }
 
+/*******************************************************************************
+*
+* c792SetThreshAll - Load the thresholds of all the channels of the QDCs in
+*                    idmask (bit n for QDC id n)
+*
+*   thresh  - C792_MAX_CHANNELS values per QDC, the tables one after the
+*             other in id order.  Bits 0-7 are the threshold, and
+*             C792_THRESH_KILL kills the channel.
+*   flags   - C792_THRESH_VERIFY : read back all the thresholds once loaded
+*             C792_THRESH_FORCE  : also write the channels the host copy
+*                                  says already hold the value
+*             C792_THRESH_SAME   : thresh is a single table, for all QDCs.
+*                                  If idmask is the whole MCST chain, it is
+*                                  written once to the MCST address.
+*   badmask - with C792_THRESH_VERIFY, one word per QDC in id order, with
+*             bit n set if channel n read back wrong (may be NULL)
+*
+*   Each QDC is locked once for its whole table.  Channels already holding
+*   the value (see c792ShadowSync) are not written, so reloading the same
+*   tables costs no write, only the readback.  A channel that reads back
+*   wrong is written again on the next call.
+*
+*
+* RETURNS: The number of channels that read back wrong (0 without
+*          C792_THRESH_VERIFY), or ERROR.
+*/
+
+int
+c792SetThreshAll(UINT32 idmask, UINT16 *thresh, int flags, UINT32 *badmask)
+{
+  UINT16 *tab, val;
+  UINT32 chainmask = 0, bad;
+  int ii, ich, imod = 0, nbad = 0, mcst = 0;
+
+  if((thresh == NULL) || (idmask == 0) ||
+     (flags & ~(C792_THRESH_VERIFY|C792_THRESH_FORCE|C792_THRESH_SAME))) {
+    C792_LOG("c792SetThreshAll: ERROR : Invalid arguments (idmask 0x%x, flags 0x%x)\n",
+	     idmask,flags,0,0,0,0);
+    return(ERROR);
+  }
+  for(ii=0;ii<32;ii++) {
+    if(!(idmask & (1U<<ii))) continue;
+    if((ii>=Nc792) || (c792p[ii] == NULL)) {
+      C792_LOG("c792SetThreshAll: ERROR : QDC id %d not initialized \n",ii,0,0,0,0,0);
+      return(ERROR);
+    }
+  }
+
+  /* One table for the whole chain: a single MCST write per channel */
+  if((flags & C792_THRESH_SAME) && (c792MCSTp != NULL)) {
+    for(ii=0;ii<Nc792;ii++)
+      if(c792CBLTRole[ii] != C792_CBLT_DISABLED)
+	chainmask |= (1<<ii);
+    mcst = (chainmask == idmask);
+  }
+
+  if(mcst) {
+    C792LOCK_ALL;
+    for(ich=0;ich<C792_MAX_CHANNELS;ich++) {
+      val = thresh[ich] & C792_SHMASK_threshold;
+      for(ii=0;ii<Nc792;ii++)
+	if((idmask & (1<<ii)) && (c792Shadow[ii].threshold[ich] != val))
+	  break;
+      if((ii == Nc792) && !(flags & C792_THRESH_FORCE))
+	continue;
+      vmeWrite16(&c792MCSTp->threshold[ich], val);
+      for(ii=0;ii<Nc792;ii++)
+	if(idmask & (1<<ii))
+	  c792Shadow[ii].threshold[ich] = val;
+    }
+    C792UNLOCK_ALL;
+  }
+
+  for(ii=0;ii<Nc792;ii++) {
+    if(!(idmask & (1<<ii))) continue;
+    tab = (flags & C792_THRESH_SAME) ? thresh : &thresh[imod*C792_MAX_CHANNELS];
+    bad = 0;
+
+    C792LOCK(ii);
+    for(ich=0;(ich<C792_MAX_CHANNELS) && !mcst;ich++) {
+      val = tab[ich] & C792_SHMASK_threshold;
+      if((flags & C792_THRESH_FORCE) || (c792Shadow[ii].threshold[ich] != val))
+	C792_SHADOW_THRESH(ii,ich,val);
+    }
+    if(flags & C792_THRESH_VERIFY) {
+      for(ich=0;ich<C792_MAX_CHANNELS;ich++) {
+	val = vmeRead16(&c792p[ii]->threshold[ich]) & C792_SHMASK_threshold;
+	if(val == (tab[ich] & C792_SHMASK_threshold)) continue;
+	c792Shadow[ii].threshold[ich] = val;
+	bad |= (1<<ich);
+	nbad++;
+      }
+    }
+    C792UNLOCK(ii);
+
+    if(badmask)
+      badmask[imod] = bad;
+    imod++;
+  }
+
+  return(nbad);
+}
+
 
 void
 c792Gate(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792Gate: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792Gate: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
-  C792LOCK;
+  C792LOCK(id);
   C792_EXEC_GATE(id);
-  C792UNLOCK;
+  C792UNLOCK(id);
 }
 
 short
@@ -1422,14 +3824,14 @@ c792Control(int id, short val)
   short rval;
 
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792Control: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792Control: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return(-1);
   }
 
-  C792LOCK;
-  vmeWrite16(&c792p[id]->control1, val);
-  rval = vmeRead16(&c792p[id]->control1);
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_WRITE(id,control1,val);
+  rval = c792Shadow[id].control1;
+  C792UNLOCK(id);
 
   return (rval);
 }
@@ -1440,14 +3842,14 @@ c792BitSet2(int id, short val)
   short rval;
 
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792BitSet2: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792BitSet2: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return(-1);
   }
 
-  C792LOCK;
-  vmeWrite16(&c792p[id]->bitSet2, val);
-  rval = vmeRead16(&c792p[id]->bitSet2);
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_BITSET2(id,val);
+  rval = c792Shadow[id].bitSet2;
+  C792UNLOCK(id);
 
   return (rval);
 }
@@ -1456,49 +3858,49 @@ void
 c792BitClear2(int id, short val)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792BitClear2: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792BitClear2: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
 
-  C792LOCK;
-  vmeWrite16(&c792p[id]->bitClear2, val);
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_BITCLEAR2(id,val);
+  C792UNLOCK(id);
 }
 
 void
 c792EnableBerr(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("%s: ERROR : QDC id %d not initialized \n",__FUNCTION__,id,0,0,0,0);
+    C792_LOG("%s: ERROR : QDC id %d not initialized \n",__FUNCTION__,id,0,0,0,0);
     return;
   }
 
-  C792LOCK;
-  vmeWrite16(&c792p[id]->control1,
-	    vmeRead16(&c792p[id]->control1) |
-	     C792_BERR_ENABLE | C792_BLK_END | C792_ALIGN64);
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_WRITE(id,control1,
+		    c792Shadow[id].control1 |
+		    C792_BERR_ENABLE | C792_BLK_END | C792_ALIGN64);
+  C792UNLOCK(id);
 }
 
 void
 c792DisableBerr(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("%s: ERROR : QDC id %d not initialized \n",__FUNCTION__,id,0,0,0,0);
+    C792_LOG("%s: ERROR : QDC id %d not initialized \n",__FUNCTION__,id,0,0,0,0);
     return;
   }
 
-  C792LOCK;
-  vmeWrite16(&c792p[id]->control1,
-	    vmeRead16(&c792p[id]->control1) & ~(C792_BERR_ENABLE | C792_BLK_END));
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_WRITE(id,control1,
+		    c792Shadow[id].control1 & ~(C792_BERR_ENABLE | C792_BLK_END));
+  C792UNLOCK(id);
 }
 
 void
 c792IncrEventBlk(int id, int count)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792IncrEventBlk: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792IncrEventBlk: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
 
@@ -1510,48 +3912,48 @@ void
 c792IncrEvent(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792IncrEvent: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792IncrEvent: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
-  C792LOCK;
+  C792LOCK(id);
   C792_EXEC_INCR_EVENT(id);
-  C792UNLOCK;
+  C792UNLOCK(id);
 }
 
 void
 c792IncrWord(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792IncrWord: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792IncrWord: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
-  C792LOCK;
+  C792LOCK(id);
   C792_EXEC_INCR_WORD(id);
-  C792UNLOCK;
+  C792UNLOCK(id);
 }
 
 void
 c792Enable(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792Enable: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792Enable: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
-  C792LOCK;
-  vmeWrite16(&c792p[id]->bitClear2, C792_OFFLINE);
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_BITCLEAR2(id,C792_OFFLINE);
+  C792UNLOCK(id);
 }
 
 void
 c792Disable(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792Disable: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792Disable: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
-  C792LOCK;
-  vmeWrite16(&c792p[id]->bitSet2, C792_OFFLINE);
-  C792UNLOCK;
+  C792LOCK(id);
+  C792_SHADOW_BITSET2(id,C792_OFFLINE);
+  C792UNLOCK(id);
 }
 
 
@@ -1559,12 +3961,13 @@ void
 c792Clear(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792Clear: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792Clear: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
-  C792LOCK;
+  C792LOCK(id);
   C792_EXEC_DATA_RESET(id);
-  C792UNLOCK;
+  C792_STAT_ADD(id,nclear,1);
+  C792UNLOCK(id);
   c792EvtReadCnt[id] = -1;
   c792EventCount[id] =  0;
 
@@ -1574,14 +3977,15 @@ void
 c792Reset(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792Reset: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792Reset: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
-  C792LOCK;
+  C792LOCK(id);
   C792_EXEC_DATA_RESET(id);
   C792_EXEC_SOFT_RESET(id);
   C792_EXEC_CLR_EVENT_COUNT(id);
-  C792UNLOCK;
+  C792_STAT_ADD(id,nclear,1);
+  C792UNLOCK(id);
   c792EvtReadCnt[id] = -1;
   c792EventCount[id] =  0;
 }
@@ -1590,12 +3994,12 @@ void
 c792EventCounterReset(int id)
 {
   if((id<0) || (c792p[id] == NULL)) {
-    logMsg("c792Reset: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
+    C792_LOG("c792Reset: ERROR : QDC id %d not initialized \n",id,0,0,0,0,0);
     return;
   }
-  C792LOCK;
+  C792LOCK(id);
   C792_EXEC_CLR_EVENT_COUNT(id);
-  C792UNLOCK;
+  C792UNLOCK(id);
   c792EvtReadCnt[id] = -1;
   c792EventCount[id] =  0;
 }
@@ -1609,10 +4013,396 @@ c792SetGeoAddress(int id, int geo)
     return ERROR;
   }
 
-  C792LOCK;
+  C792LOCK(id);
   vmeWrite16(&c792p[id]->geoAddr, geo);
-  C792_EXEC_SOFT_RESET(id);
-  C792UNLOCK;
+  C792_EXEC_SOFT_RESET(id);   /* reloads the shadow copy */
+  C792UNLOCK(id);
 
   return OK;
 }
+
+/*******************************************************************************
+*
+* c792SetByteOrder - Select the byte order of the data buffers filled by
+*                    c792ReadEvent, c792ReadEvents, c792ReadBlock,
+*                    c792ReadBlockOverlap and c792CBLTReadBlock
+*                    C792_ORDER_VME : as it comes off the bus (default).
+*                                     Nothing is swapped in the trigger
+*                                     path: the consumer swaps, if needed.
+*                    C792_ORDER_CPU : CPU byte order.  Each block is
+*                                     swapped in one go after the read.
+*                    On VxWorks both are the same.
+* c792GetByteOrder - Return the current setting
+*
+*
+* RETURNS: c792SetByteOrder: OK or ERROR.  c792GetByteOrder: the setting.
+*/
+
+STATUS
+c792SetByteOrder(int order)
+{
+  if((order!=C792_ORDER_VME) && (order!=C792_ORDER_CPU)) {
+    printf("c792SetByteOrder: ERROR: Invalid byte order (%d)\n",order);
+    return(ERROR);
+  }
+
+  c792ByteOrder = order;
+
+  return(OK);
+}
+
+int
+c792GetByteOrder()
+{
+  return(c792ByteOrder);
+}
+
+/*******************************************************************************
+*
+* c792SetLockPolicy  - Select the type of the per-module locks
+*                      C792_LOCK_NONE  : no locking (single threaded readout)
+*                      C792_LOCK_SPIN  : spinlocks
+*                      C792_LOCK_MUTEX : pthread mutexes (default)
+*                      Refused while the interrupts, the interrupt worker or
+*                      the sampler run, or while a lock is held.
+* c792LockTiming     - Enable/Disable measurement of lock wait and hold times
+* c792GetLockStats   - Copy the lock counters of a QDC
+* c792ClearLockStats - Zero the lock counters of a QDC (id<0 for all)
+* c792PrintLockStats - Print the lock counters of a QDC (id<0 for all)
+*
+*
+* RETURNS: c792SetLockPolicy and c792GetLockStats: OK or ERROR.
+*          Others: None.
+*/
+
+STATUS
+c792SetLockPolicy(int policy)
+{
+#ifdef VXWORKS
+  printf("c792SetLockPolicy: ERROR: Not supported on VxWorks\n");
+  return(ERROR);
+#else
+  c792Lock_t *lk;
+  int ii, old, busy = 0;
+
+  if((policy<C792_LOCK_NONE) || (policy>C792_LOCK_MUTEX)) {
+    printf("c792SetLockPolicy: ERROR: Invalid lock policy (%d)\n",policy);
+    return(ERROR);
+  }
+  if(c792IntRunning || (c792IntMode != C792_INT_DIRECT) || (c792SampleMs > 0)) {
+    printf("c792SetLockPolicy: ERROR: Interrupts, interrupt worker or sampler running\n");
+    return(ERROR);
+  }
+
+  pthread_once(&c792LockOnce, c792LockInitAll);
+
+  /* Take every lock, so that none is held across the change.  A thread
+     that waits for one releases it as it was taken (c792LockRelease) */
+  old = c792LockPolicy;
+  for(ii=0;ii<C792_MAX_MODULES;ii++) {
+    lk = &c792Lock[ii];
+    if(old == C792_LOCK_MUTEX)
+      busy = pthread_mutex_trylock(&lk->mutex);
+    else if(old == C792_LOCK_SPIN)
+      busy = pthread_spin_trylock(&lk->spin);
+    if(busy) break;
+  }
+
+  if(busy)
+    printf("c792SetLockPolicy: ERROR: Lock of QDC id %d is held\n",ii);
+  else
+    c792LockPolicy = policy;
+
+  while(--ii >= 0) {
+    lk = &c792Lock[ii];
+    if(old == C792_LOCK_MUTEX)
+      pthread_mutex_unlock(&lk->mutex);
+    else if(old == C792_LOCK_SPIN)
+      pthread_spin_unlock(&lk->spin);
+  }
+
+  return(busy ? ERROR : OK);
+#endif
+}
+
+void
+c792LockTiming(int enable)
+{
+#ifndef VXWORKS
+  c792LockTimeEnable = enable ? 1 : 0;
+#endif
+}
+
+STATUS
+c792GetLockStats(int id, c792LockStats *stats)
+{
+  if((id<0) || (id>=C792_MAX_MODULES) || (stats == NULL)) {
+    printf("c792GetLockStats: ERROR : Invalid QDC id %d \n",id);
+    return(ERROR);
+  }
+
+#ifdef VXWORKS
+  memset(stats, 0, sizeof(c792LockStats));
+#else
+  C792LOCK(id);
+  *stats = c792Lock[id].stats;
+  C792UNLOCK(id);
+  /* Do not count the copy itself */
+  stats->nlock--;
+#endif
+
+  return(OK);
+}
+
+void
+c792ClearLockStats(int id)
+{
+#ifndef VXWORKS
+  int ii;
+
+  for(ii=0;ii<Nc792;ii++) {
+    if((id>=0) && (ii!=id)) continue;
+    C792LOCK(ii);
+    memset(&c792Lock[ii].stats, 0, sizeof(c792LockStats));
+    C792UNLOCK(ii);
+  }
+#endif
+}
+
+void
+c792PrintLockStats(int id)
+{
+  int ii;
+  c792LockStats st;
+
+  printf("\n");
+  printf("                    CAEN792 Lock Statistics (%s%s)\n\n",
+#ifdef VXWORKS
+	 "none", ""
+#else
+	 (c792LockPolicy==C792_LOCK_MUTEX)?"mutex":
+	 (c792LockPolicy==C792_LOCK_SPIN)?"spinlock":"none",
+	 c792LockTimeEnable?", timed":""
+#endif
+	 );
+  printf("  #     Locks        Contended    Wait [us]     Held [us]     Max held [us]\n");
+  printf("--------------------------------------------------------------------------------\n");
+  for(ii=0;ii<Nc792;ii++) {
+    if((id>=0) && (ii!=id)) continue;
+    c792GetLockStats(ii, &st);
+    printf(" %2d  %12llu %12llu %13.1f %13.1f %13.1f\n", ii,
+	   st.nlock, st.ncontend, st.waitTime/1000., st.holdTime/1000.,
+	   st.holdMax/1000.);
+  }
+  printf("--------------------------------------------------------------------------------\n");
+  printf("\n");
+}
+
+/*******************************************************************************
+*
+* c792GetStats       - Copy the readout counters of a QDC
+*                      (id = C792_STATS_CBLT for the CBLT transfers)
+* c792ClearStats     - Zero the readout counters of a QDC (id<0 for all,
+*                      including CBLT)
+* c792PrintStats     - Print the readout counters of a QDC (id<0 for all)
+* c792StatsShmOpen   - Move the readout counters to the POSIX shared memory
+*                      segment name (NULL for C792_STATS_SHM), so that they
+*                      can be followed from another process.  The counters
+*                      kept so far are carried over.
+* c792StatsShmClose  - Move the readout counters back to local memory.  The
+*                      segment is left in place, for tools reading it after
+*                      the run.  Must not be called during the readout.
+*
+*   The counters are not locked against the readout, so a copy taken during
+*   the run may mix values from before and after an event.
+*
+*
+* RETURNS: c792GetStats and c792StatsShmOpen: OK or ERROR.
+*          Others: None.
+*/
+
+STATUS
+c792GetStats(int id, c792ModStats *stats)
+{
+  if((id<0) || (id>C792_STATS_CBLT) || (stats == NULL)) {
+    printf("c792GetStats: ERROR : Invalid QDC id %d \n",id);
+    return(ERROR);
+  }
+
+#ifdef VXWORKS
+  memset(stats, 0, sizeof(c792ModStats));
+#else
+  if(id == C792_STATS_CBLT)
+    *stats = c792Stats->cblt;
+  else
+    *stats = c792Stats->mod[id];
+#endif
+
+  return(OK);
+}
+
+void
+c792ClearStats(int id)
+{
+#ifndef VXWORKS
+  int ii;
+
+  for(ii=0;ii<Nc792;ii++) {
+    if((id>=0) && (ii!=id)) continue;
+    C792LOCK(ii);
+    memset(&c792Stats->mod[ii], 0, sizeof(c792ModStats));
+    C792UNLOCK(ii);
+  }
+  if((id<0) || (id==C792_STATS_CBLT)) {
+    C792LOCK_ALL;
+    memset(&c792Stats->cblt, 0, sizeof(c792ModStats));
+    C792UNLOCK_ALL;
+  }
+#endif
+}
+
+void
+c792PrintStats(int id)
+{
+  int ii;
+  c792ModStats st;
+
+  printf("\n");
+  printf("                    CAEN792 Readout Statistics\n\n");
+  printf("  #     Events       Words     DMA  DMA [MB]  DMA [us]  PIO [us]     Polls     Empty  BadH  BadT  BERR  Clr\n");
+  printf("----------------------------------------------------------------------------------------------------------------\n");
+  for(ii=0;ii<=C792_STATS_CBLT;ii++) {
+    if((id>=0) && (ii!=id)) continue;
+    if((ii>=Nc792) && (ii!=C792_STATS_CBLT)) continue;
+    c792GetStats(ii, &st);
+    if(ii==C792_STATS_CBLT) {
+      if(st.ndma == 0) continue;
+      printf("CBLT");
+    } else
+      printf(" %2d ", ii);
+    printf(" %10llu %11llu %7llu %9.2f %9.0f %9.0f %9llu %9llu %5llu %5llu %5llu %4llu\n",
+	   st.nevents, st.nwords, st.ndma, st.dmaBytes/1e6,
+	   st.dmaTime/1000., st.pioTime/1000., st.npoll, st.nempty,
+	   st.nbadHeader, st.nbadTrailer, st.nberr, st.nclear);
+  }
+  printf("----------------------------------------------------------------------------------------------------------------\n");
+  for(ii=0;ii<Nc792;ii++) {
+    if(((id>=0) && (ii!=id)) || !c792IntTab[ii].enabled) continue;
+    printf("  Interrupts %2d: %llu, %u events per interrupt%s, %u interrupts/s, %u events/s, %u retunes\n",
+	   ii, c792IntTab[ii].st.nint, c792IntTab[ii].st.level,
+	   c792IntTab[ii].adaptOn ? " (adaptive)" : "",
+	   c792IntTab[ii].st.intRate, c792IntTab[ii].st.trigRate,
+	   c792IntTab[ii].st.nretune);
+    if(c792IntTab[ii].st.ndefer)
+      printf("                 deferred to the worker, waited %.1f us mean, %llu us max\n",
+	     (double)c792IntTab[ii].st.deferSum/c792IntTab[ii].st.ndefer,
+	     c792IntTab[ii].st.deferMax);
+  }
+#ifndef VXWORKS
+  printf("  Messages: %llu queued, %llu over the rate limit, %llu lost (ring full)\n",
+	 c792Log.nput, c792Log.nsupp, c792Log.nlost);
+#endif
+  printf("\n");
+}
+
+STATUS
+c792StatsShmOpen(char *name)
+{
+#ifdef VXWORKS
+  printf("c792StatsShmOpen: ERROR: Not supported on VxWorks\n");
+  return(ERROR);
+#else
+  int fd;
+  c792StatsSeg *seg;
+
+  if(c792Stats != &c792StatsLocal) {
+    printf("c792StatsShmOpen: ERROR: Shared memory segment already open\n");
+    return(ERROR);
+  }
+  if(name == NULL)
+    name = C792_STATS_SHM;
+
+  fd = shm_open(name, O_CREAT|O_RDWR, 0644);
+  if(fd < 0) {
+    perror("c792StatsShmOpen: shm_open");
+    return(ERROR);
+  }
+  if(ftruncate(fd, sizeof(c792StatsSeg)) < 0) {
+    perror("c792StatsShmOpen: ftruncate");
+    close(fd);
+    return(ERROR);
+  }
+  seg = (c792StatsSeg *)mmap(NULL, sizeof(c792StatsSeg), PROT_READ|PROT_WRITE,
+			     MAP_SHARED, fd, 0);
+  close(fd);
+  if(seg == MAP_FAILED) {
+    perror("c792StatsShmOpen: mmap");
+    return(ERROR);
+  }
+
+  pthread_mutex_lock(&c792SampleMutex);
+  C792LOCK_ALL;
+  memcpy(seg, &c792StatsLocal, sizeof(c792StatsSeg));
+  seg->magic   = C792_STATS_MAGIC;
+  seg->version = C792_STATS_VERSION;
+  seg->size    = sizeof(c792StatsSeg);
+  seg->nmod    = Nc792;
+  c792Stats = seg;
+  C792UNLOCK_ALL;
+  pthread_mutex_unlock(&c792SampleMutex);
+
+  printf("c792StatsShmOpen: Readout counters in shared memory %s\n",name);
+
+  return(OK);
+#endif
+}
+
+void
+c792StatsShmClose()
+{
+#ifndef VXWORKS
+  c792StatsSeg *seg = c792Stats;
+
+  if(seg == &c792StatsLocal)
+    return;
+
+  pthread_mutex_lock(&c792SampleMutex);
+  C792LOCK_ALL;
+  memcpy(&c792StatsLocal, seg, sizeof(c792StatsSeg));
+  c792Stats = &c792StatsLocal;
+  C792UNLOCK_ALL;
+  pthread_mutex_unlock(&c792SampleMutex);
+
+  munmap(seg, sizeof(c792StatsSeg));
+#endif
+}
+
+/*******************************************************************************
+*
+* c792LogRate   - Set the number of messages per second let through from
+*                 each place in the library (0: V7XX_LOG_RATE).  The others
+*                 are counted, and the count printed with the next one.
+* c792LogFlush  - Print the queued messages now, in the calling thread
+*
+*   Linux only.  On VxWorks, messages go straight to logMsg.
+*
+*
+* RETURNS: c792LogFlush: Number of messages printed.
+*          c792LogRate: None.
+*/
+
+void
+c792LogRate(int rate)
+{
+  c792Log.rate = (rate > 0) ? rate : 0;
+}
+
+int
+c792LogFlush()
+{
+#ifdef VXWORKS
+  return(0);
+#else
+  return(v7xxLogFlush(&c792Log));
+#endif
+}
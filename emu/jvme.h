@@ -0,0 +1,111 @@
+/******************************************************************************
+*
+*  jvme.h  -  Emulated VME library.  Drop-in replacement for the JLab jvme
+*             header, for building and running the c792/c775 libraries on
+*             a Linux box without a crate:
+*
+*               make LINUXVME_INC=$PWD/emu libjvmeEmu.a all
+*
+*             and link the program with -ljvmeEmu instead of -ljvme.
+*
+*             Only the calls used by the V792/V775 libraries are provided.
+*             Modules are declared with vmeEmuAddModule, and events are
+*             made with vmeEmuGate (front panel gate) or the module's
+*             software gate.  See jvmeEmu.c for what is modelled.
+*
+*/
+#ifndef __JVMEEMU__
+#define __JVMEEMU__
+
+#include <stdio.h>
+
+/* Lets the libraries route their direct reads of the output buffer
+   through vmeEmuFifoRead32 */
+#define VME_EMU 1
+
+/* Types and constants of jvme / vxWorks */
+#ifndef OK
+#define OK      0
+#endif
+#ifndef ERROR
+#define ERROR  -1
+#endif
+#ifndef TRUE
+#define TRUE    1
+#endif
+#ifndef FALSE
+#define FALSE   0
+#endif
+#define LOCAL   static
+#define IMPORT  extern
+
+typedef int            STATUS;
+typedef int            BOOL;
+typedef char           INT8;
+typedef short          INT16;
+typedef int            INT32;
+typedef unsigned char  UINT8;
+typedef unsigned short UINT16;
+typedef unsigned int   UINT32;
+typedef void         (*VOIDFUNCPTR)();
+typedef int          (*FUNCPTR)();
+
+#define LSWAP(x)  __builtin_bswap32(x)
+#define SSWAP(x)  __builtin_bswap16(x)
+
+/* Emulated module types (vmeEmuAddModule) */
+#define VME_EMU_V792        792
+#define VME_EMU_V775        775
+
+#define VME_EMU_MAX_MODULES 32
+#define VME_EMU_NCHAN       32
+
+/* Fill value[VME_EMU_NCHAN] for event evnum of module imod.  Values above
+   0xfff are stored as overflows.  Returns 0 to keep the event, or non-zero
+   to drop the gate */
+typedef int (*VMEEMUGENFUNC)(void *arg, int imod, unsigned int evnum,
+			     UINT16 *value);
+
+/* Bus traffic seen by the emulator, per module */
+typedef struct
+{
+  unsigned long long nread16;    /* register reads */
+  unsigned long long nwrite16;   /* register writes */
+  unsigned long long nread32;    /* single output buffer reads */
+  unsigned long long ndma;       /* block transfers */
+  unsigned long long ndmaWords;  /* words moved by block transfers */
+  unsigned long long ngate;      /* gates seen */
+  unsigned long long nbusy;      /* gates lost, output buffer full */
+  unsigned long long nint;       /* interrupts delivered */
+} vmeEmuStats;
+
+/* jvme calls */
+int    vmeOpenDefaultWindows();
+int    vmeCloseDefaultWindows();
+int    vmeBusToLocalAdrs(int vmeAdrsSpace, char *vmeBusAdrs, char **pPciAdrs);
+int    vmeMemProbe(char *addr, int size, char *rval);
+UINT16 vmeRead16(volatile UINT16 *addr);
+UINT32 vmeRead32(volatile UINT32 *addr);
+void   vmeWrite16(volatile UINT16 *addr, UINT16 val);
+void   vmeWrite32(volatile UINT32 *addr, UINT32 val);
+int    vmeDmaConfig(UINT32 addrType, UINT32 dataType, UINT32 sstMode);
+int    vmeDmaSend(unsigned long locAdrs, UINT32 vmeAdrs, int size);
+int    vmeDmaDone();
+int    vmeIntConnect(UINT32 vector, UINT32 level, VOIDFUNCPTR routine, UINT32 arg);
+int    vmeIntDisconnect(UINT32 level);
+int    vmeBusLock();
+int    vmeBusUnlock();
+int    logMsg(const char *format, ...);
+
+/* Emulator control */
+int    vmeEmuAddModule(int type, UINT32 addr);
+void   vmeEmuClear();
+int    vmeEmuGate(int imod);
+int    vmeEmuSetGenerator(int imod, VMEEMUGENFUNC gen, void *arg);
+int    vmeEmuSetDelay(int singleNs, int blockNs);
+int    vmeEmuGetStats(int imod, vmeEmuStats *stats);
+void   vmeEmuClearStats();
+void   vmeEmuPrintStats();
+UINT32 vmeEmuFifoRead32(volatile UINT32 *addr);
+
+#endif /* __JVMEEMU__ */
@@ -0,0 +1,1256 @@
+/******************************************************************************
+*
+*  jvmeEmu.c  -  Emulated VME library.  Stands in for the JLab jvme library
+*                with a crate of C.A.E.N. Model 792 QDCs and Model 775 TDCs
+*                held in memory, so that the c792/c775/v7xx libraries can be
+*                run, checked and timed without hardware.
+*
+*                Modelled, per module:
+*                  - register map (c792_struct / c775_regs) and the
+*                    configuration ROM, with the board ID at 0x8026+0x10..
+*                  - 32 event output buffer, with header/data/trailer words,
+*                    zero and overflow suppression, channel kill, and
+*                    the "empty event" and auto increment options
+*                  - status registers, event counter (24 bits, the first
+*                    event after a reset is number 0), bit set/clear
+*                    registers, data/soft/single shot resets
+*                  - software gate (swComm), offline mode
+*                  - single word reads of the output buffer, and block
+*                    transfers (vmeDmaSend) ended by a BERR, or by filler
+*                    words when BERR is disabled.  BLK_END and ALIGN64.
+*                  - CBLT chains and MCST writes, through cbltAddr and
+*                    cbltControl.  The chain is in GEO address order.
+*                  - interrupts: when a gate leaves evTrigger or more
+*                    events in a module with a non-zero intLevel, the
+*                    routine connected on that level is called from the
+*                    thread making the gate.  Lowering evTrigger under the
+*                    events already stored calls it from a new thread.
+*
+*                As in the real library, the register file is stored in
+*                VME (big endian) byte order in the mapped windows, so a
+*                direct read through a pointer sees what the hardware
+*                would give.  Reads of the output buffer have side effects,
+*                and must go through vmeRead32 or vmeEmuFifoRead32.
+*
+*                Bus timing is not modelled unless set with vmeEmuSetDelay.
+*                Every access is counted (vmeEmuGetStats).
+*
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "jvme.h"
+
+/* Address spaces */
+#define EMU_A24             0
+#define EMU_A32             1
+#define EMU_A24_SIZE        0x01000000UL
+#define EMU_A32_SIZE        0x100000000ULL
+#define EMU_MODULE_SIZE     0x10000
+
+/* Register offsets */
+#define EMU_DATA_END        0x0800
+#define EMU_REV             0x1000
+#define EMU_GEO             0x1002
+#define EMU_CBLT_ADDR       0x1004
+#define EMU_BIT_SET1        0x1006
+#define EMU_BIT_CLEAR1      0x1008
+#define EMU_INT_LEVEL       0x100A
+#define EMU_INT_VECTOR      0x100C
+#define EMU_STATUS1         0x100E
+#define EMU_CONTROL1        0x1010
+#define EMU_SS_RESET        0x1016
+#define EMU_CBLT_CONTROL    0x101A
+#define EMU_EV_TRIGGER      0x1020
+#define EMU_STATUS2         0x1022
+#define EMU_EV_COUNT_L      0x1024
+#define EMU_EV_COUNT_H      0x1026
+#define EMU_INCR_EVENT      0x1028
+#define EMU_INCR_OFFSET     0x102A
+#define EMU_BIT_SET2        0x1032
+#define EMU_BIT_CLEAR2      0x1034
+#define EMU_CRATE_SELECT    0x103C
+#define EMU_EV_COUNT_RESET  0x1040
+#define EMU_SW_COMM         0x1068
+#define EMU_THRESHOLD       0x1080
+#define EMU_ROM             0x8000
+#define EMU_ROM_OUI_3       0x8026
+#define EMU_ROM_OUI_2       0x802A
+#define EMU_ROM_OUI_1       0x802E
+#define EMU_ROM_VERSION     0x8032
+#define EMU_ROM_ID_3        0x8036
+#define EMU_ROM_ID_2        0x803A
+#define EMU_ROM_ID_1        0x803E
+#define EMU_ROM_REVISION    0x804E
+#define EMU_ROM_SERIAL_MSB  0x8F02
+#define EMU_ROM_SERIAL_LSB  0x8F06
+
+/* Register bits */
+#define EMU_BERR_FLAG       0x0008   /* bitSet1 */
+#define EMU_SOFT_RESET      0x0080
+#define EMU_BLK_END         0x0004   /* control1 */
+#define EMU_BERR_ENABLE     0x0020
+#define EMU_ALIGN64         0x0040
+#define EMU_DREADY          0x0001   /* status1 */
+#define EMU_GDREADY         0x0002
+#define EMU_BUSY            0x0004
+#define EMU_GBUSY           0x0008
+#define EMU_EVRDY           0x0100
+#define EMU_BUFFER_EMPTY    0x0002   /* status2 */
+#define EMU_BUFFER_FULL     0x0004
+#define EMU_OFFLINE         0x0002   /* bitSet2 */
+#define EMU_CLEAR_DATA      0x0004
+#define EMU_OVER_RANGE      0x0008
+#define EMU_LOW_THR         0x0010
+#define EMU_STEP_THR        0x0100
+#define EMU_AUTO_INCR       0x0800
+#define EMU_EMPTY_PROG      0x1000
+#define EMU_ALL_TRG         0x4000
+#define EMU_THR_KILL        0x0100   /* threshold[] */
+#define EMU_CBLT_LAST       1        /* cbltControl */
+#define EMU_CBLT_FIRST      2
+
+/* Output buffer words */
+#define EMU_HEADER          0x02000000
+#define EMU_TRAILER         0x04000000
+#define EMU_FILLER          0x06000000
+#define EMU_UNDERFLOW       0x00002000
+#define EMU_OVERFLOW        0x00001000
+#define EMU_VALID           0x00004000   /* V775 */
+#define EMU_MAX_EVENTS      32
+#define EMU_MAX_WORDS       (VME_EMU_NCHAN + 2)
+
+/* Bus byte order */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define EMU_BUS16(x)        SSWAP(x)
+#define EMU_BUS32(x)        LSWAP(x)
+#else
+#define EMU_BUS16(x)        (x)
+#define EMU_BUS32(x)        (x)
+#endif
+
+typedef struct
+{
+  int            type;        /* VME_EMU_V792, VME_EMU_V775 */
+  int            space;       /* EMU_A24, EMU_A32 */
+  UINT32         base;        /* VME address */
+  char          *mem;         /* register file, in the window */
+
+  /* Output buffer */
+  UINT32         ev[EMU_MAX_EVENTS][EMU_MAX_WORDS];
+  int            evlen[EMU_MAX_EVENTS];
+  int            first;       /* oldest event */
+  int            nev;         /* events stored */
+  int            rdpos;       /* next word of the oldest event */
+  UINT32         counter;     /* event counter */
+
+  VMEEMUGENFUNC  gen;
+  void          *genArg;
+  unsigned int   seed;
+
+  vmeEmuStats    stats;
+} vmeEmuModule;
+
+typedef struct
+{
+  VOIDFUNCPTR routine;
+  UINT32      vector;
+  UINT32      arg;
+} vmeEmuInt;
+
+LOCAL pthread_mutex_t emuMutex = PTHREAD_MUTEX_INITIALIZER;
+LOCAL pthread_mutex_t emuBusMutex;
+LOCAL pthread_once_t  emuBusOnce = PTHREAD_ONCE_INIT;
+LOCAL char           *emuWindow[2] = {NULL, NULL};
+LOCAL unsigned long long emuWindowSize[2] = {EMU_A24_SIZE, EMU_A32_SIZE};
+LOCAL vmeEmuModule   *emuModule[VME_EMU_MAX_MODULES];
+LOCAL int             emuNmod = 0;
+LOCAL vmeEmuInt       emuInt[8];
+LOCAL int             emuSingleNs = 0;
+LOCAL int             emuBlockNs = 0;
+
+/* Block transfer in flight */
+LOCAL UINT32          emuDmaAddrType = 2;
+LOCAL int             emuDmaPending = 0;
+LOCAL int             emuDmaResult = 0;
+
+LOCAL int emuDefaultGen(void *arg, int imod, unsigned int evnum, UINT16 *value);
+
+/* Register access, in the bus byte order of the window */
+#define EMU_REG(m,off)        EMU_BUS16(*(volatile UINT16 *)((m)->mem + (off)))
+#define EMU_SET_REG(m,off,v)  (*(volatile UINT16 *)((m)->mem + (off)) = EMU_BUS16((UINT16)(v)))
+
+LOCAL void
+emuDelay(int ns)
+{
+  struct timespec t0, t1;
+
+  if(ns <= 0) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+  } while((t1.tv_sec - t0.tv_sec)*1000000000LL + (t1.tv_nsec - t0.tv_nsec) < ns);
+}
+
+/* Refresh the registers that follow the module state */
+LOCAL void
+emuSync(vmeEmuModule *m)
+{
+  UINT16 s1 = 0, s2 = 0;
+  int ntrig = EMU_REG(m, EMU_EV_TRIGGER) & 0x1f;
+
+  if(m->nev > 0)
+    s1 |= EMU_DREADY | EMU_GDREADY;
+  else
+    s2 |= EMU_BUFFER_EMPTY;
+  if((m->nev > 0) && (m->nev >= ntrig))   /* Event Ready: Event Trigger reached */
+    s1 |= EMU_EVRDY;
+  if(m->nev == EMU_MAX_EVENTS) {
+    s1 |= EMU_BUSY | EMU_GBUSY;
+    s2 |= EMU_BUFFER_FULL;
+  }
+
+  EMU_SET_REG(m, EMU_STATUS1, s1);
+  EMU_SET_REG(m, EMU_STATUS2, s2);
+  EMU_SET_REG(m, EMU_EV_COUNT_L, m->counter & 0xffff);
+  EMU_SET_REG(m, EMU_EV_COUNT_H, (m->counter >> 16) & 0xff);
+  EMU_SET_REG(m, EMU_BIT_CLEAR1, EMU_REG(m, EMU_BIT_SET1));
+  EMU_SET_REG(m, EMU_BIT_CLEAR2, EMU_REG(m, EMU_BIT_SET2));
+}
+
+LOCAL void
+emuClearData(vmeEmuModule *m)
+{
+  m->first = m->nev = m->rdpos = 0;
+}
+
+/* Soft or single shot reset.  GEO, crate, CBLT and threshold settings
+   are kept */
+LOCAL void
+emuReset(vmeEmuModule *m)
+{
+  emuClearData(m);
+  m->counter = 0xffffff;
+
+  EMU_SET_REG(m, EMU_BIT_SET1, EMU_REG(m, EMU_BIT_SET1) & EMU_SOFT_RESET);
+  EMU_SET_REG(m, EMU_CONTROL1, 0);
+  EMU_SET_REG(m, EMU_BIT_SET2, EMU_AUTO_INCR);
+  EMU_SET_REG(m, EMU_INT_LEVEL, 0);
+  EMU_SET_REG(m, EMU_INT_VECTOR, 0);
+  EMU_SET_REG(m, EMU_EV_TRIGGER, 0);
+  emuSync(m);
+}
+
+/* Take one word from the output buffer.  Returns 0 if it is empty */
+LOCAL int
+emuPopWord(vmeEmuModule *m, UINT32 *word)
+{
+  UINT32 *ev;
+
+  if(m->nev == 0)
+    return(0);
+
+  ev = m->ev[m->first];
+  *word = ev[m->rdpos++];
+
+  if(m->rdpos >= m->evlen[m->first]) {
+    m->rdpos = 0;
+    if(EMU_REG(m, EMU_BIT_SET2) & EMU_AUTO_INCR) {
+      m->first = (m->first + 1) % EMU_MAX_EVENTS;
+      m->nev--;
+      emuSync(m);
+    }
+  }
+  return(1);
+}
+
+LOCAL void
+emuIncrEvent(vmeEmuModule *m)
+{
+  if(m->nev == 0) return;
+
+  m->rdpos = 0;
+  m->first = (m->first + 1) % EMU_MAX_EVENTS;
+  m->nev--;
+  emuSync(m);
+}
+
+/* Gate.  Returns 1 if an event was counted */
+LOCAL int
+emuGate(vmeEmuModule *m, int imod)
+{
+  UINT16 value[VME_EMU_NCHAN];
+  UINT32 *ev, geo, word, thr;
+  UINT16 set2 = EMU_REG(m, EMU_BIT_SET2), reg;
+  int ich, nw = 0, slot, ov, un;
+
+  m->stats.ngate++;
+
+  if((set2 & (EMU_OFFLINE | EMU_CLEAR_DATA)) ||
+     (EMU_REG(m, EMU_BIT_SET1) & EMU_SOFT_RESET))
+    return(0);
+
+  if(m->nev == EMU_MAX_EVENTS) {
+    m->stats.nbusy++;
+    if(set2 & EMU_ALL_TRG) {
+      m->counter = (m->counter + 1) & 0xffffff;
+      emuSync(m);
+    }
+    return(0);
+  }
+
+  memset(value, 0, sizeof(value));
+  if((*m->gen)(m->genArg, imod, (m->counter + 1) & 0xffffff, value) != 0)
+    return(0);
+
+  m->counter = (m->counter + 1) & 0xffffff;
+
+  slot = (m->first + m->nev) % EMU_MAX_EVENTS;
+  ev = m->ev[slot];
+  geo = (UINT32)(EMU_REG(m, EMU_GEO) & 0x1f) << 27;
+
+  for(ich=0;ich<VME_EMU_NCHAN;ich++) {
+    reg = EMU_REG(m, EMU_THRESHOLD + 2*ich);
+    if(reg & EMU_THR_KILL) continue;
+
+    ov = (value[ich] > 0xfff);
+    thr = (reg & 0xff) * ((set2 & EMU_STEP_THR) ? 2 : 16);
+    un = (value[ich] < thr);
+    if(ov && !(set2 & EMU_OVER_RANGE)) continue;
+    if(un && !(set2 & EMU_LOW_THR)) continue;
+
+    word = geo | (ich << 16) | (ov ? (EMU_OVERFLOW | 0xfff) : value[ich]);
+    if(un) word |= EMU_UNDERFLOW;
+    if(m->type == VME_EMU_V775) word |= EMU_VALID;
+    ev[1 + nw++] = word;
+  }
+
+  if((nw == 0) && !(set2 & EMU_EMPTY_PROG)) {
+    emuSync(m);
+    return(1);
+  }
+
+  ev[0] = geo | EMU_HEADER | ((EMU_REG(m, EMU_CRATE_SELECT) & 0xff) << 16) | (nw << 8);
+  ev[1 + nw] = geo | EMU_TRAILER | m->counter;
+  m->evlen[slot] = nw + 2;
+  m->nev++;
+  emuSync(m);
+
+  return(1);
+}
+
+/* Interrupt to deliver after a gate, or -1.  Called with emuMutex held */
+LOCAL int
+emuIntPending(vmeEmuModule *m)
+{
+  int level = EMU_REG(m, EMU_INT_LEVEL) & 0x7;
+  int ntrig = EMU_REG(m, EMU_EV_TRIGGER) & 0x1f;
+
+  if((level == 0) || (ntrig == 0) || (m->nev < ntrig) || (emuInt[level].routine == NULL))
+    return(-1);
+
+  m->stats.nint++;
+  return(level);
+}
+
+/* Called without emuMutex, so that the routine can access the modules */
+LOCAL void
+emuIntDeliver(int level)
+{
+  VOIDFUNCPTR routine;
+  UINT32 arg;
+
+  if(level < 0) return;
+
+  pthread_mutex_lock(&emuMutex);
+  routine = emuInt[level].routine;
+  arg = emuInt[level].arg;
+  pthread_mutex_unlock(&emuMutex);
+
+  if(routine) (*routine)(arg);
+}
+
+LOCAL void *
+emuIntThread(void *arg)
+{
+  emuIntDeliver((int)(long)arg);
+  return(NULL);
+}
+
+/* Interrupt raised by lowering the Event Trigger register under the events
+   already stored.  Delivered from a thread of its own, as a real interrupt:
+   the writer usually holds the library lock the routine takes.  Called with
+   emuMutex held */
+LOCAL void
+emuIntRetrigger(vmeEmuModule *m)
+{
+  pthread_t thread;
+  int level = emuIntPending(m);
+
+  if(level < 0) return;
+  if(pthread_create(&thread, NULL, emuIntThread, (void *)(long)level) == 0)
+    pthread_detach(thread);
+}
+
+/* Module and register offset at a local address, or NULL */
+LOCAL vmeEmuModule *
+emuFind(volatile void *addr, UINT32 *offset, int *space, UINT32 *vmeAdrs)
+{
+  unsigned long a = (unsigned long)addr;
+  vmeEmuModule *m;
+  UINT32 vme;
+  int isp, ii;
+
+  for(isp=EMU_A24;isp<=EMU_A32;isp++)
+    if(emuWindow[isp] && (a >= (unsigned long)emuWindow[isp]) &&
+       (a - (unsigned long)emuWindow[isp] < emuWindowSize[isp]))
+      break;
+  if(isp > EMU_A32)
+    return(NULL);
+
+  vme = (UINT32)(a - (unsigned long)emuWindow[isp]);
+  if(space) *space = isp;
+  if(vmeAdrs) *vmeAdrs = vme;
+
+  for(ii=0;ii<emuNmod;ii++) {
+    m = emuModule[ii];
+    if((m->space == isp) && (vme >= m->base) && (vme - m->base < EMU_MODULE_SIZE)) {
+      if(offset) *offset = vme - m->base;
+      return(m);
+    }
+  }
+  return(NULL);
+}
+
+/* Register write, with its side effects.  Returns 1 if the module
+   saw a gate */
+LOCAL int
+emuWriteReg(vmeEmuModule *m, int imod, UINT32 off, UINT16 val)
+{
+  m->stats.nwrite16++;
+
+  if((off < EMU_DATA_END) || (off >= EMU_ROM))
+    return(0);
+
+  switch(off) {
+  case EMU_STATUS1: case EMU_STATUS2: case EMU_EV_COUNT_L: case EMU_EV_COUNT_H:
+  case EMU_REV:
+    break;
+  case EMU_BIT_SET1:
+    EMU_SET_REG(m, EMU_BIT_SET1, EMU_REG(m, EMU_BIT_SET1) | (val & 0x98));
+    if(val & EMU_SOFT_RESET) emuReset(m);
+    break;
+  case EMU_BIT_CLEAR1:
+    EMU_SET_REG(m, EMU_BIT_SET1, EMU_REG(m, EMU_BIT_SET1) & ~val);
+    break;
+  case EMU_BIT_SET2:
+    EMU_SET_REG(m, EMU_BIT_SET2, EMU_REG(m, EMU_BIT_SET2) | (val & 0x7fff));
+    if(val & EMU_CLEAR_DATA) emuClearData(m);
+    break;
+  case EMU_BIT_CLEAR2:
+    EMU_SET_REG(m, EMU_BIT_SET2, EMU_REG(m, EMU_BIT_SET2) & ~val);
+    break;
+  case EMU_SS_RESET:
+    emuReset(m);
+    break;
+  case EMU_INCR_EVENT:
+    emuIncrEvent(m);
+    break;
+  case EMU_INCR_OFFSET:
+    {
+      UINT32 word;
+      emuPopWord(m, &word);
+    }
+    break;
+  case EMU_EV_COUNT_RESET:
+    m->counter = 0xffffff;
+    break;
+  case EMU_SW_COMM:
+    return(emuGate(m, imod));
+  case EMU_GEO:          EMU_SET_REG(m, off, val & 0x1f); break;
+  case EMU_CBLT_ADDR:    EMU_SET_REG(m, off, val & 0xff); break;
+  case EMU_INT_LEVEL:    EMU_SET_REG(m, off, val & 0x7);  break;
+  case EMU_INT_VECTOR:   EMU_SET_REG(m, off, val & 0xff); break;
+  case EMU_CONTROL1:     EMU_SET_REG(m, off, val & 0x74); break;
+  case EMU_CBLT_CONTROL: EMU_SET_REG(m, off, val & 0x3);  break;
+  case EMU_EV_TRIGGER:   EMU_SET_REG(m, off, val & 0x1f); emuSync(m); emuIntRetrigger(m); break;
+  case EMU_CRATE_SELECT: EMU_SET_REG(m, off, val & 0xff); break;
+  default:
+    if((off >= EMU_THRESHOLD) && (off < EMU_THRESHOLD + 2*VME_EMU_NCHAN))
+      EMU_SET_REG(m, off, val & 0x1ff);
+    else
+      EMU_SET_REG(m, off, val);
+  }
+
+  emuSync(m);
+  return(0);
+}
+
+LOCAL int
+emuIndex(vmeEmuModule *m)
+{
+  int ii;
+
+  for(ii=0;ii<emuNmod;ii++)
+    if(emuModule[ii] == m) return(ii);
+  return(-1);
+}
+
+/* Modules on the CBLT/MCST chain at A32 address cblt (bits 31-24), in
+   GEO order.  Returns the number of modules */
+LOCAL int
+emuChain(UINT32 cblt, vmeEmuModule **chain)
+{
+  vmeEmuModule *tmp;
+  int ii, jj, n = 0;
+
+  for(ii=0;ii<emuNmod;ii++)
+    if((EMU_REG(emuModule[ii], EMU_CBLT_CONTROL) & 0x3) &&
+       (EMU_REG(emuModule[ii], EMU_CBLT_ADDR) == ((cblt >> 24) & 0xff)))
+      chain[n++] = emuModule[ii];
+
+  for(ii=1;ii<n;ii++)
+    for(jj=ii;(jj>0) && ((EMU_REG(chain[jj-1], EMU_GEO) & 0x1f) >
+			 (EMU_REG(chain[jj], EMU_GEO) & 0x1f));jj--) {
+      tmp = chain[jj]; chain[jj] = chain[jj-1]; chain[jj-1] = tmp;
+    }
+
+  return(n);
+}
+
+/* Copy words from the output buffer of m to dst (bus byte order), until
+   empty, maxw words, or the end of the first event with BLK_END */
+LOCAL int
+emuBlockRead(vmeEmuModule *m, UINT32 *dst, int maxw)
+{
+  int blkend = EMU_REG(m, EMU_CONTROL1) & EMU_BLK_END;
+  UINT32 word;
+  int n = 0;
+
+  while((n < maxw) && emuPopWord(m, &word)) {
+    dst[n++] = EMU_BUS32(word);
+    if(blkend && ((word & 0x07000000) == EMU_TRAILER))
+      break;
+  }
+
+  m->stats.ndma++;
+  m->stats.ndmaWords += n;
+  return(n);
+}
+
+/* End of a block transfer, after n data words: bus error if enabled on
+   the module, else filler words up to maxw.  Returns bytes transferred */
+LOCAL int
+emuBlockEnd(vmeEmuModule *m, UINT32 *dst, int n, int maxw)
+{
+  UINT16 ctrl = EMU_REG(m, EMU_CONTROL1);
+
+  if((n < maxw) && (ctrl & EMU_ALIGN64) && (n & 1))
+    dst[n++] = EMU_BUS32(EMU_FILLER);
+
+  if((n < maxw) && (ctrl & EMU_BERR_ENABLE)) {
+    EMU_SET_REG(m, EMU_BIT_SET1, EMU_REG(m, EMU_BIT_SET1) | EMU_BERR_FLAG);
+    emuSync(m);
+    return(n << 2);
+  }
+
+  while(n < maxw)
+    dst[n++] = EMU_BUS32(EMU_FILLER);
+
+  return(maxw << 2);
+}
+
+LOCAL void
+emuBusLockInit(void)
+{
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&emuBusMutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+/*******************************************************************************
+*
+* vmeOpenDefaultWindows  - Map the emulated A24 and A32 address spaces
+* vmeCloseDefaultWindows - Unmap them, and remove all emulated modules
+*
+*   The A32 window is reserved, not allocated: only the pages of the
+*   modules are backed by memory.
+*
+*
+* RETURNS: OK, or ERROR.
+*/
+
+int
+vmeOpenDefaultWindows()
+{
+  int isp;
+
+  for(isp=EMU_A24;isp<=EMU_A32;isp++) {
+    if(emuWindow[isp]) continue;
+    if(emuWindowSize[isp] > (unsigned long long)(size_t)-1) {
+      if(isp == EMU_A32) continue;   /* No A32 on 32 bit hosts */
+      return(ERROR);
+    }
+
+    emuWindow[isp] = mmap(NULL, (size_t)emuWindowSize[isp], PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(emuWindow[isp] == MAP_FAILED) {
+      perror("vmeOpenDefaultWindows: mmap");
+      emuWindow[isp] = NULL;
+      return(ERROR);
+    }
+  }
+
+  return(OK);
+}
+
+int
+vmeCloseDefaultWindows()
+{
+  int isp;
+
+  vmeEmuClear();
+
+  pthread_mutex_lock(&emuMutex);
+  for(isp=EMU_A24;isp<=EMU_A32;isp++) {
+    if(emuWindow[isp])
+      munmap(emuWindow[isp], (size_t)emuWindowSize[isp]);
+    emuWindow[isp] = NULL;
+  }
+  pthread_mutex_unlock(&emuMutex);
+
+  return(OK);
+}
+
+/*******************************************************************************
+*
+* vmeBusToLocalAdrs - Local address of a VME address
+*
+*   vmeAdrsSpace - address modifier (A24: 0x39, 0x3d, ...  A32: 0x09, 0x0d, ...)
+*
+*
+* RETURNS: OK, or ERROR if the address space is not emulated.
+*/
+
+int
+vmeBusToLocalAdrs(int vmeAdrsSpace, char *vmeBusAdrs, char **pPciAdrs)
+{
+  unsigned long vme = (unsigned long)vmeBusAdrs;
+  int isp;
+
+  switch(vmeAdrsSpace & 0x38) {
+  case 0x38: isp = EMU_A24; break;
+  case 0x08: isp = EMU_A32; break;
+  default:
+    printf("vmeBusToLocalAdrs: ERROR: Address modifier 0x%x not emulated\n",vmeAdrsSpace);
+    return(ERROR);
+  }
+
+  if(vmeOpenDefaultWindows() != OK) return(ERROR);
+  if((emuWindow[isp] == NULL) || (vme >= emuWindowSize[isp])) {
+    printf("vmeBusToLocalAdrs: ERROR: Invalid address 0x%lx for AM 0x%x\n",
+	   vme,vmeAdrsSpace);
+    return(ERROR);
+  }
+
+  *pPciAdrs = emuWindow[isp] + vme;
+  return(OK);
+}
+
+/*******************************************************************************
+*
+* vmeMemProbe - Check that a module answers at a local address
+*
+*
+* RETURNS: OK (value read in rval), or ERROR (bus error).
+*/
+
+int
+vmeMemProbe(char *addr, int size, char *rval)
+{
+  vmeEmuModule *m;
+  UINT32 off;
+
+  pthread_mutex_lock(&emuMutex);
+  m = emuFind(addr, &off, NULL, NULL);
+  if(m) {
+    if((size == 2) || (size == 4) || (size == 1))
+      memcpy(rval, addr, size);
+    m->stats.nread16++;
+  }
+  pthread_mutex_unlock(&emuMutex);
+
+  emuDelay(emuSingleNs);
+  return(m ? OK : ERROR);
+}
+
+/*******************************************************************************
+*
+* vmeRead16  - Read a 16 bit register
+* vmeRead32  - Read 32 bits.  In the output buffer window, takes the next
+*              word of the module's buffer.
+* vmeWrite16 - Write a 16 bit register (MCST, if at a CBLT/MCST address)
+* vmeWrite32 - Write 32 bits
+*
+* vmeEmuFifoRead32 - As vmeRead32 on the output buffer, but the word is left
+*                    in bus byte order, as a direct read of the window gives
+*                    it with the real library.
+*
+*
+* RETURNS: Value read, in CPU byte order (except vmeEmuFifoRead32).
+*/
+
+UINT16
+vmeRead16(volatile UINT16 *addr)
+{
+  vmeEmuModule *m;
+  UINT16 rval;
+
+  pthread_mutex_lock(&emuMutex);
+  m = emuFind(addr, NULL, NULL, NULL);
+  if(m) m->stats.nread16++;
+  rval = EMU_BUS16(*addr);
+  pthread_mutex_unlock(&emuMutex);
+
+  emuDelay(emuSingleNs);
+  return(rval);
+}
+
+UINT32
+vmeRead32(volatile UINT32 *addr)
+{
+  return(EMU_BUS32(vmeEmuFifoRead32(addr)));
+}
+
+UINT32
+vmeEmuFifoRead32(volatile UINT32 *addr)
+{
+  vmeEmuModule *m;
+  UINT32 off, rval;
+
+  pthread_mutex_lock(&emuMutex);
+  m = emuFind(addr, &off, NULL, NULL);
+  if(m && (off < EMU_DATA_END)) {
+    m->stats.nread32++;
+    if(emuPopWord(m, &rval) == 0)
+      rval = EMU_FILLER;
+    rval = EMU_BUS32(rval);
+  } else {
+    if(m) m->stats.nread16 += 2;
+    rval = *addr;
+  }
+  pthread_mutex_unlock(&emuMutex);
+
+  emuDelay(emuSingleNs);
+  return(rval);
+}
+
+void
+vmeWrite16(volatile UINT16 *addr, UINT16 val)
+{
+  vmeEmuModule *m, *chain[VME_EMU_MAX_MODULES];
+  UINT32 off, vme = 0;
+  int ii, n, space = -1, level = -1, ilev[VME_EMU_MAX_MODULES];
+
+  pthread_mutex_lock(&emuMutex);
+  m = emuFind(addr, &off, &space, &vme);
+  if(m) {
+    if(emuWriteReg(m, emuIndex(m), off, val))
+      level = emuIntPending(m);
+    pthread_mutex_unlock(&emuMutex);
+    emuIntDeliver(level);
+    emuDelay(emuSingleNs);
+    return;
+  }
+
+  /* Multicast */
+  n = 0;
+  if((space == EMU_A32) && ((vme & 0x00ffffff) < EMU_MODULE_SIZE) && emuWindow[EMU_A32] &&
+     ((unsigned long)addr - (unsigned long)emuWindow[EMU_A32] < EMU_A32_SIZE))
+    n = emuChain(vme & 0xff000000, chain);
+
+  if(n == 0)
+    *addr = EMU_BUS16(val);
+
+  for(ii=0;ii<n;ii++) {
+    ilev[ii] = -1;
+    if(emuWriteReg(chain[ii], emuIndex(chain[ii]), vme & 0xffff, val))
+      ilev[ii] = emuIntPending(chain[ii]);
+  }
+  pthread_mutex_unlock(&emuMutex);
+
+  for(ii=0;ii<n;ii++)
+    emuIntDeliver(ilev[ii]);
+
+  emuDelay(emuSingleNs);
+}
+
+void
+vmeWrite32(volatile UINT32 *addr, UINT32 val)
+{
+  vmeEmuModule *m;
+
+  pthread_mutex_lock(&emuMutex);
+  m = emuFind(addr, NULL, NULL, NULL);
+  if(m)
+    m->stats.nwrite16 += 2;
+  else
+    *addr = EMU_BUS32(val);
+  pthread_mutex_unlock(&emuMutex);
+
+  emuDelay(emuSingleNs);
+}
+
+/*******************************************************************************
+*
+* vmeDmaConfig - Set the address space of block transfers
+*                (addrType: 1 = A24, 2 = A32).  The data width and
+*                transfer protocol are not emulated.
+* vmeDmaSend   - Start a block transfer of size bytes from vmeAdrs to locAdrs.
+*                vmeAdrs is the output buffer of a module, or a CBLT address.
+*                The transfer is done here.
+* vmeDmaDone   - Wait for the transfer
+*
+*
+* RETURNS: vmeDmaConfig, vmeDmaSend: OK or ERROR.
+*          vmeDmaDone: Bytes transferred, or ERROR.
+*/
+
+int
+vmeDmaConfig(UINT32 addrType, UINT32 dataType, UINT32 sstMode)
+{
+  if((addrType != 1) && (addrType != 2)) {
+    printf("vmeDmaConfig: ERROR: Address type %d not emulated\n",addrType);
+    return(ERROR);
+  }
+
+  pthread_mutex_lock(&emuMutex);
+  emuDmaAddrType = addrType;
+  pthread_mutex_unlock(&emuMutex);
+
+  return(OK);
+}
+
+int
+vmeDmaSend(unsigned long locAdrs, UINT32 vmeAdrs, int size)
+{
+  vmeEmuModule *m = NULL, *chain[VME_EMU_MAX_MODULES];
+  UINT32 *dst = (UINT32 *)locAdrs;
+  int space = (emuDmaAddrType == 1) ? EMU_A24 : EMU_A32;
+  int ii, n = 0, nchain = 0, maxw = size >> 2, last = -1;
+
+  if((size <= 0) || (locAdrs & 0x3)) {
+    printf("vmeDmaSend: ERROR: Invalid transfer (0x%lx, %d bytes)\n",locAdrs,size);
+    return(ERROR);
+  }
+
+  pthread_mutex_lock(&emuMutex);
+  if(emuDmaPending) {
+    pthread_mutex_unlock(&emuMutex);
+    printf("vmeDmaSend: ERROR: Transfer in progress\n");
+    return(ERROR);
+  }
+
+  for(ii=0;ii<emuNmod;ii++)
+    if((emuModule[ii]->space == space) && (vmeAdrs >= emuModule[ii]->base) &&
+       (vmeAdrs - emuModule[ii]->base < EMU_DATA_END)) {
+      m = emuModule[ii];
+      break;
+    }
+
+  if(m) {
+    n = emuBlockRead(m, dst, maxw);
+    emuDmaResult = emuBlockEnd(m, dst, n, maxw);
+  } else {
+    if((space == EMU_A32) && ((vmeAdrs & 0x00ffffff) == 0))
+      nchain = emuChain(vmeAdrs, chain);
+    if(nchain == 0) {
+      pthread_mutex_unlock(&emuMutex);
+      printf("vmeDmaSend: ERROR: No module at VME address 0x%08x (A%d)\n",
+	     vmeAdrs,(space == EMU_A24) ? 24 : 32);
+      return(ERROR);
+    }
+
+    for(ii=0;ii<nchain;ii++) {
+      n += emuBlockRead(chain[ii], &dst[n], maxw - n);
+      if((EMU_REG(chain[ii], EMU_CBLT_CONTROL) & 0x3) == EMU_CBLT_LAST) last = ii;
+    }
+    /* The LAST board ends the chain */
+    emuDmaResult = emuBlockEnd(chain[(last >= 0) ? last : nchain-1], dst, n, maxw);
+  }
+  emuDmaPending = 1;
+  pthread_mutex_unlock(&emuMutex);
+
+  emuDelay(emuSingleNs + emuBlockNs*(emuDmaResult >> 2));
+  return(OK);
+}
+
+int
+vmeDmaDone()
+{
+  int rval;
+
+  pthread_mutex_lock(&emuMutex);
+  rval = emuDmaPending ? emuDmaResult : ERROR;
+  emuDmaPending = 0;
+  pthread_mutex_unlock(&emuMutex);
+
+  return(rval);
+}
+
+/*******************************************************************************
+*
+* vmeIntConnect    - Connect a routine to a VME interrupt level
+* vmeIntDisconnect - Remove it
+* vmeBusLock       - Take the VME bus lock (recursive here)
+* vmeBusUnlock     - Release it
+* logMsg           - Print a message
+*
+*
+* RETURNS: OK or ERROR.
+*/
+
+int
+vmeIntConnect(UINT32 vector, UINT32 level, VOIDFUNCPTR routine, UINT32 arg)
+{
+  if((level < 1) || (level > 7)) {
+    printf("vmeIntConnect: ERROR: Invalid interrupt level %d\n",level);
+    return(ERROR);
+  }
+
+  pthread_mutex_lock(&emuMutex);
+  emuInt[level].routine = routine;
+  emuInt[level].vector  = vector;
+  emuInt[level].arg     = arg;
+  pthread_mutex_unlock(&emuMutex);
+
+  return(OK);
+}
+
+int
+vmeIntDisconnect(UINT32 level)
+{
+  if((level < 1) || (level > 7)) {
+    printf("vmeIntDisconnect: ERROR: Invalid interrupt level %d\n",level);
+    return(ERROR);
+  }
+
+  pthread_mutex_lock(&emuMutex);
+  memset(&emuInt[level], 0, sizeof(vmeEmuInt));
+  pthread_mutex_unlock(&emuMutex);
+
+  return(OK);
+}
+
+int
+vmeBusLock()
+{
+  pthread_once(&emuBusOnce, emuBusLockInit);
+  return(pthread_mutex_lock(&emuBusMutex) ? ERROR : OK);
+}
+
+int
+vmeBusUnlock()
+{
+  pthread_once(&emuBusOnce, emuBusLockInit);
+  return(pthread_mutex_unlock(&emuBusMutex) ? ERROR : OK);
+}
+
+int
+logMsg(const char *format, ...)
+{
+  va_list ap;
+  int rval;
+
+  va_start(ap, format);
+  rval = vprintf(format, ap);
+  va_end(ap);
+
+  return(rval);
+}
+
+/*******************************************************************************
+*
+* vmeEmuAddModule - Put a module in the emulated crate
+*
+*   type - VME_EMU_V792 or VME_EMU_V775
+*   addr - VME base address (64 kB boundary).  A24 if below 0x01000000,
+*          else A32.
+*
+*   The module comes up as after a soft reset, with thresholds at 0 and
+*   GEO address imod+2 (the slot, in a crate filled from slot 2).
+*   Each event fires all channels, with values from a pseudo random
+*   sequence (see vmeEmuSetGenerator).
+*
+* vmeEmuClear - Remove all modules, and disconnect the interrupts
+*
+*
+* RETURNS: vmeEmuAddModule: Module number (imod), or ERROR.
+*/
+
+int
+vmeEmuAddModule(int type, UINT32 addr)
+{
+  vmeEmuModule *m;
+  int ii, space = (addr < EMU_A24_SIZE) ? EMU_A24 : EMU_A32;
+  UINT32 id, serial;
+
+  if((type != VME_EMU_V792) && (type != VME_EMU_V775)) {
+    printf("vmeEmuAddModule: ERROR: Unknown module type %d\n",type);
+    return(ERROR);
+  }
+  if(addr & (EMU_MODULE_SIZE-1)) {
+    printf("vmeEmuAddModule: ERROR: Address 0x%08x not on a 64 kB boundary\n",addr);
+    return(ERROR);
+  }
+  if(vmeOpenDefaultWindows() != OK) return(ERROR);
+  if(emuWindow[space] == NULL) {
+    printf("vmeEmuAddModule: ERROR: No A32 window on this host\n");
+    return(ERROR);
+  }
+
+  pthread_mutex_lock(&emuMutex);
+  if(emuNmod >= VME_EMU_MAX_MODULES) {
+    pthread_mutex_unlock(&emuMutex);
+    printf("vmeEmuAddModule: ERROR: Too many modules (max %d)\n",VME_EMU_MAX_MODULES);
+    return(ERROR);
+  }
+  for(ii=0;ii<emuNmod;ii++)
+    if((emuModule[ii]->space == space) && (emuModule[ii]->base == addr)) {
+      pthread_mutex_unlock(&emuMutex);
+      printf("vmeEmuAddModule: ERROR: Address 0x%08x already used by module %d\n",
+	     addr,ii);
+      return(ERROR);
+    }
+
+  m = (vmeEmuModule *)calloc(1, sizeof(vmeEmuModule));
+  if(m == NULL) {
+    pthread_mutex_unlock(&emuMutex);
+    printf("vmeEmuAddModule: ERROR: Cannot allocate module\n");
+    return(ERROR);
+  }
+
+  m->type   = type;
+  m->space  = space;
+  m->base   = addr;
+  m->mem    = emuWindow[space] + addr;
+  m->gen    = emuDefaultGen;
+  m->genArg = NULL;
+  m->seed   = 0x12345678 + emuNmod;
+  memset(m->mem, 0, EMU_MODULE_SIZE);
+
+  /* Configuration ROM */
+  id = (type == VME_EMU_V792) ? 0x318 : 0x307;
+  serial = 100 + emuNmod;
+  EMU_SET_REG(m, EMU_ROM_OUI_3, 0x00);
+  EMU_SET_REG(m, EMU_ROM_OUI_2, 0x40);
+  EMU_SET_REG(m, EMU_ROM_OUI_1, 0xe6);
+  EMU_SET_REG(m, EMU_ROM_VERSION, 0x11);
+  EMU_SET_REG(m, EMU_ROM_ID_3, (id >> 16) & 0xff);
+  EMU_SET_REG(m, EMU_ROM_ID_2, (id >> 8) & 0xff);
+  EMU_SET_REG(m, EMU_ROM_ID_1, id & 0xff);
+  EMU_SET_REG(m, EMU_ROM_REVISION, 0x01);
+  EMU_SET_REG(m, EMU_ROM_SERIAL_MSB, (serial >> 8) & 0xff);
+  EMU_SET_REG(m, EMU_ROM_SERIAL_LSB, serial & 0xff);
+
+  EMU_SET_REG(m, EMU_REV, 0x0b);
+  EMU_SET_REG(m, EMU_GEO, (emuNmod + 2) & 0x1f);
+  emuReset(m);
+
+  emuModule[emuNmod] = m;
+  ii = emuNmod++;
+  pthread_mutex_unlock(&emuMutex);
+
+  return(ii);
+}
+
+void
+vmeEmuClear()
+{
+  int ii;
+
+  pthread_mutex_lock(&emuMutex);
+  for(ii=0;ii<emuNmod;ii++) {
+    memset(emuModule[ii]->mem, 0, EMU_MODULE_SIZE);
+    free(emuModule[ii]);
+    emuModule[ii] = NULL;
+  }
+  emuNmod = 0;
+  memset(emuInt, 0, sizeof(emuInt));
+  emuDmaPending = 0;
+  pthread_mutex_unlock(&emuMutex);
+}
+
+/*******************************************************************************
+*
+* vmeEmuGate - Front panel gate (QDC) or common start/stop (TDC)
+*
+*   imod - module number, or -1 for all modules
+*
+*   If this leaves evTrigger events in a module with interrupts enabled,
+*   the connected routine is called before returning.
+*
+*
+* RETURNS: Number of modules that counted the event, or ERROR.
+*/
+
+int
+vmeEmuGate(int imod)
+{
+  int ii, first = imod, last = imod, n = 0, level[VME_EMU_MAX_MODULES];
+
+  pthread_mutex_lock(&emuMutex);
+  if(imod < 0) {
+    first = 0;
+    last = emuNmod - 1;
+  } else if(imod >= emuNmod) {
+    pthread_mutex_unlock(&emuMutex);
+    printf("vmeEmuGate: ERROR: Invalid module %d\n",imod);
+    return(ERROR);
+  }
+
+  for(ii=first;ii<=last;ii++) {
+    level[ii] = -1;
+    if(emuGate(emuModule[ii], ii)) {
+      n++;
+      level[ii] = emuIntPending(emuModule[ii]);
+    }
+  }
+  pthread_mutex_unlock(&emuMutex);
+
+  for(ii=first;ii<=last;ii++)
+    emuIntDeliver(level[ii]);
+
+  return(n);
+}
+
+/*******************************************************************************
+*
+* vmeEmuSetGenerator - Set the routine that makes the channel values
+*                      (NULL for the default pseudo random values)
+*
+*   imod - module number, or -1 for all modules
+*
+* vmeEmuSetDelay     - Busy wait on each access, to model the bus:
+*                      singleNs for each single cycle (and the set up of a
+*                      block transfer), blockNs for each word of a block
+*                      transfer.  0 (default) for no delay.
+*
+*
+* RETURNS: OK or ERROR.
+*/
+
+LOCAL int
+emuDefaultGen(void *arg, int imod, unsigned int evnum, UINT16 *value)
+{
+  vmeEmuModule *m = emuModule[imod];
+  int ich;
+
+  for(ich=0;ich<VME_EMU_NCHAN;ich++) {
+    m->seed = m->seed*1103515245 + 12345;
+    value[ich] = (m->seed >> 16) & 0xfff;
+  }
+  return(0);
+}
+
+int
+vmeEmuSetGenerator(int imod, VMEEMUGENFUNC gen, void *arg)
+{
+  int ii;
+
+  pthread_mutex_lock(&emuMutex);
+  if(imod >= emuNmod) {
+    pthread_mutex_unlock(&emuMutex);
+    printf("vmeEmuSetGenerator: ERROR: Invalid module %d\n",imod);
+    return(ERROR);
+  }
+
+  for(ii=0;ii<emuNmod;ii++)
+    if((imod < 0) || (ii == imod)) {
+      emuModule[ii]->gen    = gen ? gen : emuDefaultGen;
+      emuModule[ii]->genArg = arg;
+    }
+  pthread_mutex_unlock(&emuMutex);
+
+  return(OK);
+}
+
+int
+vmeEmuSetDelay(int singleNs, int blockNs)
+{
+  if((singleNs < 0) || (blockNs < 0)) {
+    printf("vmeEmuSetDelay: ERROR: Invalid delay (%d, %d)\n",singleNs,blockNs);
+    return(ERROR);
+  }
+
+  emuSingleNs = singleNs;
+  emuBlockNs  = blockNs;
+  return(OK);
+}
+
+/*******************************************************************************
+*
+* vmeEmuGetStats   - Copy the bus counters of a module
+* vmeEmuClearStats - Zero the counters of all modules
+* vmeEmuPrintStats - Print the counters of all modules
+*
+*
+* RETURNS: vmeEmuGetStats: OK or ERROR.
+*/
+
+int
+vmeEmuGetStats(int imod, vmeEmuStats *stats)
+{
+  pthread_mutex_lock(&emuMutex);
+  if((imod < 0) || (imod >= emuNmod) || (stats == NULL)) {
+    pthread_mutex_unlock(&emuMutex);
+    return(ERROR);
+  }
+  *stats = emuModule[imod]->stats;
+  pthread_mutex_unlock(&emuMutex);
+
+  return(OK);
+}
+
+void
+vmeEmuClearStats()
+{
+  int ii;
+
+  pthread_mutex_lock(&emuMutex);
+  for(ii=0;ii<emuNmod;ii++)
+    memset(&emuModule[ii]->stats, 0, sizeof(vmeEmuStats));
+  pthread_mutex_unlock(&emuMutex);
+}
+
+void
+vmeEmuPrintStats()
+{
+  vmeEmuStats st;
+  int ii;
+
+  printf("\n");
+  printf("                    Emulated VME Crate (%d modules)\n\n",emuNmod);
+  printf("  Mod Type    Address   Read16   Write16  Read32  Blocks  BlkWords"
+	 "    Gates   Busy   Ints\n");
+  printf("  --- ---- ---------- -------- -------- -------- ------ --------"
+	 " -------- ------ ------\n");
+  for(ii=0;ii<emuNmod;ii++) {
+    if(vmeEmuGetStats(ii, &st) != OK) continue;
+    printf("  %2d  V%d  0x%08x %8llu %8llu %8llu %6llu %8llu %8llu %6llu %6llu\n",
+	   ii,emuModule[ii]->type,emuModule[ii]->base,
+	   st.nread16,st.nwrite16,st.nread32,st.ndma,st.ndmaWords,
+	   st.ngate,st.nbusy,st.nint);
+  }
+  printf("\n");
+}
@@ -0,0 +1,398 @@
+/******************************************************************************
+*
+*  v7xxBench.c  -  Readout benchmark of the c792 library, run on the
+*                  emulated VME library (emu/jvme.h), so no crate is needed.
+*
+*                  For each readout mode, number of QDCs, channel occupancy
+*                  and trigger rate, the QDCs are gated (all together) and
+*                  read until ntrig triggers are done.  One CSV line is
+*                  written per point, with the event and data rates and the
+*                  trigger latency (time from the gate to the end of the
+*                  readout that took the event) percentiles.
+*
+*                  Modes:
+*                    event    c792ReadEvent, one event per QDC and readout
+*                    events   c792ReadEvents, all buffered events
+*                    block    c792ReadBlockIndex (BERR, BLK_END)
+*                    overlap  c792ReadBlockOverlap (BERR, BLK_END)
+*                    cblt     c792CBLTReadBlock + c792CBLTSplit
+*
+*                  With a trigger rate of 0, the next trigger comes as soon
+*                  as the previous one is read.  Otherwise triggers come at
+*                  fixed intervals, and queue in the QDC buffers while the
+*                  readout is busy; a trigger that finds them full is lost.
+*
+*                  The bus is modelled with a busy wait on each access
+*                  (-d, see vmeEmuSetDelay), default 500 ns per single
+*                  cycle and 50 ns per block transfer word.
+*
+*  Usage: v7xxBench [-M modes] [-m nmod,..] [-o nchan,..] [-r Hz,..]
+*                   [-n ntrig] [-d singleNs,blockNs]
+*
+*  Results go to stdout, library messages to stderr:
+*         v7xxBench -m 1,20 -o 8,32 -r 0,10000 > bench.csv
+*
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "jvme.h"
+#include "c792Lib.h"
+
+#define BENCH_BASE       0x00100000   /* A24 address of the first QDC */
+#define BENCH_CBLT_ADDR  0x08000000
+#define BENCH_MAX_LIST   32
+#define BENCH_MAX_EVENTS C792_MAX_EVENTS_PER_BUFFER
+#define BENCH_BLOCK_WORDS (C792_MAX_WORDS_PER_EVENT*C792_MAX_EVENTS_PER_BUFFER)
+
+enum {MODE_EVENT, MODE_EVENTS, MODE_BLOCK, MODE_OVERLAP, MODE_CBLT, NMODE};
+static const char *modeName[NMODE] = {"event", "events", "block", "overlap", "cblt"};
+
+typedef struct
+{
+  unsigned long long nread;    /* events read (per QDC) */
+  unsigned long long nlost;    /* triggers lost, buffers full */
+  unsigned long long nwords;   /* words read, all QDCs */
+  unsigned long long nerr;     /* readout errors */
+  unsigned long long elapsed;  /* ns */
+  double lat[4];               /* p50, p99, p999, max (us) */
+} benchResult;
+
+static UINT32       *benchBuf;
+static c792EvIndex   benchIdx[BENCH_MAX_EVENTS*C792_MAX_MODULES];
+static int           benchNchan;
+
+static unsigned long long
+benchNow()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+}
+
+/* benchNchan channels fire, starting at a channel that moves with the
+   event; the others give 0 and are under threshold */
+static int
+benchGen(void *arg, int imod, unsigned int evnum, UINT16 *value)
+{
+  int ii, first = (evnum*7) % VME_EMU_NCHAN;
+
+  for(ii=0;ii<benchNchan;ii++)
+    value[(first + ii) % VME_EMU_NCHAN] = 100 + ((evnum*31 + ii*97 + imod) & 0xeff);
+
+  return(0);
+}
+
+static int
+benchSetup(int mode, int nmod, int nchan)
+{
+  int id, ich;
+
+  vmeEmuClear();
+  for(id=0;id<nmod;id++)
+    if(vmeEmuAddModule(VME_EMU_V792, BENCH_BASE + id*0x10000) < 0)
+      return(ERROR);
+  benchNchan = nchan;
+  vmeEmuSetGenerator(-1, benchGen, NULL);
+
+  if(c792Init(BENCH_BASE, 0x10000, nmod, 0) != OK)
+    return(ERROR);
+
+  for(id=0;id<nmod;id++)
+    for(ich=0;ich<C792_MAX_CHANNELS;ich++)
+      c792SetThresh(id, ich, 1);
+
+  switch(mode) {
+  case MODE_BLOCK:
+  case MODE_OVERLAP:
+    for(id=0;id<nmod;id++)
+      c792EnableBerr(id);
+    vmeDmaConfig(1,2,0);
+    break;
+  case MODE_CBLT:
+    if(c792CBLTInit(BENCH_CBLT_ADDR, 0) != OK)
+      return(ERROR);
+    vmeDmaConfig(2,2,0);
+    break;
+  }
+
+  return(OK);
+}
+
+static int
+benchCountTrailers(UINT32 *data, int nwords)
+{
+  int ii, n = 0;
+
+  for(ii=0;ii<nwords;ii++)
+    if((LSWAP(data[ii])&C792_DATA_ID_MASK) == C792_TRAILER_DATA)
+      n++;
+  return(n);
+}
+
+/* One readout of all QDCs.  Returns the number of events taken from the
+   first QDC (all QDCs are gated together), and counts the words read
+   and the errors */
+static int
+benchReadout(int mode, int nmod, unsigned long long *nwords, unsigned long long *nerr)
+{
+  int id, n, nev = 0, nevents, bstat, modWords[C792_MAX_MODULES];
+  UINT32 *data = benchBuf;
+
+  switch(mode) {
+  case MODE_EVENT:
+    for(id=0;id<nmod;id++) {
+      n = c792ReadEvent(id, data);
+      if(n < 0) { (*nerr)++; continue; }
+      if((id == 0) && (n > 0)) nev = 1;
+      data += n;
+    }
+    break;
+
+  case MODE_EVENTS:
+    for(id=0;id<nmod;id++) {
+      n = c792ReadEvents(id, data, BENCH_MAX_EVENTS, NULL, NULL, &nevents);
+      if(n < 0) { (*nerr)++; continue; }
+      if(id == 0) nev = nevents;
+      data += n;
+    }
+    break;
+
+  case MODE_BLOCK:
+    for(id=0;id<nmod;id++) {
+      n = c792ReadBlockIndex(id, data, BENCH_BLOCK_WORDS, benchIdx, BENCH_MAX_EVENTS,
+			     &nevents, &bstat);
+      if((n < 0) || (bstat & C792_BLKSTAT_CORRUPT)) { (*nerr)++; continue; }
+      if(id == 0) nev = nevents;
+      data += n;
+    }
+    break;
+
+  case MODE_OVERLAP:
+    n = c792ReadBlockOverlap((1<<nmod)-1, data, BENCH_BLOCK_WORDS, 0, modWords);
+    if(n < 0) { (*nerr)++; break; }
+    if(modWords[0] > 0) nev = benchCountTrailers(data, modWords[0]);
+    data += n;
+    break;
+
+  case MODE_CBLT:
+    n = c792CBLTReadBlock(data, BENCH_BLOCK_WORDS*nmod);
+    if(n < 0) { (*nerr)++; break; }
+    nevents = c792CBLTSplit(data, n, benchIdx, BENCH_MAX_EVENTS*C792_MAX_MODULES);
+    if(nevents < 0) { (*nerr)++; break; }
+    nev = nevents/nmod;
+    data += n;
+    break;
+  }
+
+  *nwords += data - benchBuf;
+  return(nev);
+}
+
+static int
+benchCompare(const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+  return((x > y) - (x < y));
+}
+
+static int
+benchRun(int mode, int nmod, int rate, int ntrig, benchResult *res)
+{
+  unsigned long long *lat, arrival[BENCH_MAX_EVENTS];
+  unsigned long long t0, tnow, tnext, period;
+  int ngated = 0, nqueue = 0, qfirst = 0, nlat = 0, nev, ii;
+  static const double pct[3] = {0.50, 0.99, 0.999};
+
+  memset(res, 0, sizeof(benchResult));
+  lat = (unsigned long long *)malloc(ntrig*sizeof(unsigned long long));
+  if(lat == NULL) return(ERROR);
+
+  period = (rate > 0) ? 1000000000ULL/rate : 0;
+  t0 = tnext = benchNow();
+
+  while((ngated + res->nlost < ntrig) || (nqueue > 0)) {
+    /* Triggers due */
+    tnow = benchNow();
+    while((ngated + res->nlost < ntrig) &&
+	  ((rate > 0) ? (tnext <= tnow) : (nqueue == 0))) {
+      if(nqueue == BENCH_MAX_EVENTS) {
+	res->nlost++;
+      } else {
+	vmeEmuGate(-1);
+	arrival[(qfirst + nqueue++) % BENCH_MAX_EVENTS] = (rate > 0) ? tnext : tnow;
+	ngated++;
+      }
+      tnext += period;
+    }
+    if(nqueue == 0) continue;
+
+    nev = benchReadout(mode, nmod, &res->nwords, &res->nerr);
+    tnow = benchNow();
+    if(nev > nqueue) nev = nqueue;
+    for(ii=0;ii<nev;ii++) {
+      lat[nlat++] = tnow - arrival[qfirst];
+      qfirst = (qfirst + 1) % BENCH_MAX_EVENTS;
+    }
+    nqueue -= nev;
+    res->nread += nev;
+
+    if((nev == 0) && (res->nerr > (unsigned long long)ntrig)) {
+      free(lat);
+      return(ERROR);   /* Readout does not make progress */
+    }
+  }
+  res->elapsed = benchNow() - t0;
+
+  if(nlat > 0) {
+    qsort(lat, nlat, sizeof(unsigned long long), benchCompare);
+    for(ii=0;ii<3;ii++)
+      res->lat[ii] = lat[(int)(pct[ii]*(nlat-1) + 0.5)]/1000.0;
+    res->lat[3] = lat[nlat-1]/1000.0;
+  }
+
+  free(lat);
+  return(OK);
+}
+
+static int
+benchParseList(const char *arg, int *list, int min, int max)
+{
+  char *copy = strdup(arg), *tok, *save = NULL;
+  int n = 0;
+
+  for(tok=strtok_r(copy, ",", &save);tok;tok=strtok_r(NULL, ",", &save)) {
+    if(n == BENCH_MAX_LIST) break;
+    list[n] = atoi(tok);
+    if((list[n] < min) || (list[n] > max)) {
+      fprintf(stderr, "v7xxBench: ERROR: %s out of range (%d-%d)\n", tok, min, max);
+      free(copy);
+      return(ERROR);
+    }
+    n++;
+  }
+  free(copy);
+  return(n);
+}
+
+static int
+benchParseModes(const char *arg, int *list)
+{
+  char *copy = strdup(arg), *tok, *save = NULL;
+  int n = 0, im;
+
+  for(tok=strtok_r(copy, ",", &save);tok;tok=strtok_r(NULL, ",", &save)) {
+    for(im=0;im<NMODE;im++)
+      if(strcmp(tok, modeName[im]) == 0) break;
+    if(im == NMODE) {
+      fprintf(stderr, "v7xxBench: ERROR: Unknown mode %s\n", tok);
+      free(copy);
+      return(ERROR);
+    }
+    list[n++] = im;
+  }
+  free(copy);
+  return(n);
+}
+
+static void
+benchUsage()
+{
+  fprintf(stderr,
+	  "Usage: v7xxBench [-M modes] [-m nmod,..] [-o nchan,..] [-r Hz,..]\n"
+	  "                 [-n ntrig] [-d singleNs,blockNs]\n"
+	  "  -M  readout modes: event,events,block,overlap,cblt (default all)\n"
+	  "  -m  numbers of QDCs, 1-%d (default 1,2,4,8,16,%d)\n"
+	  "  -o  channels fired per event, 0-32 (default 4,32)\n"
+	  "  -r  trigger rates in Hz, 0 for back to back (default 0)\n"
+	  "  -n  triggers per point (default 2000)\n"
+	  "  -d  bus model, ns per single cycle and per block word (default 500,50)\n",
+	  C792_MAX_MODULES,C792_MAX_MODULES);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mode[NMODE] = {MODE_EVENT, MODE_EVENTS, MODE_BLOCK, MODE_OVERLAP, MODE_CBLT};
+  int nmod[BENCH_MAX_LIST] = {1, 2, 4, 8, 16, C792_MAX_MODULES};
+  int nchan[BENCH_MAX_LIST] = {4, 32};
+  int rate[BENCH_MAX_LIST] = {0};
+  int nmode = NMODE, nnmod = 6, nnchan = 2, nrate = 1;
+  int ntrig = 2000, delay[2] = {500, 50};
+  int opt, im, in, io, ir;
+  benchResult res;
+  FILE *out;
+
+  while((opt = getopt(argc, argv, "M:m:o:r:n:d:h")) != -1) {
+    switch(opt) {
+    case 'M': nmode  = benchParseModes(optarg, mode); break;
+    case 'm': nnmod  = benchParseList(optarg, nmod, 1, C792_MAX_MODULES); break;
+    case 'o': nnchan = benchParseList(optarg, nchan, 0, C792_MAX_CHANNELS); break;
+    case 'r': nrate  = benchParseList(optarg, rate, 0, 100000000); break;
+    case 'n': ntrig  = atoi(optarg); break;
+    case 'd':
+      if(benchParseList(optarg, delay, 0, 1000000) != 2) nmode = ERROR;
+      break;
+    default:
+      benchUsage();
+      return(1);
+    }
+    if((nmode <= 0) || (nnmod <= 0) || (nnchan <= 0) || (nrate <= 0) || (ntrig <= 0)) {
+      benchUsage();
+      return(1);
+    }
+  }
+
+  /* Library messages to stderr, results to stdout */
+  fflush(stdout);
+  out = fdopen(dup(1), "w");
+  dup2(2, 1);
+  if(out == NULL) {
+    perror("v7xxBench: fdopen");
+    return(1);
+  }
+
+  if(posix_memalign((void **)&benchBuf, 8,
+		    (BENCH_BLOCK_WORDS + 2)*C792_MAX_MODULES*sizeof(UINT32))) {
+    fprintf(stderr, "v7xxBench: ERROR: Cannot allocate data buffer\n");
+    return(1);
+  }
+  vmeEmuSetDelay(delay[0], delay[1]);
+
+  fprintf(out, "mode,nmod,nchan,rate_hz,ntrig,nread,nlost,nerr,"
+	  "events_per_s,mb_per_s,words_per_event,"
+	  "lat_p50_us,lat_p99_us,lat_p999_us,lat_max_us\n");
+
+  for(im=0;im<nmode;im++)
+    for(in=0;in<nnmod;in++)
+      for(io=0;io<nnchan;io++)
+	for(ir=0;ir<nrate;ir++) {
+	  if((benchSetup(mode[im], nmod[in], nchan[io]) != OK) ||
+	     (benchRun(mode[im], nmod[in], rate[ir], ntrig, &res) != OK)) {
+	    fprintf(stderr, "v7xxBench: ERROR: %s, %d QDCs, %d channels, %d Hz failed\n",
+		    modeName[mode[im]], nmod[in], nchan[io], rate[ir]);
+	    continue;
+	  }
+
+	  fprintf(out, "%s,%d,%d,%d,%d,%llu,%llu,%llu,%.1f,%.3f,%.1f,%.2f,%.2f,%.2f,%.2f\n",
+		  modeName[mode[im]], nmod[in], nchan[io], rate[ir], ntrig,
+		  res.nread, res.nlost, res.nerr,
+		  res.nread*1e9/res.elapsed,
+		  res.nwords*4*1e3/res.elapsed,
+		  res.nread ? (double)res.nwords/(res.nread*nmod[in]) : 0.0,
+		  res.lat[0], res.lat[1], res.lat[2], res.lat[3]);
+	  fflush(out);
+	}
+
+  vmeCloseDefaultWindows();
+  free(benchBuf);
+  fclose(out);
+
+  return(0);
+}
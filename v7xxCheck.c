@@ -0,0 +1,351 @@
+/******************************************************************************
+*
+*  v7xxCheck.c  -  Event counter check of the modules read out with the
+*                  v7xx scheduler.
+*
+*                  For each trigger, the event counter in the trailer of
+*                  each module is compared with the trigger count given
+*                  by the caller (e.g. tirGetIntCount).  The difference
+*                  between the trailer and the trigger count is learned
+*                  on the first event, and is then constant as long as the
+*                  module sees every trigger once: checking a module is a
+*                  subtraction and a compare, with no bus access.
+*                  Counters are compared on 24 bits, the width of the
+*                  module counter, so they may wrap.
+*
+*                  A module that misses a trigger changes its difference.
+*                  One that takes an extra gate keeps it, as the events
+*                  are read in order, but is left with an event in its
+*                  buffer after the read: every few triggers, the event
+*                  counter register of each module is read, and compared
+*                  with its count of events read (c792Dready), which the
+*                  libraries set from the trailer.
+*
+*                  A module that slipped is optionally resynchronised
+*                  (data reset, and its difference learned again on the
+*                  next event), and the event is tagged in the bank.  When
+*                  all the modules move together, it is the trigger count
+*                  that skipped: the differences are learned again, and
+*                  nothing is reset.
+*
+*/
+
+#ifdef VXWORKS
+#include "vxWorks.h"
+#include "logLib.h"
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "jvme.h"
+
+/* Include QDC/TDC definitions */
+#include "v7xxLib.h"
+#include "v7xxLog.h"
+
+int v7xxCheckFlags = 0;   /* V7XX_CHECK_* */
+
+LOCAL v7xxCheckStats v7xxCheckMod[V7XX_SCHED_MAX];
+LOCAL unsigned long long v7xxCheckTrigSkip = 0;   /* trigger count skips */
+LOCAL int v7xxCheckPeriod = 0;                    /* triggers between event counter reads */
+LOCAL int v7xxCheckCountdown = 0;
+
+/* Messages from the trigger path (see v7xxLog.h) */
+LOCAL v7xxLog v7xxCheckLog = V7XX_LOG_INIT("v7xxCheck");
+#define V7XX_CHECK_LOG(...)  V7XX_LOG(&v7xxCheckLog, __VA_ARGS__)
+
+/*******************************************************************************
+*
+* v7xxCheckEnable - Select the event counter check (0 to turn it off), and
+*                   learn the counters again from the next event.  Call it
+*                   after the schedule is set (v7xxSchedAdd), at prestart.
+*   flags  - V7XX_CHECK_ON     : compare the counters of each event
+*                                (v7xxCheckEvent), tag the events where a
+*                                module slipped
+*            V7XX_CHECK_RESYNC : also clear the data of a module that
+*                                slipped
+*   period - read the event counter register of the modules every period
+*            triggers, to find the extra gates (0: never).  This is the
+*            only part of the check that reads the bus (c792Dready).
+* v7xxCheckGet    - Copy the counters of schedule position pos
+* v7xxCheckPrint  - Print the counters of each schedule position
+* v7xxCheckForget - Learn the counters of schedule position pos again from
+*                   its next event, e.g. after its module was reset
+*
+*
+* RETURNS: v7xxCheckEnable and v7xxCheckGet: OK or ERROR.
+*          Others: None.
+*/
+
+STATUS
+v7xxCheckEnable(int flags, int period)
+{
+  int ii;
+
+  if(flags & ~(V7XX_CHECK_ON|V7XX_CHECK_RESYNC)) {
+    printf("v7xxCheckEnable: ERROR: Invalid flags 0x%x\n",flags);
+    return(ERROR);
+  }
+  if(period < 0) {
+    printf("v7xxCheckEnable: ERROR: Invalid period %d\n",period);
+    return(ERROR);
+  }
+  if(flags & V7XX_CHECK_RESYNC)
+    flags |= V7XX_CHECK_ON;
+
+  memset(v7xxCheckMod, 0, sizeof(v7xxCheckMod));
+  for(ii=0;ii<V7XX_SCHED_MAX;ii++)
+    v7xxCheckMod[ii].offset = V7XX_CHECK_LEARN;
+  v7xxCheckTrigSkip = 0;
+  v7xxCheckPeriod = period;
+  v7xxCheckCountdown = period;
+
+  v7xxLogStart(&v7xxCheckLog);
+  v7xxCheckFlags = flags;
+
+  return(OK);
+}
+
+STATUS
+v7xxCheckGet(int pos, v7xxCheckStats *stats)
+{
+  if((pos < 0) || (pos >= V7XX_SCHED_MAX) || (stats == NULL)) {
+    printf("v7xxCheckGet: ERROR: Invalid schedule position %d\n",pos);
+    return(ERROR);
+  }
+
+  *stats = v7xxCheckMod[pos];
+
+  return(OK);
+}
+
+void
+v7xxCheckPrint()
+{
+  v7xxCheckStats *st;
+  int ii;
+
+  printf("\n");
+  printf("                    V792/V775 Event Counter Check\n\n");
+  printf("  #          Events   Offset      Skews  Extra evts   Resyncs  No trailer\n");
+  printf("--------------------------------------------------------------------\n");
+  for(ii=0;ii<v7xxSchedCount();ii++) {
+    st = &v7xxCheckMod[ii];
+    printf(" %2d  %14llu  ",ii,st->nevents);
+    if(st->offset == V7XX_CHECK_LEARN)
+      printf("  ------");
+    else
+      printf("0x%06x",st->offset);
+    printf("  %9llu  %10llu  %8llu  %10llu\n",st->nskew,st->nextra,
+	   st->nresync,st->nnotrailer);
+  }
+  printf("--------------------------------------------------------------------\n");
+  printf("  Offset: trailer event counter - trigger count.  Trigger count skips: %llu\n",
+	 v7xxCheckTrigSkip);
+  printf("\n");
+}
+
+void
+v7xxCheckForget(int pos)
+{
+  if((pos < 0) || (pos >= V7XX_SCHED_MAX)) return;
+
+  v7xxCheckMod[pos].offset = V7XX_CHECK_LEARN;
+  v7xxCheckMod[pos].lastDelta = 0;
+}
+
+/* Trailer of schedule position ii in an event read by v7xxSchedReadout:
+   the last word, but after a block read.  Returns 0 if there is none */
+LOCAL int
+v7xxCheckTrailer(volatile UINT32 *data, v7xxSchedResult *res, int ii, int swap,
+		 UINT32 *trailer)
+{
+  UINT32 word;
+  int jj = res[ii].offset + res[ii].nwords - 1;
+
+  for(; jj >= res[ii].offset; jj--) {
+    word = swap ? LSWAP(data[jj]) : data[jj];
+    if((word & C792_DATA_ID_MASK) == C792_TRAILER_DATA) {
+      *trailer = word;
+      return(1);
+    }
+  }
+
+  return(0);
+}
+
+/*******************************************************************************
+*
+* v7xxCheckLabel - Event number of an event read by v7xxSchedReadout, from
+*                  the trailer counter of the first module of the schedule
+*                  with data and a learned offset (see v7xxCheckEvent)
+*
+*   next - event number expected.  The bits above the 24 of the module
+*          counters come from it, and it is returned if no module can tell
+*          (check off, or offsets not learned yet).
+*
+*   For a reader that does not know the trigger of the events it reads
+*   (v7xxPipeRead).  The first module of the schedule is the reference:
+*   v7xxCheckEvent, called with this number, finds the others that slipped.
+*
+*
+* RETURNS: The event number.
+*/
+
+UINT32
+v7xxCheckLabel(UINT32 next, volatile UINT32 *data, v7xxSchedResult *res)
+{
+  UINT32 word, delta;
+  int ii, nsched = v7xxSchedCount(), swap = 0;
+
+  if(!v7xxCheckFlags || (data == NULL) || (res == NULL)) return(next);
+
+#ifndef VXWORKS
+  swap = (c792GetByteOrder() != C792_ORDER_CPU);
+#endif
+
+  for(ii=0;ii<nsched;ii++) {
+    if((res[ii].nwords <= 0) || (v7xxCheckMod[ii].offset == V7XX_CHECK_LEARN))
+      continue;
+    if(!v7xxCheckTrailer(data, res, ii, swap, &word))
+      continue;
+
+    /* Counter - offset is the event number on 24 bits: the nearest one */
+    delta = ((word & C792_EVENTCOUNT_MASK) - v7xxCheckMod[ii].offset - next)
+      & C792_EVENTCOUNT_MASK;
+    if(delta & 0x800000)
+      delta |= ~C792_EVENTCOUNT_MASK;
+    return(next + delta);
+  }
+
+  return(next);
+}
+
+/*******************************************************************************
+*
+* v7xxCheckEvent - Check the event counters of one event, read by
+*                  v7xxSchedReadout, against the trigger count
+*
+*   trigger - trigger count of the event
+*   data    - buffer given to v7xxSchedReadout
+*   res     - its results
+*   tag     - where to write the tag, if a module slipped:
+*               V7XX_CHECK_MARK | flags | (V7XX_CHECK_NWORDS - 1)
+*               mask of the schedule positions that slipped
+*             in the byte order of the module data (see v7xxOrderMark).
+*             flags is V7XX_CHECK_TRIGGER if the trigger count skipped.
+*
+*   Like v7xxTimeEnd, it must be called from the thread that runs
+*   v7xxSchedReadout.
+*
+*
+* RETURNS: Number of words written to tag (0 if all the counters agree).
+*/
+
+int
+v7xxCheckEvent(UINT32 trigger, volatile UINT32 *data, v7xxSchedResult *res,
+	       volatile UINT32 *tag)
+{
+  v7xxCheckStats *st;
+  UINT32 word, off, slip = 0, hwslip = 0, xslip = 0, delta = 0, mark = 0;
+  int ii, nsched = v7xxSchedCount(), swap = 0, same = 1, nleft;
+  int readCount = 0;
+
+  if(!v7xxCheckFlags || (data == NULL) || (res == NULL)) return(0);
+
+  if(v7xxCheckPeriod && (--v7xxCheckCountdown <= 0)) {
+    v7xxCheckCountdown = v7xxCheckPeriod;
+    readCount = 1;
+  }
+
+#ifndef VXWORKS
+  swap = (c792GetByteOrder() != C792_ORDER_CPU);
+#endif
+
+  for(ii=0;ii<nsched;ii++) {
+    if(res[ii].nwords <= 0) continue;   /* timed out or failed */
+    st = &v7xxCheckMod[ii];
+
+    if(!v7xxCheckTrailer(data, res, ii, swap, &word)) {
+      st->nnotrailer++;
+      continue;
+    }
+
+    st->nevents++;
+
+    /* Events left after the read: the module took an extra gate */
+    if(readCount) {
+      nleft = (res[ii].type==V7XX_QDC) ? c792Dready(res[ii].id)
+	: c775Dready(res[ii].id);
+      if(nleft > 0) {
+	st->nextra++;
+	xslip |= (1<<ii);
+	V7XX_CHECK_LOG("v7xxCheckEvent: ERROR: %s %d has %d events too many at trigger %d\n",
+		       (res[ii].type==V7XX_QDC)?"QDC":"TDC",res[ii].id,nleft,trigger,0,0);
+      }
+    }
+
+    off = ((word & C792_EVENTCOUNT_MASK) - trigger) & C792_EVENTCOUNT_MASK;
+    if(off == st->offset)
+      continue;
+
+    /* Slow path: first event, or a slip */
+    if(st->offset == V7XX_CHECK_LEARN) {
+      st->offset = off;
+      continue;
+    }
+    slip |= (1<<ii);
+    st->lastDelta = (off - st->offset) & C792_EVENTCOUNT_MASK;
+    if(hwslip == 0)
+      delta = st->lastDelta;
+    else if(st->lastDelta != delta)
+      same = 0;
+    hwslip |= (1<<ii);
+  }
+
+  slip |= xslip;
+  if(slip == 0) return(0);
+
+  /* All the modules read moved by the same amount: the trigger count
+     skipped, not the modules */
+  for(ii=0;ii<nsched;ii++)
+    if((res[ii].nwords > 0) && !(hwslip & (1<<ii)))
+      same = 0;
+  if(same && (hwslip & (hwslip - 1))) {
+    v7xxCheckTrigSkip++;
+    for(ii=0;ii<nsched;ii++)
+      if(v7xxCheckMod[ii].offset != V7XX_CHECK_LEARN)
+	v7xxCheckMod[ii].offset = (v7xxCheckMod[ii].offset + delta) & C792_EVENTCOUNT_MASK;
+    V7XX_CHECK_LOG("v7xxCheckEvent: WARNING: Trigger count skipped by %d at trigger %d\n",
+		   (int)((-delta) & C792_EVENTCOUNT_MASK),trigger,0,0,0,0);
+    mark = V7XX_CHECK_TRIGGER;
+  } else {
+    for(ii=0;ii<nsched;ii++) {
+      if(!(slip & (1<<ii))) continue;
+      st = &v7xxCheckMod[ii];
+      if(hwslip & (1<<ii)) {
+	st->nskew++;
+	V7XX_CHECK_LOG("v7xxCheckEvent: ERROR: %s %d slipped by %d events at trigger %d\n",
+		       (res[ii].type==V7XX_QDC)?"QDC":"TDC",res[ii].id,
+		       (int)(st->lastDelta<<8)>>8,trigger,0,0);
+      }
+      if(v7xxCheckFlags & V7XX_CHECK_RESYNC) {
+	if(res[ii].type==V7XX_QDC)
+	  c792Clear(res[ii].id);
+	else
+	  c775Clear(res[ii].id);
+	st->nresync++;
+	st->offset = V7XX_CHECK_LEARN;
+      } else
+	st->offset = (st->offset + st->lastDelta) & C792_EVENTCOUNT_MASK;
+      st->lastDelta = 0;
+    }
+  }
+
+  if(tag == NULL) return(0);
+
+  word = V7XX_CHECK_MARK | mark | (V7XX_CHECK_NWORDS - 1);
+  tag[0] = swap ? LSWAP(word) : word;
+  tag[1] = swap ? LSWAP(slip) : slip;
+
+  return(V7XX_CHECK_NWORDS);
+}
@@ -0,0 +1,426 @@
+/******************************************************************************
+*
+*  v7xxDecode.c  -  Decode blocks of C.A.E.N. Model 792 QDC / 775 TDC
+*                   data words into separate arrays (channel, value, flags
+*                   per data word; GEO, crate, word count and event counter
+*                   per event).
+*
+*                   On x86 the data words are decoded 8 (AVX2) or 4 (SSE2)
+*                   at a time, the AVX2 path being chosen at run time.
+*                   Headers, trailers and anything unexpected go through
+*                   the scalar decoder, which is also used on other CPUs.
+*
+*/
+
+#ifdef VXWORKS
+#include "vxWorks.h"
+#include "logLib.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "jvme.h"
+
+/* Include QDC/TDC definitions */
+#include "v7xxLib.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(VXWORKS)
+#define V7XX_DECODE_X86
+#include <immintrin.h>
+#endif
+
+/* Word type bits, same for both modules */
+#define V7XX_TYPE_MASK   C792_DATA_ID_MASK
+
+/*******************************************************************************
+*
+* v7xxDecodeCreate  - Allocate the output arrays of v7xxDecode
+*
+*   maxhits   - maximum number of data words
+*   maxevents - maximum number of events
+*
+* v7xxDecodeDestroy - Free them
+*
+*
+* RETURNS: v7xxDecodeCreate: Pointer to the output, or NULL.
+*/
+
+v7xxDecoded *
+v7xxDecodeCreate(int maxhits, int maxevents)
+{
+  v7xxDecoded *d;
+
+  if((maxhits<=0) || (maxevents<=0)) {
+    printf("v7xxDecodeCreate: ERROR: Invalid size (maxhits=%d, maxevents=%d)\n",
+	   maxhits,maxevents);
+    return(NULL);
+  }
+
+  d = (v7xxDecoded *)calloc(1, sizeof(v7xxDecoded));
+  if(d==NULL) {
+    printf("v7xxDecodeCreate: ERROR: Cannot allocate\n");
+    return(NULL);
+  }
+
+  d->maxhits   = maxhits;
+  d->maxevents = maxevents;
+  d->cur       = -1;
+
+  /* Room for one extra vector store past the end */
+  d->chan   = (unsigned short *)calloc(maxhits+8, sizeof(unsigned short));
+  d->value  = (unsigned short *)calloc(maxhits+8, sizeof(unsigned short));
+  d->flags  = (unsigned short *)calloc(maxhits+8, sizeof(unsigned short));
+  d->geo    = (unsigned char *)calloc(maxevents, sizeof(unsigned char));
+  d->crate  = (unsigned char *)calloc(maxevents, sizeof(unsigned char));
+  d->nwords = (unsigned char *)calloc(maxevents, sizeof(unsigned char));
+  d->evcnt  = (unsigned int *)calloc(maxevents, sizeof(unsigned int));
+  d->first  = (int *)calloc(maxevents, sizeof(int));
+  d->nhit   = (int *)calloc(maxevents, sizeof(int));
+
+  if(!d->chan || !d->value || !d->flags || !d->geo || !d->crate ||
+     !d->nwords || !d->evcnt || !d->first || !d->nhit) {
+    printf("v7xxDecodeCreate: ERROR: Cannot allocate %d hits, %d events\n",
+	   maxhits,maxevents);
+    v7xxDecodeDestroy(d);
+    return(NULL);
+  }
+
+  return(d);
+}
+
+void
+v7xxDecodeDestroy(v7xxDecoded *d)
+{
+  if(d==NULL) return;
+
+  free(d->chan);
+  free(d->value);
+  free(d->flags);
+  free(d->geo);
+  free(d->crate);
+  free(d->nwords);
+  free(d->evcnt);
+  free(d->first);
+  free(d->nhit);
+  free(d);
+}
+
+/* Decode one word (already in CPU byte order) */
+static inline int
+v7xxDecodeWord(UINT32 w, v7xxDecoded *d)
+{
+  int ev;
+
+  switch(w & V7XX_TYPE_MASK) {
+  case C792_DATA:
+    if(d->cur<0) {          /* Data outside of an event */
+      d->nerr++;
+      break;
+    }
+    if(d->nhits>=d->maxhits)
+      return(ERROR);
+    d->chan[d->nhits]  = (w & C792_CHANNEL_MASK)>>16;
+    d->value[d->nhits] = w & C792_ADC_DATA_MASK;
+    d->flags[d->nhits] = (w>>12) & 0x7;
+    d->nhits++;
+    d->nhit[d->cur]++;
+    break;
+
+  case C792_HEADER_DATA:
+    if(d->cur>=0)           /* Previous event has no trailer */
+      d->nerr++;
+    if(d->nevents>=d->maxevents)
+      return(ERROR);
+    ev = d->nevents++;
+    d->geo[ev]    = (w & C792_GEO_ADDR_MASK)>>27;
+    d->crate[ev]  = (w & C792_CRATE_MASK)>>16;
+    d->nwords[ev] = (w & C792_WORDCOUNT_MASK)>>8;
+    d->evcnt[ev]  = V7XX_NO_TRAILER;
+    d->first[ev]  = d->nhits;
+    d->nhit[ev]   = 0;
+    d->cur = ev;
+    break;
+
+  case C792_TRAILER_DATA:
+    if(d->cur<0) {
+      d->nerr++;
+      break;
+    }
+    d->evcnt[d->cur] = w & C792_EVENTCOUNT_MASK;
+    d->cur = -1;
+    break;
+
+  case C792_INVALID_DATA:
+    break;
+
+  default:
+    d->nerr++;
+  }
+
+  return(OK);
+}
+
+LOCAL int
+v7xxDecodeScalar(const UINT32 *data, int nwords, int swap, v7xxDecoded *d)
+{
+  int ii;
+
+  for(ii=0;ii<nwords;ii++) {
+    if(v7xxDecodeWord(swap ? LSWAP(data[ii]) : data[ii], d)==ERROR)
+      return(ERROR);
+  }
+
+  return(OK);
+}
+
+#ifdef V7XX_DECODE_X86
+/* 4 data words at a time.  SSE2 is always there on x86_64. */
+#ifdef __i386__
+__attribute__((target("sse2")))
+#endif
+LOCAL int
+v7xxDecodeSSE2(const UINT32 *data, int nwords, int swap, v7xxDecoded *d)
+{
+  const __m128i tmask = _mm_set1_epi32(V7XX_TYPE_MASK);
+  const __m128i cmask = _mm_set1_epi32(0x3f);
+  const __m128i vmask = _mm_set1_epi32(C792_ADC_DATA_MASK);
+  const __m128i fmask = _mm_set1_epi32(0x7);
+  const __m128i bmask = _mm_set1_epi32(0x00ff00ff);
+  __m128i w, t, ch, val, fl, p;
+  int ii=0;
+
+  while(ii<nwords) {
+    if((d->cur>=0) && (ii+4<=nwords) && (d->nhits+4<=d->maxhits)) {
+      w = _mm_loadu_si128((const __m128i *)&data[ii]);
+      if(swap) {
+	/* Byte swap: exchange the 16 bit halves, then the bytes in each */
+	w = _mm_or_si128(_mm_slli_epi32(w,16), _mm_srli_epi32(w,16));
+	w = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(w,bmask),8),
+			 _mm_and_si128(_mm_srli_epi16(w,8),bmask));
+      }
+      t = _mm_cmpeq_epi32(_mm_and_si128(w,tmask), _mm_setzero_si128());
+      if(_mm_movemask_epi8(t)==0xffff) {
+	ch  = _mm_and_si128(_mm_srli_epi32(w,16), cmask);
+	val = _mm_and_si128(w, vmask);
+	fl  = _mm_and_si128(_mm_srli_epi32(w,12), fmask);
+
+	p = _mm_packs_epi32(ch, val);
+	_mm_storel_epi64((__m128i *)&d->chan[d->nhits], p);
+	_mm_storel_epi64((__m128i *)&d->value[d->nhits], _mm_srli_si128(p,8));
+	_mm_storel_epi64((__m128i *)&d->flags[d->nhits], _mm_packs_epi32(fl,fl));
+
+	d->nhits += 4;
+	d->nhit[d->cur] += 4;
+	ii += 4;
+	continue;
+      }
+    }
+
+    if(v7xxDecodeWord(swap ? LSWAP(data[ii]) : data[ii], d)==ERROR)
+      return(ERROR);
+    ii++;
+  }
+
+  return(OK);
+}
+
+/* 8 data words at a time */
+__attribute__((target("avx2")))
+LOCAL int
+v7xxDecodeAVX2(const UINT32 *data, int nwords, int swap, v7xxDecoded *d)
+{
+  const __m256i tmask = _mm256_set1_epi32(V7XX_TYPE_MASK);
+  const __m256i cmask = _mm256_set1_epi32(0x3f);
+  const __m256i vmask = _mm256_set1_epi32(C792_ADC_DATA_MASK);
+  const __m256i fmask = _mm256_set1_epi32(0x7);
+  const __m256i bswap = _mm256_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3,
+					12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+  __m256i w, ch, val, fl, p;
+  int ii=0;
+
+  while(ii<nwords) {
+    if((d->cur>=0) && (ii+8<=nwords) && (d->nhits+8<=d->maxhits)) {
+      w = _mm256_loadu_si256((const __m256i *)&data[ii]);
+      if(swap)
+	w = _mm256_shuffle_epi8(w, bswap);
+      if(_mm256_testz_si256(w, tmask)) {
+	ch  = _mm256_and_si256(_mm256_srli_epi32(w,16), cmask);
+	val = _mm256_and_si256(w, vmask);
+	fl  = _mm256_and_si256(_mm256_srli_epi32(w,12), fmask);
+
+	/* Pack works within 128 bit lanes: put the lanes back in order */
+	p = _mm256_permute4x64_epi64(_mm256_packus_epi32(ch, val), 0xd8);
+	_mm_storeu_si128((__m128i *)&d->chan[d->nhits], _mm256_castsi256_si128(p));
+	_mm_storeu_si128((__m128i *)&d->value[d->nhits], _mm256_extracti128_si256(p,1));
+	p = _mm256_permute4x64_epi64(_mm256_packus_epi32(fl, fl), 0x08);
+	_mm_storeu_si128((__m128i *)&d->flags[d->nhits], _mm256_castsi256_si128(p));
+
+	d->nhits += 8;
+	d->nhit[d->cur] += 8;
+	ii += 8;
+	continue;
+      }
+    }
+
+    if(v7xxDecodeWord(swap ? LSWAP(data[ii]) : data[ii], d)==ERROR)
+      return(ERROR);
+    ii++;
+  }
+
+  return(OK);
+}
+#endif /* V7XX_DECODE_X86 */
+
+/*******************************************************************************
+*
+* v7xxDecode - Decode a block of V792/V775 words
+*
+*   The block may hold any number of events, back to back, as filled by
+*   c792ReadEvent, c792ReadEvents, c792ReadBlock, c792CBLTReadBlock, or
+*   their c775 equivalents.  Invalid (filler) words are skipped.
+*
+*   data   - words to decode
+*   nwords - number of words
+*   flags  - V7XX_DECODE_SWAP   : words are in VME byte order
+*                                 (use V7XX_DECODE_READOUT for buffers
+*                                 filled by the readout routines)
+*            V7XX_DECODE_APPEND : keep what is already in d.  An event
+*                                 may then continue from the last block.
+*            V7XX_DECODE_SCALAR : do not use vector instructions
+*            V7XX_DECODE_SSE2   : do not use more than SSE2
+*   d      - output, from v7xxDecodeCreate
+*
+*
+* RETURNS: Number of events in d, or ERROR if d is full.
+*/
+
+int
+v7xxDecode(const UINT32 *data, int nwords, int flags, v7xxDecoded *d)
+{
+  int swap, rval;
+
+  if((data==NULL) || (d==NULL) || (nwords<0)) {
+    logMsg("v7xxDecode: ERROR: Invalid arguments\n",0,0,0,0,0,0);
+    return(ERROR);
+  }
+
+  if(!(flags & V7XX_DECODE_APPEND)) {
+    d->nhits = d->nevents = d->nerr = 0;
+    d->cur = -1;
+  }
+
+  swap = (flags & V7XX_DECODE_SWAP) ? 1 : 0;
+
+#ifdef V7XX_DECODE_X86
+  if(flags & V7XX_DECODE_SCALAR)
+    rval = v7xxDecodeScalar(data, nwords, swap, d);
+  else if(!(flags & V7XX_DECODE_SSE2) && __builtin_cpu_supports("avx2"))
+    rval = v7xxDecodeAVX2(data, nwords, swap, d);
+#ifdef __i386__
+  else if(!__builtin_cpu_supports("sse2"))
+    rval = v7xxDecodeScalar(data, nwords, swap, d);
+#endif
+  else
+    rval = v7xxDecodeSSE2(data, nwords, swap, d);
+#else
+  rval = v7xxDecodeScalar(data, nwords, swap, d);
+#endif
+
+  if(rval==ERROR) {
+    logMsg("v7xxDecode: ERROR: Output full (%d hits, %d events)\n",
+	   d->nhits,d->nevents,0,0,0,0);
+    return(ERROR);
+  }
+
+  return(d->nevents);
+}
+
+/*******************************************************************************
+*
+* v7xxDecodeBench - Compare the speed of the scalar and vector decoders
+*
+*   Decodes a block of nevents fake events (header, 32 data words,
+*   trailer, in VME byte order) nloop times with each decoder, checks
+*   that they agree, and prints the rate.
+*
+*
+* RETURNS: OK, or ERROR if the decoders disagree.
+*/
+
+STATUS
+v7xxDecodeBench(int nevents, int nloop)
+{
+  UINT32 *data;
+  v7xxDecoded *ref, *d;
+  int nwords, iev, ich, ii, iloop, ipath, npath=1, bad, rval=OK;
+  unsigned long long t0, t1;
+  int pathFlags[3] = {V7XX_DECODE_SCALAR, V7XX_DECODE_SSE2, 0};
+  char *pathName[3] = {"scalar", "SSE2", "AVX2"};
+
+  if(nevents<=0) nevents = 1000;
+  if(nloop<=0)   nloop = 100;
+
+#ifdef V7XX_DECODE_X86
+  npath = __builtin_cpu_supports("avx2") ? 3 : 2;
+#endif
+
+  data = (UINT32 *)malloc(nevents*(C792_MAX_WORDS_PER_EVENT)*sizeof(UINT32));
+  ref  = v7xxDecodeCreate(nevents*C792_MAX_CHANNELS, nevents);
+  d    = v7xxDecodeCreate(nevents*C792_MAX_CHANNELS, nevents);
+  if(!data || !ref || !d) {
+    printf("v7xxDecodeBench: ERROR: Cannot allocate %d events\n",nevents);
+    free(data);
+    v7xxDecodeDestroy(ref);
+    v7xxDecodeDestroy(d);
+    return(ERROR);
+  }
+
+  nwords = 0;
+  srand(1);
+  for(iev=0;iev<nevents;iev++) {
+    data[nwords++] = LSWAP(C792_HEADER_DATA | ((iev%21+1)<<27) | (1<<16)
+			   | (C792_MAX_CHANNELS<<8));
+    for(ich=0;ich<C792_MAX_CHANNELS;ich++)
+      data[nwords++] = LSWAP(C792_DATA | ((iev%21+1)<<27) | (ich<<16)
+			     | (rand() & 0x7fff));
+    data[nwords++] = LSWAP(C792_TRAILER_DATA | ((iev%21+1)<<27) | iev);
+  }
+
+  printf("\n");
+  printf("  v7xxDecodeBench: %d events, %d words, %d loops\n\n",
+	 nevents,nwords,nloop);
+
+  for(ipath=0;ipath<npath;ipath++) {
+    t0 = v7xxTimeUs();
+    for(iloop=0;iloop<nloop;iloop++)
+      v7xxDecode(data, nwords, V7XX_DECODE_SWAP|pathFlags[ipath], d);
+    t1 = v7xxTimeUs();
+
+    if(ipath==0) {
+      v7xxDecode(data, nwords, V7XX_DECODE_SWAP|V7XX_DECODE_SCALAR, ref);
+      bad = 0;
+    } else {
+      bad = (d->nhits!=ref->nhits) || (d->nevents!=ref->nevents) ||
+	(d->nerr!=ref->nerr);
+      for(ii=0;(ii<ref->nhits)&&!bad;ii++)
+	bad = (d->chan[ii]!=ref->chan[ii]) || (d->value[ii]!=ref->value[ii]) ||
+	  (d->flags[ii]!=ref->flags[ii]);
+      for(ii=0;(ii<ref->nevents)&&!bad;ii++)
+	bad = (d->geo[ii]!=ref->geo[ii]) || (d->crate[ii]!=ref->crate[ii]) ||
+	  (d->nwords[ii]!=ref->nwords[ii]) || (d->evcnt[ii]!=ref->evcnt[ii]) ||
+	  (d->first[ii]!=ref->first[ii]) || (d->nhit[ii]!=ref->nhit[ii]);
+    }
+    if(bad) rval = ERROR;
+
+    printf("  %-8s %10.1f Mwords/s  %s\n",pathName[ipath],
+	   (t1>t0) ? ((double)nwords*nloop)/(t1-t0) : 0.,
+	   bad ? "MISMATCH" : "OK");
+  }
+  printf("\n");
+
+  free(data);
+  v7xxDecodeDestroy(ref);
+  v7xxDecodeDestroy(d);
+
+  return(rval);
+}
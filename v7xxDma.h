@@ -0,0 +1,54 @@
+/******************************************************************************
+*
+*  v7xxDma.h  -  The VME DMA engine, shared by the c792 and c775 libraries.
+*                Include after jvme.h.
+*
+*                There is a single DMA engine, and a split block read
+*                (c792ReadBlockStart/c775ReadBlockStart) leaves its
+*                transfer in flight after it returns.  A library takes the
+*                engine with a compare-and-swap before it starts a
+*                transfer, and gives it back once the transfer is done.
+*                A start that finds the engine taken, by either library,
+*                fails instead of disturbing the transfer in flight.
+*
+*                The owner word is a weak definition in both libraries,
+*                so a program linked with both has a single copy of it.
+*
+*/
+#ifndef __V7XXDMA__
+#define __V7XXDMA__
+
+#define V7XX_DMA_QDC  1   /* library: c792 */
+#define V7XX_DMA_TDC  2   /* c775 */
+
+/* Owner of the engine: library << 8 | module id (C792_STATS_CBLT or
+   C775_STATS_CBLT for a CBLT chain), 0 when free */
+int v7xxDmaOwner __attribute__((weak));
+
+/* Take the engine for module id of library lib.  RETURNS: OK, or ERROR
+   with the owner in *owner (if not NULL) */
+static inline STATUS
+v7xxDmaTake(int lib, int id, int *owner)
+{
+  int expect = 0;
+
+  if(__atomic_compare_exchange_n(&v7xxDmaOwner, &expect, (lib << 8) | id, 0,
+				 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return OK;
+
+  if(owner)
+    *owner = expect;
+  return ERROR;
+}
+
+static inline void
+v7xxDmaGive()
+{
+  __atomic_store_n(&v7xxDmaOwner, 0, __ATOMIC_RELEASE);
+}
+
+/* Names for the messages */
+#define V7XX_DMA_LIB(owner)  ((((owner) >> 8) == V7XX_DMA_QDC) ? "QDC" : "TDC")
+#define V7XX_DMA_ID(owner)   ((owner) & 0xff)
+
+#endif /* __V7XXDMA__ */
@@ -0,0 +1,117 @@
+/******************************************************************************
+*
+*  v7xxInt.h  -  VME interrupt levels and vectors shared by the c792 and
+*                c775 libraries.  Include after jvme.h.
+*
+*                On Linux, jvme connects a single routine to each VME
+*                level.  The first library enabling an interrupt on a
+*                level connects v7xxIntDispatch to it, which calls the
+*                level handler of each library registered there: QDCs
+*                and TDCs may share a level, and enabling the TDC
+*                interrupts no longer takes the level away from c792Int.
+*
+*                A vector belongs to the library which enabled it first;
+*                the other library gets an error for it.
+*
+*                The table is a weak definition in both libraries, so a
+*                program linked with both has a single copy of it.
+*
+*/
+#ifndef __V7XXINT__
+#define __V7XXINT__
+
+#define V7XX_INT_QDC   0   /* library index: c792 */
+#define V7XX_INT_TDC   1   /* c775 */
+#define V7XX_INT_NLIB  2
+
+typedef struct
+{
+  VOIDFUNCPTR    handler[V7XX_INT_NLIB][8];  /* level handler, NULL: none */
+  int            connected[8];               /* v7xxIntDispatch on the level */
+  unsigned char  vecOwner[256];              /* library index + 1, 0: free */
+} v7xxIntShare;
+
+v7xxIntShare v7xxIntTab __attribute__((weak));
+
+static const char *v7xxIntLibName[V7XX_INT_NLIB] = { "c792", "c775" };
+
+/* Level handlers of both libraries */
+static void
+v7xxIntDispatch(int level)
+{
+  VOIDFUNCPTR handler;
+  int lib;
+
+  for(lib=0; lib<V7XX_INT_NLIB; lib++)
+    {
+      handler = __atomic_load_n(&v7xxIntTab.handler[lib][level], __ATOMIC_ACQUIRE);
+      if(handler)
+	(*handler)(level);
+    }
+}
+
+/* Take vector vec for library lib.  ERROR if the other library has it */
+static inline STATUS
+v7xxIntClaimVec(int lib, UINT32 vec)
+{
+  int owner = v7xxIntTab.vecOwner[vec & 0xff];
+
+  if(owner && (owner != lib + 1))
+    {
+      printf("%sIntEnable: ERROR : Interrupt vector 0x%x is used by the %s library\n",
+	     v7xxIntLibName[lib], vec, v7xxIntLibName[owner - 1]);
+      return ERROR;
+    }
+  v7xxIntTab.vecOwner[vec & 0xff] = lib + 1;
+  return OK;
+}
+
+static inline void
+v7xxIntReleaseVec(int lib, UINT32 vec)
+{
+  if(v7xxIntTab.vecOwner[vec & 0xff] == lib + 1)
+    v7xxIntTab.vecOwner[vec & 0xff] = 0;
+}
+
+/* Register the level handler of library lib, and connect v7xxIntDispatch
+   to the level if no library did yet (Linux).  On VxWorks the libraries
+   connect their vectors themselves */
+static inline STATUS
+v7xxIntAttachLevel(int lib, UINT32 level, UINT32 vec, VOIDFUNCPTR handler)
+{
+#ifndef VXWORKS
+  if(!v7xxIntTab.connected[level])
+    {
+      if(vmeIntDisconnect(level) != 0)
+	{
+	  printf("%sIntConnect: ERROR disconnecting Interrupt\n", v7xxIntLibName[lib]);
+	  return ERROR;
+	}
+      if(vmeIntConnect(vec, level, (VOIDFUNCPTR)v7xxIntDispatch, level) != 0)
+	{
+	  printf("%sIntConnect: ERROR in intConnect()\n", v7xxIntLibName[lib]);
+	  return ERROR;
+	}
+      v7xxIntTab.connected[level] = 1;
+    }
+#endif
+  __atomic_store_n(&v7xxIntTab.handler[lib][level], handler, __ATOMIC_RELEASE);
+  return OK;
+}
+
+/* Last module of library lib left the level */
+static inline void
+v7xxIntDetachLevel(int lib, UINT32 level)
+{
+  __atomic_store_n(&v7xxIntTab.handler[lib][level], NULL, __ATOMIC_RELEASE);
+}
+
+/* Does the other library also have modules on the level?  The handlers
+   must then check EVRDY even for a single module */
+static inline int
+v7xxIntShared(int lib, UINT32 level)
+{
+  return __atomic_load_n(&v7xxIntTab.handler[1 - lib][level], __ATOMIC_RELAXED) != NULL;
+}
+
+#endif /* __V7XXINT__ */
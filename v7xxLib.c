@@ -0,0 +1,740 @@
+/******************************************************************************
+*
+*  v7xxLib.c  -  Readout helpers shared by crates mixing C.A.E.N. Model 792
+*                QDCs and Model 775 TDCs.
+*
+*                Readout scheduler: poll the Data Ready bit of all the
+*                registered QDCs and TDCs together, read each module as
+*                soon as it has data, and give up on the ones that are
+*                not ready by a time based deadline.
+*
+*                Readout pipeline (Linux only): a reader thread pushes
+*                the raw data of each event into a v7xxRing, and the
+*                thread that owns the output buffer formats it.
+*
+*/
+
+#ifdef VXWORKS
+#include "vxWorks.h"
+#include "logLib.h"
+#include "tickLib.h"
+#include "sysLib.h"
+#else
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "jvme.h"
+
+/* Include QDC/TDC definitions */
+#include "v7xxLib.h"
+#include "v7xxLog.h"
+
+/* Readout schedule */
+typedef struct
+{
+  int type;
+  int id;
+  int mode;
+  int maxwords;
+} v7xxSchedEntry;
+
+LOCAL v7xxSchedEntry v7xxSched[V7XX_SCHED_MAX];
+LOCAL int v7xxNsched = 0;
+
+/* How the scheduler waits between two passes with nothing ready */
+LOCAL int v7xxWaitMode   = C792_WAIT_SPIN;
+LOCAL int v7xxWaitSpinUs = C792_WAIT_SPIN_US;
+
+/* Messages from the trigger path, printed by a thread started in
+   v7xxSchedInit (see v7xxLog.h) */
+LOCAL v7xxLog v7xxLibLog = V7XX_LOG_INIT("v7xxLib");
+#define V7XX_LIB_LOG(...)  V7XX_LOG(&v7xxLibLog, __VA_ARGS__)
+
+/* Time since an arbitrary origin, in microseconds */
+unsigned long long
+v7xxTimeUs()
+{
+#ifdef VXWORKS
+  return(((unsigned long long)tickGet()*1000000ULL)/sysClkRateGet());
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((unsigned long long)ts.tv_sec*1000000ULL + ts.tv_nsec/1000);
+#endif
+}
+
+/*******************************************************************************
+*
+* v7xxSchedInit  - Empty the readout schedule
+* v7xxSchedAdd   - Add a module to the readout schedule
+*
+*   type     - V7XX_QDC or V7XX_TDC
+*   id       - module id, as given by c792Init/c775Init
+*   mode     - V7XX_READ_EVENT : one event with programmed I/O
+*              V7XX_READ_BLOCK : block read (BERR must be enabled)
+*   maxwords - maximum number of words to read from the module
+*              (V7XX_READ_BLOCK only)
+*
+* v7xxSchedCount - Number of modules in the readout schedule
+* v7xxSchedGet   - Type and id of the module at schedule position pos
+*
+*
+* RETURNS: v7xxSchedAdd: Position in the schedule (index of its
+*                        v7xxSchedResult), or ERROR.
+*          v7xxSchedGet: OK, or ERROR if pos is not in the schedule.
+*/
+
+void
+v7xxSchedInit()
+{
+  memset(v7xxSched, 0, sizeof(v7xxSched));
+  v7xxNsched = 0;
+  v7xxLogStart(&v7xxLibLog);
+}
+
+int
+v7xxSchedAdd(int type, int id, int mode, int maxwords)
+{
+  int ii, nmax;
+
+  if((type!=V7XX_QDC) && (type!=V7XX_TDC)) {
+    printf("v7xxSchedAdd: ERROR: Invalid module type (%d)\n",type);
+    return(ERROR);
+  }
+
+  nmax = (type==V7XX_QDC) ? C792_MAX_MODULES : C775_MAX_MODULES;
+  if((id<0) || (id>=nmax)) {
+    printf("v7xxSchedAdd: ERROR: Invalid %s id (%d)\n",
+	   (type==V7XX_QDC)?"QDC":"TDC",id);
+    return(ERROR);
+  }
+
+  if((mode!=V7XX_READ_EVENT) && (mode!=V7XX_READ_BLOCK)) {
+    printf("v7xxSchedAdd: ERROR: Invalid read mode (%d)\n",mode);
+    return(ERROR);
+  }
+
+  if((mode==V7XX_READ_BLOCK) && (maxwords<=0)) {
+    printf("v7xxSchedAdd: ERROR: Invalid maxwords (%d)\n",maxwords);
+    return(ERROR);
+  }
+
+  if(v7xxNsched>=V7XX_SCHED_MAX) {
+    printf("v7xxSchedAdd: ERROR: Schedule full (%d modules)\n",V7XX_SCHED_MAX);
+    return(ERROR);
+  }
+
+  for(ii=0;ii<v7xxNsched;ii++) {
+    if((v7xxSched[ii].type==type) && (v7xxSched[ii].id==id)) {
+      printf("v7xxSchedAdd: ERROR: %s %d already scheduled\n",
+	     (type==V7XX_QDC)?"QDC":"TDC",id);
+      return(ERROR);
+    }
+  }
+
+  v7xxSched[v7xxNsched].type     = type;
+  v7xxSched[v7xxNsched].id       = id;
+  v7xxSched[v7xxNsched].mode     = mode;
+  v7xxSched[v7xxNsched].maxwords = maxwords;
+
+  return(v7xxNsched++);
+}
+
+int
+v7xxSchedCount()
+{
+  return(v7xxNsched);
+}
+
+STATUS
+v7xxSchedGet(int pos, int *type, int *id)
+{
+  if((pos<0) || (pos>=v7xxNsched) || (type==NULL) || (id==NULL))
+    return(ERROR);
+
+  *type = v7xxSched[pos].type;
+  *id   = v7xxSched[pos].id;
+
+  return(OK);
+}
+
+/*******************************************************************************
+*
+* v7xxSetByteOrder - Select the byte order of the data buffers of both
+*                    the QDCs and the TDCs (see c792SetByteOrder)
+*                    C792_ORDER_VME : no swap in the trigger path
+*                    C792_ORDER_CPU : blocks swapped after each read
+* v7xxOrderMark    - Return the byte order mark to store in the bank
+*                    ahead of the module data
+* v7xxOrderFlags   - Consumer: return the v7xxDecode flags for the module
+*                    data that follows a byte order mark
+*
+*
+* RETURNS: v7xxSetByteOrder: OK or ERROR.
+*          v7xxOrderFlags: 0, V7XX_DECODE_SWAP, or ERROR if mark is not
+*                          a byte order mark.
+*/
+
+STATUS
+v7xxSetByteOrder(int order)
+{
+  if((c792SetByteOrder(order)==ERROR) || (c775SetByteOrder(order)==ERROR))
+    return(ERROR);
+
+  return(OK);
+}
+
+UINT32
+v7xxOrderMark()
+{
+  if(c792GetByteOrder()!=c775GetByteOrder())
+    V7XX_LIB_LOG("v7xxOrderMark: WARN: QDC and TDC byte orders differ (%d, %d)\n",
+	   c792GetByteOrder(),c775GetByteOrder(),0,0,0,0);
+
+#ifdef VXWORKS
+  return(V7XX_ORDER_MARK);
+#else
+  if(c792GetByteOrder()==C792_ORDER_CPU)
+    return(V7XX_ORDER_MARK);
+  return(LSWAP(V7XX_ORDER_MARK));
+#endif
+}
+
+int
+v7xxOrderFlags(UINT32 mark)
+{
+  if(mark==V7XX_ORDER_MARK)
+    return(0);
+  if(mark==LSWAP(V7XX_ORDER_MARK))
+    return(V7XX_DECODE_SWAP);
+
+  return(ERROR);
+}
+
+/*******************************************************************************
+*
+* v7xxSetWaitMode - Select how v7xxGDReady and v7xxSchedReadout wait when
+*                   no module has data (per run).  Also sets the mode of
+*                   c792WaitReady and c775WaitReady.
+*                   C792_WAIT_SPIN     : poll until the deadline
+*                   C792_WAIT_ADAPTIVE : poll for spinUs, then sleep
+*                                        between passes
+*                   C792_WAIT_INT      : poll for spinUs, then sleep until
+*                                        a QDC or TDC interrupt (Linux;
+*                                        same as C792_WAIT_ADAPTIVE on
+*                                        VxWorks)
+*
+*
+* RETURNS: OK or ERROR.
+*/
+
+STATUS
+v7xxSetWaitMode(int mode, int spinUs)
+{
+  if((c792SetWaitMode(mode,spinUs)==ERROR) || (c775SetWaitMode(mode,spinUs)==ERROR))
+    return(ERROR);
+
+  v7xxWaitSpinUs = (spinUs < 0) ? C792_WAIT_SPIN_US : spinUs;
+  v7xxWaitMode   = mode;
+
+  return(OK);
+}
+
+/* Called after a pass with nothing ready: sleep if the wait started
+   more than v7xxWaitSpinUs ago, but not past the deadline */
+LOCAL void
+v7xxWaitPause(unsigned long long t0, unsigned long long now,
+	      unsigned long long deadline, unsigned long long *sleepUs)
+{
+#ifndef VXWORKS
+  unsigned long long us, cnt;
+  struct timeval tv;
+  fd_set fds;
+  int qfd, tfd;
+#endif
+
+  if((v7xxWaitMode==C792_WAIT_SPIN) || (now - t0 < (unsigned long long)v7xxWaitSpinUs)
+     || (now >= deadline))
+    return;
+
+#ifdef VXWORKS
+  taskDelay(0);   /* a tick is too long, just yield */
+#else
+  if(v7xxWaitMode==C792_WAIT_INT) {
+    us = deadline - now;
+    qfd = c792WaitFd();
+    tfd = c775WaitFd();
+    FD_ZERO(&fds);
+    FD_SET(qfd, &fds);
+    FD_SET(tfd, &fds);
+    tv.tv_sec  = us/1000000;
+    tv.tv_usec = us%1000000;
+    if(select((qfd > tfd ? qfd : tfd) + 1, &fds, NULL, NULL, &tv) > 0) {
+      if(FD_ISSET(qfd, &fds) && (read(qfd, &cnt, sizeof(cnt)) < 0)) cnt = 0;
+      if(FD_ISSET(tfd, &fds) && (read(tfd, &cnt, sizeof(cnt)) < 0)) cnt = 0;
+    }
+    return;
+  }
+
+  us = (*sleepUs < deadline - now) ? *sleepUs : deadline - now;
+  tv.tv_sec  = us/1000000;
+  tv.tv_usec = us%1000000;
+  select(0, NULL, NULL, NULL, &tv);
+#endif
+  if(*sleepUs < C792_WAIT_SLEEP_MAX)
+    *sleepUs *= 2;
+}
+
+/*******************************************************************************
+*
+* v7xxGDReady - Wait for the Data Ready bit of a set of QDCs and TDCs
+*
+*   qdcmask/tdcmask   - modules to wait for (bit n = id n)
+*   timeout           - deadline in microseconds (0: check once)
+*   qdcready/tdcready - if not NULL, filled with the modules that have data
+*
+*   This is c792GDReady/c775GDReady for both module types together,
+*   with a deadline in time rather than in loop iterations.  Between
+*   passes, it waits as selected by v7xxSetWaitMode.
+*
+* RETURNS: Number of modules still without data (0 when all are ready).
+*/
+
+int
+v7xxGDReady(UINT32 qdcmask, UINT32 tdcmask, int timeout,
+	    UINT32 *qdcready, UINT32 *tdcready)
+{
+  UINT32 qmask=0, tmask=0, qnew, tnew;
+  unsigned long long t0, now, deadline, sleepUs = C792_WAIT_SLEEP_MIN;
+  int nleft=0, ii;
+
+  t0 = v7xxTimeUs();
+  deadline = t0 + (timeout>0 ? timeout : 0);
+
+  while(1) {
+    qnew = (qdcmask & ~qmask) ? c792GDReady(qdcmask & ~qmask, 1) : 0;
+    tnew = (tdcmask & ~tmask) ? c775GDReady(tdcmask & ~tmask, 1) : 0;
+    qmask |= qnew;
+    tmask |= tnew;
+
+    if((qmask==qdcmask) && (tmask==tdcmask))
+      break;
+    now = v7xxTimeUs();
+    if(now >= deadline)
+      break;
+    if(!(qnew | tnew))
+      v7xxWaitPause(t0, now, deadline, &sleepUs);
+  }
+
+  if(qdcready) *qdcready = qmask;
+  if(tdcready) *tdcready = tmask;
+
+  for(ii=0;ii<32;ii++) {
+    if((qdcmask & ~qmask) & (1<<ii)) nleft++;
+    if((tdcmask & ~tmask) & (1<<ii)) nleft++;
+  }
+
+  return(nleft);
+}
+
+/*******************************************************************************
+*
+* v7xxSchedReadout - Read out all the modules in the schedule, in the
+*                    order their data becomes ready
+*
+*   The Data Ready bits of all the pending modules are polled together.
+*   Each module is read as soon as it has data, and its words appended
+*   to the buffer.  Modules still without data at the deadline are
+*   skipped and reported as timed out.  Passes that find nothing ready
+*   are spaced as selected by v7xxSetWaitMode.
+*
+*   data     - destination buffer
+*   maxwords - size of the destination buffer, in words
+*   timeout  - deadline in microseconds, counted from the call
+*   tmask    - if not NULL, filled with the schedule positions
+*              (bit n = v7xxSchedAdd return value n) that timed out
+*   res      - if not NULL, array of v7xxSchedCount() results, indexed
+*              by schedule position
+*
+*
+* RETURNS: Number of words read, or ERROR.
+*/
+
+int
+v7xxSchedReadout(volatile UINT32 *data, int maxwords, int timeout,
+		 UINT32 *tmask, v7xxSchedResult *res)
+{
+  UINT32 pending, qmask, tdmask, qready, tready, bit;
+  unsigned long long t0, now, deadline, tick = 0, tnext;
+  unsigned long long sleepUs = C792_WAIT_SLEEP_MIN;
+  int ii, rv, nwrds=0, nread=0, space, nw;
+  v7xxSchedEntry *ent;
+
+  if((data==NULL) || (maxwords<=0)) {
+    V7XX_LIB_LOG("v7xxSchedReadout: ERROR: Invalid buffer (maxwords=%d)\n",
+	   maxwords,0,0,0,0,0);
+    return(ERROR);
+  }
+
+  if(v7xxNsched==0) {
+    V7XX_LIB_LOG("v7xxSchedReadout: ERROR: No modules in the schedule\n",0,0,0,0,0,0);
+    return(ERROR);
+  }
+
+  if(res) {
+    for(ii=0;ii<v7xxNsched;ii++) {
+      res[ii].type     = v7xxSched[ii].type;
+      res[ii].id       = v7xxSched[ii].id;
+      res[ii].offset   = 0;
+      res[ii].nwords   = 0;
+      res[ii].order    = -1;
+      res[ii].waitTime = 0;
+    }
+  }
+
+  pending = (v7xxNsched==32) ? 0xffffffff : ((1<<v7xxNsched)-1);
+
+  t0 = v7xxTimeUs();
+  deadline = t0 + (timeout>0 ? timeout : 0);
+  if(v7xxTimeFlags)
+    tick = v7xxTsc();
+
+  while(pending) {
+    /* Build the QDC and TDC masks of the modules still waiting */
+    qmask = tdmask = 0;
+    for(ii=0;ii<v7xxNsched;ii++) {
+      if(!(pending & (1<<ii))) continue;
+      if(v7xxSched[ii].type==V7XX_QDC)
+	qmask  |= (1<<v7xxSched[ii].id);
+      else
+	tdmask |= (1<<v7xxSched[ii].id);
+    }
+
+    /* One pass over the Data Ready bits */
+    qready = qmask  ? c792GDReady(qmask, 1)  : 0;
+    tready = tdmask ? c775GDReady(tdmask, 1) : 0;
+    now = v7xxTimeUs();
+    if(v7xxTimeFlags) {
+      tnext = v7xxTsc();
+      v7xxTimeCur.phase[V7XX_PHASE_WAIT] += tnext - tick;
+      tick = tnext;
+    }
+
+    /* Read what is ready */
+    for(ii=0;ii<v7xxNsched;ii++) {
+      bit = (1<<ii);
+      if(!(pending & bit)) continue;
+
+      ent = &v7xxSched[ii];
+      if(ent->type==V7XX_QDC) {
+	if(!(qready & (1<<ent->id))) continue;
+      } else {
+	if(!(tready & (1<<ent->id))) continue;
+      }
+
+      pending &= ~bit;
+      space = maxwords - nwrds;
+
+      if(ent->mode==V7XX_READ_BLOCK) {
+	nw = (ent->maxwords < space) ? ent->maxwords : space;
+	if(ent->type==V7XX_QDC)
+	  rv = c792ReadBlock(ent->id, &data[nwrds], nw);
+	else
+	  rv = c775ReadBlock(ent->id, &data[nwrds], nw);
+      } else {
+	nw = (ent->type==V7XX_QDC) ? C792_MAX_WORDS_PER_EVENT
+	  : C775_MAX_WORDS_PER_EVENT;
+	if(space < nw)
+	  rv = ERROR;
+	else if(ent->type==V7XX_QDC)
+	  rv = c792ReadEvent(ent->id, (UINT32 *)&data[nwrds]);
+	else
+	  rv = c775ReadEvent(ent->id, (UINT32 *)&data[nwrds]);
+      }
+
+      if(v7xxTimeFlags) {
+	tnext = v7xxTsc();
+	v7xxTimeCur.mod[ii] = tnext - tick;
+	v7xxTimeCur.modmask |= bit;
+	v7xxTimeCur.phase[V7XX_PHASE_READ] += tnext - tick;
+	tick = tnext;
+      }
+
+      if(rv<=0) {
+	V7XX_LIB_LOG("v7xxSchedReadout: ERROR: Read failed (type %d, id %d, status %d, %d words free)\n",
+	       ent->type,ent->id,rv,space,0,0);
+	rv = ERROR;
+      }
+
+      if(res) {
+	res[ii].offset   = nwrds;
+	res[ii].nwords   = rv;
+	res[ii].order    = nread;
+	res[ii].waitTime = (int)(now - t0);
+      }
+      nread++;
+
+      if(rv>0)
+	nwrds += rv;
+    }
+
+    if(pending && (v7xxTimeUs() >= deadline))
+      break;
+    if(!(qready | tready))
+      v7xxWaitPause(t0, now, deadline, &sleepUs);
+  }
+
+  if(tmask) *tmask = pending;
+
+  return(nwrds);
+}
+
+/*******************************************************************************
+*
+* v7xxSchedPrint - Print the schedule, and the results of a readout if
+*                  res is not NULL
+*
+*
+* RETURNS: None.
+*/
+
+void
+v7xxSchedPrint(v7xxSchedResult *res)
+{
+  int ii;
+
+  printf("\n");
+  printf("                    V792/V775 Readout Schedule\n\n");
+  printf("  #   Type  id  Mode   Max  |  Order  Offset  Words  Wait [us]\n");
+  printf("--------------------------------------------------------------------\n");
+  for(ii=0;ii<v7xxNsched;ii++) {
+    printf(" %2d   %s  %2d  %s  %4d  |",ii,
+	   (v7xxSched[ii].type==V7XX_QDC)?"QDC":"TDC",v7xxSched[ii].id,
+	   (v7xxSched[ii].mode==V7XX_READ_BLOCK)?"block":"event",
+	   v7xxSched[ii].maxwords);
+    if(res==NULL)
+      printf("\n");
+    else if(res[ii].order<0)
+      printf("  timed out\n");
+    else
+      printf("  %5d  %6d  %5d  %9d\n",res[ii].order,res[ii].offset,
+	     res[ii].nwords,res[ii].waitTime);
+  }
+  printf("--------------------------------------------------------------------\n");
+  printf("\n");
+}
+
+#ifndef VXWORKS
+/* Number of the last event pushed by the reader thread (v7xxPipeRead) */
+LOCAL unsigned int v7xxPipeLast = 0;
+/* Trigger path (v7xxPipeFormat): last event number written for its own
+   trigger, and trigger - event number */
+LOCAL unsigned int v7xxPipeSeen = 0;
+LOCAL unsigned int v7xxPipeSkew = 0;
+
+/*******************************************************************************
+*
+* v7xxPipeReset  - Set the number of the first event the reader thread
+*                  reads (e.g. the first trigger of the run).  Call before
+*                  starting the reader thread.
+*
+* v7xxPipeRead   - Reader thread: Read out the schedule as soon as a module
+*                  has data, into the next free slot of the ring
+*
+*   timeout - deadline in microseconds (see v7xxSchedReadout), counted
+*             from the first module found ready, rather than from the
+*             call: the reader calls again and again while it waits for
+*             data.
+*
+*   The reader does not wait for the trigger path: it reads each event as
+*   the modules have it, and the ring holds the events read ahead.  When
+*   the ring is full the reader stops reading, and the module buffers hold
+*   the trigger back.  The slot is numbered from the trailer counter of
+*   the first module of the schedule with data, less the offset learned by
+*   the event counter check (v7xxCheckLabel), or as the event after the
+*   previous one if the check is off.  The check (v7xxCheckEvent) then
+*   runs here with that number, and tags the slot if another module
+*   slipped.  The data of the slots is at most r->maxwords -
+*   V7XX_CHECK_NWORDS words, to leave room for the tag.
+*
+*   Nothing is formatted or logged here.  The slot flags the modules that
+*   timed out or failed (tmask/emask, bit n = schedule position n) for the
+*   formatter to report.  Modules that failed are cleared.
+*
+*   RETURNS: 1 if an event was pushed, 0 if the ring is full or no data is
+*            there yet, or ERROR.
+*
+*
+* v7xxPipeFormat - Trigger path: Pop the events up to the one of trigger,
+*                  and write them into the output buffer
+*
+*   Each event is written as the event number, the byte order mark, the
+*   module data, 0xda000bad for every module that failed, and the
+*   0xdaebd00d end of block marker.  *nwords gets the number of words
+*   written.
+*
+*   An event with a number already written is late: a module that timed
+*   out in its event, read on its own afterwards.  It is written ahead of
+*   the event of trigger, with its own number, and counted in the ring
+*   statistics (v7xxRingLate).  An event with a new number below trigger
+*   follows triggers that no module took: as for a skip of the trigger
+*   count in v7xxCheckEvent, the events are numbered from trigger on.
+*
+*   RETURNS: V7XX_PIPE_EVENT   - the event of trigger was written
+*            V7XX_PIPE_WAIT    - it is not in the ring yet
+*            V7XX_PIPE_MISSING - the ring holds a later event: none was
+*                                read for trigger
+*            ERROR             - bad arguments
+*/
+
+void
+v7xxPipeReset(unsigned int first)
+{
+  v7xxPipeLast = first - 1;
+  v7xxPipeSeen = first - 1;
+  v7xxPipeSkew = 0;
+}
+
+int
+v7xxPipeRead(v7xxRing *r, int timeout)
+{
+  v7xxRingSlot *slot;
+  v7xxSchedResult res[V7XX_SCHED_MAX];
+  UINT32 tmask=0, emask=0, all, qmask=0, tdmask=0;
+  unsigned int evnum;
+  int nwrds, ii;
+
+  if(r==NULL)
+    return(ERROR);
+
+  slot = v7xxRingPutStart(r);
+  if(slot==NULL)
+    return(0);
+
+  /* No module ready: not an event yet, and the deadline not started */
+  for(ii=0;ii<v7xxNsched;ii++) {
+    if(v7xxSched[ii].type==V7XX_QDC)
+      qmask  |= (1<<v7xxSched[ii].id);
+    else
+      tdmask |= (1<<v7xxSched[ii].id);
+  }
+  if(!((qmask  && c792GDReady(qmask, 1)) ||
+       (tdmask && c775GDReady(tdmask, 1))))
+    return(0);
+
+  nwrds = v7xxSchedReadout((volatile UINT32 *)slot->data,
+			   r->maxwords - V7XX_CHECK_NWORDS, timeout, &tmask, res);
+  if(nwrds<0)
+    return(ERROR);
+
+  all = (v7xxNsched==32) ? 0xffffffff : ((1<<v7xxNsched)-1);
+  if(tmask==all)
+    return(0);
+
+  evnum = v7xxCheckLabel(v7xxPipeLast + 1, (volatile UINT32 *)slot->data, res);
+  nwrds += v7xxCheckEvent(evnum, (volatile UINT32 *)slot->data, res,
+			  (volatile UINT32 *)&slot->data[nwrds]);
+
+  for(ii=0;ii<v7xxNsched;ii++) {
+    if(res[ii].nwords>=0) continue;
+    emask |= (1<<ii);
+    if(res[ii].type==V7XX_QDC)
+      c792Clear(res[ii].id);
+    else
+      c775Clear(res[ii].id);
+  }
+
+  slot->evnum  = evnum;
+  slot->nwords = nwrds;
+  slot->tmask  = tmask;
+  slot->emask  = emask;
+  slot->order  = v7xxOrderMark();
+  v7xxRingPutCommit(r);
+  v7xxPipeLast = evnum;
+
+  return(1);
+}
+
+/* Write the event of a slot.  Returns the number of words, or ERROR if
+   it does not fit in maxwords */
+LOCAL int
+v7xxPipeSlotFormat(v7xxRingSlot *slot, volatile UINT32 *data, int maxwords)
+{
+  int ii, nerr=0, nwrds=0;
+
+  for(ii=0;ii<v7xxNsched;ii++) {
+    if(slot->emask & (1<<ii)) {
+      V7XX_LIB_LOG("v7xxPipeFormat: ERROR: Event %d: Read Failed (type %d, id %d)\n",
+	     slot->evnum,v7xxSched[ii].type,v7xxSched[ii].id,0,0,0);
+      nerr++;
+    } else if(slot->tmask & (1<<ii)) {
+      V7XX_LIB_LOG("v7xxPipeFormat: ERROR: Event %d: NO data (type %d, id %d)\n",
+	     slot->evnum,v7xxSched[ii].type,v7xxSched[ii].id,0,0,0);
+    }
+  }
+
+  if((slot->nwords + nerr + 3) > maxwords) {
+    V7XX_LIB_LOG("v7xxPipeFormat: ERROR: Event %d (%d words) does not fit in %d words\n",
+	   slot->evnum,slot->nwords,maxwords,0,0,0);
+    return(ERROR);
+  }
+
+  data[nwrds++] = LSWAP(slot->evnum);  /* Event Number */
+  data[nwrds++] = slot->order;         /* Byte order mark */
+  memcpy((void *)&data[nwrds], slot->data, slot->nwords*sizeof(UINT32));
+  nwrds += slot->nwords;
+  for(ii=0;ii<nerr;ii++)
+    data[nwrds++] = 0xda000bad;
+  data[nwrds++] = LSWAP(0xdaebd00d);   /* Event EOB */
+
+  return(nwrds);
+}
+
+int
+v7xxPipeFormat(v7xxRing *r, volatile UINT32 *data, int maxwords,
+	       unsigned int trigger, int *nwords)
+{
+  v7xxRingSlot *slot;
+  unsigned int evnum;
+  int late, nw;
+
+  if((r==NULL) || (data==NULL) || (nwords==NULL))
+    return(ERROR);
+
+  *nwords = 0;
+  while((slot = v7xxRingGetStart(r)) != NULL) {
+    evnum = slot->evnum + v7xxPipeSkew;
+    late = ((int)(slot->evnum - v7xxPipeSeen) <= 0);
+    if(!late && ((int)(evnum - trigger) > 0))
+      return(V7XX_PIPE_MISSING);
+
+    if(late) {
+      v7xxRingLate(r);
+      V7XX_LIB_LOG("v7xxPipeFormat: ERROR: Event %d read late, written with trigger %d\n",
+	     evnum,trigger,0,0,0,0);
+    } else if(evnum != trigger) {
+      V7XX_LIB_LOG("v7xxPipeFormat: WARNING: No module took the %d triggers before %d\n",
+	     trigger-evnum,trigger,0,0,0,0);
+      v7xxPipeSkew += trigger - evnum;
+      evnum = trigger;
+    }
+
+    slot->evnum = evnum;
+    nw = v7xxPipeSlotFormat(slot, &data[*nwords], maxwords - *nwords);
+    if(nw > 0)
+      *nwords += nw;
+    v7xxRingGetCommit(r);
+
+    if(!late) {
+      v7xxPipeSeen = evnum - v7xxPipeSkew;
+      return(V7XX_PIPE_EVENT);
+    }
+  }
+
+  return(V7XX_PIPE_WAIT);
+}
+#endif /* VXWORKS */
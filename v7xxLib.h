@@ -0,0 +1,271 @@
+/******************************************************************************
+*
+*  v7xxLib.h  -  Header file for readout helpers shared by crates mixing
+*                C.A.E.N. Model 792 QDCs and Model 775 TDCs.
+*                Requires c792Lib and c775Lib.
+*
+*/
+#ifndef __V7XXLIB__
+#define __V7XXLIB__
+
+#include "c792Lib.h"
+#include "c775Lib.h"
+#ifndef VXWORKS
+#include "v7xxRing.h"
+#endif
+
+/* Module types */
+#define V7XX_QDC            0
+#define V7XX_TDC            1
+
+/* Maximum number of modules in the readout schedule (one bit each in
+   a UINT32 mask) */
+#define V7XX_SCHED_MAX      32
+
+/* How a module is read once it has data */
+#define V7XX_READ_EVENT     0   /* c792ReadEvent/c775ReadEvent (programmed I/O) */
+#define V7XX_READ_BLOCK     1   /* c792ReadBlock/c775ReadBlock (BERR enabled) */
+
+/* Data word bits common to the V792 and V775 */
+#define V7XX_DATA_OVERFLOW  0x00001000
+#define V7XX_DATA_UNDERFLOW 0x00002000
+#define V7XX_DATA_VALID     0x00004000   /* V775 only */
+
+/* v7xxDecode flags */
+#define V7XX_DECODE_SWAP    0x1   /* Input words are in VME byte order */
+#define V7XX_DECODE_APPEND  0x2   /* Add to the previous output */
+#define V7XX_DECODE_SCALAR  0x10  /* Do not use vector instructions */
+#define V7XX_DECODE_SSE2    0x20  /* Do not use more than SSE2 */
+
+/* Flags needed for buffers filled by c792ReadEvent, c775ReadEvent, ...
+   with the default byte order (C792_ORDER_VME) */
+#ifdef VXWORKS
+#define V7XX_DECODE_READOUT 0
+#else
+#define V7XX_DECODE_READOUT V7XX_DECODE_SWAP
+#endif
+
+/* v7xxPipeFormat results */
+#define V7XX_PIPE_WAIT      0   /* the event of the trigger is not read yet */
+#define V7XX_PIPE_EVENT     1   /* it was written */
+#define V7XX_PIPE_MISSING   2   /* the ring holds later events: it will not come */
+
+/* Byte order mark, stored in the bank after the event number in the
+   byte order of the module data (see v7xxOrderMark).  The consumer finds
+   either this value, or the same byte swapped (see v7xxOrderFlags) */
+#define V7XX_ORDER_MARK     0xda0b0e0d
+
+/* v7xxDecoded flags[] bits */
+#define V7XX_HIT_OVERFLOW   0x1
+#define V7XX_HIT_UNDERFLOW  0x2
+#define V7XX_HIT_VALID      0x4
+
+/* v7xxDecoded evcnt[] of an event without trailer */
+#define V7XX_NO_TRAILER     0xffffffff
+
+/* Decoded data, as separate arrays.  Allocate with v7xxDecodeCreate */
+typedef struct
+{
+  int maxhits;             /* size of the per data word arrays */
+  int maxevents;           /* size of the per event arrays */
+  int nhits;               /* data words decoded */
+  int nevents;             /* headers decoded */
+  int nerr;                /* words out of place, or of unknown type */
+  int cur;                 /* event waiting for its trailer, or -1 */
+
+  /* per data word */
+  unsigned short *chan;    /* channel */
+  unsigned short *value;   /* ADC/TDC value */
+  unsigned short *flags;   /* V7XX_HIT_* */
+
+  /* per event */
+  unsigned char  *geo;     /* GEO address, from the header */
+  unsigned char  *crate;   /* crate number, from the header */
+  unsigned char  *nwords;  /* data word count, from the header */
+  unsigned int   *evcnt;   /* event counter, from the trailer */
+  int            *first;   /* index of its first data word */
+  int            *nhit;    /* number of data words decoded */
+} v7xxDecoded;
+
+/* Trigger timing (v7xxTimeEnable) */
+#define V7XX_TIME_ON        0x1   /* Histogram the phases of each trigger */
+#define V7XX_TIME_STAMP     0x2   /* Also write the timing words into the bank */
+
+/* Phases of a trigger, between v7xxTimeStart and v7xxTimeEnd */
+#define V7XX_PHASE_WAIT     0     /* polling the Data Ready bits */
+#define V7XX_PHASE_READ     1     /* reading the modules */
+#define V7XX_PHASE_OUTPUT   2     /* the rest: bank header, error words, logging */
+#define V7XX_PHASE_TOTAL    3
+#define V7XX_NPHASE         4
+
+/* Histogram bins: bin n counts times of 2^(n-1) to 2^n - 1 ticks */
+#define V7XX_TIME_NBINS     40
+
+/* Timing words (V7XX_TIME_STAMP): this mark | number of words that
+   follow, the start of the trigger in us, and the V7XX_NPHASE phases
+   in ns (see v7xxTimeEnd) */
+#define V7XX_TIME_MARK      0xda7e0000
+#define V7XX_TIME_NWORDS    (2 + V7XX_NPHASE)
+
+/* Time histogram, in ticks of v7xxTsc */
+typedef struct
+{
+  unsigned long long n;        /* entries */
+  unsigned long long sum;      /* total */
+  unsigned long long min;
+  unsigned long long max;
+  unsigned int       bin[V7XX_TIME_NBINS];
+} v7xxTimeHist;
+
+/* Trigger being timed, in ticks of v7xxTsc */
+typedef struct
+{
+  unsigned long long t0;                    /* v7xxTimeStart */
+  unsigned long long phase[V7XX_NPHASE];    /* time in each phase */
+  unsigned long long mod[V7XX_SCHED_MAX];   /* time reading each schedule position */
+  UINT32             modmask;               /* schedule positions read */
+} v7xxTimeTrig;
+
+extern int          v7xxTimeFlags;
+extern v7xxTimeTrig v7xxTimeCur;
+
+/* CPU cycle or time base counter.  Its rate is measured by v7xxTimeEnable */
+static __inline__ unsigned long long
+v7xxTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return(((unsigned long long)hi<<32) | lo);
+#elif defined(__aarch64__)
+  unsigned long long t;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (t));
+  return(t);
+#elif defined(__powerpc__) || defined(__PPC__)
+  unsigned int hi, lo, hi2;
+  do {
+    __asm__ __volatile__ ("mftbu %0" : "=r" (hi));
+    __asm__ __volatile__ ("mftb %0" : "=r" (lo));
+    __asm__ __volatile__ ("mftbu %0" : "=r" (hi2));
+  } while(hi != hi2);
+  return(((unsigned long long)hi<<32) | lo);
+#else
+  unsigned long long v7xxTimeUs();
+  return(v7xxTimeUs());
+#endif
+}
+
+/* Event counter check (v7xxCheckEnable) */
+#define V7XX_CHECK_ON       0x1   /* Compare the counters of each event */
+#define V7XX_CHECK_RESYNC   0x2   /* Also clear the data of a module that slipped */
+
+/* Tag of an event where a module slipped (v7xxCheckEvent): this mark |
+   flags | number of words that follow, and the mask of the schedule
+   positions that slipped */
+#define V7XX_CHECK_MARK     0xda5c0000
+#define V7XX_CHECK_TRIGGER  0x100     /* flag: the trigger count skipped */
+#define V7XX_CHECK_NWORDS   2
+
+/* Offset of a module not seen yet */
+#define V7XX_CHECK_LEARN    0xffffffff
+
+/* Event counter check, per schedule position (v7xxCheckGet) */
+typedef struct
+{
+  UINT32 offset;                 /* trailer counter - trigger count, 24 bits */
+  UINT32 lastDelta;              /* change of offset being handled */
+  unsigned long long nevents;    /* events checked */
+  unsigned long long nskew;      /* slips of the trailer counter */
+  unsigned long long nextra;     /* events left after the read (extra gates) */
+  unsigned long long nresync;    /* data resets (V7XX_CHECK_RESYNC) */
+  unsigned long long nnotrailer; /* events without trailer, not checked */
+} v7xxCheckStats;
+
+extern int v7xxCheckFlags;
+
+/* Watchdog (v7xxWatchEnable): conditions found on a module */
+#define V7XX_WATCH_FULL       0x1   /* output buffer full (Status 2) */
+#define V7XX_WATCH_BUSY       0x2   /* busy V7XX_WATCH_BUSY_US, counter stopped (Status 1) */
+#define V7XX_WATCH_FAIL       0x4   /* consecutive reads failed or timed out */
+#define V7XX_WATCH_BUSY_US    1000  /* a conversion takes a few us */
+
+/* Recovery steps, applied in turn while the condition stays */
+#define V7XX_WATCH_DRAIN      1     /* read out and drop the buffered events */
+#define V7XX_WATCH_CLEAR      2     /* data reset */
+#define V7XX_WATCH_RESET      3     /* soft reset, write back what it changed */
+#define V7XX_WATCH_REPROGRAM  4     /* soft reset, write the whole configuration */
+#define V7XX_WATCH_NSTEP      5
+
+#define V7XX_WATCH_NINCIDENT  64    /* last incidents kept (v7xxWatchGet) */
+
+/* One incident: from the check that found a condition, to the first check
+   where the module is read out and its status is clean */
+typedef struct
+{
+  int    pos;                   /* schedule position */
+  int    type;                  /* V7XX_QDC or V7XX_TDC */
+  int    id;
+  int    cause;                 /* V7XX_WATCH_FULL|BUSY|FAIL seen */
+  int    step;                  /* last recovery step applied */
+  int    nstep;                 /* recovery steps applied */
+  unsigned long long start;     /* us (v7xxTimeUs) */
+  unsigned long long duration;  /* us, 0 while open */
+} v7xxIncident;
+
+/* Per module result of v7xxSchedReadout */
+typedef struct
+{
+  int    type;     /* V7XX_QDC or V7XX_TDC */
+  int    id;       /* module id in its own library */
+  int    offset;   /* word offset of its data in the buffer */
+  int    nwords;   /* words read, 0 if timed out, ERROR if the read failed */
+  int    order;    /* position in the readout sequence, -1 if not read */
+  int    waitTime; /* us from the start of the readout until ready */
+} v7xxSchedResult;
+
+/* Function Prototypes */
+void   v7xxSchedInit();
+int    v7xxSchedAdd(int type, int id, int mode, int maxwords);
+int    v7xxSchedCount();
+STATUS v7xxSchedGet(int pos, int *type, int *id);
+int    v7xxGDReady(UINT32 qdcmask, UINT32 tdcmask, int timeout,
+		   UINT32 *qdcready, UINT32 *tdcready);
+int    v7xxSchedReadout(volatile UINT32 *data, int maxwords, int timeout,
+			UINT32 *tmask, v7xxSchedResult *res);
+void   v7xxSchedPrint(v7xxSchedResult *res);
+unsigned long long v7xxTimeUs();
+STATUS v7xxSetByteOrder(int order);
+STATUS v7xxSetWaitMode(int mode, int spinUs);
+UINT32 v7xxOrderMark();
+int    v7xxOrderFlags(UINT32 mark);
+v7xxDecoded *v7xxDecodeCreate(int maxhits, int maxevents);
+void   v7xxDecodeDestroy(v7xxDecoded *d);
+int    v7xxDecode(const UINT32 *data, int nwords, int flags, v7xxDecoded *d);
+STATUS v7xxDecodeBench(int nevents, int nloop);
+STATUS v7xxTimeEnable(int flags);
+void   v7xxTimeClear();
+STATUS v7xxTimeGet(int phase, v7xxTimeHist *hist);
+void   v7xxTimePrint(int full);
+void   v7xxTimeStart();
+int    v7xxTimeEnd(volatile UINT32 *data);
+STATUS v7xxCheckEnable(int flags, int period);
+int    v7xxCheckEvent(UINT32 trigger, volatile UINT32 *data, v7xxSchedResult *res,
+		      volatile UINT32 *tag);
+UINT32 v7xxCheckLabel(UINT32 next, volatile UINT32 *data, v7xxSchedResult *res);
+STATUS v7xxCheckGet(int pos, v7xxCheckStats *stats);
+void   v7xxCheckPrint();
+void   v7xxCheckForget(int pos);
+STATUS v7xxWatchEnable(int period, int maxFail, int stallMs);
+void   v7xxWatchTimeouts(UINT32 posmask);
+void   v7xxWatchStart();
+UINT32 v7xxWatchEvent(v7xxSchedResult *res);
+int    v7xxWatchGet(v7xxIncident *inc, int max);
+void   v7xxWatchPrint();
+#ifndef VXWORKS
+void   v7xxPipeReset(unsigned int first);
+int    v7xxPipeRead(v7xxRing *r, int timeout);
+int    v7xxPipeFormat(v7xxRing *r, volatile UINT32 *data, int maxwords,
+		      unsigned int trigger, int *nwords);
+#endif
+
+#endif /* __V7XXLIB__ */
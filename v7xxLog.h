@@ -0,0 +1,299 @@
+/******************************************************************************
+*
+*  v7xxLog.h  -  Deferred, rate limited logMsg for the trigger path, shared
+*                by the c792 and c775 libraries.  Include after jvme.h.
+*
+*                V7XX_LOG(log, fmt, arg1, ... arg6) formats nothing: it
+*                stores the message site (format) and its arguments in a
+*                lock-free ring per log.  A single thread, shared by all
+*                the logs of the program, prints them: v7xxLogStart
+*                starts it, v7xxLogStop stops it.  It sleeps on an
+*                eventfd, and a message wakes it only when it finds its
+*                ring empty.  Each site lets through at most log->rate
+*                messages per second; the others are counted, and the
+*                count is printed with the next message that gets through.
+*                A full ring drops the message, it never blocks.
+*
+*                As with logMsg, %s arguments must still be valid when the
+*                message is printed (string constants, __func__).
+*
+*                On VxWorks, logMsg is already deferred to tLogTask, and
+*                V7XX_LOG is logMsg.
+*
+*/
+#ifndef __V7XXLOG__
+#define __V7XXLOG__
+
+/* First 6 arguments after the format, as long, padded with 0 */
+#define V7XX_LOG_FMT(fmt, ...)  fmt
+#define V7XX_LOG_A6(fmt, a, b, c, d, e, f, ...)				\
+  (long)(a), (long)(b), (long)(c), (long)(d), (long)(e), (long)(f)
+#define V7XX_LOG_ARGS(...)      V7XX_LOG_A6(__VA_ARGS__, 0, 0, 0, 0, 0, 0, 0)
+
+#ifdef VXWORKS
+
+typedef struct
+{
+  int rate;
+} v7xxLog;
+
+#define V7XX_LOG_INIT(name)     { 0 }
+#define V7XX_LOG(log, ...)						\
+  logMsg(V7XX_LOG_FMT(__VA_ARGS__, 0), V7XX_LOG_ARGS(__VA_ARGS__))
+#define v7xxLogStart(log)
+#define v7xxLogStop()
+#define v7xxLogFlush(log)
+
+#else /* Linux */
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define V7XX_LOG_SLOTS      256   /* power of 2 */
+#define V7XX_LOG_RATE       10    /* default messages per second and site */
+#define V7XX_LOG_PERIOD_US  2000  /* printing thread poll period, without eventfd */
+#define V7XX_LOG_NLOG       16    /* logs printed by the thread */
+
+/* One per V7XX_LOG call site */
+typedef struct
+{
+  const char   *fmt;
+  long          window;  /* second counted in nwin */
+  unsigned int  nwin;    /* messages seen in that second */
+  unsigned int  nsupp;   /* suppressed since the last one queued */
+} v7xxLogSite;
+
+typedef struct
+{
+  volatile unsigned long seq;   /* 2*turn: free, 2*turn+1: full */
+  v7xxLogSite  *site;
+  unsigned int  nsupp;          /* suppressed before this one */
+  long          arg[6];
+} v7xxLogRec;
+
+typedef struct
+{
+  const char         *name;
+  int                 rate;     /* messages per second and site, 0: default */
+  int                 listed;   /* printed by the thread */
+  pthread_mutex_t     mutex;    /* consumer side only */
+  unsigned long       head __attribute__((aligned(64)));
+  unsigned long       tail __attribute__((aligned(64)));
+  int                 pending;  /* the thread was woken up for this ring */
+  unsigned long long  nput;     /* messages queued */
+  unsigned long long  nsupp;    /* messages suppressed by the rate limit */
+  unsigned long long  nlost;    /* messages dropped, ring full */
+  v7xxLogRec          rec[V7XX_LOG_SLOTS];
+} v7xxLog;
+
+#define V7XX_LOG_INIT(name)  { name, 0, 0, PTHREAD_MUTEX_INITIALIZER }
+
+/* The printing thread and the logs it prints.  As v7xxIntTab, a weak
+   definition, so a program linked with several of the libraries has a
+   single copy of it */
+typedef struct
+{
+  pthread_mutex_t  mutex;
+  pthread_t        thread;
+  int              running;
+  volatile int     stop;
+  int              efd;     /* eventfd, -1: none */
+  int              nlog;
+  v7xxLog         *log[V7XX_LOG_NLOG];
+} v7xxLogShare;
+
+v7xxLogShare v7xxLogTab __attribute__((weak)) =
+  { .mutex = PTHREAD_MUTEX_INITIALIZER, .efd = -1 };
+
+#define V7XX_LOG(log, ...) do {						\
+    static v7xxLogSite _v7xxLogSite = { V7XX_LOG_FMT(__VA_ARGS__, 0) }; \
+    v7xxLogPut(log, &_v7xxLogSite, V7XX_LOG_ARGS(__VA_ARGS__));		\
+  } while(0)
+
+/* Slot pos & (V7XX_LOG_SLOTS-1) is used once per turn pos/V7XX_LOG_SLOTS.
+   Its sequence number tells if it is free or full for a given turn, so a
+   zeroed ring is empty and messages can be queued before v7xxLogStart */
+#define V7XX_LOG_FREE(pos)  (2*((pos)/V7XX_LOG_SLOTS))
+#define V7XX_LOG_FULL(pos)  (2*((pos)/V7XX_LOG_SLOTS) + 1)
+
+/* Wake the printing thread up, if this is the first message since it
+   last looked at the ring */
+static inline int
+v7xxLogWake(v7xxLog *log)
+{
+  unsigned long long one = 1;
+  int efd;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&log->pending, __ATOMIC_RELAXED) ||
+     __atomic_exchange_n(&log->pending, 1, __ATOMIC_RELAXED))
+    return(0);
+
+  efd = __atomic_load_n(&v7xxLogTab.efd, __ATOMIC_ACQUIRE);
+  if(efd < 0)
+    return(0);
+
+  return(write(efd, &one, sizeof(one)) == sizeof(one));
+}
+
+/* Producers: any thread, lock-free */
+static inline void
+v7xxLogPut(v7xxLog *log, v7xxLogSite *site,
+	   long a1, long a2, long a3, long a4, long a5, long a6)
+{
+  struct timespec ts;
+  v7xxLogRec *rec;
+  unsigned long pos, seq;
+  unsigned int nsupp;
+  int rate = log->rate>0 ? log->rate : V7XX_LOG_RATE;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  if(site->window != ts.tv_sec) {
+    site->window = ts.tv_sec;
+    site->nwin = 0;
+  }
+  if(++site->nwin > (unsigned int)rate) {
+    __atomic_fetch_add(&site->nsupp, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&log->nsupp, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+  while(1) {
+    rec = &log->rec[pos & (V7XX_LOG_SLOTS-1)];
+    seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+    if(seq == V7XX_LOG_FREE(pos)) {
+      if(__atomic_compare_exchange_n(&log->head, &pos, pos+1, 1,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	break;
+    } else if((long)(seq - V7XX_LOG_FREE(pos)) < 0) {
+      /* Still full from the previous turn */
+      __atomic_fetch_add(&log->nlost, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&site->nsupp, 1, __ATOMIC_RELAXED);
+      return;
+    } else
+      pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+  }
+
+  nsupp = __atomic_exchange_n(&site->nsupp, 0, __ATOMIC_RELAXED);
+  rec->site   = site;
+  rec->nsupp  = nsupp;
+  rec->arg[0] = a1; rec->arg[1] = a2; rec->arg[2] = a3;
+  rec->arg[3] = a4; rec->arg[4] = a5; rec->arg[5] = a6;
+  __atomic_fetch_add(&log->nput, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&rec->seq, V7XX_LOG_FULL(pos), __ATOMIC_RELEASE);
+
+  v7xxLogWake(log);
+}
+
+/* Consumer: print everything queued.  Returns the number of messages */
+static inline int
+v7xxLogFlush(v7xxLog *log)
+{
+  v7xxLogRec *rec;
+  unsigned long pos;
+  int n = 0;
+
+  pthread_mutex_lock(&log->mutex);
+  /* Messages queued from now on wake the thread up again */
+  __atomic_store_n(&log->pending, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  pos = log->tail;
+  while(1) {
+    rec = &log->rec[pos & (V7XX_LOG_SLOTS-1)];
+    if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != V7XX_LOG_FULL(pos))
+      break;
+
+    if(rec->nsupp)
+      printf("%s: (%u more like the next one suppressed)\n",log->name,rec->nsupp);
+    printf(rec->site->fmt, rec->arg[0], rec->arg[1], rec->arg[2],
+	   rec->arg[3], rec->arg[4], rec->arg[5]);
+
+    __atomic_store_n(&rec->seq, V7XX_LOG_FREE(pos + V7XX_LOG_SLOTS),
+		     __ATOMIC_RELEASE);
+    pos++;
+    n++;
+  }
+  log->tail = pos;
+  pthread_mutex_unlock(&log->mutex);
+
+  if(n) fflush(stdout);
+
+  return(n);
+}
+
+static inline void *
+v7xxLogThread(void *arg)
+{
+  v7xxLogShare *sh = &v7xxLogTab;
+  unsigned long long n;
+  int ii;
+
+  while(1) {
+    for(ii=0; ii<__atomic_load_n(&sh->nlog, __ATOMIC_ACQUIRE); ii++)
+      v7xxLogFlush(sh->log[ii]);
+    if(sh->stop)
+      break;
+    if(read(sh->efd, &n, sizeof(n)) < 0)
+      usleep(V7XX_LOG_PERIOD_US);
+  }
+
+  return(NULL);
+}
+
+/* Have log printed by the thread, and start the thread if it is not
+   running */
+static inline void
+v7xxLogStart(v7xxLog *log)
+{
+  v7xxLogShare *sh = &v7xxLogTab;
+
+  pthread_mutex_lock(&sh->mutex);
+  if(!log->listed) {
+    if(sh->nlog < V7XX_LOG_NLOG) {
+      sh->log[sh->nlog] = log;
+      __atomic_store_n(&sh->nlog, sh->nlog + 1, __ATOMIC_RELEASE);
+      log->listed = 1;
+    } else
+      printf("v7xxLogStart: ERROR: More than %d logs, %s is not printed\n",
+	     V7XX_LOG_NLOG, log->name);
+  }
+  if(sh->efd < 0) {
+    __atomic_store_n(&sh->efd, eventfd(0, EFD_CLOEXEC), __ATOMIC_RELEASE);
+    if(sh->efd < 0)
+      perror("v7xxLogStart: eventfd");
+  }
+  if(!sh->running) {
+    sh->stop = 0;
+    if(pthread_create(&sh->thread, NULL, v7xxLogThread, NULL) == 0)
+      sh->running = 1;
+    else
+      perror("v7xxLogStart: pthread_create");
+  }
+  pthread_mutex_unlock(&sh->mutex);
+}
+
+/* Stop the thread, once it has printed what was queued.  Later messages
+   wait for v7xxLogFlush or the next v7xxLogStart */
+static inline void
+v7xxLogStop(void)
+{
+  v7xxLogShare *sh = &v7xxLogTab;
+  unsigned long long one = 1;
+
+  pthread_mutex_lock(&sh->mutex);
+  if(sh->running) {
+    sh->stop = 1;
+    if((sh->efd >= 0) && (write(sh->efd, &one, sizeof(one)) < 0))
+      perror("v7xxLogStop: write");
+    pthread_join(sh->thread, NULL);
+    sh->running = 0;
+  }
+  pthread_mutex_unlock(&sh->mutex);
+}
+
+#endif /* VXWORKS */
+
+#endif /* __V7XXLOG__ */
@@ -0,0 +1,227 @@
+/******************************************************************************
+*
+*  v7xxRing.c  -  Single producer / single consumer event ring between
+*                 the VME reader thread and the output formatter.
+*                 Linux only.
+*
+*                 Lock free: the producer owns head, the consumer owns
+*                 tail, and each keeps a cached copy of the other's index
+*                 so that the shared cache lines are only touched when
+*                 the ring looks full (producer) or empty (consumer).
+*
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "v7xxRing.h"
+
+/*******************************************************************************
+*
+* v7xxRingCreate  - Allocate a ring
+*
+*   nslots   - number of event slots, rounded up to a power of 2
+*   maxwords - maximum number of data words in one event
+*
+* v7xxRingDestroy - Free a ring.  Both threads must be done with it.
+*
+*
+* RETURNS: v7xxRingCreate: Pointer to the ring, or NULL.
+*/
+
+v7xxRing *
+v7xxRingCreate(int nslots, int maxwords)
+{
+  v7xxRing *r;
+  unsigned int n=1, size;
+
+  if((nslots<=0) || (maxwords<=0)) {
+    printf("v7xxRingCreate: ERROR: Invalid size (nslots=%d, maxwords=%d)\n",
+	   nslots,maxwords);
+    return(NULL);
+  }
+
+  while(n < (unsigned int)nslots) n <<= 1;
+
+  if(posix_memalign((void **)&r, V7XX_RING_CACHELINE, sizeof(v7xxRing))) {
+    printf("v7xxRingCreate: ERROR: Cannot allocate ring\n");
+    return(NULL);
+  }
+  memset(r, 0, sizeof(v7xxRing));
+
+  /* Slots start on a cache line, so the producer writing one slot does
+     not share a line with the consumer reading the previous one */
+  size = sizeof(v7xxRingSlot) + (maxwords-1)*sizeof(unsigned int);
+  size = (size + V7XX_RING_CACHELINE - 1) & ~(V7XX_RING_CACHELINE - 1);
+
+  if(posix_memalign((void **)&r->slots, V7XX_RING_CACHELINE, n*size)) {
+    printf("v7xxRingCreate: ERROR: Cannot allocate %d slots of %d bytes\n",
+	   n,size);
+    free(r);
+    return(NULL);
+  }
+  memset(r->slots, 0, n*size);
+
+  r->nslots   = n;
+  r->mask     = n - 1;
+  r->stride   = size;
+  r->maxwords = maxwords;
+
+  return(r);
+}
+
+void
+v7xxRingDestroy(v7xxRing *r)
+{
+  if(r==NULL) return;
+
+  free(r->slots);
+  free(r);
+}
+
+/*******************************************************************************
+*
+* v7xxRingPutStart  - Producer: Get the next free slot
+* v7xxRingPutCommit - Producer: Publish the slot returned by v7xxRingPutStart
+*
+*
+* RETURNS: v7xxRingPutStart: Pointer to the slot, or NULL if the ring is
+*                            full (the event is not lost: call again later).
+*/
+
+v7xxRingSlot *
+v7xxRingPutStart(v7xxRing *r)
+{
+  unsigned int head = r->head;
+
+  if((head - r->tailCache) >= r->nslots) {
+    r->tailCache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if((head - r->tailCache) >= r->nslots) {
+      r->nfull++;
+      return(NULL);
+    }
+  }
+
+  return((v7xxRingSlot *)(r->slots + (head & r->mask)*r->stride));
+}
+
+void
+v7xxRingPutCommit(v7xxRing *r)
+{
+  unsigned int head = r->head + 1;
+
+  __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+  r->nput++;
+  if((head - r->tailCache) > r->maxDepth)
+    r->maxDepth = head - r->tailCache;
+}
+
+/*******************************************************************************
+*
+* v7xxRingGetStart  - Consumer: Get the oldest event
+* v7xxRingGetCommit - Consumer: Release the slot returned by v7xxRingGetStart
+* v7xxRingLate      - Consumer: Count an event that came after the consumer
+*                     gave up waiting for it
+*
+*
+* RETURNS: v7xxRingGetStart: Pointer to the slot, or NULL if the ring
+*                            is empty.
+*/
+
+v7xxRingSlot *
+v7xxRingGetStart(v7xxRing *r)
+{
+  unsigned int tail = r->tail;
+
+  if(tail == r->headCache) {
+    r->headCache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if(tail == r->headCache) {
+      r->nempty++;
+      return(NULL);
+    }
+  }
+
+  return((v7xxRingSlot *)(r->slots + (tail & r->mask)*r->stride));
+}
+
+void
+v7xxRingGetCommit(v7xxRing *r)
+{
+  __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+  r->nget++;
+}
+
+void
+v7xxRingLate(v7xxRing *r)
+{
+  r->nlate++;
+}
+
+/*******************************************************************************
+*
+* v7xxRingDepth      - Number of events queued (approximate, from any thread)
+* v7xxRingGetStats   - Copy the ring counters (approximate while running)
+* v7xxRingClearStats - Zero the ring counters.  Only while the ring is idle.
+* v7xxRingPrintStats - Print the ring counters
+*
+*
+* RETURNS: v7xxRingDepth: Number of events.  Others: None.
+*/
+
+int
+v7xxRingDepth(v7xxRing *r)
+{
+  unsigned int head, tail;
+
+  tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+  return((int)(head - tail));
+}
+
+void
+v7xxRingGetStats(v7xxRing *r, v7xxRingStats *stats)
+{
+  if((r==NULL) || (stats==NULL)) return;
+
+  stats->nput     = r->nput;
+  stats->nget     = r->nget;
+  stats->nfull    = r->nfull;
+  stats->nempty   = r->nempty;
+  stats->nlate    = r->nlate;
+  stats->maxDepth = r->maxDepth;
+}
+
+void
+v7xxRingClearStats(v7xxRing *r)
+{
+  if(r==NULL) return;
+
+  r->nput = r->nfull = 0;
+  r->maxDepth = 0;
+  r->nget = r->nempty = r->nlate = 0;
+}
+
+void
+v7xxRingPrintStats(v7xxRing *r)
+{
+  v7xxRingStats st;
+
+  if(r==NULL) return;
+
+  v7xxRingGetStats(r, &st);
+
+  printf("\n");
+  printf("                    V792/V775 Event Ring (%d slots x %d words)\n\n",
+	 r->nslots,r->maxwords);
+  printf("  Events put     : %llu\n",st.nput);
+  printf("  Events got     : %llu\n",st.nget);
+  printf("  Queued now     : %d\n",v7xxRingDepth(r));
+  printf("  Max queued     : %u\n",st.maxDepth);
+  printf("  Ring full      : %llu  (producer back-pressure)\n",st.nfull);
+  printf("  Ring empty     : %llu  (consumer idle polls)\n",st.nempty);
+  printf("  Events late    : %llu  (after the consumer gave up on them)\n",st.nlate);
+  printf("\n");
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+*
+*  v7xxRing.h  -  Single producer / single consumer event ring, to pass
+*                 raw module data from a VME reader thread to the thread
+*                 that formats the output buffer.  Linux only.
+*
+*                 Does not depend on the VME libraries, so it can be
+*                 built and exercised without hardware.
+*
+*/
+#ifndef __V7XXRING__
+#define __V7XXRING__
+
+#define V7XX_RING_CACHELINE   64
+
+/* Event slot.  The producer fills the header and data[] between
+   v7xxRingPutStart and v7xxRingPutCommit */
+typedef struct
+{
+  unsigned int evnum;    /* event number */
+  int          nwords;   /* words used in data[] */
+  unsigned int tmask;    /* modules that timed out (user defined) */
+  unsigned int emask;    /* modules that failed (user defined) */
+  unsigned int order;    /* byte order of data[] (user defined) */
+  unsigned int data[1];  /* maxwords words, see v7xxRingCreate */
+} v7xxRingSlot;
+
+/* Ring counters.  nput/nfull/maxDepth are kept by the producer,
+   nget/nempty/nlate by the consumer */
+typedef struct
+{
+  unsigned long long nput;     /* events pushed */
+  unsigned long long nget;     /* events popped */
+  unsigned long long nfull;    /* times the producer found the ring full */
+  unsigned long long nempty;   /* times the consumer found the ring empty */
+  unsigned long long nlate;    /* events popped after the consumer gave up
+				  waiting for them (v7xxRingLate) */
+  unsigned int       maxDepth; /* largest number of events queued */
+} v7xxRingStats;
+
+typedef struct v7xxRing_s
+{
+  /* Producer side */
+  volatile unsigned int head __attribute__((aligned(V7XX_RING_CACHELINE)));
+  unsigned int       tailCache;
+  unsigned long long nput;
+  unsigned long long nfull;
+  unsigned int       maxDepth;
+
+  /* Consumer side */
+  volatile unsigned int tail __attribute__((aligned(V7XX_RING_CACHELINE)));
+  unsigned int       headCache;
+  unsigned long long nget;
+  unsigned long long nempty;
+  unsigned long long nlate;
+
+  /* Read only after v7xxRingCreate */
+  unsigned int nslots __attribute__((aligned(V7XX_RING_CACHELINE)));
+  unsigned int mask;
+  unsigned int stride;     /* bytes between slots */
+  int          maxwords;
+  char        *slots;
+} v7xxRing;
+
+/* Function Prototypes */
+v7xxRing     *v7xxRingCreate(int nslots, int maxwords);
+void          v7xxRingDestroy(v7xxRing *r);
+v7xxRingSlot *v7xxRingPutStart(v7xxRing *r);
+void          v7xxRingPutCommit(v7xxRing *r);
+v7xxRingSlot *v7xxRingGetStart(v7xxRing *r);
+void          v7xxRingGetCommit(v7xxRing *r);
+void          v7xxRingLate(v7xxRing *r);
+int           v7xxRingDepth(v7xxRing *r);
+void          v7xxRingGetStats(v7xxRing *r, v7xxRingStats *stats);
+void          v7xxRingClearStats(v7xxRing *r);
+void          v7xxRingPrintStats(v7xxRing *r);
+
+#endif /* __V7XXRING__ */
@@ -0,0 +1,77 @@
+/******************************************************************************
+*
+*  v7xxSwap.h  -  Byte swap of whole blocks of 32 bit words, shared by the
+*                 c792 and c775 libraries.  Include after jvme.h.
+*
+*                 On x86 the block is swapped 8 (AVX2, chosen at run time)
+*                 or 4 (SSE2) words at a time.  Elsewhere, one word at a
+*                 time with LSWAP.
+*
+*/
+#ifndef __V7XXSWAP__
+#define __V7XXSWAP__
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(VXWORKS)
+#define V7XX_SWAP_X86
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline int
+v7xxSwapBlockAVX2(UINT32 *data, int nwords)
+{
+  const __m256i bswap = _mm256_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3,
+					12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+  int ii;
+
+  for(ii=0;ii+8<=nwords;ii+=8)
+    _mm256_storeu_si256((__m256i *)&data[ii],
+			_mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *)&data[ii]),
+					    bswap));
+  return(ii);
+}
+
+#ifdef __i386__
+__attribute__((target("sse2")))
+#endif
+static inline int
+v7xxSwapBlockSSE2(UINT32 *data, int nwords)
+{
+  const __m128i bmask = _mm_set1_epi32(0x00ff00ff);
+  __m128i w;
+  int ii;
+
+  for(ii=0;ii+4<=nwords;ii+=4) {
+    w = _mm_loadu_si128((__m128i *)&data[ii]);
+    /* Exchange the 16 bit halves, then the bytes in each */
+    w = _mm_or_si128(_mm_slli_epi32(w,16), _mm_srli_epi32(w,16));
+    w = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(w,bmask),8),
+		     _mm_srli_epi16(w,8));
+    _mm_storeu_si128((__m128i *)&data[ii], w);
+  }
+  return(ii);
+}
+#endif /* V7XX_SWAP_X86 */
+
+/* Byte swap nwords words of data, in place */
+static inline void
+v7xxSwapBlock(volatile UINT32 *data, int nwords)
+{
+  UINT32 *d = (UINT32 *)data;
+  int ii = 0;
+
+#ifdef V7XX_SWAP_X86
+  if(__builtin_cpu_supports("avx2"))
+    ii = v7xxSwapBlockAVX2(d, nwords);
+#ifdef __i386__
+  else if(__builtin_cpu_supports("sse2"))
+#else
+  else
+#endif
+    ii = v7xxSwapBlockSSE2(d, nwords);
+#endif
+
+  for(;ii<nwords;ii++)
+    d[ii] = LSWAP(d[ii]);
+}
+
+#endif /* __V7XXSWAP__ */
@@ -0,0 +1,280 @@
+/******************************************************************************
+*
+*  v7xxTime.c  -  Per-phase timing of the trigger routine, for crates
+*                 read out with the v7xx scheduler.
+*
+*                 Each trigger is split in phases (waiting for Data Ready,
+*                 reading the modules, the rest of the bank), timed with
+*                 the CPU cycle / time base counter, and added to one
+*                 histogram per phase and per schedule position.  Bins are
+*                 powers of two, so adding an entry is a few instructions
+*                 and the timing can be left on during production runs.
+*
+*                 Optionally, the times of each trigger are also written
+*                 into the event bank (V7XX_TIME_STAMP), for offline study.
+*
+*/
+
+#ifdef VXWORKS
+#include "vxWorks.h"
+#include "logLib.h"
+#include "taskLib.h"
+#include "sysLib.h"
+#else
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "jvme.h"
+
+/* Include QDC/TDC definitions */
+#include "v7xxLib.h"
+
+int          v7xxTimeFlags = 0;   /* V7XX_TIME_* */
+v7xxTimeTrig v7xxTimeCur;         /* trigger being timed */
+
+LOCAL v7xxTimeHist v7xxTimePhase[V7XX_NPHASE];
+LOCAL v7xxTimeHist v7xxTimeMod[V7XX_SCHED_MAX];
+LOCAL unsigned long long v7xxTimeOrigin = 0;  /* tick at v7xxTimeEnable */
+LOCAL double       v7xxTimeTicksPerUs = 0;
+LOCAL unsigned int v7xxTimeNsMult = 0;        /* ns per tick, 16.16 fixed point */
+
+LOCAL const char *v7xxPhaseName[V7XX_NPHASE] = {"wait", "read", "output", "total"};
+
+/* Add one entry.  Bin n holds 2^(n-1) to 2^n - 1 ticks */
+#define V7XX_HIST_ADD(h,t) {						\
+    int _bin = (t) ? 64 - __builtin_clzll(t) : 0;			\
+    if(_bin >= V7XX_TIME_NBINS) _bin = V7XX_TIME_NBINS - 1;		\
+    (h)->bin[_bin]++;							\
+    (h)->n++;								\
+    (h)->sum += (t);							\
+    if((t) < (h)->min) (h)->min = (t);					\
+    if((t) > (h)->max) (h)->max = (t);					\
+  }
+
+/* Count the ticks of v7xxTsc in about 20 ms */
+LOCAL void
+v7xxTimeCalibrate()
+{
+  unsigned long long u0, u1, t0, t1;
+
+  u0 = v7xxTimeUs();
+  t0 = v7xxTsc();
+#ifdef VXWORKS
+  taskDelay((sysClkRateGet()+49)/50);
+#else
+  usleep(20000);
+#endif
+  u1 = v7xxTimeUs();
+  t1 = v7xxTsc();
+
+  if((u1 <= u0) || (t1 <= t0)) {
+    logMsg("v7xxTimeCalibrate: ERROR: Time base not running, assuming 1 tick = 1 ns\n",
+	   0,0,0,0,0,0);
+    v7xxTimeTicksPerUs = 1000.;
+  } else
+    v7xxTimeTicksPerUs = (double)(t1 - t0)/(double)(u1 - u0);
+
+  v7xxTimeNsMult = (unsigned int)(65536.*1000./v7xxTimeTicksPerUs);
+}
+
+/*******************************************************************************
+*
+* v7xxTimeEnable - Select the trigger timing (0 to turn it off)
+*                  V7XX_TIME_ON    : histogram the phases of each trigger
+*                  V7XX_TIME_STAMP : also write V7XX_TIME_NWORDS timing
+*                                    words into each bank (see v7xxTimeEnd)
+*                  The counter is calibrated on the first call (20 ms).
+* v7xxTimeClear  - Empty the histograms
+* v7xxTimeGet    - Copy the histogram of a phase (V7XX_PHASE_*) or, with
+*                  phase = V7XX_NPHASE + n, of schedule position n
+* v7xxTimePrint  - Print the mean, quantiles and maximum of each phase and
+*                  schedule position, in us.  With full != 0, the non
+*                  empty bins too.
+*
+*
+* RETURNS: v7xxTimeEnable and v7xxTimeGet: OK or ERROR.
+*          Others: None.
+*/
+
+STATUS
+v7xxTimeEnable(int flags)
+{
+  if(flags & ~(V7XX_TIME_ON|V7XX_TIME_STAMP)) {
+    logMsg("v7xxTimeEnable: ERROR: Invalid flags 0x%x\n",flags,0,0,0,0,0);
+    return(ERROR);
+  }
+  if(flags & V7XX_TIME_STAMP)
+    flags |= V7XX_TIME_ON;
+
+  if((flags != 0) && (v7xxTimeTicksPerUs == 0)) {
+    v7xxTimeCalibrate();
+    v7xxTimeClear();
+  }
+  v7xxTimeOrigin = v7xxTsc();
+  v7xxTimeFlags = flags;
+
+  return(OK);
+}
+
+void
+v7xxTimeClear()
+{
+  int ii;
+
+  memset(v7xxTimePhase, 0, sizeof(v7xxTimePhase));
+  memset(v7xxTimeMod, 0, sizeof(v7xxTimeMod));
+  for(ii=0;ii<V7XX_NPHASE;ii++)
+    v7xxTimePhase[ii].min = ~0ULL;
+  for(ii=0;ii<V7XX_SCHED_MAX;ii++)
+    v7xxTimeMod[ii].min = ~0ULL;
+}
+
+STATUS
+v7xxTimeGet(int phase, v7xxTimeHist *hist)
+{
+  if((phase < 0) || (phase >= V7XX_NPHASE + V7XX_SCHED_MAX) || (hist == NULL)) {
+    printf("v7xxTimeGet: ERROR: Invalid phase %d\n",phase);
+    return(ERROR);
+  }
+
+  if(phase < V7XX_NPHASE)
+    *hist = v7xxTimePhase[phase];
+  else
+    *hist = v7xxTimeMod[phase - V7XX_NPHASE];
+
+  return(OK);
+}
+
+/* Upper edge of the bin holding the fraction q of the entries, in us */
+LOCAL double
+v7xxTimeQuantile(v7xxTimeHist *h, double q)
+{
+  unsigned long long sum = 0, want;
+  int ii;
+
+  want = (unsigned long long)(q*h->n + 0.5);
+  for(ii=0;ii<V7XX_TIME_NBINS;ii++) {
+    sum += h->bin[ii];
+    if(sum >= want) break;
+  }
+  if(ii >= V7XX_TIME_NBINS - 1)
+    return(h->max/v7xxTimeTicksPerUs);
+
+  return(((1ULL<<ii) - 1)/v7xxTimeTicksPerUs);
+}
+
+LOCAL void
+v7xxTimePrintHist(const char *name, int id, v7xxTimeHist *h, int full)
+{
+  int ii;
+
+  if(h->n == 0) return;
+
+  if(id < 0)
+    printf("  %-8s", name);
+  else
+    printf("  %s%-2d", name, id);
+  printf(" %10llu %9.2f %9.2f %9.2f %9.2f %9.2f\n", h->n,
+	 h->sum/v7xxTimeTicksPerUs/h->n, h->min/v7xxTimeTicksPerUs,
+	 v7xxTimeQuantile(h, 0.5), v7xxTimeQuantile(h, 0.99),
+	 h->max/v7xxTimeTicksPerUs);
+
+  if(!full) return;
+  for(ii=0;ii<V7XX_TIME_NBINS;ii++) {
+    if(h->bin[ii] == 0) continue;
+    printf("              < %10.3f us : %u\n",
+	   (1ULL<<ii)/v7xxTimeTicksPerUs, h->bin[ii]);
+  }
+}
+
+void
+v7xxTimePrint(int full)
+{
+  int ii;
+
+  printf("\n");
+  printf("                    V792/V775 Trigger Timing (%.1f ticks/us)\n\n",
+	 v7xxTimeTicksPerUs);
+  printf("  Phase         Triggers  Mean[us]   Min[us]   p50[us]   p99[us]   Max[us]\n");
+  printf("--------------------------------------------------------------------------------\n");
+  for(ii=0;ii<V7XX_NPHASE;ii++)
+    v7xxTimePrintHist(v7xxPhaseName[ii], -1, &v7xxTimePhase[ii], full);
+  for(ii=0;ii<v7xxSchedCount();ii++)
+    v7xxTimePrintHist("read #", ii, &v7xxTimeMod[ii], full);
+  printf("--------------------------------------------------------------------------------\n");
+  printf("  read #n: schedule position n (see v7xxSchedPrint).  p50/p99 are bin edges.\n");
+  printf("\n");
+}
+
+/*******************************************************************************
+*
+* v7xxTimeStart - Mark the start of a trigger
+* v7xxTimeEnd   - Mark the end of a trigger, and add its phases to the
+*                 histograms.  The wait and read phases are filled in by
+*                 v7xxSchedReadout, in between.
+*
+*   data - where to write the timing words (V7XX_TIME_STAMP only):
+*            V7XX_TIME_MARK | (V7XX_TIME_NWORDS - 1)
+*            start of the trigger, in us since v7xxTimeEnable
+*            time of each phase (V7XX_PHASE_*), in ns
+*          in the byte order of the module data (see v7xxOrderMark).
+*
+*   Both must be called from the thread that runs v7xxSchedReadout, so
+*   the timing is not for readout in a separate thread (v7xxPipeRead).
+*
+*
+* RETURNS: v7xxTimeEnd: Number of words written to data.
+*          v7xxTimeStart: None.
+*/
+
+void
+v7xxTimeStart()
+{
+  if(!v7xxTimeFlags) return;
+
+  v7xxTimeCur.t0 = v7xxTsc();
+  v7xxTimeCur.phase[V7XX_PHASE_WAIT] = 0;
+  v7xxTimeCur.phase[V7XX_PHASE_READ] = 0;
+  v7xxTimeCur.modmask = 0;
+}
+
+int
+v7xxTimeEnd(volatile UINT32 *data)
+{
+  unsigned long long *ph = v7xxTimeCur.phase;
+  UINT32 mask, word;
+  int ii, swap = 0;
+
+  if(!v7xxTimeFlags) return(0);
+
+  ph[V7XX_PHASE_TOTAL]  = v7xxTsc() - v7xxTimeCur.t0;
+  ph[V7XX_PHASE_OUTPUT] = ph[V7XX_PHASE_TOTAL]
+    - ph[V7XX_PHASE_WAIT] - ph[V7XX_PHASE_READ];
+
+  for(ii=0;ii<V7XX_NPHASE;ii++)
+    V7XX_HIST_ADD(&v7xxTimePhase[ii], ph[ii]);
+
+  for(mask=v7xxTimeCur.modmask; mask; mask &= mask - 1) {
+    ii = __builtin_ctz(mask);
+    V7XX_HIST_ADD(&v7xxTimeMod[ii], v7xxTimeCur.mod[ii]);
+  }
+
+  if(!(v7xxTimeFlags & V7XX_TIME_STAMP) || (data == NULL))
+    return(0);
+
+#ifndef VXWORKS
+  swap = (c792GetByteOrder() != C792_ORDER_CPU);
+#endif
+  for(ii=0;ii<V7XX_TIME_NWORDS;ii++) {
+    if(ii == 0)
+      word = V7XX_TIME_MARK | (V7XX_TIME_NWORDS - 1);
+    else if(ii == 1)
+      word = (UINT32)((v7xxTimeCur.t0 - v7xxTimeOrigin)/v7xxTimeTicksPerUs);
+    else
+      word = (UINT32)((ph[ii-2]*v7xxTimeNsMult)>>16);
+    data[ii] = swap ? LSWAP(word) : word;
+  }
+
+  return(V7XX_TIME_NWORDS);
+}
@@ -0,0 +1,469 @@
+/******************************************************************************
+*
+*  v7xxWatch.c  -  Watchdog of the modules read out with the v7xx
+*                  scheduler: finds a module stuck with its output buffer
+*                  full, stuck busy, or failing its reads, and recovers
+*                  it without ending the run.
+*
+*                  For each trigger, the results of v7xxSchedReadout are
+*                  counted, with no bus access.  A read that fails counts,
+*                  a timeout only for the modules that have data for every
+*                  trigger (v7xxWatchTimeouts): a V775 with no hits has no
+*                  event.  Every few triggers, and as soon as a module
+*                  fails maxFail reads in a row, the
+*                  status registers of the modules are looked at through
+*                  c792GetSnapshot/c775GetSnapshot: with the sampler
+*                  threads running (c792SamplerStart), it is a copy from
+*                  memory.
+*
+*                  A module found in trouble opens an incident, and gets
+*                  the first recovery step: its buffer is drained.  Each
+*                  later check that still finds it in trouble applies the
+*                  next one: data reset, soft reset with the registers it
+*                  changed written back, then the whole configuration
+*                  written again from the host copy (c792Reprogram).  The
+*                  incident ends at the first check that finds the module
+*                  read out and its status clean: its duration is the live
+*                  time lost, to the sampling period.
+*
+*                  A module that holds the trigger off (busy, buffer full)
+*                  stops the triggers, and so the checks: on Linux, a
+*                  thread also checks the modules when no trigger came
+*                  for stallMs.  The trigger path holds the watch lock
+*                  from v7xxWatchStart, before the readout, to
+*                  v7xxWatchEvent, so the thread never applies a step to a
+*                  module being read.
+*
+*/
+
+#ifdef VXWORKS
+#include "vxWorks.h"
+#include "logLib.h"
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "jvme.h"
+
+/* Include QDC/TDC definitions */
+#include "v7xxLib.h"
+#include "v7xxLog.h"
+
+/* State of a schedule position */
+typedef struct
+{
+  int    nfail;                   /* consecutive reads failed (see v7xxWatchTimeouts) */
+  int    readOK;                  /* read out since the last step */
+  int    open;                    /* incident in progress, in cur */
+  unsigned long long lastStep;    /* us, last step: older snapshots are ignored */
+  unsigned long long busySince;   /* us, first of the busy snapshots, 0: not busy */
+  UINT32 busyCount;               /* event counter in that snapshot */
+  v7xxIncident cur;
+  unsigned long long nincident;
+  unsigned long long nstep[V7XX_WATCH_NSTEP];
+  unsigned long long lost;        /* us, in the incidents that ended */
+} v7xxWatchMod;
+
+LOCAL v7xxWatchMod v7xxWatchState[V7XX_SCHED_MAX];
+LOCAL v7xxIncident v7xxWatchInc[V7XX_WATCH_NINCIDENT];  /* incidents that ended */
+LOCAL unsigned long long v7xxWatchNinc = 0;
+LOCAL int v7xxWatchPeriod = 0;      /* triggers between checks, 0: off */
+LOCAL int v7xxWatchCountdown = 0;
+LOCAL int v7xxWatchMaxFail = 0;
+LOCAL UINT32 v7xxWatchTimeoutMask = 0;          /* positions whose timeouts are failures */
+LOCAL int v7xxWatchHeld = 0;                    /* lock taken by v7xxWatchStart */
+LOCAL unsigned long long v7xxWatchOrigin = 0;   /* us, at v7xxWatchEnable */
+
+/* Data drained from a module, a whole buffer (under the lock) */
+#define V7XX_WATCH_SCRATCH  (C792_MAX_EVENTS_PER_BUFFER*C792_MAX_WORDS_PER_EVENT)
+LOCAL UINT32 v7xxWatchScratch[V7XX_WATCH_SCRATCH];
+
+LOCAL const char *v7xxWatchStepName[V7XX_WATCH_NSTEP] =
+  {"-", "drain", "clear", "reset", "reprogram"};
+
+/* Messages from the trigger path (see v7xxLog.h) */
+LOCAL v7xxLog v7xxWatchLog = V7XX_LOG_INIT("v7xxWatch");
+#define V7XX_WATCH_LOG(...)  V7XX_LOG(&v7xxWatchLog, __VA_ARGS__)
+
+/* The checks run in the trigger path or in the stall thread.  The lock
+   also covers the readout, from v7xxWatchStart to v7xxWatchEvent */
+#ifdef VXWORKS
+#define V7XX_WATCH_LOCK()
+#define V7XX_WATCH_UNLOCK()
+#else
+LOCAL pthread_mutex_t v7xxWatchMutex = PTHREAD_MUTEX_INITIALIZER;
+LOCAL pthread_t v7xxWatchThreadId;
+LOCAL volatile int v7xxWatchStallMs = 0;        /* 0: no thread */
+LOCAL volatile unsigned long long v7xxWatchLast = 0;   /* us, last trigger */
+#define V7XX_WATCH_LOCK()     pthread_mutex_lock(&v7xxWatchMutex)
+#define V7XX_WATCH_UNLOCK()   pthread_mutex_unlock(&v7xxWatchMutex)
+#endif
+
+/* Recovery step of module type/id */
+LOCAL void
+v7xxWatchApply(int type, int id, int step)
+{
+  switch(step) {
+  case V7XX_WATCH_DRAIN:
+    if(type==V7XX_QDC)
+      c792FlushEvents(id,C792_FLUSH_PIO,v7xxWatchScratch,V7XX_WATCH_SCRATCH,
+		      NULL,0,NULL);
+    else
+      c775FlushEvents(id,C775_FLUSH_PIO,v7xxWatchScratch,V7XX_WATCH_SCRATCH,
+		      NULL,0,NULL);
+    break;
+  case V7XX_WATCH_CLEAR:
+    if(type==V7XX_QDC)
+      c792Clear(id);
+    else
+      c775Clear(id);
+    break;
+  default:
+    if(type==V7XX_QDC)
+      c792Reprogram(id,(step==V7XX_WATCH_REPROGRAM));
+    else
+      c775Reprogram(id,(step==V7XX_WATCH_REPROGRAM));
+  }
+}
+
+LOCAL void
+v7xxWatchClose(v7xxWatchMod *wm, unsigned long long now)
+{
+  v7xxIncident *inc = &wm->cur;
+
+  inc->duration = (now > inc->start) ? now - inc->start : 1;
+  wm->lost += inc->duration;
+  wm->open = 0;
+  v7xxWatchInc[v7xxWatchNinc % V7XX_WATCH_NINCIDENT] = *inc;
+  v7xxWatchNinc++;
+
+  V7XX_WATCH_LOG("v7xxWatch: %s %d recovered after %d us (%d steps, last %s)\n",
+		 (inc->type==V7XX_QDC)?"QDC":"TDC",inc->id,(int)inc->duration,
+		 inc->nstep,v7xxWatchStepName[inc->step],0);
+}
+
+/* Check schedule position pos, and apply the next recovery step if it is
+   in trouble.  Called with the lock.  Returns 1 if a step was applied */
+LOCAL int
+v7xxWatchCheck(int pos)
+{
+  v7xxWatchMod *wm = &v7xxWatchState[pos];
+  c792Snapshot qs;
+  c775Snapshot ts;
+  unsigned long long t, now;
+  UINT32 evc;
+  UINT16 full, busy;
+  int type, id, step, fresh, cause = 0;
+
+  if(v7xxSchedGet(pos,&type,&id) != OK) return(0);
+
+  if(type==V7XX_QDC) {
+    if(c792GetSnapshot(id,&qs) != OK) return(0);
+    t    = qs.time;
+    full = qs.status2 & C792_BUFFER_FULL;
+    busy = qs.status1 & C792_BUSY;
+    evc  = qs.evCount;
+  } else {
+    if(c775GetSnapshot(id,&ts) != OK) return(0);
+    t    = ts.time;
+    full = ts.status2 & C775_BUFFER_FULL;
+    busy = ts.status1 & C775_BUSY;
+    evc  = ts.evCount;
+  }
+  now = v7xxTimeUs();
+
+  /* A snapshot taken before the last step tells nothing about it.  Two
+     busy snapshots far apart may catch two different conversions: the
+     module is stuck busy only if its event counter did not move between
+     them, i.e. it took no gate in the meantime */
+  fresh = (t > wm->lastStep);
+  if(fresh) {
+    if(full)
+      cause |= V7XX_WATCH_FULL;
+    if(!busy)
+      wm->busySince = 0;
+    else if((wm->busySince == 0) || (evc != wm->busyCount)) {
+      wm->busySince = t;
+      wm->busyCount = evc;
+    }
+    else if(t - wm->busySince >= V7XX_WATCH_BUSY_US)
+      cause |= V7XX_WATCH_BUSY;
+  }
+  if(wm->nfail >= v7xxWatchMaxFail)
+    cause |= V7XX_WATCH_FAIL;
+
+  if(cause == 0) {
+    if(wm->open && wm->readOK && fresh)
+      v7xxWatchClose(wm, now);
+    return(0);
+  }
+
+  if(!wm->open) {
+    memset(&wm->cur, 0, sizeof(wm->cur));
+    wm->cur.pos   = pos;
+    wm->cur.type  = type;
+    wm->cur.id    = id;
+    wm->cur.start = now;
+    wm->open = 1;
+    wm->nincident++;
+  }
+  wm->cur.cause |= cause;
+  step = (wm->cur.step < V7XX_WATCH_REPROGRAM) ? wm->cur.step + 1
+    : V7XX_WATCH_REPROGRAM;
+
+  V7XX_WATCH_LOG("v7xxWatch: %s %d%s%s%s: %s\n",
+		 (type==V7XX_QDC)?"QDC":"TDC",id,
+		 (cause & V7XX_WATCH_FULL)?" buffer full":"",
+		 (cause & V7XX_WATCH_BUSY)?" stuck busy":"",
+		 (cause & V7XX_WATCH_FAIL)?" not read out":"",
+		 v7xxWatchStepName[step]);
+
+  v7xxWatchApply(type, id, step);
+  v7xxCheckForget(pos);
+
+  wm->cur.step = step;
+  wm->cur.nstep++;
+  wm->nstep[step]++;
+  wm->nfail     = 0;
+  wm->readOK    = 0;
+  wm->busySince = 0;
+  wm->lastStep  = v7xxTimeUs();
+
+  return(1);
+}
+
+#ifndef VXWORKS
+/* Check the modules when no trigger came for stallMs */
+LOCAL void *
+v7xxWatchThread(void *arg)
+{
+  int ii, ms;
+
+  while((ms = v7xxWatchStallMs) > 0) {
+    usleep(ms*1000);
+    if(v7xxTimeUs() - v7xxWatchLast < ms*1000ULL) continue;
+
+    V7XX_WATCH_LOCK();
+    if(v7xxWatchPeriod)
+      for(ii=0;ii<v7xxSchedCount();ii++)
+	v7xxWatchCheck(ii);
+    V7XX_WATCH_UNLOCK();
+  }
+
+  return(NULL);
+}
+#endif
+
+/*******************************************************************************
+*
+* v7xxWatchEnable - Start the watchdog (period 0 to stop it), and forget
+*                   the incidents.  Call it after the schedule is set
+*                   (v7xxSchedAdd), at prestart.
+*   period  - check the status of the modules every period triggers
+*   maxFail - a module whose reads fail maxFail times in a row is in
+*             trouble (0: never)
+*   stallMs - when no trigger came for stallMs, check the modules from a
+*             thread (Linux only, 0: no thread)
+* v7xxWatchTimeouts - Count the timeouts of the schedule positions in
+*                   posmask (bit n = position n) as failed reads: the
+*                   modules that have data for every trigger, e.g. a QDC
+*                   without zero or overflow suppression.  Kept across
+*                   v7xxWatchEnable; none by default.
+* v7xxWatchGet    - Copy the last (up to max) incidents into inc, oldest
+*                   first, then those in progress (duration 0)
+* v7xxWatchPrint  - Print the incidents and the live time lost, per
+*                   schedule position, and the last incidents
+*
+*
+* RETURNS: v7xxWatchEnable: OK or ERROR.
+*          v7xxWatchGet: Number of incidents copied.
+*          Others: None.
+*/
+
+STATUS
+v7xxWatchEnable(int period, int maxFail, int stallMs)
+{
+  if((period < 0) || (maxFail < 0) || (stallMs < 0)) {
+    printf("v7xxWatchEnable: ERROR: Invalid period %d, maxFail %d or stallMs %d\n",
+	   period,maxFail,stallMs);
+    return(ERROR);
+  }
+
+#ifndef VXWORKS
+  /* Stop the thread of the previous run */
+  if(v7xxWatchStallMs) {
+    v7xxWatchStallMs = 0;
+    pthread_join(v7xxWatchThreadId, NULL);
+  }
+#endif
+
+  V7XX_WATCH_LOCK();
+  memset(v7xxWatchState, 0, sizeof(v7xxWatchState));
+  memset(v7xxWatchInc, 0, sizeof(v7xxWatchInc));
+  v7xxWatchNinc = 0;
+  v7xxWatchMaxFail = (maxFail > 0) ? maxFail : 0x7fffffff;
+  v7xxWatchCountdown = period;
+  v7xxWatchPeriod = period;
+  v7xxWatchOrigin = v7xxTimeUs();
+  V7XX_WATCH_UNLOCK();
+
+  v7xxLogStart(&v7xxWatchLog);
+
+  if((period == 0) || (stallMs == 0)) return(OK);
+#ifdef VXWORKS
+  printf("v7xxWatchEnable: WARNING: No stall thread on VxWorks\n");
+#else
+  v7xxWatchLast = v7xxTimeUs();
+  v7xxWatchStallMs = stallMs;
+  if(pthread_create(&v7xxWatchThreadId, NULL, v7xxWatchThread, NULL) != 0) {
+    perror("v7xxWatchEnable: pthread_create");
+    v7xxWatchStallMs = 0;
+  }
+#endif
+
+  return(OK);
+}
+
+void
+v7xxWatchTimeouts(UINT32 posmask)
+{
+  V7XX_WATCH_LOCK();
+  v7xxWatchTimeoutMask = posmask;
+  V7XX_WATCH_UNLOCK();
+}
+
+int
+v7xxWatchGet(v7xxIncident *inc, int max)
+{
+  unsigned long long first;
+  int ii, n = 0;
+
+  if((inc == NULL) || (max <= 0)) return(0);
+
+  V7XX_WATCH_LOCK();
+  first = (v7xxWatchNinc > V7XX_WATCH_NINCIDENT) ?
+    v7xxWatchNinc - V7XX_WATCH_NINCIDENT : 0;
+  for(; (first < v7xxWatchNinc) && (n < max); first++)
+    inc[n++] = v7xxWatchInc[first % V7XX_WATCH_NINCIDENT];
+  for(ii=0;(ii<V7XX_SCHED_MAX) && (n < max);ii++)
+    if(v7xxWatchState[ii].open)
+      inc[n++] = v7xxWatchState[ii].cur;
+  V7XX_WATCH_UNLOCK();
+
+  return(n);
+}
+
+void
+v7xxWatchPrint()
+{
+  v7xxIncident inc[V7XX_WATCH_NINCIDENT + V7XX_SCHED_MAX];
+  v7xxWatchMod *wm;
+  int ii, n, type, id;
+
+  n = v7xxWatchGet(inc, V7XX_WATCH_NINCIDENT + V7XX_SCHED_MAX);
+
+  printf("\n");
+  printf("                    V792/V775 Watchdog\n\n");
+  printf("  #  Module   Incidents     Drain     Clear     Reset  Reprogram   Lost[ms]\n");
+  printf("--------------------------------------------------------------------------------\n");
+  for(ii=0;ii<v7xxSchedCount();ii++) {
+    wm = &v7xxWatchState[ii];
+    if(v7xxSchedGet(ii,&type,&id) != OK) continue;
+    printf(" %2d  %s %2d  %10llu %9llu %9llu %9llu  %9llu %10.3f%s\n",ii,
+	   (type==V7XX_QDC)?"QDC":"TDC",id,wm->nincident,
+	   wm->nstep[V7XX_WATCH_DRAIN],wm->nstep[V7XX_WATCH_CLEAR],
+	   wm->nstep[V7XX_WATCH_RESET],wm->nstep[V7XX_WATCH_REPROGRAM],
+	   wm->lost/1000.,wm->open ? "  (in progress)" : "");
+  }
+  printf("--------------------------------------------------------------------------------\n");
+  if(n > 0) {
+    printf("  Last incidents (FULL: buffer full, BUSY: stuck busy, FAIL: not read out)\n");
+    for(ii=0;ii<n;ii++)
+      printf("  %10.3f s  %s %2d  %-4s %-4s %-4s  %d steps, last %-9s  %10.3f ms%s\n",
+	     (inc[ii].start - v7xxWatchOrigin)/1e6,
+	     (inc[ii].type==V7XX_QDC)?"QDC":"TDC",inc[ii].id,
+	     (inc[ii].cause & V7XX_WATCH_FULL)?"FULL":"",
+	     (inc[ii].cause & V7XX_WATCH_BUSY)?"BUSY":"",
+	     (inc[ii].cause & V7XX_WATCH_FAIL)?"FAIL":"",
+	     inc[ii].nstep,v7xxWatchStepName[inc[ii].step],
+	     inc[ii].duration/1000.,inc[ii].duration ? "" : " (in progress)");
+  }
+  printf("  Incidents: %llu ended, times since v7xxWatchEnable.\n",v7xxWatchNinc);
+  printf("\n");
+}
+
+/*******************************************************************************
+*
+* v7xxWatchStart - Take the watch lock before the readout of a trigger,
+*                  so that the stall thread does not apply a recovery step
+*                  to a module being read.  Waits for a step in progress.
+*
+* v7xxWatchEvent - Count the reads of one event, from the results of
+*                  v7xxSchedReadout (NULL if it failed), check the modules
+*                  when it is time, and give the lock back.  Like
+*                  v7xxCheckEvent, it must be called from the thread that
+*                  runs v7xxSchedReadout, after it.
+*
+*   The recovery steps are applied here, in the trigger path: a module
+*   read out again after the step has a new data buffer.
+*
+*
+* RETURNS: v7xxWatchStart: None.
+*          v7xxWatchEvent: Mask of the schedule positions that got a
+*          recovery step.
+*/
+
+void
+v7xxWatchStart()
+{
+  if(!v7xxWatchPeriod || v7xxWatchHeld) return;
+
+  V7XX_WATCH_LOCK();
+  v7xxWatchHeld = 1;
+}
+
+UINT32
+v7xxWatchEvent(v7xxSchedResult *res)
+{
+  v7xxWatchMod *wm;
+  UINT32 check = 0, done = 0;
+  int ii, nsched = v7xxSchedCount();
+
+  if(!v7xxWatchHeld) {
+    if(!v7xxWatchPeriod) return(0);
+    V7XX_WATCH_LOCK();
+  }
+  v7xxWatchHeld = 0;
+
+  for(ii=0;(res != NULL) && (ii<nsched);ii++) {
+    wm = &v7xxWatchState[ii];
+    if(res[ii].nwords > 0) {
+      wm->nfail = 0;
+      if(wm->open) {   /* ends at the next clean status */
+	wm->readOK = 1;
+	check |= (1<<ii);
+      }
+    } else if((res[ii].nwords < 0) || (v7xxWatchTimeoutMask & (1<<ii))) {
+      if(++wm->nfail >= v7xxWatchMaxFail)
+	check |= (1<<ii);
+    }
+  }
+  if(--v7xxWatchCountdown <= 0) {
+    v7xxWatchCountdown = v7xxWatchPeriod;
+    check = (nsched==32) ? 0xffffffff : ((1<<nsched)-1);
+  }
+#ifndef VXWORKS
+  if(v7xxWatchStallMs)
+    v7xxWatchLast = v7xxTimeUs();
+#endif
+
+  for(; check; check &= check - 1) {
+    ii = __builtin_ctz(check);
+    if(v7xxWatchCheck(ii)) done |= (1<<ii);
+  }
+  V7XX_WATCH_UNLOCK();
+
+  return(done);
+}